@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
 #include "microdb.h"
 
 
@@ -14,6 +15,202 @@
  */
 #define DEF_FILE_EXT ".def"
 
+/*
+ * INDEX_INFO_OFFSET -- データ定義ファイルの先頭ページの中で、索引の定義を置く位置
+ *
+ * フィールドの情報が最大数あっても重ならないように、その後ろに置く。
+ * 索引を導入する前に作ったファイルでは、この位置は0で埋まっているので
+ * 索引の数は0と読める。
+ */
+#define INDEX_INFO_OFFSET (sizeof(int) + MAX_FIELD * (MAX_FIELD_NAME + sizeof(DataType)))
+
+/*
+ * INDEX_INFO_SIZE -- 索引1つ分の定義に割り当てるバイト数
+ *
+ * 後から定義の項目を増やせるよう、余裕を持たせてある(余りは0で埋める)。
+ */
+#define INDEX_INFO_SIZE 256
+
+/*
+ * CATALOG_SIZE -- カタログのハッシュ表の大きさ
+ */
+#define CATALOG_SIZE 64
+
+/*
+ * CatalogEntry -- カタログに載せた1つのテーブルのデータ定義情報
+ *
+ * getTableInfoが返すのはtableInfoへのポインタで、freeTableInfoはそれを
+ * CatalogEntryに戻して参照数を減らす(そのためtableInfoを先頭に置く)。
+ */
+typedef struct CatalogEntry CatalogEntry;
+struct CatalogEntry {
+  TableInfo tableInfo;                  /* データ定義情報(共有するので書き換えない) */
+  char tableName[MAX_FILENAME];         /* テーブルの名前 */
+  int refCount;                         /* getTableInfoで渡して、まだ解放されていない数 */
+  int cached;                           /* カタログに載っていれば1 */
+  CatalogEntry *next;                   /* ハッシュ表の同じ場所の次の要素 */
+};
+
+/*
+ * catalog -- テーブルの名前からデータ定義情報を引くハッシュ表
+ *
+ * 一度読んだデータ定義ファイルの内容をここに置いておき、
+ * 定義を変える関数(createTable、dropTable、addIndexInfo、removeIndexInfo)で捨てる。
+ */
+static CatalogEntry *catalog[CATALOG_SIZE];
+
+/*
+ * catalogMutex -- カタログと参照数を守る(複数のスレッドから呼び出せるようにするため)
+ */
+static pthread_mutex_t catalogMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * getDefFileName -- データ定義ファイルのファイル名の作成
+ *
+ * 引数:
+ *	tableName: テーブルの名前
+ *
+ * 返り値:
+ *	[tableName].defという文字列を返す。失敗したらNULLを返す。
+ *	返した文字列は、不要になったらfreeで解放すること。
+ */
+static char *getDefFileName(char *tableName)
+{
+  int len;
+  char *filename;
+
+  len = strlen(tableName) + strlen(DEF_FILE_EXT) + 1;
+  if ((filename = malloc(len)) == NULL) {
+    return NULL;
+  }
+  snprintf(filename, len, "%s%s", tableName, DEF_FILE_EXT);
+
+  return filename;
+}
+
+/*
+ * getCatalogSlot -- テーブルの名前から、カタログのハッシュ表の場所を求める
+ */
+static CatalogEntry **getCatalogSlot(char *tableName)
+{
+  unsigned int hash = 2166136261u;
+  unsigned char *p;
+
+  for (p = (unsigned char *) tableName; *p != '\0'; p++) {
+    hash = (hash ^ *p) * 16777619u;
+  }
+
+  return &catalog[hash % CATALOG_SIZE];
+}
+
+/*
+ * invalidateTableInfo -- カタログからテーブルのデータ定義情報を取り除く
+ *
+ * まだ使われていれば、最後にfreeTableInfoされたときに解放する。
+ */
+static void invalidateTableInfo(char *tableName)
+{
+  CatalogEntry **slot, *entry;
+
+  pthread_mutex_lock(&catalogMutex);
+  for (slot = getCatalogSlot(tableName); (entry = *slot) != NULL; slot = &entry->next) {
+    if (strcmp(entry->tableName, tableName) == 0) {
+      *slot = entry->next;
+      entry->cached = 0;
+      if (entry->refCount == 0) {
+        free(entry);
+      }
+      break;
+    }
+  }
+  pthread_mutex_unlock(&catalogMutex);
+}
+
+/*
+ * encodeIndexInfo -- 索引の定義をページに書き込む
+ *
+ * 引数:
+ *	page: データ定義ファイルの先頭ページ
+ *	numIndex: 索引の数
+ *	indexInfo: 索引の定義の配列
+ *
+ * 返り値:
+ *	なし
+ */
+static void encodeIndexInfo(char *page, int numIndex, IndexInfo *indexInfo)
+{
+  int i;
+  char *p;
+
+  p = page + INDEX_INFO_OFFSET;
+  memset(p, 0, sizeof(int) + MAX_INDEX * INDEX_INFO_SIZE);
+  memcpy(p, &numIndex, sizeof(int));
+  p += sizeof(int);
+
+  for (i = 0; i < numIndex; i++) {
+    char *q = p + i * INDEX_INFO_SIZE;
+
+    memcpy(q, indexInfo[i].name, MAX_INDEX_NAME);
+    q += MAX_INDEX_NAME;
+    memcpy(q, indexInfo[i].fieldName, MAX_FIELD_NAME);
+    q += MAX_FIELD_NAME;
+    memcpy(q, &indexInfo[i].dataType, sizeof(DataType));
+    q += sizeof(DataType);
+    memcpy(q, &indexInfo[i].indexType, sizeof(IndexType));
+    q += sizeof(IndexType);
+    memcpy(q, &indexInfo[i].numInclude, sizeof(int));
+    q += sizeof(int);
+    memcpy(q, indexInfo[i].includeName, MAX_INCLUDE * MAX_FIELD_NAME);
+    q += MAX_INCLUDE * MAX_FIELD_NAME;
+    memcpy(q, indexInfo[i].includeType, MAX_INCLUDE * sizeof(DataType));
+  }
+}
+
+/*
+ * decodeIndexInfo -- ページから索引の定義を読み出す
+ *
+ * 引数:
+ *	page: データ定義ファイルの先頭ページ
+ *	table: 読み出した定義を書き込むデータ定義情報
+ *
+ * 返り値:
+ *	なし
+ */
+static void decodeIndexInfo(char *page, TableInfo *table)
+{
+  int i;
+  char *p;
+
+  p = page + INDEX_INFO_OFFSET;
+  memcpy(&table->numIndex, p, sizeof(int));
+  p += sizeof(int);
+  if (table->numIndex < 0 || table->numIndex > MAX_INDEX) {
+    table->numIndex = 0;
+  }
+
+  for (i = 0; i < table->numIndex; i++) {
+    char *q = p + i * INDEX_INFO_SIZE;
+
+    memcpy(table->indexInfo[i].name, q, MAX_INDEX_NAME);
+    q += MAX_INDEX_NAME;
+    memcpy(table->indexInfo[i].fieldName, q, MAX_FIELD_NAME);
+    q += MAX_FIELD_NAME;
+    memcpy(&table->indexInfo[i].dataType, q, sizeof(DataType));
+    q += sizeof(DataType);
+    /* 種類を導入する前に作った索引では0(B+木)と読める */
+    memcpy(&table->indexInfo[i].indexType, q, sizeof(IndexType));
+    q += sizeof(IndexType);
+    memcpy(&table->indexInfo[i].numInclude, q, sizeof(int));
+    q += sizeof(int);
+    memcpy(table->indexInfo[i].includeName, q, MAX_INCLUDE * MAX_FIELD_NAME);
+    q += MAX_INCLUDE * MAX_FIELD_NAME;
+    memcpy(table->indexInfo[i].includeType, q, MAX_INCLUDE * sizeof(DataType));
+    if (table->indexInfo[i].numInclude < 0 || table->indexInfo[i].numInclude > MAX_INCLUDE) {
+      table->indexInfo[i].numInclude = 0;
+    }
+  }
+}
+
 /*
  * initializeDataDefModule -- データ定義モジュールの初期化
  *
@@ -39,27 +236,30 @@ Result initializeDataDefModule()
  */
 Result finalizeDataDefModule()
 {
+  CatalogEntry *entry, *next;
+  int i;
+
+  /* カタログを空にする(まだ使われているものは、freeTableInfoで解放される) */
+  pthread_mutex_lock(&catalogMutex);
+  for (i = 0; i < CATALOG_SIZE; i++) {
+    for (entry = catalog[i]; entry != NULL; entry = next) {
+      next = entry->next;
+      entry->cached = 0;
+      if (entry->refCount == 0) {
+        free(entry);
+      }
+    }
+    catalog[i] = NULL;
+  }
+  pthread_mutex_unlock(&catalogMutex);
+
   return OK;
 }
 
 /*
- * createTable -- 表(テーブル)の作成
- *
- * 引数:
- *	tableName: 作成する表の名前
- *	tableInfo: データ定義情報
- *
- * 返り値:
- *	成功ならOK、失敗ならNGを返す
- *
- * データ定義ファイルの構造(ファイル名: tableName.def)
- *   +-------------------+----------------------+-------------------+----
- *   |フィールド数       |フィールド名          |データ型           |
- *   |(sizeof(int)バイト)|(MAX_FIELD_NAMEバイト)|(sizeof(int)バイト)|
- *   +-------------------+----------------------+-------------------+----
- * 以降、フィールド名とデータ型が交互に続く。
+ * createTableUnlocked -- createTableの本体(テーブルのロックは呼び出し元で取る)
  */
-Result createTable(char *tableName, TableInfo *tableInfo)
+static Result createTableUnlocked(char *tableName, TableInfo *tableInfo)
 { 
 
   int i,len;
@@ -67,6 +267,9 @@ Result createTable(char *tableName, TableInfo *tableInfo)
   char page[PAGE_SIZE];
   char *p;
 
+  /* 同じ名前のテーブルの古い定義がカタログに残っていれば捨てる */
+  invalidateTableInfo(tableName);
+
   /* [tableName].defという文字列を作る */
   len = strlen(tableName) + strlen(DEF_FILE_EXT) + 1;
   if ((filename = malloc(len)) == NULL) {
@@ -118,18 +321,47 @@ Result createTable(char *tableName, TableInfo *tableInfo)
 }
 
 /*
- * dropTable -- 表(テーブル)の削除
+ * createTable -- 表(テーブル)の作成
  *
  * 引数:
- *	??????
+ *	tableName: 作成する表の名前
+ *	tableInfo: データ定義情報
  *
  * 返り値:
- *	??????
+ *	成功ならOK、失敗ならNGを返す
+ *
+ * データ定義ファイルの構造(ファイル名: tableName.def)
+ *   +-------------------+----------------------+-------------------+----
+ *   |フィールド数       |フィールド名          |データ型           |
+ *   |(sizeof(int)バイト)|(MAX_FIELD_NAMEバイト)|(sizeof(int)バイト)|
+ *   +-------------------+----------------------+-------------------+----
+ * 以降、フィールド名とデータ型が交互に続く。
+ * INDEX_INFO_OFFSETの位置からは索引の数と索引の定義が続く(作成時は0個)。
+ *
+ * テーブルの排他ロックを取って行う。
  */
-Result dropTable(char *tableName)
+Result createTable(char *tableName, TableInfo *tableInfo)
 {
-  int len;
+  Result ret;
+
+  if (lockTable(tableName, LOCK_EXCLUSIVE) != OK) {
+    return NG;
+  }
+  ret = createTableUnlocked(tableName, tableInfo);
+  unlockTable(tableName);
+
+  return ret;
+}
+
+/*
+ * dropTableUnlocked -- dropTableの本体(テーブルのロックは呼び出し元で取る)
+ */
+static Result dropTableUnlocked(char *tableName)
+{
+  int i,len;
   char *filename;
+  TableInfo *tableInfo;
+
 
   /* [tableName].defという文字列を作る */
   len = strlen(tableName) + strlen(DEF_FILE_EXT) + 1;
@@ -138,6 +370,14 @@ Result dropTable(char *tableName)
   }  
   snprintf(filename, len, "%s%s", tableName, DEF_FILE_EXT);
 
+  /* 索引ファイルを削除する */
+  if (existFile(filename) && (tableInfo = getTableInfo(tableName)) != NULL) {
+    for (i = 0; i < tableInfo->numIndex; i++) {
+      deleteIndexFile(tableName, tableInfo->indexInfo[i].name);
+    }
+    freeTableInfo(tableInfo);
+  }
+  invalidateTableInfo(tableName);
 
   if (deleteFile(filename) != OK) {
     return NG;
@@ -150,64 +390,242 @@ Result dropTable(char *tableName)
 }
 
 /*
- * getTableInfo -- 表のデータ定義情報を取得する関数
+ * dropTable -- 表(テーブル)の削除
  *
  * 引数:
- *	tableName: 情報を表示する表の名前
+ *	??????
  *
  * 返り値:
- *	tableNameのデータ定義情報を返す
- *	エラーの場合には、NULLを返す
+ *	??????
  *
- * ***注意***
- *	この関数が返すデータ定義情報を収めたメモリ領域は、不要になったら
- *	必ずfreeTableInfoで解放すること。
+ * テーブルの排他ロックを取って行う。
  */
-TableInfo *getTableInfo(char *tableName)
+Result dropTable(char *tableName)
 {
-  int i,len;
+  Result ret;
+
+  if (lockTable(tableName, LOCK_EXCLUSIVE) != OK) {
+    return NG;
+  }
+  ret = dropTableUnlocked(tableName);
+  unlockTable(tableName);
+
+  return ret;
+}
+
+/*
+ * loadTableInfo -- データ定義ファイルを読んで、カタログの要素を作る
+ *
+ * 引数:
+ *	tableName: テーブルの名前
+ *
+ * 返り値:
+ *	作った要素(参照数は0)を返す。エラーの場合には、NULLを返す。
+ *
+ * レコードのバイト数と、フィールドの位置もここで計算しておく。
+ * レコードの先頭には、1バイトの「使用中」フラグと、レコードを作ったトランザクションと
+ * 消したトランザクションのIDと、前の版の位置からなる見出し(RECORD_HEADER_SIZEバイト)がある。
+ */
+static CatalogEntry *loadTableInfo(char *tableName)
+{
+  int i, offset;
   char *filename;
   char page[PAGE_SIZE];
   File *file;
   char *p;
+  CatalogEntry *entry;
+  TableInfo *table;
+  Result ret;
 
-  /* [tableName].defという文字列を作る */
-  len = strlen(tableName) + strlen(DEF_FILE_EXT) + 1;
-  if ((filename = malloc(len)) == NULL) {
-      return NULL;
+  if (strlen(tableName) >= MAX_FILENAME || (filename = getDefFileName(tableName)) == NULL) {
+    return NULL;
   }
-  snprintf(filename, len, "%s%s", tableName, DEF_FILE_EXT);
-  if ((file = openFile(filename)) == NULL) {
+  file = openFile(filename);
+  free(filename);
+  if (file == NULL) {
     return NULL;
   }
-
-  TableInfo *table; 
-  table = malloc(sizeof(TableInfo));
-  if (table == NULL) {
+  ret = readPage(file, 0, page);
+  if (closeFile(file) != OK || ret != OK) {
     return NULL;
   }
 
-  if (readPage(file, 0, page) != OK) {
+  if ((entry = malloc(sizeof(CatalogEntry))) == NULL) {
     return NULL;
   }
-
+  table = &entry->tableInfo;
   p = page;
 
   memcpy(&table->numField, p, sizeof(table->numField));
   p += sizeof(table->numField);  
 
+  offset = RECORD_HEADER_SIZE;
   for (i = 0; i < table->numField; i++){
     memcpy(&table->fieldInfo[i].name, p, MAX_FIELD_NAME);
     p += MAX_FIELD_NAME;
     memcpy(&table->fieldInfo[i].dataType, p, sizeof(table->fieldInfo[i].dataType));
     p += sizeof(table->fieldInfo[i].dataType);
+
+    table->fieldOffset[i] = offset;
+    offset += (table->fieldInfo[i].dataType == TYPE_INTEGER) ? sizeof(int) : MAX_STRING;
   }
+  table->recordSize = offset;
 
-  if (closeFile(file) == NG) {
-  return NULL;
+  decodeIndexInfo(page, table);
+
+  strcpy(entry->tableName, tableName);
+  entry->refCount = 0;
+  entry->cached = 0;
+  entry->next = NULL;
+
+  return entry;
+}
+
+/*
+ * getTableInfo -- 表のデータ定義情報を取得する関数
+ *
+ * 引数:
+ *	tableName: 情報を表示する表の名前
+ *
+ * 返り値:
+ *	tableNameのデータ定義情報を返す
+ *	エラーの場合には、NULLを返す
+ *
+ * カタログに載っていれば、ファイルを読まずにそれを返す。
+ * 返すデータ定義情報はほかの呼び出し元と共有しているので、書き換えないこと。
+ *
+ * ***注意***
+ *	この関数が返すデータ定義情報を収めたメモリ領域は、不要になったら
+ *	必ずfreeTableInfoで解放すること。
+ */
+TableInfo *getTableInfo(char *tableName)
+{
+  CatalogEntry **slot, *entry;
+
+  pthread_mutex_lock(&catalogMutex);
+  slot = getCatalogSlot(tableName);
+  for (entry = *slot; entry != NULL; entry = entry->next) {
+    if (strcmp(entry->tableName, tableName) == 0) {
+      entry->refCount++;
+      pthread_mutex_unlock(&catalogMutex);
+      return &entry->tableInfo;
+    }
+  }
+
+  /* カタログになければ、データ定義ファイルを読んで載せる */
+  if ((entry = loadTableInfo(tableName)) == NULL) {
+    pthread_mutex_unlock(&catalogMutex);
+    return NULL;
+  }
+  entry->refCount = 1;
+  entry->cached = 1;
+  entry->next = *slot;
+  *slot = entry;
+  pthread_mutex_unlock(&catalogMutex);
+
+  return &entry->tableInfo;
+}
+
+/*
+ * addIndexInfo -- データ定義ファイルへの索引の定義の追加
+ *
+ * 引数:
+ *	tableName: 索引を追加するテーブルの名前
+ *	indexInfo: 追加する索引の定義
+ *
+ * 返り値:
+ *	成功ならOK、同じ名前の索引があるか、数が上限を超えるか、失敗ならNGを返す
+ */
+Result addIndexInfo(char *tableName, IndexInfo *indexInfo)
+{
+  char *filename;
+  char page[PAGE_SIZE];
+  File *file;
+  TableInfo table;
+  int i;
+  Result ret = NG;
+
+  if ((filename = getDefFileName(tableName)) == NULL) {
+    return NG;
+  }
+  if ((file = openFile(filename)) == NULL) {
+    free(filename);
+    return NG;
+  }
+  free(filename);
+
+  if (readPage(file, 0, page) == OK) {
+    decodeIndexInfo(page, &table);
+    for (i = 0; i < table.numIndex; i++) {
+      if (strcmp(table.indexInfo[i].name, indexInfo->name) == 0) {
+        break;
+      }
+    }
+    if (i == table.numIndex && table.numIndex < MAX_INDEX) {
+      table.indexInfo[table.numIndex++] = *indexInfo;
+      encodeIndexInfo(page, table.numIndex, table.indexInfo);
+      ret = writePage(file, 0, page);
+    }
+  }
+
+  invalidateTableInfo(tableName);
+  if (closeFile(file) != OK) {
+    return NG;
   }
 
-  return table;
+  return ret;
+}
+
+/*
+ * removeIndexInfo -- データ定義ファイルからの索引の定義の削除
+ *
+ * 引数:
+ *	tableName: 索引を削除するテーブルの名前
+ *	indexName: 削除する索引の名前
+ *
+ * 返り値:
+ *	成功ならOK、その名前の索引がないか、失敗ならNGを返す
+ */
+Result removeIndexInfo(char *tableName, char *indexName)
+{
+  char *filename;
+  char page[PAGE_SIZE];
+  File *file;
+  TableInfo table;
+  int i;
+  Result ret = NG;
+
+  if ((filename = getDefFileName(tableName)) == NULL) {
+    return NG;
+  }
+  if ((file = openFile(filename)) == NULL) {
+    free(filename);
+    return NG;
+  }
+  free(filename);
+
+  if (readPage(file, 0, page) == OK) {
+    decodeIndexInfo(page, &table);
+    for (i = 0; i < table.numIndex; i++) {
+      if (strcmp(table.indexInfo[i].name, indexName) == 0) {
+        break;
+      }
+    }
+    if (i < table.numIndex) {
+      memmove(&table.indexInfo[i], &table.indexInfo[i + 1],
+              sizeof(IndexInfo) * (table.numIndex - i - 1));
+      table.numIndex--;
+      encodeIndexInfo(page, table.numIndex, table.indexInfo);
+      ret = writePage(file, 0, page);
+    }
+  }
+
+  invalidateTableInfo(tableName);
+  if (closeFile(file) != OK) {
+    return NG;
+  }
+
+  return ret;
 }
 
 /*
@@ -222,10 +640,45 @@ TableInfo *getTableInfo(char *tableName)
  * ***注意***
  *	関数getTableInfoが返すデータ定義情報を収めたメモリ領域は、
  *	不要になったら必ずこの関数で解放すること。
+ *	実際には参照数を減らすだけで、カタログに載っている間は解放しない。
  */
 void freeTableInfo(TableInfo *table)
 { 
-  free(table);
+  CatalogEntry *entry = (CatalogEntry *) table;
+
+  if (entry == NULL) {
+    return;
+  }
+
+  /* カタログから取り除かれていて、誰も使っていなければ解放する */
+  pthread_mutex_lock(&catalogMutex);
+  if (--entry->refCount == 0 && !entry->cached) {
+    free(entry);
+  }
+  pthread_mutex_unlock(&catalogMutex);
+}
+
+/*
+ * isTableInfoValid -- データ定義情報がまだ最新かどうかを調べる
+ *
+ * 引数:
+ *	table: getTableInfoで取得したデータ定義情報
+ *
+ * 返り値:
+ *	カタログに載っていれば1、その後に定義が変えられて取り除かれていれば0
+ *
+ * getTableInfoで取得したデータ定義情報を長く持ち続ける呼び出し元は、
+ * 使う前にこの関数で確かめ、0ならgetTableInfoで取得し直すこと。
+ */
+int isTableInfoValid(TableInfo *table)
+{
+  int cached;
+
+  pthread_mutex_lock(&catalogMutex);
+  cached = ((CatalogEntry *) table)->cached;
+  pthread_mutex_unlock(&catalogMutex);
+
+  return cached;
 }
 
 /*
@@ -240,7 +693,7 @@ void freeTableInfo(TableInfo *table)
 void printTableInfo(char *tableName)
 {
     TableInfo *tableInfo;
-    int i;
+    int i, j;
 
     /* テーブル名を出力 */
     printf("\nTable %s\n", tableName);
@@ -273,6 +726,17 @@ void printTableInfo(char *tableName)
 	}
     }
 
+    /* 索引の情報を出力 */
+    for (i = 0; i < tableInfo->numIndex; i++) {
+	printf("  index %d: name = %s, field = %s, type = %s", i + 1,
+	       tableInfo->indexInfo[i].name, tableInfo->indexInfo[i].fieldName,
+	       (tableInfo->indexInfo[i].indexType == INDEX_HASH) ? "hash" : "btree");
+	for (j = 0; j < tableInfo->indexInfo[i].numInclude; j++) {
+	    printf("%s%s", (j == 0) ? ", include = " : " ", tableInfo->indexInfo[i].includeName[j]);
+	}
+	printf("\n");
+    }
+
     /* データ定義情報を解放する */
     freeTableInfo(tableInfo);
 
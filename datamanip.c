@@ -11,12 +11,51 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
 
 /*
  * DAATA_FILE_EXT -- データファイルの拡張子
  */
 #define DATA_FILE_EXT ".dat"
 
+/*
+ * DEFAULT_WORK_MEMORY -- 集約などの作業に使うメモリの上限の初期値(バイト数)
+ */
+#define DEFAULT_WORK_MEMORY (4 * 1024 * 1024)
+
+/*
+ * workMemory -- 集約などの作業に使うメモリの上限(バイト数)
+ *
+ * これを超えそうになったら、作業用ファイルに書き出しながら処理する。
+ */
+static long workMemory = DEFAULT_WORK_MEMORY;
+
+/*
+ * MAX_SCAN_THREADS -- 並列走査に使うスレッド数の上限
+ */
+#define MAX_SCAN_THREADS 64
+
+/*
+ * scanThreads -- 並列走査に使うスレッド数(0ならCPUの数)
+ */
+static int scanThreads = 0;
+
+/*
+ * settingMutex -- workMemoryとscanThreadsを守る
+ *
+ * 問合せを実行している別のスレッドから読まれるので、書き換えるときは
+ * これを取る。
+ */
+static pthread_mutex_t settingMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * sessionKey -- 呼び出したスレッドが文を実行している接続の設定(useSessionで設定)
+ */
+static pthread_key_t sessionKey;
+static pthread_once_t sessionKeyOnce = PTHREAD_ONCE_INIT;
+
+static Result undoOpenTransactions();
+
 /*
  * initializeDataManipModule -- データ操作モジュールの初期化
  *
@@ -28,7 +67,23 @@
  */
 Result initializeDataManipModule()
 {
-    return OK;
+    /* 並列走査などのタスクを実行するスレッドを用意する */
+    if (initializeScheduler(getScanThreads()) != OK) {
+        return NG;
+    }
+
+    /* 前回ログに記録した変更をやり直してから、ログを取り始める */
+    if (initializeLogModule() != OK) {
+        return NG;
+    }
+
+    /* レコードの版を見分けるトランザクションIDを、前回の続きから振る */
+    if (initializeMvccModule() != OK) {
+        return NG;
+    }
+
+    /* コミットしないうちに止まった操作の書き換えを元に戻す */
+    return undoOpenTransactions();
 }
 
 /*
@@ -42,7 +97,15 @@ Result initializeDataManipModule()
  */
 Result finalizeDataManipModule()
 {
-    return OK;
+    Result ret;
+
+    finalizeScheduler();
+    ret = finalizeMvccModule();
+    if (finalizeLogModule() != OK) {
+        ret = NG;
+    }
+
+    return ret;
 }
 
 /*
@@ -53,700 +116,5264 @@ Result finalizeDataManipModule()
  *
  * 返り値:
  *  tableInfoのテーブルに収められた1つのレコードを保存するのに
- *  必要なバイト数
+ *  必要なバイト数(見出しの分を含む)
+ *
+ * getTableInfoがカタログに載せるときに計算してある。
  */
 static int getRecordSize(TableInfo *tableInfo)
 {
-    int total = 0;
-    int i;
-
-    for (i = 0; i < tableInfo->numField; i++) {
-        /* i番目のフィールドがINT型かSTRING型か調べる */
-        if (tableInfo->fieldInfo[i].dataType==TYPE_INTEGER){
-          /* INT型ならtotalにsizeof(int)を加算 */
-          total += sizeof(int);
-        }else if (tableInfo->fieldInfo[i].dataType==TYPE_STRING){
-          /* STRING型ならtotalにMAX_STRINGを加算 */
-          total += MAX_STRING;
-        }
-      
-    }
-
-    /* フラグの分の1を足す */
-    total++;
-
-    return total;
+    return tableInfo->recordSize;
 }
 
 /*
- * insertRecord -- レコードの挿入
+ * RECORD_USED, RECORD_VERSION -- レコードの見出しの先頭のフラグの値(未使用の場所は0)
  *
- * 引数:
- *  tableName: レコードを挿入するテーブルの名前
- *  recordData: 挿入するレコードのデータ
+ * 書き換えはレコードをその場で新しい版にし、書き換える前の版は写しにして
+ * 別の空き場所に置く(RECORD_VERSION)。写しは走査では読み飛ばし、スナップショットで
+ * 読むときだけ、元の場所のレコードから前の版の位置をたどって読む。
+ */
+#define RECORD_USED 1
+#define RECORD_VERSION 2
+
+/*
+ * CREATE_XID_OFFSET, DELETE_XID_OFFSET, PREV_VERSION_OFFSET -- レコードの見出しの中の、
+ * 作ったトランザクションと消したトランザクションのIDと、前の版の位置
  *
- * 返り値:
- *  挿入に成功したらOK、失敗したらNGを返す
+ * 見出しの大きさRECORD_HEADER_SIZEはmicrodb.hで定義している。
+ */
+#define CREATE_XID_OFFSET 1
+#define DELETE_XID_OFFSET (1 + (int) sizeof(TransactionId))
+#define PREV_VERSION_OFFSET (1 + 2 * (int) sizeof(TransactionId))
+
+/*
+ * getCreateXid -- レコードを作ったトランザクションのID
  */
-Result insertRecord(char *tableName, RecordData *recordData)
+static TransactionId getCreateXid(char *record)
 {
-    TableInfo *tableInfo;
-    int numPage,len,recordSize,i,j;
-    char *record;
-    char *filename;
-    File *file;
-    char *p;
-    char page[PAGE_SIZE]={0};
+  TransactionId xid;
 
-    /* テーブルの情報を取得する */
-    if ((tableInfo = getTableInfo(tableName)) == NULL) {
-        /* エラー処理 */
-        return NG;
-    }
+  memcpy(&xid, record + CREATE_XID_OFFSET, sizeof(TransactionId));
+  return xid;
+}
 
-    /* 1レコード分のデータをファイルに収めるのに必要なバイト数を計算する */
-    recordSize = getRecordSize(tableInfo);
-    assert(0<recordSize);
+/*
+ * getDeleteXid -- レコードを消したトランザクションのID(消していなければ0)
+ */
+static TransactionId getDeleteXid(char *record)
+{
+  TransactionId xid;
 
-    /* 必要なバイト数分のメモリを確保する */
-    if ((record = malloc(recordSize)) == NULL) {
-        /* エラー処理 */
-      return NG;
-    }
-    p = record;
+  memcpy(&xid, record + DELETE_XID_OFFSET, sizeof(TransactionId));
+  return xid;
+}
 
-    /* 先頭に、「使用中」を意味するフラグを立てる */
-    memset(p, 1, 1);
-    p += 1;
+/*
+ * setDeleteXid -- レコードを消したトランザクションのIDを記録する
+ *
+ * 場所はすぐには空けず、どのスナップショットからも見えなくなってから
+ * vacuumTableか挿入が片付ける。
+ */
+static void setDeleteXid(char *record, TransactionId xid)
+{
+  memcpy(record + DELETE_XID_OFFSET, &xid, sizeof(TransactionId));
+}
 
-    /* 確保したメモリ領域に、フィールド数分だけ、順次データを埋め込む */
-    for (i = 0; i < tableInfo->numField; i++) {
-      switch (tableInfo->fieldInfo[i].dataType) {
-        case TYPE_INTEGER:
-          memcpy(p, &recordData->fieldData[i].valueSet, sizeof(int));
-          p += sizeof(int);
-          break;
-        case TYPE_STRING:
-          memcpy(p, &recordData->fieldData[i].valueSet, MAX_STRING);
-          p += MAX_STRING;
-        break;
-        default:
-          /* ここにくることはないはず */
-            freeTableInfo(tableInfo);
-            free(record);
-            return NG;
-      }
-    }
+/*
+ * getPrevVersion -- 書き換える前の版の写しの位置(なければページ番号が-1)
+ */
+static void getPrevVersion(char *record, RecordId *recordId)
+{
+  memcpy(&recordId->pageNum, record + PREV_VERSION_OFFSET, sizeof(int));
+  memcpy(&recordId->slotNum, record + PREV_VERSION_OFFSET + sizeof(int), sizeof(int));
+}
 
-    assert(record!=NULL);
+/*
+ * setPrevVersion -- 書き換える前の版の写しの位置を記録する
+ */
+static void setPrevVersion(char *record, RecordId *recordId)
+{
+  memcpy(record + PREV_VERSION_OFFSET, &recordId->pageNum, sizeof(int));
+  memcpy(record + PREV_VERSION_OFFSET + sizeof(int), &recordId->slotNum, sizeof(int));
+}
 
-    /* 使用済みのtableInfoデータのメモリを解放する */
-    freeTableInfo(tableInfo);
+/*
+ * setRecordHeader -- レコードの見出しを、トランザクションxidが作ったものにする
+ *
+ * 前の版はないものとする(書き換えでは、写しを置いてからsetPrevVersionで記録する)。
+ */
+static void setRecordHeader(char *record, TransactionId xid)
+{
+  TransactionId none = 0;
+  RecordId noVersion = { -1, -1 };
 
-    /*
-     * ここまでで、挿入するレコードの情報を埋め込んだバイト列recordができあがる
-     */
+  *record = RECORD_USED;
+  memcpy(record + CREATE_XID_OFFSET, &xid, sizeof(TransactionId));
+  memcpy(record + DELETE_XID_OFFSET, &none, sizeof(TransactionId));
+  setPrevVersion(record, &noVersion);
+}
 
+/*
+ * makeVersionRecord -- レコードを、書き換える前の版の写しにする
+ *
+ * 引数:
+ *  record: 写しにするレコードのバイト列(元の場所のレコードを写したもの)
+ *  xid: 書き換えるトランザクションのID(写しを消したものとして記録する)
+ *
+ * 作ったトランザクションのIDと前の版の位置はそのまま残す。
+ */
+static void makeVersionRecord(char *record, TransactionId xid)
+{
+  *record = RECORD_VERSION;
+  setDeleteXid(record, xid);
+}
 
-    /* [tableName].defという文字列を作る */
-    len = strlen(tableName) + strlen(DATA_FILE_EXT) + 1;
-    if ((filename = malloc(len)) == NULL) {
-      return NG;
-    }
-    snprintf(filename, len, "%s%s", tableName, DATA_FILE_EXT);
+/*
+ * isVisibleRecord -- ページ上のレコードが見えるかどうか
+ *
+ * 引数:
+ *  record: 見出しを含むレコードのバイト列
+ *  snapshot: スナップショット(NULLなら最新の状態を見る)
+ *
+ * 返り値:
+ *  見えれば1、見えなければ0を返す
+ *
+ * 最新の状態では、使用中で消していないレコードはすべて見える
+ * (ほかのスレッドが書き換えている途中のレコードは、ロックで読まないようにする)。
+ * 書き換える前の版の写しは、ここでは見えないものとする(findVisibleVersionでたどる)。
+ */
+static int isVisibleRecord(char *record, Snapshot *snapshot)
+{
+  if (*record != RECORD_USED) {
+    return 0;
+  }
+  if (snapshot == NULL) {
+    return getDeleteXid(record) == 0;
+  }
+  return isVisibleVersion(snapshot, getCreateXid(record), getDeleteXid(record));
+}
 
-    /* データファイルをオープンする */
-    if ((file = openFile(filename)) == NULL) {
-      return NG;
+/*
+ * findVisibleVersion -- 元の場所のレコードから、スナップショットで見える版を探す
+ *
+ * 引数:
+ *  file: データファイル
+ *  record: 元の場所のレコードのバイト列
+ *  recordSize: 1レコードのバイト数
+ *  snapshot: スナップショット(NULLなら最新の状態を見る)
+ *  version: 古い版の写しを読み込む領域(recordSizeバイト)
+ *
+ * 返り値:
+ *  見える版のバイト列(recordかversion)を返す。見える版がないか、
+ *  写しを読めなければNULLを返す。
+ *
+ * 元の場所のレコードを作ったトランザクションがスナップショットの時点で
+ * 終わっていなければ、前の版の写しを順にたどる。写しは、その次の版を作った
+ * トランザクションが消したものとして置いてあるので、IDが合わなければ
+ * (片付けた後に別のレコードが入っていれば)そこで止める。
+ * 写しを返すときは、versionのフラグを使用中にしておく(ほかのレコードと同じに扱える)。
+ */
+static char *findVisibleVersion(File *file, char *record, int recordSize, Snapshot *snapshot,
+                                char *version)
+{
+  char page[PAGE_SIZE];
+  TransactionId createXid;
+  RecordId prev;
+
+  if (isVisibleRecord(record, snapshot)) {
+    return record;
+  }
+  if (*record != RECORD_USED || snapshot == NULL) {
+    return NULL;
+  }
+
+  for (;;) {
+    /* 作ったトランザクションが見えるのに見えない版なら、消したものが見えている */
+    createXid = getCreateXid(record);
+    if (isVisibleVersion(snapshot, createXid, 0)) {
+      return NULL;
     }
+    getPrevVersion(record, &prev);
+    if (prev.pageNum < 0 || prev.slotNum < 0 || prev.slotNum >= PAGE_SIZE / recordSize
+        || readPage(file, prev.pageNum, page) != OK) {
+      return NULL;
+    }
+    record = page + prev.slotNum * recordSize;
+    if (*record != RECORD_VERSION || getDeleteXid(record) != createXid) {
+      return NULL;
+    }
+    if (isVisibleVersion(snapshot, getCreateXid(record), createXid)) {
+      memcpy(version, record, recordSize);
+      *version = RECORD_USED;
+      return version;
+    }
+  }
+}
 
-    /* データファイルのページ数を調べる */
-    numPage = getNumPages(filename);
+/*
+ * isFreeSlot -- ページ上の場所が空いている(空けてよい)かどうか
+ *
+ * 使われていないか、horizonより前に終わったトランザクションが消したレコードなら
+ * (どのスナップショットからも見えないので)空いているとみなす。
+ * 書き換える前の版の写しも、次の版を作ったトランザクションが消したものとして扱う。
+ */
+static int isFreeSlot(char *record, TransactionId horizon)
+{
+  TransactionId xid;
 
+  if (*record == 0) {
+    return 1;
+  }
+  xid = getDeleteXid(record);
+  return xid != 0 && xid < horizon;
+}
 
-    /* レコードを挿入できる場所を探す */
-    for (i = 0; i < numPage; i++) {
-        /* 1ページ分のデータを読み込む */
-        if (readPage(file, i, page) != OK) {
-          free(record);
-          return NG;
-        }
+/*
+ * CompiledCondition -- フィールドの位置を解決済みの条件式
+ *
+ * Conditionのフィールド名を、レコードのバイト列の中での位置に置き換えたもの。
+ * 走査の開始時に一度だけ作成し、ページ上のレコードに対して
+ * RecordDataを作らずに直接評価するために使う。
+ */
+typedef struct CompiledCondition CompiledCondition;
+struct CompiledCondition {
+  int offset;                           /* フィールドの位置(存在しなければ-1) */
+  DataType dataType;                    /* フィールドのデータ型 */
+  OperatorType operator;                /* 比較演算子 */
+  ValueSet valueSet;                    /* 比較する値 */
+  CompiledCondition *andCondition;
+  CompiledCondition *orCondition;
+};
 
-      /* pageの先頭からrecordSizeバイトずつ飛びながら、先頭のフラグが「0」(未使用)の場所を探す */
-        for (j = 0; j < (PAGE_SIZE / recordSize); j++) {
-          char *q;
-          q = page + j*recordSize;
-          if (*q == 0) {
-            /* 見つけた空き領域に上で用意したバイト列recordを埋め込む */
-            memcpy(q, record, recordSize);
-
-            /* ファイルに書き戻す */
-            if (writePage(file, i, page) != OK) {
-              free(record);
-              return NG;
-            }
-            closeFile(file);
-            free(record);
-            return OK;
-          }
-        }
-    }
+/*
+ * getDataFileName -- データファイルのファイル名の作成
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *
+ * 返り値:
+ *  [tableName].datという文字列を返す。失敗したらNULLを返す。
+ *  返した文字列は、不要になったらfreeで解放すること。
+ */
+static char *getDataFileName(char *tableName)
+{
+  int len;
+  char *filename;
+
+  len = strlen(tableName) + strlen(DATA_FILE_EXT) + 1;
+  if ((filename = malloc(len)) == NULL) {
+    return NULL;
+  }
+  snprintf(filename, len, "%s%s", tableName, DATA_FILE_EXT);
 
-    assert(record != NULL);
+  return filename;
+}
 
-    /*
-     * ファイルの最後まで探しても未使用の場所が見つからなかったら
-     * ファイルの最後に新しく空のページを用意し、そこに書き込む
-     */
+/*
+ * getFieldOffset -- レコードのバイト列の中でのフィールドの位置の取得
+ *
+ * 引数:
+ *  tableInfo: データ定義情報
+ *  name: フィールド名
+ *  dataType: フィールドのデータ型を返す領域(NULLでもよい)
+ *
+ * 返り値:
+ *  フラグを含めたレコードの先頭からのバイト数を返す。
+ *  フィールドが存在しなければ-1を返す。
+ */
+static int getFieldOffset(TableInfo *tableInfo, char *name, DataType *dataType)
+{
+  int i;
 
-    char page2[PAGE_SIZE]={0};
-    memcpy(page2, record, recordSize);
-    if (writePage(file, i, page2) != OK) {
-      free(record);
-      return NG;
+  for (i = 0; i < tableInfo->numField; i++) {
+    if (strcmp(tableInfo->fieldInfo[i].name, name) == 0) {
+      if (dataType != NULL) {
+        *dataType = tableInfo->fieldInfo[i].dataType;
+      }
+      return tableInfo->fieldOffset[i];
     }
+  }
 
-
-    closeFile(file);
-    free(record);
-    return OK;
+  return -1;
 }
 
+/*
+ * countCondition -- 条件式に含まれる比較の数を数える
+ */
+static int countCondition(Condition *condition)
+{
+  if (condition == NULL) {
+    return 0;
+  }
 
-/* ------ ■■これ以降の関数は、次回以降の実験で説明の予定 ■■ ----- */
+  return 1 + countCondition(condition->andCondition) + countCondition(condition->orCondition);
+}
 
 /*
- * checkCondition -- レコードが条件を満足するかどうかのチェック
+ * fillCompiledCondition -- 条件式の1つの比較をCompiledConditionに写す
  *
  * 引数:
- *  recordData: チェックするレコード
- *  condition: チェックする条件
+ *  tableInfo: データ定義情報
+ *  condition: 写す条件式
+ *  array: CompiledConditionの配列
+ *  used: arrayの使用済みの要素数
  *
  * 返り値:
- *  レコードrecordが条件conditionを満足すればOK、満足しなければNGを返す
+ *  写した先の要素へのポインタ
  */
-static Result checkCondition(RecordData *recordData, Condition *condition)
-{ 
-  int i;
-  for (i = 0; i < recordData->numField; i++){
-    if (strcmp(recordData->fieldData[i].name,condition->name)==0){
-      if (condition->dataType==TYPE_INTEGER){
-        if (condition->operator==OPR_EQUAL){
-          if (recordData->fieldData[i].valueSet.intValue == condition->valueSet.intValue){
-            if (condition->andCondition==NULL){
-              return OK; 
-            }else{
-              if(checkCondition(recordData,condition->andCondition)==OK){
-                return OK;
-              }                
-            }
-          }else{
-            if (condition->orCondition != NULL){
-              if(checkCondition(recordData,condition->orCondition)==OK){
-                return OK;
-              } 
-            }
-          }
-        }else if (condition->operator==OPR_NOT_EQUAL){
-          if (recordData->fieldData[i].valueSet.intValue != condition->valueSet.intValue){
-            if (condition->andCondition==NULL){
-              return OK; 
-            }else{
-              if(checkCondition(recordData,condition->andCondition)==OK){
-                return OK;
-              }                
-            }
-          }else{
-            if (condition->orCondition != NULL){
-              if(checkCondition(recordData,condition->orCondition)==OK){
-                return OK;
-              } 
-            }
-          }
-        }else if (condition->operator==OPR_GREATER_THAN){
-          if (recordData->fieldData[i].valueSet.intValue > condition->valueSet.intValue){
-            if (condition->andCondition==NULL){
-              return OK; 
-            }else{
-              if(checkCondition(recordData,condition->andCondition)==OK){
-                return OK;
-              }                
-            }
-          }else{
-            if (condition->orCondition != NULL){
-              if(checkCondition(recordData,condition->orCondition)==OK){
-                return OK;
-              } 
-            }
-          }
-        }else if (condition->operator==OPR_LESS_THAN){
-          if (recordData->fieldData[i].valueSet.intValue < condition->valueSet.intValue){
-            if (condition->andCondition==NULL){
-              return OK; 
-            }else{
-              if(checkCondition(recordData,condition->andCondition)==OK){
-                return OK;
-              }                
-            }
-          }else{
-            if (condition->orCondition != NULL){
-              if(checkCondition(recordData,condition->orCondition)==OK){
-                return OK;
-              } 
-            }
-          }
-        }  
-      }else if (condition->dataType==TYPE_STRING){
-        if (condition->operator==OPR_EQUAL){
-          if (strcmp(recordData->fieldData[i].valueSet.stringValue,condition->valueSet.stringValue)==0){
-            if (condition->andCondition==NULL){
-              return OK; 
-            }else{
-              if(checkCondition(recordData,condition->andCondition)==OK){
-                return OK;
-              }                
-            }  
-          }else{
-            if (condition->orCondition != NULL){
-              if(checkCondition(recordData,condition->orCondition)==OK){
-                return OK;
-              } 
-            }
-          }
-        }else if (condition->operator==OPR_NOT_EQUAL){
-          if (strcmp(recordData->fieldData[i].valueSet.stringValue,condition->valueSet.stringValue)!=0){
-            if (condition->andCondition==NULL){
-              return OK; 
-            }else{
-              if(checkCondition(recordData,condition->andCondition)==OK){
-                return OK;
-              }                
-            } 
-          }else{
-            if (condition->orCondition != NULL){
-              if(checkCondition(recordData,condition->orCondition)==OK){
-                return OK;
-              } 
-            }
-          }
-        }else if (condition->operator==OPR_GREATER_THAN){
-          if (strcmp(recordData->fieldData[i].valueSet.stringValue,condition->valueSet.stringValue)>0){
-            if (condition->andCondition==NULL){
-              return OK; 
-            }else{
-              if(checkCondition(recordData,condition->andCondition)==OK){
-                return OK;
-              }                
-            } 
-          }else{
-            if (condition->orCondition != NULL){
-              if(checkCondition(recordData,condition->orCondition)==OK){
-                return OK;
-              } 
-            }
-          }
-        }else if (condition->operator==OPR_LESS_THAN){
-          if (strcmp(recordData->fieldData[i].valueSet.stringValue,condition->valueSet.stringValue)<0){
-            if (condition->andCondition==NULL){
-              return OK; 
-            }else{
-              if(checkCondition(recordData,condition->andCondition)==OK){
-                return OK;
-              }                
-            } 
-          }else{
-            if (condition->orCondition != NULL){
-              if(checkCondition(recordData,condition->orCondition)==OK){
-                return OK;
-              } 
-            }
-          }
-        }  
-      }      
-    }  
+static CompiledCondition *fillCompiledCondition(TableInfo *tableInfo, Condition *condition,
+                                                CompiledCondition *array, int *used)
+{
+  CompiledCondition *compiled;
+
+  if (condition == NULL) {
+    return NULL;
   }
 
-  return NG;
+  compiled = &array[(*used)++];
+  compiled->offset = getFieldOffset(tableInfo, condition->name, NULL);
+  compiled->dataType = condition->dataType;
+  compiled->operator = condition->operator;
+  compiled->valueSet = condition->valueSet;
+  compiled->andCondition = fillCompiledCondition(tableInfo, condition->andCondition, array, used);
+  compiled->orCondition = fillCompiledCondition(tableInfo, condition->orCondition, array, used);
 
+  return compiled;
 }
 
 /*
- * selectRecord -- レコードの検索
+ * compileCondition -- 条件式のフィールドの位置の解決
  *
  * 引数:
- *  tableName: レコードを検索するテーブルの名前
- *  condition: 検索するレコードの条件
+ *  tableInfo: データ定義情報
+ *  condition: 条件式(NULLならすべてのレコードが条件を満たす)
+ *  compiled: 作成したCompiledConditionを返す領域
  *
  * 返り値:
- *  検索に成功したら検索されたレコード(の集合)へのポインタを返し、
- *  検索に失敗したらNULLを返す。
- *  検索した結果、該当するレコードが1つもなかった場合も、レコードの
- *  集合へのポインタを返す。
+ *  成功ならOK、失敗ならNGを返す
  *
  * ***注意***
- *  この関数が返すレコードの集合を収めたメモリ領域は、不要になったら
- *  必ずfreeRecordSetで解放すること。
+ *  作成したCompiledConditionは、不要になったらfreeで解放すること。
+ */
+static Result compileCondition(TableInfo *tableInfo, Condition *condition, CompiledCondition **compiled)
+{
+  int numCondition, used = 0;
+
+  *compiled = NULL;
+  if ((numCondition = countCondition(condition)) == 0) {
+    return OK;
+  }
+
+  if ((*compiled = malloc(sizeof(CompiledCondition) * numCondition)) == NULL) {
+    return NG;
+  }
+  fillCompiledCondition(tableInfo, condition, *compiled, &used);
+
+  return OK;
+}
+
+/*
+ * checkRawCondition -- ページ上のレコードが条件を満足するかどうかのチェック
+ *
+ * 引数:
+ *  record: フラグを含むレコードのバイト列
+ *  condition: compileConditionで作成した条件(NULLなら常に満足する)
+ *
+ * 返り値:
+ *  条件を満足すればOK、満足しなければNGを返す
+ *
+ * 満足すればandConditionを、満足しなければorConditionをたどる。
+ */
+static Result checkRawCondition(char *record, CompiledCondition *condition)
+{
+  char *p;
+  int value, cmp, match;
+
+  if (condition == NULL) {
+    return OK;
+  }
+
+  if (condition->offset < 0) {
+    return NG;
+  }
+
+  p = record + condition->offset;
+  if (condition->dataType == TYPE_INTEGER) {
+    memcpy(&value, p, sizeof(int));
+    cmp = (value > condition->valueSet.intValue) - (value < condition->valueSet.intValue);
+  } else if (condition->dataType == TYPE_STRING) {
+    cmp = strncmp(p, condition->valueSet.stringValue, MAX_STRING);
+  } else {
+    return NG;
+  }
+
+  switch (condition->operator) {
+    case OPR_EQUAL:
+      match = (cmp == 0);
+      break;
+    case OPR_NOT_EQUAL:
+      match = (cmp != 0);
+      break;
+    case OPR_GREATER_THAN:
+      match = (cmp > 0);
+      break;
+    case OPR_LESS_THAN:
+      match = (cmp < 0);
+      break;
+    default:
+      return NG;
+  }
+
+  if (match) {
+    if (condition->andCondition == NULL) {
+      return OK;
+    }
+    return checkRawCondition(record, condition->andCondition);
+  }
+
+  if (condition->orCondition != NULL) {
+    return checkRawCondition(record, condition->orCondition);
+  }
+
+  return NG;
+}
+
+/*
+ * decodeRecord -- レコードのバイト列をRecordDataに写す
+ *
+ * 引数:
+ *  tableInfo: データ定義情報
+ *  record: フラグを含むレコードのバイト列
+ *  recordData: 写し先
+ *
+ * 返り値:
+ *  なし
+ */
+static void decodeRecord(TableInfo *tableInfo, char *record, RecordData *recordData)
+{
+  int k;
+  char *q = record + RECORD_HEADER_SIZE;
+
+  recordData->numField = tableInfo->numField;
+  recordData->recordId.pageNum = -1;
+  recordData->recordId.slotNum = -1;
+  recordData->next = NULL;
+  for (k = 0; k < tableInfo->numField; k++) {
+    strcpy(recordData->fieldData[k].name, tableInfo->fieldInfo[k].name);
+    recordData->fieldData[k].dataType = tableInfo->fieldInfo[k].dataType;
+    switch (tableInfo->fieldInfo[k].dataType) {
+      case TYPE_INTEGER:
+        memcpy(&recordData->fieldData[k].valueSet, q, sizeof(int));
+        q += sizeof(int);
+        break;
+      case TYPE_STRING:
+        memcpy(&recordData->fieldData[k].valueSet, q, MAX_STRING);
+        q += MAX_STRING;
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+/*
+ * encodeRecord -- RecordDataの値を、ファイルに収めるレコードのバイト列に写す
+ *
+ * 引数:
+ *  tableInfo: データ定義情報
+ *  recordData: 写すレコードのデータ
+ *  record: 写し先(getRecordSizeバイト)
+ *
+ * 返り値:
+ *  成功ならOK、データ型が正しくなければNGを返す
+ */
+static Result encodeRecord(TableInfo *tableInfo, RecordData *recordData, char *record)
+{
+  int i;
+  char *p = record;
+
+  /* 見出しは、ページに置くときにトランザクションのIDとともに設定する */
+  memset(p, 0, RECORD_HEADER_SIZE);
+  p += RECORD_HEADER_SIZE;
+
+  /* フィールド数分だけ、順次データを埋め込む */
+  for (i = 0; i < tableInfo->numField; i++) {
+    switch (tableInfo->fieldInfo[i].dataType) {
+      case TYPE_INTEGER:
+        memcpy(p, &recordData->fieldData[i].valueSet, sizeof(int));
+        p += sizeof(int);
+        break;
+      case TYPE_STRING:
+        memcpy(p, &recordData->fieldData[i].valueSet, MAX_STRING);
+        p += MAX_STRING;
+        break;
+      default:
+        /* ここにくることはないはず */
+        return NG;
+    }
+  }
+
+  return OK;
+}
+
+/*
+ * RecordScan -- 条件を満たすレコードを1つずつ取り出す走査の状態
+ *
+ * 条件式が索引を使える比較を含んでいれば索引をたどってレコードを読み、
+ * そうでなければデータファイルのページを先頭から順に読む。
+ * どちらの場合も、返すレコードは条件式全体を満たすものだけである。
+ */
+typedef struct RecordScan RecordScan;
+struct RecordScan {
+  TableInfo *tableInfo;                 /* データ定義情報 */
+  int recordSize;                       /* 1レコードのバイト数 */
+  File *file;                           /* データファイル */
+  int numPage;                          /* データファイルのページ数 */
+  CompiledCondition *compiled;          /* 条件式 */
+  Snapshot *snapshot;                   /* 見るレコードを決めるスナップショット(最新の状態ならNULL) */
+  Index *index;                         /* たどる索引(使わなければNULL) */
+  int ownIndex;                         /* indexをこの走査でオープンしたなら1 */
+  IndexScan *indexScan;                 /* 索引の走査 */
+  IndexInfo *indexInfo;                 /* たどる索引の定義 */
+  char *indexRecord;                    /* 索引だけで走査する場合、要素から作ったレコード(しなければNULL) */
+  RecordId recordId;                    /* 直前に返したレコードの位置 */
+  int pageNum;                          /* pageに読み込んだページの番号(なければ-1) */
+  int modified;                         /* pageを書き換えたなら1 */
+  Result (*beforeWrite)(RecordScan *scan, void *arg);  /* pageを書き戻す前に呼ぶ関数(なければNULL) */
+  void *beforeWriteArg;                 /* その引数 */
+  char *version;                        /* スナップショットで読む場合、古い版の写しを読み込む領域 */
+  int parallel;                         /* 並列に走査して集めたレコードを返すなら1 */
+  char *parallelRecord;                 /* 並列に走査して集めたレコード */
+  RecordId *parallelId;                 /* そのレコードの位置 */
+  long numParallel;                     /* 集めたレコードの数 */
+  long nextParallel;                    /* 次に返すレコードの番号 */
+  char page[PAGE_SIZE];                 /* 読み込んだページ */
+};
+
+/*
+ * chooseIndex -- 条件式の検索に使える索引を選ぶ
+ *
+ * 引数:
+ *  tableInfo: データ定義情報
+ *  condition: 条件式
+ *  indexCondition: 索引で調べる比較を返す領域
+ *
+ * 返り値:
+ *  使う索引の番号を返す。使える索引がなければ-1を返す。
+ *
+ * 比較がandだけでつながっている場合、どれか1つの比較を満たすレコードを
+ * 索引で絞り込み、残りの比較はレコードを読んでから調べればよい。
+ * =、<、>のどれかで索引のあるフィールドを比べているものを使い、
+ * =があればそれを優先する。ハッシュ索引は=にしか使えない。
+ */
+static int chooseIndex(TableInfo *tableInfo, Condition *condition, Condition **indexCondition)
+{
+  Condition *c;
+  int i, found = -1;
+
+  for (c = condition; c != NULL; c = c->andCondition) {
+    if (c->orCondition != NULL) {
+      return -1;
+    }
+  }
+
+  for (c = condition; c != NULL; c = c->andCondition) {
+    if (c->operator == OPR_NOT_EQUAL || (found >= 0 && (*indexCondition)->operator == OPR_EQUAL)) {
+      continue;
+    }
+    for (i = 0; i < tableInfo->numIndex; i++) {
+      if (strcmp(tableInfo->indexInfo[i].fieldName, c->name) == 0
+          && tableInfo->indexInfo[i].dataType == c->dataType
+          && (tableInfo->indexInfo[i].indexType != INDEX_HASH || c->operator == OPR_EQUAL)) {
+        found = i;
+        *indexCondition = c;
+        break;
+      }
+    }
+  }
+
+  return found;
+}
+
+/*
+ * markUsedField -- 読むフィールドの配列に、フィールドの印を付ける
+ *
+ * 返り値:
+ *  成功ならOK、そのフィールドがなければNGを返す
+ */
+static Result markUsedField(TableInfo *tableInfo, char *name, char *usedField)
+{
+  int k;
+
+  for (k = 0; k < tableInfo->numField; k++) {
+    if (strcmp(tableInfo->fieldInfo[k].name, name) == 0) {
+      usedField[k] = 1;
+      return OK;
+    }
+  }
+
+  return NG;
+}
+
+/*
+ * isIndexField -- 索引の要素に値が含まれるフィールドかどうか
+ */
+static int isIndexField(IndexInfo *indexInfo, char *name)
+{
+  int i;
+
+  if (strcmp(indexInfo->fieldName, name) == 0) {
+    return 1;
+  }
+  for (i = 0; i < indexInfo->numInclude; i++) {
+    if (strcmp(indexInfo->includeName[i], name) == 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * isConditionCovered -- 条件式のフィールドがすべて索引の要素に含まれるかどうか
+ */
+static int isConditionCovered(IndexInfo *indexInfo, Condition *condition)
+{
+  if (condition == NULL) {
+    return 1;
+  }
+
+  return isIndexField(indexInfo, condition->name)
+    && isConditionCovered(indexInfo, condition->andCondition)
+    && isConditionCovered(indexInfo, condition->orCondition);
+}
+
+/*
+ * isCoveringIndex -- 索引の要素だけで走査できるかどうか
+ *
+ * 引数:
+ *  tableInfo: データ定義情報
+ *  indexInfo: 索引の定義
+ *  condition: 条件式
+ *  usedField: 呼び出し側が読むフィールドに1を立てた配列(NULLならすべて読む)
+ *
+ * 返り値:
+ *  読むフィールドと条件式のフィールドがすべて索引の要素に含まれれば1、
+ *  そうでなければ0
+ */
+static int isCoveringIndex(TableInfo *tableInfo, IndexInfo *indexInfo, Condition *condition,
+                           char *usedField)
+{
+  int k;
+
+  if (usedField == NULL) {
+    return 0;
+  }
+  for (k = 0; k < tableInfo->numField; k++) {
+    if (usedField[k] && !isIndexField(indexInfo, tableInfo->fieldInfo[k].name)) {
+      return 0;
+    }
+  }
+
+  return isConditionCovered(indexInfo, condition);
+}
+
+/*
+ * makeIndexRecord -- 索引の要素から、レコードのバイト列を作る
+ *
+ * 索引に含まれないフィールドは0で埋める。
+ */
+static void makeIndexRecord(RecordScan *scan, IndexEntry *entry)
+{
+  IndexInfo *indexInfo = scan->indexInfo;
+  char *p = entry->payload;
+  int i, offset, size;
+
+  memset(scan->indexRecord, 0, scan->recordSize);
+  scan->indexRecord[0] = RECORD_USED;
+
+  offset = getFieldOffset(scan->tableInfo, indexInfo->fieldName, NULL);
+  if (indexInfo->dataType == TYPE_INTEGER) {
+    memcpy(scan->indexRecord + offset, &entry->key.intValue, sizeof(int));
+  } else {
+    memcpy(scan->indexRecord + offset, entry->key.stringValue, MAX_STRING);
+  }
+
+  for (i = 0; i < indexInfo->numInclude; i++) {
+    size = (indexInfo->includeType[i] == TYPE_INTEGER) ? sizeof(int) : MAX_STRING;
+    offset = getFieldOffset(scan->tableInfo, indexInfo->includeName[i], NULL);
+    memcpy(scan->indexRecord + offset, p, size);
+    p += size;
+  }
+}
+
+/*
+ * openRecordScan -- レコードの走査の開始
+ *
+ * 引数:
+ *  scan: 走査の状態を書き込む領域
+ *  tableName: テーブルの名前
+ *  tableInfo: データ定義情報(走査が終わるまで解放しないこと)
+ *  condition: 条件式(NULLならすべてのレコード)
+ *  indexes: オープン済みの索引の配列(NULLなら必要な索引を走査の中でオープンする)
+ *  usedField: 呼び出し側が読むフィールドに1を立てた配列(NULLならすべて読む)
+ *  snapshot: スナップショット(NULLなら最新の状態を見る)
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * スナップショットで読む場合は、ほかのスレッドが索引を書き換えているかもしれない
+ * ので、索引は使わずにデータファイルを順に読む。
+ *
+ * 使う索引の要素に、読むフィールドと条件式のフィールドがすべて含まれていれば、
+ * データファイルのページは読まず、索引の要素から作ったレコードを返す
+ * (usedFieldにないフィールドの値は0になっている)。
+ *
+ * ***注意***
+ *  走査が終わったら必ずcloseRecordScanを呼ぶこと。
+ */
+static Result openRecordScan(RecordScan *scan, char *tableName, TableInfo *tableInfo,
+                             Condition *condition, Index **indexes, char *usedField,
+                             Snapshot *snapshot)
+{
+  Condition *indexCondition;
+  char *filename;
+  int k;
+
+  scan->tableInfo = tableInfo;
+  scan->recordSize = getRecordSize(tableInfo);
+  scan->snapshot = snapshot;
+  scan->index = NULL;
+  scan->ownIndex = 0;
+  scan->indexScan = NULL;
+  scan->indexInfo = NULL;
+  scan->indexRecord = NULL;
+  scan->recordId.pageNum = 0;
+  scan->recordId.slotNum = -1;
+  scan->pageNum = -1;
+  scan->modified = 0;
+  scan->beforeWrite = NULL;
+  scan->beforeWriteArg = NULL;
+  scan->version = NULL;
+  scan->parallel = 0;
+  scan->parallelRecord = NULL;
+  scan->parallelId = NULL;
+  scan->numParallel = 0;
+  scan->nextParallel = 0;
+
+  if (compileCondition(tableInfo, condition, &scan->compiled) != OK) {
+    return NG;
+  }
+  if (snapshot != NULL && (scan->version = malloc(scan->recordSize)) == NULL) {
+    free(scan->compiled);
+    return NG;
+  }
+
+  /* データファイルをオープンする */
+  if ((filename = getDataFileName(tableName)) == NULL) {
+    free(scan->version);
+    free(scan->compiled);
+    return NG;
+  }
+  scan->numPage = getNumPages(filename);
+  if ((scan->file = openFile(filename)) == NULL) {
+    free(filename);
+    free(scan->version);
+    free(scan->compiled);
+    return NG;
+  }
+  free(filename);
+
+  /* 使える索引があれば、索引の走査を始める(できなければデータファイルを順に読む) */
+  if (snapshot == NULL && (k = chooseIndex(tableInfo, condition, &indexCondition)) >= 0) {
+    if (indexes != NULL) {
+      scan->index = indexes[k];
+    } else if ((scan->index = openIndex(tableName, &tableInfo->indexInfo[k])) != NULL) {
+      scan->ownIndex = 1;
+    }
+    if (scan->index != NULL) {
+      scan->indexScan = openIndexScan(scan->index, indexCondition->operator, &indexCondition->valueSet);
+      scan->indexInfo = &tableInfo->indexInfo[k];
+    }
+    if (scan->indexScan != NULL
+        && isCoveringIndex(tableInfo, scan->indexInfo, condition, usedField)) {
+      scan->indexRecord = malloc(scan->recordSize);
+    }
+  }
+
+  return OK;
+}
+
+/*
+ * writeScanPage -- 走査で書き換えたページを書き戻す
+ *
+ * beforeWriteがあれば、書き戻す前に呼ぶ(書き換える前の版の写しを先に置くため)。
+ */
+static Result writeScanPage(RecordScan *scan)
+{
+  if (!scan->modified) {
+    return OK;
+  }
+  if (scan->beforeWrite != NULL && scan->beforeWrite(scan, scan->beforeWriteArg) != OK) {
+    return NG;
+  }
+  if (writePage(scan->file, scan->pageNum, scan->page) != OK) {
+    return NG;
+  }
+  scan->modified = 0;
+
+  return OK;
+}
+
+/*
+ * loadScanPage -- 走査でデータファイルのページを読み込む
+ *
+ * 読み込んでいたページを書き換えていたら、先に書き戻す。
+ */
+static Result loadScanPage(RecordScan *scan, int pageNum)
+{
+  if (writeScanPage(scan) != OK) {
+    return NG;
+  }
+
+  scan->pageNum = -1;
+  if (readPage(scan->file, pageNum, scan->page) != OK) {
+    return NG;
+  }
+  scan->pageNum = pageNum;
+
+  return OK;
+}
+
+/*
+ * getNextRecord -- 走査で条件を満たす次のレコードを取り出す
+ *
+ * 引数:
+ *  scan: 走査の状態
+ *  record: フラグを含むレコードのバイト列へのポインタを返す領域
+ *          (もうレコードがなければNULL)
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 返したバイト列は、次にこの関数を呼び出すまで有効である。
+ * バイト列を書き換えた場合はmarkRecordModifiedを呼ぶこと。
+ * レコードの位置はscan->recordIdに入っている。
+ */
+static Result getNextRecord(RecordScan *scan, char **record)
+{
+  IndexEntry *entry;
+  int perPage = PAGE_SIZE / scan->recordSize;
+  char *q;
+
+  *record = NULL;
+
+  /* 並列に走査した場合は、集めておいたレコードを順に返す */
+  if (scan->parallel) {
+    if (scan->nextParallel < scan->numParallel) {
+      scan->recordId = scan->parallelId[scan->nextParallel];
+      *record = scan->parallelRecord + (size_t) scan->recordSize * scan->nextParallel++;
+    }
+    return OK;
+  }
+
+  for (;;) {
+    if (scan->indexScan != NULL) {
+      /* 索引が指すレコードを読む */
+      if (getNextIndexEntry(scan->indexScan, &entry) != OK) {
+        return NG;
+      }
+      if (entry == NULL) {
+        return OK;
+      }
+      scan->recordId = entry->recordId;
+      if (scan->indexRecord != NULL) {
+        /* 索引の要素だけで足りる場合は、データファイルを読まない */
+        makeIndexRecord(scan, entry);
+        if (checkRawCondition(scan->indexRecord, scan->compiled) == OK) {
+          *record = scan->indexRecord;
+          return OK;
+        }
+        continue;
+      }
+      if (scan->recordId.pageNum < 0 || scan->recordId.pageNum >= scan->numPage
+          || scan->recordId.slotNum < 0 || scan->recordId.slotNum >= perPage) {
+        continue;
+      }
+    } else {
+      /* データファイルの次の場所に進む */
+      if (++scan->recordId.slotNum >= perPage) {
+        scan->recordId.pageNum++;
+        scan->recordId.slotNum = 0;
+      }
+      if (scan->recordId.pageNum >= scan->numPage) {
+        return OK;
+      }
+    }
+
+    if (scan->pageNum != scan->recordId.pageNum
+        && loadScanPage(scan, scan->recordId.pageNum) != OK) {
+      return NG;
+    }
+
+    q = scan->page + scan->recordId.slotNum * scan->recordSize;
+    q = findVisibleVersion(scan->file, q, scan->recordSize, scan->snapshot, scan->version);
+    if (q != NULL && checkRawCondition(q, scan->compiled) == OK) {
+      *record = q;
+      return OK;
+    }
+  }
+}
+
+/*
+ * markRecordModified -- 走査で返したレコードを書き換えたことを記録する
+ *
+ * 並列に走査した場合、返したレコードはページの写しなので、
+ * ここでページを読み込んで書き換えた内容を写す。
+ */
+static Result markRecordModified(RecordScan *scan)
+{
+  char *record;
+
+  if (scan->parallel) {
+    if (scan->pageNum != scan->recordId.pageNum
+        && loadScanPage(scan, scan->recordId.pageNum) != OK) {
+      return NG;
+    }
+    record = scan->parallelRecord + (size_t) scan->recordSize * (scan->nextParallel - 1);
+    memcpy(scan->page + scan->recordId.slotNum * scan->recordSize, record, scan->recordSize);
+  }
+
+  scan->modified = 1;
+  return OK;
+}
+
+/*
+ * seekRecordScan -- 走査をデータファイルの順の走査にして、指定した位置の次から始める
+ *
+ * 引数:
+ *  scan: openRecordScanしたばかりの走査の状態
+ *  after: この位置の次のレコードから返す(NULLなら先頭から)
+ *
+ * 索引をたどるとキーの順になってしまうので、索引の走査はやめる。
+ */
+static void seekRecordScan(RecordScan *scan, RecordId *after)
+{
+  closeIndexScan(scan->indexScan);
+  scan->indexScan = NULL;
+  free(scan->indexRecord);
+  scan->indexRecord = NULL;
+  if (after != NULL) {
+    scan->recordId = *after;
+  }
+}
+
+/*
+ * MORSEL_PAGES -- 並列走査で、スレッドが一度に受け持つページ数
+ */
+#define MORSEL_PAGES 32
+
+/*
+ * PARALLEL_MIN_PAGES -- これより小さいデータファイルは並列に走査しない
+ */
+#define PARALLEL_MIN_PAGES 256
+
+/*
+ * ScanMorsel -- 並列走査で、MORSEL_PAGESページ分の中から集めたレコード
+ */
+typedef struct ScanMorsel ScanMorsel;
+struct ScanMorsel {
+  char *record;                         /* 条件を満たしたレコード */
+  RecordId *recordId;                   /* その位置 */
+  int numRecord;                        /* レコードの数 */
+  int capacity;                         /* 領域に入るレコードの数 */
+};
+
+/*
+ * ParallelScan -- 並列走査のタスクが共有する状態
+ *
+ * データファイルをMORSEL_PAGESページずつに分け、それぞれを1つのタスクとして
+ * スケジューラに投入する。タスクは受け持ちのページで条件を満たすレコードごとに
+ * visitを呼ぶ。visitは受け持ちの番号ごとに別の領域に結果を作るので、
+ * タスクどうしで結果を取り合うことはない。
+ */
+typedef struct ParallelScan ParallelScan;
+struct ParallelScan {
+  RecordScan *scan;                     /* 走査(データファイルと条件式) */
+  int numMorsel;                        /* 受け持ちの数 */
+  Result (*visit)(ParallelScan *parallel, int morsel, char *record, RecordId *recordId);
+  ScanMorsel *morsel;                   /* レコードを集める場合の受け持ちごとの結果 */
+  Aggregate *aggregate;                 /* 集約する場合の受け持ちごとの結果(numAggregate個ずつ) */
+  int *offset;                          /* 集約関数の対象フィールドの位置 */
+  int numAggregate;                     /* 集約関数の数 */
+  Result result;                        /* どれかのタスクが失敗したらNG */
+  pthread_mutex_t mutex;                /* resultを守る */
+};
+
+/*
+ * MorselTask -- 並列走査の1つのタスクの引数
+ */
+typedef struct MorselTask MorselTask;
+struct MorselTask {
+  ParallelScan *parallel;
+  int morsel;                           /* 受け持ちの番号 */
+};
+
+/*
+ * canParallelizeScan -- 走査を並列に行うかどうかの判定
+ *
+ * 索引をたどる走査や、小さなデータファイルの走査は並列にしない。
+ */
+static int canParallelizeScan(RecordScan *scan)
+{
+  return scan->indexScan == NULL && scan->numPage >= PARALLEL_MIN_PAGES
+    && getSchedulerThreads() > 1;
+}
+
+/*
+ * scanMorsel -- 並列走査の1つのタスク(受け持ちのページを読んで調べる)
+ */
+static void scanMorsel(void *arg)
+{
+  MorselTask *task = arg;
+  ParallelScan *parallel = task->parallel;
+  RecordScan *scan = parallel->scan;
+  int perPage = PAGE_SIZE / scan->recordSize;
+  int first, n, i, j;
+  RecordId recordId;
+  char *pages, *q;
+  char version[PAGE_SIZE];
+  Result ret = OK;
+
+  first = task->morsel * MORSEL_PAGES;
+  n = scan->numPage - first < MORSEL_PAGES ? scan->numPage - first : MORSEL_PAGES;
+
+  if ((pages = malloc((size_t) PAGE_SIZE * n)) == NULL
+      || readPagesShared(scan->file, first, pages, n) != OK) {
+    ret = NG;
+  }
+
+  for (i = 0; i < n && ret == OK; i++) {
+    for (j = 0; j < perPage && ret == OK; j++) {
+      q = pages + (size_t) PAGE_SIZE * i + j * scan->recordSize;
+      q = findVisibleVersion(scan->file, q, scan->recordSize, scan->snapshot, version);
+      if (q != NULL && checkRawCondition(q, scan->compiled) == OK) {
+        recordId.pageNum = first + i;
+        recordId.slotNum = j;
+        ret = parallel->visit(parallel, task->morsel, q, &recordId);
+      }
+    }
+  }
+
+  free(pages);
+  if (ret != OK) {
+    pthread_mutex_lock(&parallel->mutex);
+    parallel->result = NG;
+    pthread_mutex_unlock(&parallel->mutex);
+  }
+}
+
+/*
+ * runParallelScan -- 受け持ちごとのタスクをスケジューラに投入し、終わるまで待つ
+ *
+ * 引数:
+ *  parallel: scan, visitと、visitが使う結果の領域を設定した状態
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+static Result runParallelScan(ParallelScan *parallel)
+{
+  TaskGroup *group;
+  MorselTask *task;
+  int i;
+
+  parallel->result = OK;
+  if ((task = malloc(sizeof(MorselTask) * parallel->numMorsel)) == NULL) {
+    return NG;
+  }
+  if ((group = createTaskGroup()) == NULL) {
+    free(task);
+    return NG;
+  }
+  pthread_mutex_init(&parallel->mutex, NULL);
+
+  /* 投入できなかったタスクは、この場で実行する */
+  for (i = 0; i < parallel->numMorsel; i++) {
+    task[i].parallel = parallel;
+    task[i].morsel = i;
+    if (submitTask(group, scanMorsel, &task[i]) != OK) {
+      scanMorsel(&task[i]);
+    }
+  }
+  waitTaskGroup(group);
+
+  freeTaskGroup(group);
+  pthread_mutex_destroy(&parallel->mutex);
+  free(task);
+
+  return parallel->result;
+}
+
+/*
+ * collectMorselRecord -- 並列走査で見つけたレコードを受け持ちの結果に加える
+ */
+static Result collectMorselRecord(ParallelScan *parallel, int m, char *record, RecordId *recordId)
+{
+  ScanMorsel *morsel = &parallel->morsel[m];
+  int recordSize = parallel->scan->recordSize;
+  int capacity;
+  char *p;
+  RecordId *id;
+
+  if (morsel->numRecord == morsel->capacity) {
+    capacity = morsel->capacity == 0 ? 64 : morsel->capacity * 2;
+    if ((p = realloc(morsel->record, (size_t) recordSize * capacity)) == NULL) {
+      return NG;
+    }
+    morsel->record = p;
+    if ((id = realloc(morsel->recordId, sizeof(RecordId) * capacity)) == NULL) {
+      return NG;
+    }
+    morsel->recordId = id;
+    morsel->capacity = capacity;
+  }
+
+  memcpy(morsel->record + (size_t) recordSize * morsel->numRecord, record, recordSize);
+  morsel->recordId[morsel->numRecord] = *recordId;
+  morsel->numRecord++;
+  return OK;
+}
+
+/*
+ * parallelizeRecordScan -- データファイルを順に読む走査を、複数のスレッドで済ませる
+ *
+ * 引数:
+ *  scan: openRecordScanしたばかりの走査の状態
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 並列にできない走査はそのままにする。
+ * 条件を満たすレコードをタスクで集めておき、以後のgetNextRecordは
+ * それをページの順に返す(並列でない場合と同じ順になる)。
+ */
+static Result parallelizeRecordScan(RecordScan *scan)
+{
+  ParallelScan parallel;
+  ScanMorsel *morsel;
+  long total, k;
+  int i;
+  Result ret;
+
+  if (!canParallelizeScan(scan)) {
+    return OK;
+  }
+
+  parallel.scan = scan;
+  parallel.numMorsel = (scan->numPage + MORSEL_PAGES - 1) / MORSEL_PAGES;
+  parallel.visit = collectMorselRecord;
+  if ((parallel.morsel = calloc(parallel.numMorsel, sizeof(ScanMorsel))) == NULL) {
+    return NG;
+  }
+  ret = runParallelScan(&parallel);
+
+  /* 受け持ちの順につなげる */
+  total = 0;
+  for (i = 0; i < parallel.numMorsel; i++) {
+    total += parallel.morsel[i].numRecord;
+  }
+  if (ret == OK) {
+    scan->parallelRecord = malloc((size_t) scan->recordSize * (total > 0 ? total : 1));
+    scan->parallelId = malloc(sizeof(RecordId) * (total > 0 ? total : 1));
+    if (scan->parallelRecord == NULL || scan->parallelId == NULL) {
+      ret = NG;
+    }
+  }
+  k = 0;
+  for (i = 0; i < parallel.numMorsel; i++) {
+    morsel = &parallel.morsel[i];
+    if (ret == OK && morsel->numRecord > 0) {
+      memcpy(scan->parallelRecord + (size_t) scan->recordSize * k, morsel->record,
+             (size_t) scan->recordSize * morsel->numRecord);
+      memcpy(scan->parallelId + k, morsel->recordId, sizeof(RecordId) * morsel->numRecord);
+      k += morsel->numRecord;
+    }
+    free(morsel->record);
+    free(morsel->recordId);
+  }
+  free(parallel.morsel);
+
+  if (ret != OK) {
+    return NG;
+  }
+
+  scan->parallel = 1;
+  scan->numParallel = total;
+  scan->nextParallel = 0;
+  return OK;
+}
+
+/*
+ * closeRecordScan -- レコードの走査の終了
+ *
+ * 引数:
+ *  scan: 走査の状態
+ *
+ * 返り値:
+ *  成功ならOK、書き換えたページを書き戻せなければNGを返す
+ */
+static Result closeRecordScan(RecordScan *scan)
+{
+  Result ret = OK;
+
+  if (writeScanPage(scan) != OK) {
+    ret = NG;
+  }
+  closeIndexScan(scan->indexScan);
+  if (scan->ownIndex) {
+    closeIndex(scan->index);
+  }
+  if (closeFile(scan->file) != OK) {
+    ret = NG;
+  }
+  free(scan->compiled);
+  free(scan->indexRecord);
+  free(scan->version);
+  free(scan->parallelRecord);
+  free(scan->parallelId);
+
+  return ret;
+}
+
+/*
+ * openTableIndexes -- テーブルのすべての索引のオープン
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  tableInfo: データ定義情報
+ *  indexes: オープンした索引を返す配列(MAX_INDEX個)
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す(その場合、何もオープンしていない)
+ */
+static Result openTableIndexes(char *tableName, TableInfo *tableInfo, Index **indexes)
+{
+  int i;
+
+  for (i = 0; i < tableInfo->numIndex; i++) {
+    if ((indexes[i] = openIndex(tableName, &tableInfo->indexInfo[i])) == NULL) {
+      while (--i >= 0) {
+        closeIndex(indexes[i]);
+      }
+      return NG;
+    }
+  }
+
+  return OK;
+}
+
+/*
+ * closeTableIndexes -- openTableIndexesでオープンした索引のクローズ
+ */
+static Result closeTableIndexes(TableInfo *tableInfo, Index **indexes)
+{
+  int i;
+  Result ret = OK;
+
+  for (i = 0; i < tableInfo->numIndex; i++) {
+    if (closeIndex(indexes[i]) != OK) {
+      ret = NG;
+    }
+  }
+
+  return ret;
+}
+
+/*
+ * makeIndexEntry -- レコードから索引の要素を作る
+ *
+ * 引数:
+ *  tableInfo: データ定義情報
+ *  indexInfo: 索引の定義
+ *  record: フラグを含むレコードのバイト列
+ *  recordId: レコードの位置
+ *  entry: 作った要素を書き込む領域
+ *
+ * 返り値:
+ *  成功ならOK、索引のフィールドがなければNGを返す
+ */
+static Result makeIndexEntry(TableInfo *tableInfo, IndexInfo *indexInfo, char *record,
+                             RecordId *recordId, IndexEntry *entry)
+{
+  int i, offset, size;
+  char *p;
+
+  if ((offset = getFieldOffset(tableInfo, indexInfo->fieldName, NULL)) < 0) {
+    return NG;
+  }
+
+  memset(&entry->key, 0, sizeof(ValueSet));
+  if (indexInfo->dataType == TYPE_INTEGER) {
+    memcpy(&entry->key.intValue, record + offset, sizeof(int));
+  } else {
+    strncpy(entry->key.stringValue, record + offset, MAX_STRING);
+  }
+  entry->recordId = *recordId;
+
+  /* 索引に含めるフィールドの値を、レコードと同じ形式で並べる */
+  p = entry->payload;
+  for (i = 0; i < indexInfo->numInclude; i++) {
+    size = (indexInfo->includeType[i] == TYPE_INTEGER) ? sizeof(int) : MAX_STRING;
+    if ((offset = getFieldOffset(tableInfo, indexInfo->includeName[i], NULL)) < 0) {
+      return NG;
+    }
+    memcpy(p, record + offset, size);
+    p += size;
+  }
+
+  return OK;
+}
+
+/*
+ * updateIndexes -- レコードの挿入や削除に合わせて、オープン済みの索引を更新する
+ *
+ * 引数:
+ *  tableInfo: データ定義情報
+ *  indexes: オープン済みの索引の配列
+ *  record: フラグを含むレコードのバイト列
+ *  recordId: レコードの位置
+ *  insert: 挿入なら1、削除なら0
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+static Result updateIndexes(TableInfo *tableInfo, Index **indexes, char *record,
+                            RecordId *recordId, int insert)
+{
+  IndexEntry entry;
+  int i;
+
+  for (i = 0; i < tableInfo->numIndex; i++) {
+    if (makeIndexEntry(tableInfo, &tableInfo->indexInfo[i], record, recordId, &entry) != OK) {
+      return NG;
+    }
+    if (insert) {
+      if (insertIndexEntry(indexes[i], &entry) != OK) {
+        return NG;
+      }
+    } else if (deleteIndexEntry(indexes[i], &entry) != OK) {
+      return NG;
+    }
+  }
+
+  return OK;
+}
+
+/*
+ * MAX_ROW_LOCK -- レコードごとにロックして挿入するレコードの数の上限
+ *
+ * これより多く挿入するときは、テーブルの排他ロックを取る(ロックの数を抑える)。
+ */
+#define MAX_ROW_LOCK 256
+
+/*
+ * lockTableForWrite -- レコードを書き換える操作のために、テーブルのロックを取る
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  numRecord: 書き換えるレコードの数
+ *  rowLevel: レコードごとにロックするなら1、テーブル全体を書き換えから守ったなら0を返す領域
+ *
+ * 返り値:
+ *  ロックを取れたらOK、失敗したらNGを返す
+ *
+ * 索引は並行した書き換えを守っていないので、索引のあるテーブルではテーブルの
+ * 共有インテンション排他ロックを取る(スナップショットで読む操作とは並行して進むが、
+ * ほかの書き換えや索引を使う読み出しは待たせる)。索引がなければインテンション
+ * 排他ロックを取り、書き換えるレコードはそれぞれロックする(別のレコードを
+ * 書き換える操作は並行して進む)。
+ */
+static Result lockTableForWrite(char *tableName, int numRecord, int *rowLevel)
+{
+  TableInfo *tableInfo;
+
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    return NG;
+  }
+  *rowLevel = (tableInfo->numIndex == 0 && numRecord <= MAX_ROW_LOCK);
+  freeTableInfo(tableInfo);
+
+  if (lockTable(tableName, *rowLevel ? LOCK_INTENTION_EXCLUSIVE : LOCK_SHARED_INTENTION_EXCLUSIVE) != OK) {
+    return NG;
+  }
+  if (!*rowLevel) {
+    return OK;
+  }
+
+  /* ロックを取るまでの間に索引が作られていたら、取り直す */
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    unlockTable(tableName);
+    return NG;
+  }
+  if (tableInfo->numIndex > 0) {
+    *rowLevel = 0;
+    unlockTable(tableName);
+    if (lockTable(tableName, LOCK_SHARED_INTENTION_EXCLUSIVE) != OK) {
+      freeTableInfo(tableInfo);
+      return NG;
+    }
+  }
+  freeTableInfo(tableInfo);
+
+  return OK;
+}
+
+/*
+ * lockTableForRead -- レコードを読む操作のために、テーブルのロックを取る
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  condition: 読むレコードの条件(NULLならすべて)
+ *  snapshot: スナップショットを取る領域
+ *  use: 走査に使うスナップショット(最新の状態を読むならNULL)を返す領域
+ *
+ * 返り値:
+ *  ロックを取れたらOK、失敗したらNGを返す
+ *
+ * 索引で絞り込めるときは、索引は版を持たないので、テーブルの共有ロックを取って
+ * 最新の状態を読む。そうでなければインテンション共有ロックとスナップショットを
+ * 取って読む(書き換える操作を待たせず、書き換える操作を待たない)。
+ * 読み終わったらunlockTableForReadを呼ぶこと。
+ */
+static Result lockTableForRead(char *tableName, Condition *condition, Snapshot *snapshot, Snapshot **use)
+{
+  TableInfo *tableInfo;
+  Condition *indexCondition;
+  int indexed;
+
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    return NG;
+  }
+  indexed = (chooseIndex(tableInfo, condition, &indexCondition) >= 0);
+  freeTableInfo(tableInfo);
+
+  if (indexed) {
+    *use = NULL;
+    return lockTable(tableName, LOCK_SHARED);
+  }
+
+  if (lockTable(tableName, LOCK_INTENTION_SHARED) != OK) {
+    return NG;
+  }
+  if (takeSnapshot(snapshot) != OK) {
+    unlockTable(tableName);
+    return NG;
+  }
+  *use = snapshot;
+
+  return OK;
+}
+
+/*
+ * unlockTableForRead -- lockTableForReadで取ったスナップショットとロックを返す
+ */
+static void unlockTableForRead(char *tableName, Snapshot *use)
+{
+  if (use != NULL) {
+    releaseSnapshot(use);
+  }
+  unlockTable(tableName);
+}
+
+/*
+ * placeRecords -- ファイルに収める形式にしたレコードを、データファイルの空き場所に置く
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  tableInfo: データ定義情報
+ *  records: 変換したレコードのバイト列を続けたもの
+ *  numRecord: レコードの数
+ *  xid: レコードを作るトランザクションのID(0なら、recordsは見出しを設定済みの
+ *       古い版の写しで、見出しはそのまま置き、索引には加えない)
+ *  recordIds: 置いた位置を返す配列
+ *  rowLevel: レコードごとにロックするなら1
+ *  startPage: 空き場所を探し始めるページの番号(NULLなら先頭から)。
+ *             最後に置いたページの番号を返す(続けて呼ぶときに前から探し直さない)
+ *  skipPage: 使わないページの番号(なければ-1)
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 既存のページの空き場所(使われていないか、どのスナップショットからも見えない
+ * レコードの場所)を先頭から埋め、ページを使い切ったら新しいページをファイルの
+ * 最後に加える。1ページに入れたレコードはまとめて1回で書き戻す。
+ *
+ * rowLevelが1なら、ページを読んでから書き戻すまでラッチを取り、
+ * 埋める場所のレコードの排他ロックを取る。ロックは最後に返す。
+ */
+static Result placeRecords(char *tableName, TableInfo *tableInfo, char *records, int numRecord,
+                           TransactionId xid, RecordId *recordIds, int rowLevel,
+                           int *startPage, int skipPage)
+{
+    Index *indexes[MAX_INDEX];
+    TransactionId horizon;
+    int numPage, recordSize, perPage, i, j, n, modified;
+    char *filename;
+    char *q;
+    File *file;
+    char page[PAGE_SIZE];
+    Result ret = OK;
+
+    if (numRecord <= 0) {
+      return OK;
+    }
+    recordSize = getRecordSize(tableInfo);
+    perPage = PAGE_SIZE / recordSize;
+
+    /* データファイルと索引をオープンする */
+    if ((filename = getDataFileName(tableName)) == NULL) {
+      return NG;
+    }
+    numPage = getNumPages(filename);
+    if ((file = openFile(filename)) == NULL) {
+      free(filename);
+      return NG;
+    }
+    if (xid != 0 && openTableIndexes(tableName, tableInfo, indexes) != OK) {
+      closeFile(file);
+      free(filename);
+      return NG;
+    }
+
+    /* これより前に消したレコードの場所は、どのスナップショットからも見えないので埋めてよい */
+    horizon = getVacuumHorizon();
+
+    n = 0;
+    for (i = (startPage != NULL) ? *startPage : 0; n < numRecord && ret == OK; i++) {
+      if (i == skipPage) {
+        continue;
+      }
+      if (rowLevel) {
+        /* ほかのスレッドがページを加えたかもしれないので、ラッチを取ってから数え直す */
+        if (latchPage(tableName, i) != OK) {
+          ret = NG;
+          break;
+        }
+        numPage = getNumPages(filename);
+      }
+
+      if (i < numPage) {
+        if (readPage(file, i, page) != OK) {
+          ret = NG;
+        }
+      } else {
+        memset(page, 0, PAGE_SIZE);
+      }
+
+      modified = 0;
+      for (j = 0; j < perPage && n < numRecord && ret == OK; j++) {
+        q = page + j * recordSize;
+        if (!isFreeSlot(q, horizon)) {
+          continue;
+        }
+        recordIds[n].pageNum = i;
+        recordIds[n].slotNum = j;
+        if (rowLevel && tryLockRecord(tableName, &recordIds[n], LOCK_EXCLUSIVE) != OK) {
+          /* 削除したスレッドがまだロックを持っている場所は使わない */
+          continue;
+        }
+        memcpy(q, records + (size_t) n * recordSize, recordSize);
+        n++;
+        modified = 1;
+        if (xid != 0) {
+          setRecordHeader(q, xid);
+          if (updateIndexes(tableInfo, indexes, q, &recordIds[n - 1], 1) != OK) {
+            ret = NG;
+          }
+        }
+      }
+
+      /* ファイルに書き戻す */
+      if (modified && writePage(file, i, page) != OK) {
+        ret = NG;
+      }
+      if (rowLevel) {
+        unlatchPage(tableName, i);
+      }
+    }
+
+    /* 埋めた場所のロックを返す */
+    if (rowLevel) {
+      for (i = 0; i < n; i++) {
+        unlockRecord(tableName, &recordIds[i]);
+      }
+    }
+    if (startPage != NULL && n > 0) {
+      *startPage = recordIds[n - 1].pageNum;
+    }
+
+    if (xid != 0 && closeTableIndexes(tableInfo, indexes) != OK) {
+      ret = NG;
+    }
+    if (closeFile(file) != OK) {
+      ret = NG;
+    }
+    free(filename);
+    return ret;
+}
+
+/*
+ * storeRecords -- 新しく作ったレコードを、データファイルの空き場所に置く
+ *
+ * recordsは見出しを除いて変換したもの。ほかの引数と返り値はplaceRecordsと同じ。
+ */
+static Result storeRecords(char *tableName, TableInfo *tableInfo, char *records, int numRecord,
+                           TransactionId xid, RecordId *recordIds, int rowLevel)
+{
+  return placeRecords(tableName, tableInfo, records, numRecord, xid, recordIds, rowLevel, NULL, -1);
+}
+
+/*
+ * undoRecords -- 失敗した操作が書き換えたレコードを元に戻す
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  xid: 失敗した操作のトランザクションID
+ *  rowLevel: レコードごとにロックして書き換えていたなら1(ページのラッチを取って戻す)
+ *
+ * 返り値:
+ *  すべて元に戻せたらOK、失敗したらNGを返す
+ *
+ * テーブルのロックを持ったまま、トランザクションを終える前に呼ぶ(それまでxidの版は
+ * どのスナップショットからも見えない)。データファイルを2回走査し、1回目はxidが作った
+ * 版を前の版の写しで置き換え(写しがなければ挿入したものなので場所を空け)、xidが
+ * 消した版は消していないことにする。索引の要素もそれに合わせて入れ替える
+ * (操作が途中で失敗していて索引にない要素は、消せなくても構わない)。
+ * 2回目は、xidが置いた写しをすべて空ける。
+ */
+static Result undoRecords(char *tableName, TransactionId xid, int rowLevel)
+{
+  TableInfo *tableInfo;
+  Index *indexes[MAX_INDEX];
+  IndexEntry entry;
+  RecordId recordId, prev;
+  File *file;
+  char page[PAGE_SIZE], versionPage[PAGE_SIZE];
+  char *filename, *q, *v;
+  int i, j, k, pass, numPage, recordSize, perPage, modified;
+  Result ret = OK;
+
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    return NG;
+  }
+  recordSize = getRecordSize(tableInfo);
+  perPage = PAGE_SIZE / recordSize;
+  if ((filename = getDataFileName(tableName)) == NULL) {
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+  numPage = getNumPages(filename);
+  file = openFile(filename);
+  free(filename);
+  if (file == NULL) {
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+  if (openTableIndexes(tableName, tableInfo, indexes) != OK) {
+    closeFile(file);
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+
+  for (pass = 0; pass < 2 && ret == OK; pass++) {
+    for (i = 0; i < numPage && ret == OK; i++) {
+      if (rowLevel && latchPage(tableName, i) != OK) {
+        ret = NG;
+        break;
+      }
+      if (readPage(file, i, page) != OK) {
+        ret = NG;
+      }
+
+      modified = 0;
+      for (j = 0; j < perPage && ret == OK; j++) {
+        q = page + j * recordSize;
+        recordId.pageNum = i;
+        recordId.slotNum = j;
+
+        if (pass == 1) {
+          if (*q == RECORD_VERSION && getDeleteXid(q) == xid) {
+            memset(q, 0, recordSize);
+            modified = 1;
+          }
+        } else if (*q == RECORD_USED && getCreateXid(q) == xid) {
+          for (k = 0; k < tableInfo->numIndex; k++) {
+            if (makeIndexEntry(tableInfo, &tableInfo->indexInfo[k], q, &recordId, &entry) == OK) {
+              deleteIndexEntry(indexes[k], &entry);
+            }
+          }
+
+          /* 前の版の写しを探す(同じページなら、読み込んだものを使う) */
+          getPrevVersion(q, &prev);
+          v = NULL;
+          if (prev.pageNum >= 0 && prev.slotNum >= 0 && prev.slotNum < perPage) {
+            if (prev.pageNum == i) {
+              v = page + prev.slotNum * recordSize;
+            } else if (readPage(file, prev.pageNum, versionPage) == OK) {
+              v = versionPage + prev.slotNum * recordSize;
+            } else {
+              ret = NG;
+              break;
+            }
+          }
+
+          if (v != NULL && *v == RECORD_VERSION && getDeleteXid(v) == xid) {
+            memcpy(q, v, recordSize);
+            *q = RECORD_USED;
+            setDeleteXid(q, 0);
+            ret = updateIndexes(tableInfo, indexes, q, &recordId, 1);
+          } else {
+            memset(q, 0, recordSize);
+          }
+          modified = 1;
+        } else if (*q == RECORD_USED && getDeleteXid(q) == xid) {
+          setDeleteXid(q, 0);
+          ret = updateIndexes(tableInfo, indexes, q, &recordId, 1);
+          modified = 1;
+        }
+      }
+
+      if (modified && writePage(file, i, page) != OK) {
+        ret = NG;
+      }
+      if (rowLevel) {
+        unlatchPage(tableName, i);
+      }
+    }
+  }
+
+  if (closeTableIndexes(tableInfo, indexes) != OK) {
+    ret = NG;
+  }
+  if (closeFile(file) != OK) {
+    ret = NG;
+  }
+  freeTableInfo(tableInfo);
+  return ret;
+}
+
+/*
+ * undoOpenTransactions -- 前回コミットしないうちに止まった操作の書き換えを元に戻す
+ *
+ * 引数:
+ *  なし
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * ログとデータ定義モジュールを初期化してから、ほかの操作を始める前に呼ぶ。
+ * 元に戻せなかった操作は実行中のまま残すので、その版は見えない(ログにも
+ * 終えたことを記録しないので、次に起動したときにもう一度試す)。
+ * テーブルがもうなければ、元に戻すものはない。
+ */
+static Result undoOpenTransactions()
+{
+  LoggedTransaction *list;
+  TableInfo *tableInfo;
+  int i, num, undone;
+
+  if ((list = getOpenTransactions(&num)) == NULL) {
+    return NG;
+  }
+
+  for (i = 0; i < num; i++) {
+    if (recoverTransaction(list[i].xid) != OK) {
+      free(list);
+      return NG;
+    }
+    if ((tableInfo = getTableInfo(list[i].tableName)) == NULL) {
+      undone = 1;
+    } else {
+      freeTableInfo(tableInfo);
+      undone = (undoRecords(list[i].tableName, list[i].xid, 0) == OK);
+    }
+    abortTransaction(list[i].xid, undone);
+  }
+
+  free(list);
+  return OK;
+}
+
+/*
+ * finishTransaction -- レコードを書き換える操作のトランザクションを終える
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  xid: トランザクションのID
+ *  ret: 操作の結果
+ *  undo: 失敗した場合に、undoRecordsで書き換えを元に戻すなら1
+ *        (操作がほかから見える版を何も書いていなければ0でよい)
+ *  rowLevel: レコードごとにロックして書き換えていたなら1
+ *
+ * 返り値:
+ *  操作が成功していて、トランザクションを終えられたらOK、そうでなければNGを返す
+ *
+ * テーブルのロックを返す前に呼ぶこと。成功していればcommitTransactionで終え、
+ * 失敗していれば書き換えを元に戻してからabortTransactionで終える。
+ */
+static Result finishTransaction(char *tableName, TransactionId xid, Result ret, int undo, int rowLevel)
+{
+  if (ret == OK) {
+    return commitTransaction(xid);
+  }
+
+  abortTransaction(xid, !undo || undoRecords(tableName, xid, rowLevel) == OK);
+  return NG;
+}
+
+/*
+ * insertRecordsUnlocked -- insertRecordsの本体(テーブルのロックは呼び出し元で取る)
+ */
+static Result insertRecordsUnlocked(char *tableName, RecordData *recordData, int numRecord,
+                                    TransactionId xid, int rowLevel)
+{
+    TableInfo *tableInfo;
+    RecordId *recordIds;
+    int recordSize, n;
+    char *records;
+    Result ret;
+
+    if (numRecord <= 0) {
+      return OK;
+    }
+
+    /* テーブルの情報を取得する */
+    if ((tableInfo = getTableInfo(tableName)) == NULL) {
+        /* エラー処理 */
+        return NG;
+    }
+
+    /* 1レコード分のデータをファイルに収めるのに必要なバイト数を計算する */
+    recordSize = getRecordSize(tableInfo);
+    assert(0<recordSize);
+
+    /* すべてのレコードを、ファイルに収める形式のバイト列にしておく */
+    records = malloc((size_t) recordSize * numRecord);
+    recordIds = malloc(sizeof(RecordId) * numRecord);
+    if (records == NULL || recordIds == NULL) {
+      freeTableInfo(tableInfo);
+      free(records);
+      free(recordIds);
+      return NG;
+    }
+    for (n = 0; n < numRecord; n++) {
+      if (encodeRecord(tableInfo, &recordData[n], records + (size_t) n * recordSize) != OK) {
+        freeTableInfo(tableInfo);
+        free(records);
+        free(recordIds);
+        return NG;
+      }
+    }
+
+    ret = storeRecords(tableName, tableInfo, records, numRecord, xid, recordIds, rowLevel);
+    for (n = 0; n < numRecord; n++) {
+      recordData[n].recordId = recordIds[n];
+    }
+
+    freeTableInfo(tableInfo);
+    free(records);
+    free(recordIds);
+    return ret;
+}
+
+/*
+ * insertRecords -- 複数のレコードの挿入
+ *
+ * 引数:
+ *  tableName: レコードを挿入するテーブルの名前
+ *  recordData: 挿入するレコードのデータの配列
+ *  numRecord: 挿入するレコードの数
+ *
+ * 返り値:
+ *  すべての挿入に成功したらOK、失敗したらNGを返す
+ *
+ * データ定義情報の取得、データファイルと索引のオープンは1回だけ行う。
+ * 既存のページの空き場所を先頭から埋め、1ページに入れたレコードは
+ * まとめて1回で書き戻す。残りは新しいページに詰めて、ファイルの最後に加える。
+ * 挿入した位置は、それぞれのrecordData[i].recordIdに入れる。
+ *
+ * 索引のないテーブルに少しだけ挿入するときは、テーブルのインテンション排他ロックと
+ * 埋める場所のレコードの排他ロックを取って行う(ほかの挿入や削除と並行して進む)。
+ * そうでなければ、テーブルの共有インテンション排他ロックを取って行う。
+ * 挿入したレコードは、この関数が返ってから取ったスナップショットから見える。
+ */
+Result insertRecords(char *tableName, RecordData *recordData, int numRecord)
+{
+  TransactionId xid;
+  Result ret;
+  int rowLevel;
+
+  if (lockTableForWrite(tableName, numRecord, &rowLevel) != OK) {
+    return NG;
+  }
+  if ((xid = beginTransaction(tableName)) == 0) {
+    unlockTable(tableName);
+    return NG;
+  }
+  ret = insertRecordsUnlocked(tableName, recordData, numRecord, xid, rowLevel);
+  ret = finishTransaction(tableName, xid, ret, 1, rowLevel);
+  unlockTable(tableName);
+
+  return ret;
+}
+
+/*
+ * insertRecord -- レコードの挿入
+ *
+ * 引数:
+ *  tableName: レコードを挿入するテーブルの名前
+ *  recordData: 挿入するレコードのデータ
+ *  recordId: 挿入した位置を返す領域(NULLなら返さない)
+ *
+ * 返り値:
+ *  挿入に成功したらOK、失敗したらNGを返す
+ *
+ * insertRecordsで1件だけ挿入するので、recordData->recordIdにも位置が入る。
+ */
+Result insertRecord(char *tableName, RecordData *recordData, RecordId *recordId)
+{
+    if (insertRecords(tableName, recordData, 1) != OK) {
+      return NG;
+    }
+    if (recordId != NULL) {
+      *recordId = recordData->recordId;
+    }
+
+    return OK;
+}
+
+
+/*
+ * COPY_BUFFER_SIZE -- copyで読み込むファイルのバッファの大きさ(バイト数)
+ *
+ * 1行はこれより短くなければならない。
+ */
+#define COPY_BUFFER_SIZE (1024 * 1024)
+
+/*
+ * COPY_CHUNK_PAGES -- copyで一度にデータファイルに書き込むページ数
+ */
+#define COPY_CHUNK_PAGES 64
+
+/*
+ * parseCopyLine -- CSV/TSVの1行を、ファイルに収めるレコードの形式に直接変換する
+ *
+ * 引数:
+ *  tableInfo: データ定義情報
+ *  line: 行の先頭(改行は含まない)
+ *  end: 行の終わり
+ *  delimiter: フィールドの区切り文字
+ *  record: 変換したレコードを書き込む領域(0で埋めてあること)
+ *
+ * 返り値:
+ *  成功ならOK、フィールドの数や値が正しくなければNGを返す
+ *
+ * フィールドは"で囲んでもよい(その中では""が"を表す)。
+ * 文字列はMAX_STRING - 1バイトを超えた分を切り捨てる。
+ */
+static Result parseCopyLine(TableInfo *tableInfo, char *line, char *end, char delimiter, char *record)
+{
+  char *p = line;
+  char *q = record + RECORD_HEADER_SIZE;
+  char value[MAX_STRING];
+  int k, len, quoted, negative;
+  long n;
+
+  *record = RECORD_USED;
+  for (k = 0; k < tableInfo->numField; k++) {
+    /* フィールドの値を取り出す */
+    len = 0;
+    quoted = (p < end && *p == '"');
+    if (quoted) {
+      for (p++; p < end; p++) {
+        if (*p == '"') {
+          if (p + 1 < end && p[1] == '"') {
+            p++;
+          } else {
+            break;
+          }
+        }
+        if (len < MAX_STRING - 1) {
+          value[len++] = *p;
+        }
+      }
+      if (p == end) {
+        return NG;
+      }
+      p++;
+    } else {
+      for (; p < end && *p != delimiter; p++) {
+        if (len < MAX_STRING - 1) {
+          value[len++] = *p;
+        }
+      }
+    }
+
+    /* 区切り文字か行の終わりが来るはず */
+    if (k < tableInfo->numField - 1) {
+      if (p == end || *p != delimiter) {
+        return NG;
+      }
+      p++;
+    } else if (p != end) {
+      return NG;
+    }
+
+    if (tableInfo->fieldInfo[k].dataType == TYPE_INTEGER) {
+      int i = 0, intValue;
+
+      while (i < len && value[i] == ' ') {
+        i++;
+      }
+      negative = (i < len && value[i] == '-');
+      if (i < len && (value[i] == '-' || value[i] == '+')) {
+        i++;
+      }
+      if (i == len || value[i] < '0' || value[i] > '9') {
+        return NG;
+      }
+      for (n = 0; i < len && value[i] >= '0' && value[i] <= '9'; i++) {
+        n = n * 10 + (value[i] - '0');
+        if (n > 2147483648L) {
+          return NG;
+        }
+      }
+      while (i < len && value[i] == ' ') {
+        i++;
+      }
+      if (i != len || (!negative && n > 2147483647L)) {
+        return NG;
+      }
+      intValue = (int) (negative ? -n : n);
+      memcpy(q, &intValue, sizeof(int));
+      q += sizeof(int);
+    } else {
+      memcpy(q, value, len);
+      q += MAX_STRING;
+    }
+  }
+
+  return OK;
+}
+
+/*
+ * copyFromUnlocked -- copyFromの本体(テーブルのロックは呼び出し元で取る)
+ */
+static Result copyFromUnlocked(char *tableName, char *filename, long *numRecord, TransactionId xid)
+{
+  TableInfo *tableInfo;
+  Index *indexes[MAX_INDEX];
+  RecordId recordId;
+  FILE *fp;
+  File *file;
+  char *dataFileName, *buffer, *chunk, *line, *end, *next, *record;
+  char delimiter;
+  int recordSize, perPage, numPage, chunkPage, slot, len;
+  size_t filled, n;
+  Result ret = OK;
+
+  *numRecord = 0;
+  len = strlen(filename);
+  delimiter = (len >= 4 && strcmp(filename + len - 4, ".tsv") == 0) ? '\t' : ',';
+
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    return NG;
+  }
+  recordSize = getRecordSize(tableInfo);
+  perPage = PAGE_SIZE / recordSize;
+
+  if ((fp = fopen(filename, "r")) == NULL) {
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+  buffer = malloc(COPY_BUFFER_SIZE);
+  chunk = malloc((size_t) PAGE_SIZE * COPY_CHUNK_PAGES);
+  if (buffer == NULL || chunk == NULL || (dataFileName = getDataFileName(tableName)) == NULL) {
+    free(buffer);
+    free(chunk);
+    fclose(fp);
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+  numPage = getNumPages(dataFileName);
+  file = openFile(dataFileName);
+  free(dataFileName);
+  if (file == NULL || openTableIndexes(tableName, tableInfo, indexes) != OK) {
+    if (file != NULL) {
+      closeFile(file);
+    }
+    free(buffer);
+    free(chunk);
+    fclose(fp);
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+
+  /* 新しいページを、既存のページの後ろにまとめて用意していく */
+  memset(chunk, 0, (size_t) PAGE_SIZE * COPY_CHUNK_PAGES);
+  chunkPage = 0;
+  slot = 0;
+  filled = 0;
+  line = buffer;
+  for (;;) {
+    /* 行の終わりを探し、なければ残りを先頭に寄せて続きを読む */
+    end = memchr(line, '\n', buffer + filled - line);
+    if (end == NULL && !feof(fp)) {
+      filled -= line - buffer;
+      memmove(buffer, line, filled);
+      line = buffer;
+      if (filled == COPY_BUFFER_SIZE) {
+        ret = NG;
+        break;
+      }
+      n = fread(buffer + filled, 1, COPY_BUFFER_SIZE - filled, fp);
+      if (n == 0 && ferror(fp)) {
+        ret = NG;
+        break;
+      }
+      filled += n;
+      continue;
+    }
+    if (end == NULL) {
+      /* 改行のない最後の行 */
+      if (line == buffer + filled) {
+        break;
+      }
+      end = buffer + filled;
+      next = end;
+    } else {
+      next = end + 1;
+    }
+    if (end > line && end[-1] == '\r') {
+      end--;
+    }
+    if (end == line) {
+      line = next;
+      continue;
+    }
+
+    /* ページの次の場所に、行をレコードに変換して置く */
+    record = chunk + (size_t) PAGE_SIZE * chunkPage + (size_t) slot * recordSize;
+    recordId.pageNum = numPage + chunkPage;
+    recordId.slotNum = slot;
+    if (parseCopyLine(tableInfo, line, end, delimiter, record) != OK) {
+      /* 失敗した行は書き込まない */
+      memset(record, 0, recordSize);
+      ret = NG;
+      break;
+    }
+    setRecordHeader(record, xid);
+    if (updateIndexes(tableInfo, indexes, record, &recordId, 1) != OK) {
+      memset(record, 0, recordSize);
+      ret = NG;
+      break;
+    }
+    (*numRecord)++;
+    line = next;
+
+    /* ページが埋まったら次のページへ、まとまったら書き込む */
+    if (++slot == perPage) {
+      slot = 0;
+      if (++chunkPage == COPY_CHUNK_PAGES) {
+        if (writePages(file, numPage, chunk, chunkPage) != OK) {
+          ret = NG;
+          break;
+        }
+        numPage += chunkPage;
+        chunkPage = 0;
+        memset(chunk, 0, (size_t) PAGE_SIZE * COPY_CHUNK_PAGES);
+      }
+    }
+  }
+
+  /* 途中まで埋めたページも書き込む */
+  if (chunkPage > 0 || slot > 0) {
+    if (writePages(file, numPage, chunk, chunkPage + (slot > 0)) != OK) {
+      ret = NG;
+    }
+  }
+
+  if (closeTableIndexes(tableInfo, indexes) != OK) {
+    ret = NG;
+  }
+  if (closeFile(file) != OK) {
+    ret = NG;
+  }
+  free(buffer);
+  free(chunk);
+  fclose(fp);
+  freeTableInfo(tableInfo);
+  return ret;
+}
+
+/*
+ * copyFrom -- CSV/TSVファイルからのレコードの一括読み込み
+ *
+ * 引数:
+ *  tableName: レコードを加えるテーブルの名前
+ *  filename: 読み込むファイルの名前(.tsvで終わればタブ区切り、それ以外はカンマ区切り)
+ *  numRecord: 読み込んだレコードの数を返す領域(失敗した場合はそこまでの数)
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 1行が1レコードで、テーブルの定義の順にフィールドを並べる。空行は読み飛ばす。
+ * ファイルは大きなバッファで順に読み、各行をページの中のレコードの形式に
+ * 直接変換する。レコードは空き場所を探さずに新しいページに詰め、
+ * COPY_CHUNK_PAGESページずつまとめてファイルの最後に書き込む。
+ * 途中で失敗した場合は、それまでに書き込んだレコードも取り消す(見えるようにはならない)。
+ *
+ * テーブルの共有インテンション排他ロックを取って行う(スナップショットで読む操作は
+ * 待たせず、読み込んだレコードは終わるまで見えない)。
+ */
+Result copyFrom(char *tableName, char *filename, long *numRecord)
+{
+  TransactionId xid;
+  Result ret;
+
+  if (lockTable(tableName, LOCK_SHARED_INTENTION_EXCLUSIVE) != OK) {
+    return NG;
+  }
+  if ((xid = beginTransaction(tableName)) == 0) {
+    unlockTable(tableName);
+    return NG;
+  }
+  ret = copyFromUnlocked(tableName, filename, numRecord, xid);
+  ret = finishTransaction(tableName, xid, ret, 1, 0);
+  unlockTable(tableName);
+
+  return ret;
+}
+
+
+/*
+ * CopyOutput -- copyToでファイルに書き出す内容をためるバッファ
+ */
+typedef struct CopyOutput CopyOutput;
+struct CopyOutput {
+  int desc;                             /* 書き出すファイルのディスクリプタ */
+  char *buffer;                         /* バッファ(COPY_BUFFER_SIZEバイト) */
+  int length;                           /* たまっているバイト数 */
+};
+
+/*
+ * flushCopyOutput -- バッファにたまった内容をファイルに書き出す
+ */
+static Result flushCopyOutput(CopyOutput *output)
+{
+  char *p = output->buffer;
+  ssize_t n;
+
+  while (output->length > 0) {
+    if ((n = write(output->desc, p, output->length)) <= 0) {
+      return NG;
+    }
+    p += n;
+    output->length -= n;
+  }
+
+  return OK;
+}
+
+/*
+ * formatInteger -- 整数を10進数の文字列にする
+ *
+ * 引数:
+ *  value: 整数
+ *  p: 文字列を書き込む領域(12バイト以上)
+ *
+ * 返り値:
+ *  書き込んだバイト数(終端文字は書かない)
+ */
+static int formatInteger(int value, char *p)
+{
+  char digit[12];
+  unsigned int n = (value < 0) ? -(unsigned int) value : (unsigned int) value;
+  int i = 0, len = 0;
+
+  do {
+    digit[i++] = '0' + n % 10;
+    n /= 10;
+  } while (n > 0);
+  if (value < 0) {
+    p[len++] = '-';
+  }
+  while (i > 0) {
+    p[len++] = digit[--i];
+  }
+
+  return len;
+}
+
+/*
+ * formatCopyRecord -- レコードを1行のCSV/TSV、またはバイナリ形式にしてバッファに加える
+ *
+ * 引数:
+ *  tableInfo: データ定義情報
+ *  record: フラグを含むレコードのバイト列
+ *  delimiter: フィールドの区切り文字(0ならバイナリ形式)
+ *  p: 書き込む領域(getCopyLineSizeバイト以上)
+ *
+ * 返り値:
+ *  書き込んだバイト数
+ *
+ * バイナリ形式では、整数は4バイト(このマシンのバイト順)、文字列は
+ * 1バイトの長さに続けてその長さのバイト列を置く。
+ * CSV/TSVでは、区切り文字、"、改行を含む文字列を"で囲む。
+ */
+static int formatCopyRecord(TableInfo *tableInfo, char *record, char delimiter, char *p)
+{
+  char *q = record + RECORD_HEADER_SIZE;
+  char *start = p;
+  int k, i, len, intValue;
+
+  for (k = 0; k < tableInfo->numField; k++) {
+    if (delimiter != 0 && k > 0) {
+      *p++ = delimiter;
+    }
+    if (tableInfo->fieldInfo[k].dataType == TYPE_INTEGER) {
+      if (delimiter == 0) {
+        memcpy(p, q, sizeof(int));
+        p += sizeof(int);
+      } else {
+        memcpy(&intValue, q, sizeof(int));
+        p += formatInteger(intValue, p);
+      }
+      q += sizeof(int);
+      continue;
+    }
+
+    len = strnlen(q, MAX_STRING);
+    if (delimiter == 0) {
+      *p++ = (char) len;
+      memcpy(p, q, len);
+      p += len;
+    } else if (memchr(q, delimiter, len) == NULL && memchr(q, '"', len) == NULL
+               && memchr(q, '\n', len) == NULL && memchr(q, '\r', len) == NULL) {
+      memcpy(p, q, len);
+      p += len;
+    } else {
+      *p++ = '"';
+      for (i = 0; i < len; i++) {
+        if (q[i] == '"') {
+          *p++ = '"';
+        }
+        *p++ = q[i];
+      }
+      *p++ = '"';
+    }
+    q += MAX_STRING;
+  }
+  if (delimiter != 0) {
+    *p++ = '\n';
+  }
+
+  return p - start;
+}
+
+/*
+ * copyToUnlocked -- copyToの本体(テーブルのロックは呼び出し元で取る)
+ */
+static Result copyToUnlocked(char *tableName, Condition *condition, char *filename, long *numRecord,
+                             Snapshot *snapshot)
+{
+  TableInfo *tableInfo;
+  RecordScan scan;
+  CopyOutput output;
+  char *q;
+  char delimiter;
+  int len, lineSize, k;
+  Result ret;
+
+  *numRecord = 0;
+  len = strlen(filename);
+  if (len >= 4 && strcmp(filename + len - 4, ".tsv") == 0) {
+    delimiter = '\t';
+  } else if (len >= 4 && strcmp(filename + len - 4, ".bin") == 0) {
+    delimiter = 0;
+  } else {
+    delimiter = ',';
+  }
+
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    return NG;
+  }
+
+  /* 1行の最大の長さ(文字列がすべて"で、2倍になって囲まれる場合) */
+  lineSize = 1;
+  for (k = 0; k < tableInfo->numField; k++) {
+    lineSize += (tableInfo->fieldInfo[k].dataType == TYPE_INTEGER) ? 12 : MAX_STRING * 2 + 3;
+  }
+
+  if ((output.buffer = malloc(COPY_BUFFER_SIZE)) == NULL) {
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+  output.length = 0;
+  if ((output.desc = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+    free(output.buffer);
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+  if (openRecordScan(&scan, tableName, tableInfo, condition, NULL, NULL, snapshot) != OK) {
+    close(output.desc);
+    free(output.buffer);
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+
+  while ((ret = getNextRecord(&scan, &q)) == OK && q != NULL) {
+    if (output.length + lineSize > COPY_BUFFER_SIZE && flushCopyOutput(&output) != OK) {
+      ret = NG;
+      break;
+    }
+    output.length += formatCopyRecord(tableInfo, q, delimiter, output.buffer + output.length);
+    (*numRecord)++;
+  }
+  if (ret == OK && flushCopyOutput(&output) != OK) {
+    ret = NG;
+  }
+
+  if (closeRecordScan(&scan) != OK) {
+    ret = NG;
+  }
+  if (close(output.desc) == -1) {
+    ret = NG;
+  }
+  free(output.buffer);
+  freeTableInfo(tableInfo);
+  return ret;
+}
+
+/*
+ * copyTo -- 条件を満たすレコードのファイルへの一括書き出し
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  condition: 書き出すレコードの条件(NULLならすべてのレコード)
+ *  filename: 書き出すファイルの名前(.tsvで終わればタブ区切り、
+ *            .binで終わればバイナリ形式、それ以外はカンマ区切り)
+ *  numRecord: 書き出したレコードの数を返す領域
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * ページ上のレコードから直接大きなバッファに書式化し、
+ * バッファが埋まるたびに1回のwriteで書き出す。
+ *
+ * テーブルの共有ロックを取って行う。
+ */
+Result copyTo(char *tableName, Condition *condition, char *filename, long *numRecord)
+{
+  Result ret;
+  Snapshot snapshot, *use;
+
+  if (lockTableForRead(tableName, condition, &snapshot, &use) != OK) {
+    return NG;
+  }
+  ret = copyToUnlocked(tableName, condition, filename, numRecord, use);
+  unlockTableForRead(tableName, use);
+
+  return ret;
+}
+
+
+/* ------ ■■これ以降の関数は、次回以降の実験で説明の予定 ■■ ----- */
+
+/*
+ * selectRecordUnlocked -- selectRecordの本体(テーブルのロックは呼び出し元で取る)
+ */
+static RecordSet *selectRecordUnlocked(char *tableName, Condition *condition, Snapshot *snapshot)
+{
+  int com;
+  char *q;
+  RecordData *p,*list,*record;
+  RecordSet *recordSet;
+  TableInfo *tableInfo;
+  RecordScan scan;
+  Result ret;
+
+  /*レコードセットを用意する*/
+  if ((recordSet = (RecordSet *)malloc(sizeof(RecordSet))) == NULL) {
+      return NULL;
+  }
+  recordSet->recordData=NULL;
+  recordSet->numRecord=0;
+
+  /* テーブルの定義情報を取得する */
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    /* テーブル情報の取得に失敗したので、処理をやめて返る */
+    free(recordSet);
+    return NULL;
+  }
+
+  /*
+   * 条件を満たすレコードを1つずつ取り出す(索引が使えれば索引をたどる)。
+   * データファイルを順に読む場合は、複数のスレッドで読む。
+   */
+  if (openRecordScan(&scan, tableName, tableInfo, condition, NULL, NULL, snapshot) != OK) {
+    freeTableInfo(tableInfo);
+    free(recordSet);
+    return NULL;
+  }
+  if (parallelizeRecordScan(&scan) != OK) {
+    closeRecordScan(&scan);
+    freeTableInfo(tableInfo);
+    free(recordSet);
+    return NULL;
+  }
+
+  while ((ret = getNextRecord(&scan, &q)) == OK && q != NULL) {
+    /*データを収める領域を確保する*/
+    if ((record = (RecordData *) malloc(sizeof(RecordData))) == NULL) {
+      ret = NG;
+      break;
+    }
+
+    /*レコードの内容を領域に写し、レコードの集合に追加する*/
+    decodeRecord(tableInfo, q, record);
+    record->recordId = scan.recordId;
+    com = 0;
+    if (condition != NULL && condition->distinct==DISTINCT){
+      list=recordSet->recordData;
+      while(list!= NULL){
+        if((com=compare(record,list))==1){
+          break;
+        }
+        list=list->next;
+      }
+    }
+    if (com==0){
+      p = recordSet->recordData;
+      recordSet->recordData = record;
+      record->next = p;
+      recordSet->numRecord++;
+    }else{
+      free(record);
+    }
+  }
+
+  /*走査を終えてレコードの集合を返す*/
+  closeRecordScan(&scan);
+  freeTableInfo(tableInfo);
+  if (ret != OK) {
+    freeRecordSet(recordSet);
+    free(recordSet);
+    return NULL;
+  }
+
+  return recordSet;
+}
+
+/*
+ * selectRecord -- レコードの検索
+ *
+ * 引数:
+ *  tableName: レコードを検索するテーブルの名前
+ *  condition: 検索するレコードの条件
+ *
+ * 返り値:
+ *  検索に成功したら検索されたレコード(の集合)へのポインタを返し、
+ *  検索に失敗したらNULLを返す。
+ *  検索した結果、該当するレコードが1つもなかった場合も、レコードの
+ *  集合へのポインタを返す。
+ *
+ * ***注意***
+ *  この関数が返すレコードの集合を収めたメモリ領域は、不要になったら
+ *  必ずfreeRecordSetで解放すること。
+ *
+ * テーブルの共有ロックを取って行う。
+ */
+RecordSet *selectRecord(char *tableName, Condition *condition)
+{
+  RecordSet *recordSet;
+  Snapshot snapshot, *use;
+
+  if (lockTableForRead(tableName, condition, &snapshot, &use) != OK) {
+    return NULL;
+  }
+  recordSet = selectRecordUnlocked(tableName, condition, use);
+  unlockTableForRead(tableName, use);
+
+  return recordSet;
+}
+
+/*
+ * selectFieldsUnlocked -- selectFieldsの本体(テーブルのロックは呼び出し元で取る)
+ */
+static RecordSet *selectFieldsUnlocked(char *tableName, Condition *condition, Projection *projection,
+                                       Snapshot *snapshot)
+{
+  TableInfo *tableInfo;
+  RecordScan scan;
+  RecordSet *recordSet;
+  RecordData *record;
+  char usedField[MAX_FIELD];
+  int offset[MAX_FIELD];
+  DataType dataType[MAX_FIELD];
+  char *q;
+  int i;
+  Result ret;
+
+  if (projection->numField <= 0 || projection->numField > MAX_FIELD) {
+    return NULL;
+  }
+
+  if ((recordSet = (RecordSet *) malloc(sizeof(RecordSet))) == NULL) {
+    return NULL;
+  }
+  recordSet->recordData = NULL;
+  recordSet->numRecord = 0;
+
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    free(recordSet);
+    return NULL;
+  }
+
+  /* 取り出すフィールドの位置を解決しておく */
+  memset(usedField, 0, sizeof(usedField));
+  for (i = 0; i < projection->numField; i++) {
+    if ((offset[i] = getFieldOffset(tableInfo, projection->name[i], &dataType[i])) < 0) {
+      freeTableInfo(tableInfo);
+      free(recordSet);
+      return NULL;
+    }
+    markUsedField(tableInfo, projection->name[i], usedField);
+  }
+
+  if (openRecordScan(&scan, tableName, tableInfo, condition, NULL, usedField, snapshot) != OK) {
+    freeTableInfo(tableInfo);
+    free(recordSet);
+    return NULL;
+  }
+
+  while ((ret = getNextRecord(&scan, &q)) == OK && q != NULL) {
+    if ((record = (RecordData *) malloc(sizeof(RecordData))) == NULL) {
+      ret = NG;
+      break;
+    }
+
+    /* 指定したフィールドだけを写し、レコードの集合に追加する */
+    record->numField = projection->numField;
+    for (i = 0; i < projection->numField; i++) {
+      strcpy(record->fieldData[i].name, projection->name[i]);
+      record->fieldData[i].dataType = dataType[i];
+      memset(&record->fieldData[i].valueSet, 0, sizeof(ValueSet));
+      memcpy(&record->fieldData[i].valueSet, q + offset[i],
+             (dataType[i] == TYPE_INTEGER) ? sizeof(int) : MAX_STRING);
+    }
+    record->next = recordSet->recordData;
+    recordSet->recordData = record;
+    recordSet->numRecord++;
+  }
+
+  closeRecordScan(&scan);
+  freeTableInfo(tableInfo);
+  if (ret != OK) {
+    freeRecordSet(recordSet);
+    free(recordSet);
+    return NULL;
+  }
+
+  return recordSet;
+}
+
+/*
+ * selectFields -- 条件を満たすレコードの、指定したフィールドだけの検索
+ *
+ * 引数:
+ *  tableName: レコードを検索するテーブルの名前
+ *  condition: 検索するレコードの条件(NULLならすべてのレコード)
+ *  projection: 取り出すフィールドの並び
+ *
+ * 返り値:
+ *  検索に成功したら、指定したフィールドだけを指定した順に持つレコードの
+ *  集合へのポインタを返し、失敗したらNULLを返す。
+ *
+ * 指定したフィールドと条件式のフィールドがすべて索引に含まれていれば、
+ * データファイルを読まずに索引だけで答える。
+ *
+ * ***注意***
+ *  この関数が返すレコードの集合を収めたメモリ領域は、不要になったら
+ *  必ずfreeRecordSetで解放すること。
+ *
+ * テーブルの共有ロックを取って行う。
+ */
+RecordSet *selectFields(char *tableName, Condition *condition, Projection *projection)
+{
+  RecordSet *recordSet;
+  Snapshot snapshot, *use;
+
+  if (lockTableForRead(tableName, condition, &snapshot, &use) != OK) {
+    return NULL;
+  }
+  recordSet = selectFieldsUnlocked(tableName, condition, projection, use);
+  unlockTableForRead(tableName, use);
+
+  return recordSet;
+}
+
+
+/*
+ * checkCondition -- レコードが条件を満足するかどうかのチェック
+ *
+ * 引数:
+ *  recordData: チェックするレコード
+ *  condition: チェックする条件
+ *
+ * 返り値:
+ *  レコードrecordが条件conditionを満足すればOK、満足しなければNGを返す
+ */
+int compare(RecordData *record1,RecordData *record2){
+  int i;
+
+  for (i = 0; i < record1->numField; i++){
+    if (record1->fieldData[i].dataType==TYPE_INTEGER){
+      if (record1->fieldData[i].valueSet.intValue != record2->fieldData[i].valueSet.intValue){
+        return 0;       
+      }     
+    }else if(record1->fieldData[i].dataType==TYPE_STRING){
+      if(strcmp(record1->fieldData[i].valueSet.stringValue,record2->fieldData[i].valueSet.stringValue)!=0){
+        return 0;
+      }
+    }  
+  }
+
+  return 1;
+}
+
+
+/*
+ * freeRecordSet -- レコード集合の情報を収めたメモリ領域の解放
+ *
+ * 引数:
+ *  recordSet: 解放するメモリ領域
+ *
+ * 返り値:
+ *  なし
+ *
+ * ***注意***
+ *  関数selectRecordが返すレコードの集合を収めたメモリ領域は、
+ *  不要になったら必ずこの関数で解放すること。
+ */
+void freeRecordSet(RecordSet *recordSet)
+{
+
+
+  //char *p,*r;
+  RecordData *p;
+  //r = recordSet->recordData;
+  /*レコードがある限り読み込む*/
+  while(recordSet->recordData !=NULL){
+    p = recordSet->recordData->next;
+    free(recordSet->recordData);
+    recordSet->recordData = p;
+  }
+
+  if (recordSet==NULL){
+    free(recordSet);
+  }
+
+}
+
+/*
+ * deleteRecordUnlocked -- deleteRecordの本体(テーブルのロックは呼び出し元で取る)
+ */
+static Result deleteRecordUnlocked(char *tableName, Condition *condition, TransactionId xid)
+{
+  TableInfo *tableInfo;
+  Index *indexes[MAX_INDEX];
+  RecordScan scan;
+  char *q;
+  Result ret;
+
+  /* テーブルの定義情報を取得する */
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    /* テーブル情報の取得に失敗したので、処理をやめて返る */
+    return NG;
+  }
+
+  /*
+   * 削除するレコードを索引からも消すので、索引をすべてオープンしておく。
+   * 走査で索引をたどる場合も同じ索引を使う(走査は葉の内容を読み込んで
+   * 持っているので、たどっている途中で要素を消しても差し支えない)。
+   */
+  if (openTableIndexes(tableName, tableInfo, indexes) != OK) {
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+  if (openRecordScan(&scan, tableName, tableInfo, condition, indexes, NULL, NULL) != OK) {
+    closeTableIndexes(tableInfo, indexes);
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+
+  /* 削除するレコードを探すところは、複数のスレッドで行う */
+  ret = parallelizeRecordScan(&scan);
+
+  /*条件に一致したレコードを索引から消し、消したトランザクションを記録する*/
+  while (ret == OK && (ret = getNextRecord(&scan, &q)) == OK && q != NULL) {
+    if (updateIndexes(tableInfo, indexes, q, &scan.recordId, 0) != OK) {
+      ret = NG;
+      break;
+    }
+    setDeleteXid(q, xid);
+    if (markRecordModified(&scan) != OK) {
+      ret = NG;
+      break;
+    }
+  }
+
+  /*ファイルを閉じる*/
+  if (closeRecordScan(&scan) != OK) {
+    ret = NG;
+  }
+  if (closeTableIndexes(tableInfo, indexes) != OK) {
+    ret = NG;
+  }
+  freeTableInfo(tableInfo);
+  return ret;
+}
+
+/*
+ * deleteRecord -- レコードの削除
+ *
+ * 引数:
+ *  tableName: レコードを削除するテーブルの名前
+ *  condition: 削除するレコードの条件
+ *
+ * 返り値:
+ *  削除に成功したらOK、失敗したらNGを返す
+ *
+ * レコードの場所はすぐには空けず、消したトランザクションのIDを記録する
+ * (それより前に取ったスナップショットからは、まだ見える)。索引の要素はすぐに消す。
+ *
+ * テーブルの共有インテンション排他ロックを取って行う。
+ */
+Result deleteRecord(char *tableName, Condition *condition)
+{
+  TransactionId xid;
+  Result ret;
+
+  if (lockTable(tableName, LOCK_SHARED_INTENTION_EXCLUSIVE) != OK) {
+    return NG;
+  }
+  if ((xid = beginTransaction(tableName)) == 0) {
+    unlockTable(tableName);
+    return NG;
+  }
+  ret = deleteRecordUnlocked(tableName, condition, xid);
+  ret = finishTransaction(tableName, xid, ret, 1, 0);
+  unlockTable(tableName);
+
+  return ret;
+}
+
+/*
+ * VersionBatch -- 書き換えで、走査中のページのレコードの古い版の写しをためておく領域
+ *
+ * 写しは、走査がそのページを書き戻す前にplaceVersionsでまとめて置く。
+ * ためるのは1ページ分までなので、書き換えるレコードの数によらず大きさは決まっている。
+ */
+typedef struct VersionBatch VersionBatch;
+struct VersionBatch {
+  char *tableName;                      /* テーブルの名前 */
+  TableInfo *tableInfo;                 /* データ定義情報 */
+  int recordSize;                       /* 1レコードのバイト数 */
+  int numVersion;                       /* ためた写しの数 */
+  int *slotNum;                         /* それぞれの元のレコードの、ページの中での番号 */
+  char *versions;                       /* 写しのバイト列 */
+  RecordId *versionIds;                 /* 写しを置いた位置 */
+  int startPage;                        /* 次に空き場所を探し始めるページ */
+};
+
+/*
+ * placeVersions -- ためた古い版の写しを置き、元のレコードにその位置を記録する
+ *
+ * 走査がページを書き戻す前に呼ぶ(RecordScanのbeforeWrite)。
+ * 写しを先に置いておくので、スナップショットで読むほかのスレッドが新しい版の
+ * ページを読んだときには、前の版をたどれる。
+ * 走査中のページに空き場所があればそこに置き(ページと一緒に書き戻す)、
+ * 残りはほかのページの空き場所に置く。
+ */
+static Result placeVersions(RecordScan *scan, void *arg)
+{
+  VersionBatch *batch = arg;
+  TransactionId horizon;
+  int i, j, recordSize = batch->recordSize;
+  char *q;
+
+  if (batch->numVersion == 0) {
+    return OK;
+  }
+
+  horizon = getVacuumHorizon();
+  i = 0;
+  for (j = 0; j < PAGE_SIZE / recordSize && i < batch->numVersion; j++) {
+    q = scan->page + j * recordSize;
+    if (isFreeSlot(q, horizon)) {
+      memcpy(q, batch->versions + (size_t) recordSize * i, recordSize);
+      batch->versionIds[i].pageNum = scan->pageNum;
+      batch->versionIds[i].slotNum = j;
+      i++;
+    }
+  }
+  if (i < batch->numVersion
+      && placeRecords(batch->tableName, batch->tableInfo, batch->versions + (size_t) recordSize * i,
+                      batch->numVersion - i, 0, batch->versionIds + i, 0,
+                      &batch->startPage, scan->pageNum) != OK) {
+    return NG;
+  }
+
+  for (i = 0; i < batch->numVersion; i++) {
+    setPrevVersion(scan->page + batch->slotNum[i] * recordSize, &batch->versionIds[i]);
+  }
+  batch->numVersion = 0;
+
+  return OK;
+}
+
+/*
+ * updateRecordUnlocked -- updateRecordの本体(テーブルのロックは呼び出し元で取る)
+ */
+static Result updateRecordUnlocked(char *tableName, Assignment *assignment, Condition *condition,
+                                   TransactionId xid)
+{
+  TableInfo *tableInfo;
+  Index *indexes[MAX_INDEX];
+  int offset[MAX_FIELD];
+  RecordScan scan;
+  VersionBatch batch;
+  DataType dataType;
+  char *q, *version;
+  int i, perPage, recordSize;
+  Result ret;
+
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    return NG;
+  }
+
+  /* 書き換えるフィールドの位置を調べる(データ型が違えばエラー) */
+  for (i = 0; i < assignment->numField; i++) {
+    if ((offset[i] = getFieldOffset(tableInfo, assignment->name[i], &dataType)) < 0
+        || dataType != assignment->dataType[i]) {
+      freeTableInfo(tableInfo);
+      return NG;
+    }
+  }
+
+  recordSize = getRecordSize(tableInfo);
+  perPage = PAGE_SIZE / recordSize;
+  batch.tableName = tableName;
+  batch.tableInfo = tableInfo;
+  batch.recordSize = recordSize;
+  batch.numVersion = 0;
+  batch.startPage = 0;
+  batch.slotNum = malloc(sizeof(int) * perPage);
+  batch.versions = malloc((size_t) recordSize * perPage);
+  batch.versionIds = malloc(sizeof(RecordId) * perPage);
+  if (batch.slotNum == NULL || batch.versions == NULL || batch.versionIds == NULL) {
+    ret = NG;
+    goto cleanup;
+  }
+
+  if (openTableIndexes(tableName, tableInfo, indexes) != OK) {
+    ret = NG;
+    goto cleanup;
+  }
+  if (openRecordScan(&scan, tableName, tableInfo, condition, indexes, NULL, NULL) != OK) {
+    closeTableIndexes(tableInfo, indexes);
+    ret = NG;
+    goto cleanup;
+  }
+  scan.beforeWrite = placeVersions;
+  scan.beforeWriteArg = &batch;
+
+  /*
+   * 条件を満たすレコードを、その場で新しい版にする。古い版は写しにしてためておき、
+   * ページを書き戻す前に空き場所に置く(位置は変わらず、それより前に取った
+   * スナップショットからは古い版が見え続ける)。
+   */
+  while ((ret = getNextRecord(&scan, &q)) == OK && q != NULL) {
+    /* 索引の走査で、この書き換えで新しくしたレコードにまた出会ったら飛ばす */
+    if (getCreateXid(q) == xid) {
+      continue;
+    }
+
+    /* 古い版は索引から消し、写しにしてためておく */
+    if (updateIndexes(tableInfo, indexes, q, &scan.recordId, 0) != OK) {
+      ret = NG;
+      break;
+    }
+    version = batch.versions + (size_t) recordSize * batch.numVersion;
+    memcpy(version, q, recordSize);
+    makeVersionRecord(version, xid);
+    batch.slotNum[batch.numVersion++] = scan.recordId.slotNum;
+
+    /* 新しい版を作って、索引に加える */
+    setRecordHeader(q, xid);
+    for (i = 0; i < assignment->numField; i++) {
+      if (assignment->dataType[i] == TYPE_INTEGER) {
+        memcpy(q + offset[i], &assignment->valueSet[i].intValue, sizeof(int));
+      } else {
+        memcpy(q + offset[i], assignment->valueSet[i].stringValue, MAX_STRING);
+      }
+    }
+    if (updateIndexes(tableInfo, indexes, q, &scan.recordId, 1) != OK
+        || markRecordModified(&scan) != OK) {
+      ret = NG;
+      break;
+    }
+  }
+
+  if (closeRecordScan(&scan) != OK) {
+    ret = NG;
+  }
+  if (closeTableIndexes(tableInfo, indexes) != OK) {
+    ret = NG;
+  }
+
+cleanup:
+  free(batch.slotNum);
+  free(batch.versions);
+  free(batch.versionIds);
+  freeTableInfo(tableInfo);
+  return ret;
+}
+
+/*
+ * updateRecord -- レコードの書き換え
+ *
+ * 引数:
+ *  tableName: レコードを書き換えるテーブルの名前
+ *  assignment: 書き換えるフィールドと新しい値
+ *  condition: 書き換えるレコードの条件(NULLならすべてのレコード)
+ *
+ * 返り値:
+ *  書き換えに成功したらOK、失敗したらNGを返す
+ *
+ * 条件を満たすレコードはその場で書き換え、書き換える前の版は写しにして空き場所に
+ * 置く(それより前に取ったスナップショットからは、写しをたどって古い版が見え続ける)。
+ * そのため、レコードの位置は変わらない。データファイルは1回だけ走査し、写しは
+ * 1ページ分ずつまとめて置く。
+ *
+ * テーブルの共有インテンション排他ロックを取って行う。
+ */
+Result updateRecord(char *tableName, Assignment *assignment, Condition *condition)
+{
+  TransactionId xid;
+  Result ret;
+
+  if (lockTable(tableName, LOCK_SHARED_INTENTION_EXCLUSIVE) != OK) {
+    return NG;
+  }
+  if ((xid = beginTransaction(tableName)) == 0) {
+    unlockTable(tableName);
+    return NG;
+  }
+  ret = updateRecordUnlocked(tableName, assignment, condition, xid);
+  ret = finishTransaction(tableName, xid, ret, 1, 0);
+  unlockTable(tableName);
+
+  return ret;
+}
+
+/*
+ * vacuumTableUnlocked -- vacuumTableの本体(テーブルのロックは呼び出し元で取る)
+ */
+static Result vacuumTableUnlocked(char *tableName, long *numRecord)
+{
+  TableInfo *tableInfo;
+  TransactionId horizon;
+  File *file;
+  char *filename, *q;
+  char page[PAGE_SIZE];
+  int i, j, numPage, recordSize, modified;
+  Result ret = OK;
+
+  *numRecord = 0;
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    return NG;
+  }
+  recordSize = getRecordSize(tableInfo);
+  freeTableInfo(tableInfo);
+
+  if ((filename = getDataFileName(tableName)) == NULL) {
+    return NG;
+  }
+  numPage = getNumPages(filename);
+  file = openFile(filename);
+  free(filename);
+  if (file == NULL) {
+    return NG;
+  }
+
+  horizon = getVacuumHorizon();
+  for (i = 0; i < numPage && ret == OK; i++) {
+    if (readPage(file, i, page) != OK) {
+      ret = NG;
+      break;
+    }
+
+    /* どのスナップショットからも見えない削除済みのレコードを、未使用にする */
+    modified = 0;
+    for (j = 0; j < PAGE_SIZE / recordSize; j++) {
+      q = page + j * recordSize;
+      if (*q != 0 && isFreeSlot(q, horizon)) {
+        memset(q, 0, recordSize);
+        (*numRecord)++;
+        modified = 1;
+      }
+    }
+    if (modified && writePage(file, i, page) != OK) {
+      ret = NG;
+    }
+  }
+
+  if (closeFile(file) != OK) {
+    ret = NG;
+  }
+  return ret;
+}
+
+/*
+ * vacuumTable -- 削除したレコードの場所を片付ける
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  numRecord: 片付けたレコードの数を返す領域
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 削除や書き換えで消したレコードのうち、使用中のスナップショットから見える
+ * 可能性のないもの(getVacuumHorizonより前のトランザクションが消したもの)を
+ * 未使用にする。挿入も同じレコードの場所を再利用するので、これは場所を
+ * まとめて空けておくためのものである。
+ *
+ * テーブルの共有インテンション排他ロックを取って行う。
+ */
+Result vacuumTable(char *tableName, long *numRecord)
+{
+  Result ret;
+
+  if (lockTable(tableName, LOCK_SHARED_INTENTION_EXCLUSIVE) != OK) {
+    return NG;
+  }
+  ret = vacuumTableUnlocked(tableName, numRecord);
+  unlockTable(tableName);
+
+  return ret;
+}
+
+/*
+ * readRecordPage -- レコードの位置を指定して、そのレコードを含むページを読む
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  tableInfo: データ定義情報
+ *  recordId: レコードの位置
+ *  file: オープンしたデータファイルを返す領域
+ *  page: ページを読み込む領域
+ *  record: page上のレコードの先頭を返す領域
+ *  snapshot: スナップショット(NULLなら最新の状態を見る)
+ *
+ * 返り値:
+ *  その位置に見えるレコードがあればOKを返す。
+ *  位置が範囲外か、レコードが見えなければNGを返す(ファイルはクローズ済み)。
+ *
+ * 読むのはレコードを含む1ページと、スナップショットで見える版が古い版の
+ * 写しならそのページである。写しを読んだ場合は、page上のレコードを写しの内容で
+ * 置き換えて返す(このpageは書き戻さないこと)。
+ */
+static Result readRecordPage(char *tableName, TableInfo *tableInfo, RecordId *recordId,
+                             File **file, char *page, char **record, Snapshot *snapshot)
+{
+  char copy[PAGE_SIZE];
+  char *filename, *version;
+  int recordSize, numPage;
+
+  recordSize = getRecordSize(tableInfo);
+  if (recordId->slotNum < 0 || recordId->slotNum >= PAGE_SIZE / recordSize
+      || recordId->pageNum < 0) {
+    return NG;
+  }
+
+  if ((filename = getDataFileName(tableName)) == NULL) {
+    return NG;
+  }
+  numPage = getNumPages(filename);
+  if (recordId->pageNum >= numPage || (*file = openFile(filename)) == NULL) {
+    free(filename);
+    return NG;
+  }
+  free(filename);
+
+  if (readPage(*file, recordId->pageNum, page) != OK) {
+    closeFile(*file);
+    return NG;
+  }
+  *record = page + recordId->slotNum * recordSize;
+  if ((version = findVisibleVersion(*file, *record, recordSize, snapshot, copy)) == NULL) {
+    closeFile(*file);
+    return NG;
+  }
+  if (version != *record) {
+    memcpy(*record, version, recordSize);
+  }
+
+  return OK;
+}
+
+/*
+ * fetchRecordByIdUnlocked -- fetchRecordByIdの本体(テーブルのロックは呼び出し元で取る)
+ */
+static Result fetchRecordByIdUnlocked(char *tableName, RecordId *recordId, RecordData *recordData,
+                                      Snapshot *snapshot)
+{
+  TableInfo *tableInfo;
+  File *file;
+  char page[PAGE_SIZE];
+  char *q;
+  Result ret;
+
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    return NG;
+  }
+  if (readRecordPage(tableName, tableInfo, recordId, &file, page, &q, snapshot) != OK) {
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+
+  decodeRecord(tableInfo, q, recordData);
+  recordData->recordId = *recordId;
+
+  ret = closeFile(file);
+  freeTableInfo(tableInfo);
+  return ret;
+}
+
+/*
+ * fetchRecordById -- 位置を指定したレコードの取り出し
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  recordId: レコードの位置(insertRecordが返したもの、あるいは検索結果のもの)
+ *  recordData: レコードの内容を返す領域
+ *
+ * 返り値:
+ *  その位置にレコードがあればOK、なければNGを返す
+ *
+ * テーブルのインテンション共有ロックとスナップショットを取って行う(レコードを
+ * 書き換えている操作を待たず、その前の内容を読む)。
+ */
+Result fetchRecordById(char *tableName, RecordId *recordId, RecordData *recordData)
+{
+  Snapshot snapshot, *use;
+  Result ret;
+
+  if (lockTableForRead(tableName, NULL, &snapshot, &use) != OK) {
+    return NG;
+  }
+  ret = fetchRecordByIdUnlocked(tableName, recordId, recordData, use);
+  unlockTableForRead(tableName, use);
+
+  return ret;
+}
+
+/*
+ * deleteRecordByIdUnlocked -- deleteRecordByIdの本体(テーブルのロックは呼び出し元で取る)
+ *
+ * rowLevelが1なら、ページを読んでから書き戻すまでそのページのラッチを取る。
+ * レコードを書き戻したら、changedを1にする。
+ */
+static Result deleteRecordByIdUnlocked(char *tableName, RecordId *recordId, TransactionId xid,
+                                       int rowLevel, int *changed)
+{
+  TableInfo *tableInfo;
+  Index *indexes[MAX_INDEX];
+  File *file;
+  char page[PAGE_SIZE];
+  char *q;
+  Result ret = OK;
+
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    return NG;
+  }
+  if (rowLevel && latchPage(tableName, recordId->pageNum) != OK) {
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+  if (readRecordPage(tableName, tableInfo, recordId, &file, page, &q, NULL) != OK) {
+    if (rowLevel) {
+      unlatchPage(tableName, recordId->pageNum);
+    }
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+
+  /* 索引から消してから、消したトランザクションを記録して書き戻す */
+  if (tableInfo->numIndex > 0) {
+    if (openTableIndexes(tableName, tableInfo, indexes) != OK) {
+      ret = NG;
+    } else {
+      ret = updateIndexes(tableInfo, indexes, q, recordId, 0);
+      if (closeTableIndexes(tableInfo, indexes) != OK) {
+        ret = NG;
+      }
+    }
+  }
+  if (ret == OK) {
+    setDeleteXid(q, xid);
+    if ((ret = writePage(file, recordId->pageNum, page)) == OK) {
+      *changed = 1;
+    }
+  }
+
+  if (closeFile(file) != OK) {
+    ret = NG;
+  }
+  if (rowLevel) {
+    unlatchPage(tableName, recordId->pageNum);
+  }
+  freeTableInfo(tableInfo);
+  return ret;
+}
+
+/*
+ * deleteRecordById -- 位置を指定したレコードの削除
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  recordId: 削除するレコードの位置
+ *
+ * 返り値:
+ *  削除に成功したらOK、その位置にレコードがないか、失敗したらNGを返す
+ *
+ * 索引のないテーブルでは、テーブルのインテンション排他ロックとレコードの排他ロックを
+ * 取って行う(別のレコードの挿入や削除と並行して進む)。そうでなければ、テーブルの
+ * 共有インテンション排他ロックを取って行う。
+ */
+Result deleteRecordById(char *tableName, RecordId *recordId)
+{
+  TransactionId xid;
+  Result ret;
+  int rowLevel, changed = 0;
+
+  if (lockTableForWrite(tableName, 1, &rowLevel) != OK) {
+    return NG;
+  }
+  if (rowLevel && lockRecord(tableName, recordId, LOCK_EXCLUSIVE) != OK) {
+    unlockTable(tableName);
+    return NG;
+  }
+  if ((xid = beginTransaction(tableName)) == 0) {
+    ret = NG;
+  } else {
+    ret = deleteRecordByIdUnlocked(tableName, recordId, xid, rowLevel, &changed);
+    ret = finishTransaction(tableName, xid, ret, changed, rowLevel);
+  }
+  if (rowLevel) {
+    unlockRecord(tableName, recordId);
+  }
+  unlockTable(tableName);
+
+  return ret;
+}
+
+/*
+ * updateRecordByIdUnlocked -- updateRecordByIdの本体(テーブルのロックは呼び出し元で取る)
+ *
+ * 書き換える前の版の写しを先に空き場所に置いてから、元の場所を新しい版にする。
+ * rowLevelが1なら、元のページを読み書きする間だけそのページのラッチを取る
+ * (写しを置くときには、置く先のページのラッチを順に取るので、ラッチを持ったままに
+ * はしない。その間もレコードの排他ロックで、ほかから書き換えられないようにしている)。
+ * 元の場所を書き戻したら、changedを1にする(写しだけなら、どこからも見えない)。
+ */
+static Result updateRecordByIdUnlocked(char *tableName, RecordId *recordId, RecordData *recordData,
+                                       TransactionId xid, int rowLevel, int *changed)
+{
+  TableInfo *tableInfo;
+  Index *indexes[MAX_INDEX];
+  RecordId versionId;
+  File *file;
+  char page[PAGE_SIZE];
+  char *q, *record, *version;
+  int recordSize;
+  Result ret = OK;
+
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    return NG;
+  }
+  recordSize = getRecordSize(tableInfo);
+  record = malloc(recordSize);
+  version = malloc(recordSize);
+  if (record == NULL || version == NULL
+      || encodeRecord(tableInfo, recordData, record) != OK) {
+    free(record);
+    free(version);
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+
+  /* 古い版を写しにして、空き場所に置く */
+  if (rowLevel && latchPage(tableName, recordId->pageNum) != OK) {
+    ret = NG;
+  } else {
+    if (readRecordPage(tableName, tableInfo, recordId, &file, page, &q, NULL) != OK) {
+      ret = NG;
+    } else {
+      memcpy(version, q, recordSize);
+      makeVersionRecord(version, xid);
+      if (closeFile(file) != OK) {
+        ret = NG;
+      }
+    }
+    if (rowLevel) {
+      unlatchPage(tableName, recordId->pageNum);
+    }
+  }
+  if (ret == OK) {
+    ret = placeRecords(tableName, tableInfo, version, 1, 0, &versionId, rowLevel, NULL, -1);
+  }
+  if (ret != OK) {
+    free(record);
+    free(version);
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+
+  /* 元の場所を読み直して新しい版にし、索引の要素を入れ替えて書き戻す */
+  if (rowLevel && latchPage(tableName, recordId->pageNum) != OK) {
+    free(record);
+    free(version);
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+  if (readRecordPage(tableName, tableInfo, recordId, &file, page, &q, NULL) != OK) {
+    ret = NG;
+  } else {
+    if (tableInfo->numIndex > 0) {
+      if (openTableIndexes(tableName, tableInfo, indexes) != OK) {
+        ret = NG;
+      } else {
+        ret = updateIndexes(tableInfo, indexes, q, recordId, 0);
+        if (ret == OK) {
+          memcpy(q, record, recordSize);
+          setRecordHeader(q, xid);
+          setPrevVersion(q, &versionId);
+          ret = updateIndexes(tableInfo, indexes, q, recordId, 1);
+        }
+        if (closeTableIndexes(tableInfo, indexes) != OK) {
+          ret = NG;
+        }
+      }
+    } else {
+      memcpy(q, record, recordSize);
+      setRecordHeader(q, xid);
+      setPrevVersion(q, &versionId);
+    }
+    if (ret == OK && (ret = writePage(file, recordId->pageNum, page)) == OK) {
+      *changed = 1;
+    }
+    if (closeFile(file) != OK) {
+      ret = NG;
+    }
+  }
+  if (rowLevel) {
+    unlatchPage(tableName, recordId->pageNum);
+  }
+
+  free(record);
+  free(version);
+  freeTableInfo(tableInfo);
+  return ret;
+}
+
+/*
+ * updateRecordById -- 位置を指定したレコードの書き換え
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  recordId: 書き換えるレコードの位置
+ *  recordData: 新しいレコードの内容(すべてのフィールドの値を持つこと)
+ *
+ * 返り値:
+ *  書き換えに成功したらOK、その位置にレコードがないか、失敗したらNGを返す
+ *
+ * レコードはその場で書き換えるので、位置は変わらない(書き換える前の版は写しにして
+ * 空き場所に置き、それより前に取ったスナップショットからはその版が見える)。
+ *
+ * 索引のないテーブルでは、テーブルのインテンション排他ロックとレコードの排他ロックを
+ * 取って行う(別のレコードの挿入や削除と並行して進む)。そうでなければ、テーブルの
+ * 共有インテンション排他ロックを取って行う。
+ */
+Result updateRecordById(char *tableName, RecordId *recordId, RecordData *recordData)
+{
+  TransactionId xid;
+  Result ret;
+  int rowLevel, changed = 0;
+
+  if (lockTableForWrite(tableName, 1, &rowLevel) != OK) {
+    return NG;
+  }
+  if (rowLevel && lockRecord(tableName, recordId, LOCK_EXCLUSIVE) != OK) {
+    unlockTable(tableName);
+    return NG;
+  }
+  if ((xid = beginTransaction(tableName)) == 0) {
+    ret = NG;
+  } else {
+    ret = updateRecordByIdUnlocked(tableName, recordId, recordData, xid, rowLevel, &changed);
+    ret = finishTransaction(tableName, xid, ret, changed, rowLevel);
+  }
+  if (rowLevel) {
+    unlockRecord(tableName, recordId);
+  }
+  unlockTable(tableName);
+
+  return ret;
+}
+
+/*
+ * selectRecordAfterUnlocked -- selectRecordAfterの本体(テーブルのロックは呼び出し元で取る)
+ */
+static RecordSet *selectRecordAfterUnlocked(char *tableName, Condition *condition, RecordId *after, int limit,
+                                            Snapshot *snapshot)
+{
+  RecordData *record, **tail;
+  RecordSet *recordSet;
+  TableInfo *tableInfo;
+  RecordScan scan;
+  char *q;
+  Result ret = OK;
+
+  if ((recordSet = (RecordSet *)malloc(sizeof(RecordSet))) == NULL) {
+      return NULL;
+  }
+  recordSet->recordData = NULL;
+  recordSet->numRecord = 0;
+  tail = &recordSet->recordData;
+
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    free(recordSet);
+    return NULL;
+  }
+  if (openRecordScan(&scan, tableName, tableInfo, condition, NULL, NULL, snapshot) != OK) {
+    freeTableInfo(tableInfo);
+    free(recordSet);
+    return NULL;
+  }
+  seekRecordScan(&scan, after);
+
+  while ((limit <= 0 || recordSet->numRecord < limit)
+         && (ret = getNextRecord(&scan, &q)) == OK && q != NULL) {
+    if ((record = (RecordData *) malloc(sizeof(RecordData))) == NULL) {
+      ret = NG;
+      break;
+    }
+    decodeRecord(tableInfo, q, record);
+    record->recordId = scan.recordId;
+    *tail = record;
+    tail = &record->next;
+    recordSet->numRecord++;
+  }
+
+  closeRecordScan(&scan);
+  freeTableInfo(tableInfo);
+  if (ret != OK) {
+    freeRecordSet(recordSet);
+    free(recordSet);
+    return NULL;
+  }
+
+  return recordSet;
+}
+
+/*
+ * selectRecordAfter -- 指定した位置より後ろのレコードを、決まった数だけ検索する
+ *
+ * 引数:
+ *  tableName: レコードを検索するテーブルの名前
+ *  condition: 検索するレコードの条件(NULLならすべてのレコード)
+ *  after: この位置より後ろのレコードを返す(NULLなら先頭から)
+ *  limit: 返すレコードの最大数(0以下なら制限しない)
+ *
+ * 返り値:
+ *  検索に成功したらレコードの集合へのポインタを、失敗したらNULLを返す。
+ *
+ * レコードはデータファイルの中の位置の順に並び、それぞれrecordIdに位置が入っている。
+ * 最後のレコードの位置を次の呼び出しのafterに渡せば、続きを取り出せる。
+ *
+ * ***注意***
+ *  この関数が返すレコードの集合を収めたメモリ領域は、不要になったら
+ *  必ずfreeRecordSetで解放すること。
+ *
+ * テーブルの共有ロックを取って行う。
+ */
+RecordSet *selectRecordAfter(char *tableName, Condition *condition, RecordId *after, int limit)
+{
+  RecordSet *recordSet;
+  Snapshot snapshot, *use;
+
+  if (lockTableForRead(tableName, condition, &snapshot, &use) != OK) {
+    return NULL;
+  }
+  recordSet = selectRecordAfterUnlocked(tableName, condition, after, limit, use);
+  unlockTableForRead(tableName, use);
+
+  return recordSet;
+}
+
+/*
+ * createDataFile -- データファイルの作成
+ *
+ * 引数:
+ *  tableName: 作成するテーブルの名前
+ *
+ * 返り値:
+ *  作成に成功したらOK、失敗したらNGを返す
+ */
+Result createDataFile(char *tableName)
+{
+  int len;
+  char *filename;
+
+  /* [tableName].dafという文字列を作る */
+  len = strlen(tableName) + strlen(DATA_FILE_EXT) + 1;
+  if ((filename = malloc(len)) == NULL) {
+      return NG;
+  }
+  snprintf(filename, len, "%s%s", tableName, DATA_FILE_EXT);
+
+
+  if (createFile(filename) != OK) {
+    return NG;
+  }
+
+  return OK;
+
+}
+
+/*
+ * deleteDataFile -- データファイルの削除
+ *
+ * 引数:
+ *  tableName: 削除するテーブルの名前
+ *
+ * 返り値:
+ *  削除に成功したらOK、失敗したらNGを返す
+ */
+Result deleteDataFile(char *tableName)
+{
+  int len;
+  char *filename;
+
+  /* [tableName].dafという文字列を作る */
+  len = strlen(tableName) + strlen(DATA_FILE_EXT) + 1;
+  if ((filename = malloc(len)) == NULL) {
+      return NG;
+  }
+  snprintf(filename, len, "%s%s", tableName, DATA_FILE_EXT);
+
+
+  if (deleteFile(filename) != OK) {
+    return NG;
+  }
+
+  return OK;
+
+}
+
+/*
+ * createIndexUnlocked -- createIndexの本体(テーブルのロックは呼び出し元で取る)
+ */
+static Result createIndexUnlocked(char *tableName, IndexInfo *indexInfo)
+{
+  TableInfo *tableInfo;
+  IndexEntry entry;
+  RecordScan scan;
+  Index *index;
+  IndexBuilder *builder;
+  char *q;
+  int i;
+  Result ret;
+
+  if (strlen(indexInfo->name) >= MAX_INDEX_NAME || strlen(indexInfo->fieldName) >= MAX_FIELD_NAME
+      || indexInfo->numInclude < 0 || indexInfo->numInclude > MAX_INCLUDE
+      || (indexInfo->indexType == INDEX_HASH && indexInfo->numInclude > 0)) {
+    return NG;
+  }
+
+  /* テーブルの定義情報を取得し、索引の定義を確かめる */
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    return NG;
+  }
+  if (getFieldOffset(tableInfo, indexInfo->fieldName, &indexInfo->dataType) < 0
+      || tableInfo->numIndex >= MAX_INDEX) {
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+  for (i = 0; i < indexInfo->numInclude; i++) {
+    if (getFieldOffset(tableInfo, indexInfo->includeName[i], &indexInfo->includeType[i]) < 0) {
+      freeTableInfo(tableInfo);
+      return NG;
+    }
+  }
+  for (i = 0; i < tableInfo->numIndex; i++) {
+    if (strcmp(tableInfo->indexInfo[i].name, indexInfo->name) == 0) {
+      freeTableInfo(tableInfo);
+      return NG;
+    }
+  }
+
+  /* 空の索引を作り、既にあるレコードを加える */
+  if (createIndexFile(tableName, indexInfo) != OK) {
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+  if ((index = openIndex(tableName, indexInfo)) == NULL) {
+    deleteIndexFile(tableName, indexInfo->name);
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+  if ((builder = createIndexBuilder(index, getWorkMemory())) == NULL) {
+    closeIndex(index);
+    deleteIndexFile(tableName, indexInfo->name);
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+  if (openRecordScan(&scan, tableName, tableInfo, NULL, NULL, NULL, NULL) != OK) {
+    freeIndexBuilder(builder);
+    closeIndex(index);
+    deleteIndexFile(tableName, indexInfo->name);
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+  while ((ret = getNextRecord(&scan, &q)) == OK && q != NULL) {
+    if (makeIndexEntry(tableInfo, indexInfo, q, &scan.recordId, &entry) != OK
+        || addBuildEntry(builder, &entry) != OK) {
+      ret = NG;
+      break;
+    }
+  }
+  closeRecordScan(&scan);
+  if (ret == OK) {
+    ret = buildIndex(builder);
+  }
+  freeIndexBuilder(builder);
+  if (closeIndex(index) != OK) {
+    ret = NG;
+  }
+  freeTableInfo(tableInfo);
+
+  /* 索引ができあがってから、データ定義に加える */
+  if (ret != OK || addIndexInfo(tableName, indexInfo) != OK) {
+    deleteIndexFile(tableName, indexInfo->name);
+    return NG;
+  }
+
+  return OK;
+}
+
+/*
+ * createIndex -- 索引の作成
+ *
+ * 引数:
+ *  tableName: 索引を作るテーブルの名前
+ *  indexInfo: 索引の定義(名前、フィールド名、種類、索引に含めるフィールド名)
+ *             データ型はテーブルの定義から求めて書き込む
+ *
+ * 返り値:
+ *  作成に成功したらOK、失敗したらNGを返す
+ *
+ * 既にあるレコードもすべて索引に加える。データファイルを先頭から順に読み、
+ * 集めた要素を整列してから索引を一括して作る(B+木の場合)。
+ * 索引に含めるフィールドを指定できるのはB+木だけである。
+ *
+ * テーブルの排他ロックを取って行う。
+ */
+Result createIndex(char *tableName, IndexInfo *indexInfo)
+{
+  Result ret;
+
+  if (lockTable(tableName, LOCK_EXCLUSIVE) != OK) {
+    return NG;
+  }
+  ret = createIndexUnlocked(tableName, indexInfo);
+  unlockTable(tableName);
+
+  return ret;
+}
+
+/*
+ * dropIndexUnlocked -- dropIndexの本体(テーブルのロックは呼び出し元で取る)
+ */
+static Result dropIndexUnlocked(char *tableName, char *indexName)
+{
+  if (removeIndexInfo(tableName, indexName) != OK) {
+    return NG;
+  }
+
+  return deleteIndexFile(tableName, indexName);
+}
+
+/*
+ * dropIndex -- 索引の削除
+ *
+ * 引数:
+ *  tableName: 索引のあるテーブルの名前
+ *  indexName: 削除する索引の名前
+ *
+ * 返り値:
+ *  削除に成功したらOK、失敗したらNGを返す
+ *
+ * テーブルの排他ロックを取って行う。
+ */
+Result dropIndex(char *tableName, char *indexName)
+{
+  Result ret;
+
+  if (lockTable(tableName, LOCK_EXCLUSIVE) != OK) {
+    return NG;
+  }
+  ret = dropIndexUnlocked(tableName, indexName);
+  unlockTable(tableName);
+
+  return ret;
+}
+
+/*
+ * resetAggregate -- 集約関数の状態の初期化
+ */
+static void resetAggregate(Aggregate *aggregate)
+{
+  aggregate->count = 0;
+  aggregate->sum = 0;
+  memset(&aggregate->min, 0, sizeof(ValueSet));
+  memset(&aggregate->max, 0, sizeof(ValueSet));
+}
+
+/*
+ * updateAggregate -- 集約関数の状態に1レコード分の値を加える
+ *
+ * 引数:
+ *  aggregate: 更新する集約関数
+ *  field: レコードのバイト列の中の対象フィールドの位置
+ *         (count(*)の場合はNULL)
+ *
+ * 返り値:
+ *  なし
+ */
+static void updateAggregate(Aggregate *aggregate, char *field)
+{
+  int value;
+
+  if (field != NULL && aggregate->dataType == TYPE_INTEGER) {
+    memcpy(&value, field, sizeof(int));
+    aggregate->sum += value;
+    if (aggregate->count == 0 || value < aggregate->min.intValue) {
+      aggregate->min.intValue = value;
+    }
+    if (aggregate->count == 0 || value > aggregate->max.intValue) {
+      aggregate->max.intValue = value;
+    }
+  } else if (field != NULL && aggregate->dataType == TYPE_STRING) {
+    if (aggregate->count == 0 || strncmp(field, aggregate->min.stringValue, MAX_STRING) < 0) {
+      memcpy(aggregate->min.stringValue, field, MAX_STRING);
+    }
+    if (aggregate->count == 0 || strncmp(field, aggregate->max.stringValue, MAX_STRING) > 0) {
+      memcpy(aggregate->max.stringValue, field, MAX_STRING);
+    }
+  }
+
+  aggregate->count++;
+}
+
+/*
+ * resolveAggregate -- 集約関数の対象フィールドの位置の解決
+ *
+ * 引数:
+ *  tableInfo: データ定義情報
+ *  aggregate: 集約関数の配列
+ *  numAggregate: 集約関数の数
+ *  offset: 対象フィールドの位置を返す配列(count(*)の場合は-1)
+ *
+ * 返り値:
+ *  成功ならOK、存在しないフィールドや型の合わない集約関数があればNGを返す
+ */
+static Result resolveAggregate(TableInfo *tableInfo, Aggregate *aggregate, int numAggregate, int *offset)
+{
+  int i;
+
+  if (numAggregate > MAX_AGGREGATE) {
+    return NG;
+  }
+
+  for (i = 0; i < numAggregate; i++) {
+    resetAggregate(&aggregate[i]);
+
+    if (strcmp(aggregate[i].name, "*") == 0) {
+      /* count(*)以外に"*"は指定できない */
+      if (aggregate[i].type != AGG_COUNT) {
+        return NG;
+      }
+      aggregate[i].dataType = TYPE_UNKNOWN;
+      offset[i] = -1;
+      continue;
+    }
+
+    if ((offset[i] = getFieldOffset(tableInfo, aggregate[i].name, &aggregate[i].dataType)) < 0) {
+      return NG;
+    }
+
+    /* sumとavgは整数型のフィールドにしか使えない */
+    if ((aggregate[i].type == AGG_SUM || aggregate[i].type == AGG_AVG)
+        && aggregate[i].dataType != TYPE_INTEGER) {
+      return NG;
+    }
+  }
+
+  return OK;
+}
+
+/*
+ * mergeAggregate -- 集約関数の途中の状態をまとめる
+ *
+ * 引数:
+ *  aggregate: まとめる先
+ *  from: 別のレコードの集まりについて集計した状態
+ *
+ * 返り値:
+ *  なし
+ */
+static void mergeAggregate(Aggregate *aggregate, Aggregate *from)
+{
+  if (from->count == 0) {
+    return;
+  }
+
+  if (aggregate->dataType == TYPE_INTEGER) {
+    aggregate->sum += from->sum;
+    if (aggregate->count == 0 || from->min.intValue < aggregate->min.intValue) {
+      aggregate->min.intValue = from->min.intValue;
+    }
+    if (aggregate->count == 0 || from->max.intValue > aggregate->max.intValue) {
+      aggregate->max.intValue = from->max.intValue;
+    }
+  } else if (aggregate->dataType == TYPE_STRING) {
+    if (aggregate->count == 0 || strncmp(from->min.stringValue, aggregate->min.stringValue, MAX_STRING) < 0) {
+      memcpy(aggregate->min.stringValue, from->min.stringValue, MAX_STRING);
+    }
+    if (aggregate->count == 0 || strncmp(from->max.stringValue, aggregate->max.stringValue, MAX_STRING) > 0) {
+      memcpy(aggregate->max.stringValue, from->max.stringValue, MAX_STRING);
+    }
+  }
+
+  aggregate->count += from->count;
+}
+
+/*
+ * aggregateMorselRecord -- 並列走査で見つけたレコードを受け持ちの集約関数に加える
+ */
+static Result aggregateMorselRecord(ParallelScan *parallel, int m, char *record, RecordId *recordId)
+{
+  Aggregate *aggregate = &parallel->aggregate[m * parallel->numAggregate];
+  int k;
+
+  (void) recordId;
+  for (k = 0; k < parallel->numAggregate; k++) {
+    updateAggregate(&aggregate[k], parallel->offset[k] < 0 ? NULL : record + parallel->offset[k]);
+  }
+
+  return OK;
+}
+
+/*
+ * aggregateParallel -- データファイルを複数のスレッドで読みながらの集約
+ *
+ * 引数:
+ *  scan: openRecordScanしたばかりの走査の状態
+ *  aggregate: 計算する集約関数の配列(resolveAggregate済み、結果もここに返す)
+ *  numAggregate: 集約関数の数
+ *  offset: 集約関数の対象フィールドの位置
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 受け持ちごとに集計し、最後に受け持ちの順にまとめる。
+ */
+static Result aggregateParallel(RecordScan *scan, Aggregate *aggregate, int numAggregate, int *offset)
+{
+  ParallelScan parallel;
+  int i, k;
+  Result ret;
+
+  parallel.scan = scan;
+  parallel.numMorsel = (scan->numPage + MORSEL_PAGES - 1) / MORSEL_PAGES;
+  parallel.visit = aggregateMorselRecord;
+  parallel.offset = offset;
+  parallel.numAggregate = numAggregate;
+  if ((parallel.aggregate = malloc(sizeof(Aggregate) * numAggregate * parallel.numMorsel)) == NULL) {
+    return NG;
+  }
+  for (i = 0; i < parallel.numMorsel; i++) {
+    memcpy(&parallel.aggregate[i * numAggregate], aggregate, sizeof(Aggregate) * numAggregate);
+  }
+
+  if ((ret = runParallelScan(&parallel)) == OK) {
+    for (i = 0; i < parallel.numMorsel; i++) {
+      for (k = 0; k < numAggregate; k++) {
+        mergeAggregate(&aggregate[k], &parallel.aggregate[i * numAggregate + k]);
+      }
+    }
+  }
+
+  free(parallel.aggregate);
+  return ret;
+}
+
+/*
+ * aggregateRecordUnlocked -- aggregateRecordの本体(テーブルのロックは呼び出し元で取る)
+ */
+static Result aggregateRecordUnlocked(char *tableName, Condition *condition, Aggregate *aggregate, int numAggregate,
+                                      Snapshot *snapshot)
+{
+  TableInfo *tableInfo;
+  RecordScan scan;
+  int offset[MAX_AGGREGATE];
+  char usedField[MAX_FIELD];
+  int k;
+  char *q;
+  Result ret;
+
+  /* テーブルの定義情報を取得する */
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    return NG;
+  }
+
+  /* 集約関数のフィールドの位置を解決しておく */
+  if (resolveAggregate(tableInfo, aggregate, numAggregate, offset) != OK) {
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+
+  memset(usedField, 0, sizeof(usedField));
+  for (k = 0; k < numAggregate; k++) {
+    if (offset[k] >= 0) {
+      markUsedField(tableInfo, aggregate[k].name, usedField);
+    }
+  }
+
+  /* 条件を満たすレコードを1つずつ取り出して集計する */
+  if (openRecordScan(&scan, tableName, tableInfo, condition, NULL, usedField, snapshot) != OK) {
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+  if (canParallelizeScan(&scan)) {
+    ret = aggregateParallel(&scan, aggregate, numAggregate, offset);
+  } else {
+    while ((ret = getNextRecord(&scan, &q)) == OK && q != NULL) {
+      for (k = 0; k < numAggregate; k++) {
+        updateAggregate(&aggregate[k], offset[k] < 0 ? NULL : q + offset[k]);
+      }
+    }
+  }
+
+  closeRecordScan(&scan);
+  freeTableInfo(tableInfo);
+  return ret;
+}
+
+/*
+ * aggregateRecord -- 条件を満たすレコードの集約
+ *
+ * 引数:
+ *  tableName: 集約するテーブルの名前
+ *  condition: 集約するレコードの条件(NULLならすべてのレコード)
+ *  aggregate: 計算する集約関数の配列(結果もここに返す)
+ *  numAggregate: 集約関数の数
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * ページ上のレコードを直接調べながら集計するので、
+ * 条件を満たすレコードのためにRecordDataを確保することはない。
+ * 集約関数と条件式のフィールドがすべて索引に含まれていれば、
+ * データファイルを読まずに索引だけで集計する。
+ * データファイルを順に読む場合は、複数のスレッドで読んで集計する。
+ *
+ * テーブルの共有ロックを取って行う。
+ */
+Result aggregateRecord(char *tableName, Condition *condition, Aggregate *aggregate, int numAggregate)
+{
+  Result ret;
+  Snapshot snapshot, *use;
+
+  if (lockTableForRead(tableName, condition, &snapshot, &use) != OK) {
+    return NG;
+  }
+  ret = aggregateRecordUnlocked(tableName, condition, aggregate, numAggregate, use);
+  unlockTableForRead(tableName, use);
+
+  return ret;
+}
+
+/*
+ * aggregateTypeName -- 集約関数の名前(表示用)
+ */
+static char *aggregateTypeName[] = {
+  "count",                      /* AGG_COUNT */
+  "sum",                        /* AGG_SUM */
+  "min",                        /* AGG_MIN */
+  "max",                        /* AGG_MAX */
+  "avg",                        /* AGG_AVG */
+};
+
+/*
+ * getAggregateLabel -- 集約関数の見出し("sum(age)"など)の作成
+ *
+ * 引数:
+ *  aggregate: 集約関数
+ *  label: 見出しを書き込む領域
+ *  size: labelの大きさ(バイト数)
+ *
+ * 返り値:
+ *  なし
+ */
+static void getAggregateLabel(Aggregate *aggregate, char *label, int size)
+{
+  snprintf(label, size, "%s(%s)", aggregateTypeName[aggregate->type], aggregate->name);
+}
+
+/*
+ * printAggregateValue -- 集約関数の結果の値を1つ表示する
+ */
+static void printAggregateValue(FILE *output, Aggregate *aggregate)
+{
+  ValueSet *value;
+
+  switch (aggregate->type) {
+    case AGG_COUNT:
+      fprintf(output, "|%15ld", aggregate->count);
+      return;
+    case AGG_SUM:
+      fprintf(output, "|%15ld", aggregate->sum);
+      return;
+    case AGG_AVG:
+      if (aggregate->count == 0) {
+        fprintf(output, "|%15s", "");
+      } else {
+        fprintf(output, "|%15.3f", (double) aggregate->sum / aggregate->count);
+      }
+      return;
+    case AGG_MIN:
+    case AGG_MAX:
+      value = (aggregate->type == AGG_MIN) ? &aggregate->min : &aggregate->max;
+      if (aggregate->count == 0) {
+        fprintf(output, "|%15s", "");
+      } else if (aggregate->dataType == TYPE_INTEGER) {
+        fprintf(output, "|%15d", value->intValue);
+      } else {
+        fprintf(output, "|%-15.*s", MAX_STRING, value->stringValue);
+      }
+      return;
+  }
+}
+
+/*
+ * printAggregate -- 集約関数の結果の表示
+ *
+ * 引数:
+ *  output: 出力先のストリーム
+ *  aggregate: 表示する集約関数の配列
+ *  numAggregate: 集約関数の数
+ */
+void printAggregate(FILE *output, Aggregate *aggregate, int numAggregate)
+{
+  char label[MAX_FIELD_NAME + 8];
+  int i;
+
+  for (i = 0; i < numAggregate; i++){
+    fprintf(output, "+---------------");
+  }
+  fprintf(output, "+\n");
+  for (i = 0; i < numAggregate; i++){
+    getAggregateLabel(&aggregate[i], label, sizeof(label));
+    fprintf(output, "|%-15s", label);
+  }
+  fprintf(output, "|\n");
+  for (i = 0; i < numAggregate; i++){
+    fprintf(output, "+---------------");
+  }
+  fprintf(output, "+\n");
+  for (i = 0; i < numAggregate; i++){
+    printAggregateValue(output, &aggregate[i]);
+  }
+  fprintf(output, "|\n");
+  for (i = 0; i < numAggregate; i++){
+    fprintf(output, "+---------------");
+  }
+  fprintf(output, "+\n");
+}
+
+/*
+ * createSessionKey -- 接続の設定を覚えるキーの作成(一度だけ呼ばれる)
+ */
+static void createSessionKey()
+{
+  pthread_key_create(&sessionKey, NULL);
+}
+
+/*
+ * useSession -- 呼び出したスレッドで実行する文が使う、接続ごとの設定の指定
+ *
+ * 引数:
+ *  session: 接続ごとの設定(NULLならプロセス全体の設定だけを使う)
+ *
+ * 返り値:
+ *  なし
+ *
+ * 文の実行を終えたらNULLを指定し直すこと。
+ */
+void useSession(Session *session)
+{
+  pthread_once(&sessionKeyOnce, createSessionKey);
+  pthread_setspecific(sessionKey, session);
+}
+
+/*
+ * setWorkMemory -- 集約などの作業に使うメモリの上限の設定
+ *
+ * 引数:
+ *  bytes: メモリの上限(バイト数)
+ *
+ * 返り値:
+ *  なし
+ *
+ * プロセス全体の設定を変える。接続ごとの設定は、Sessionのメンバを書き換える。
+ */
+void setWorkMemory(long bytes)
+{
+  if (bytes > 0) {
+    pthread_mutex_lock(&settingMutex);
+    workMemory = bytes;
+    pthread_mutex_unlock(&settingMutex);
+  }
+}
+
+/*
+ * getWorkMemory -- 集約などの作業に使うメモリの上限の取得
+ *
+ * useSessionで指定した接続に設定があればそれを、なければプロセス全体の
+ * 設定を返す。
+ */
+long getWorkMemory()
+{
+  Session *session;
+  long bytes;
+
+  pthread_once(&sessionKeyOnce, createSessionKey);
+  session = pthread_getspecific(sessionKey);
+  if (session != NULL && session->workMemory > 0) {
+    return session->workMemory;
+  }
+
+  pthread_mutex_lock(&settingMutex);
+  bytes = workMemory;
+  pthread_mutex_unlock(&settingMutex);
+  return bytes;
+}
+
+/*
+ * countScanThreads -- 設定したスレッド数から、実際に使うスレッド数を求める
+ */
+static int countScanThreads(int numThread)
+{
+  long n;
+
+  if (numThread > 0) {
+    return numThread;
+  }
+
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1) {
+    return 1;
+  }
+  return n > MAX_SCAN_THREADS ? MAX_SCAN_THREADS : (int) n;
+}
+
+/*
+ * setScanThreads -- 並列走査に使うスレッド数の設定
+ *
+ * 引数:
+ *  numThread: スレッド数(1なら並列に走査しない。0ならCPUの数)
+ *
+ * 返り値:
+ *  なし
+ *
+ * スケジューラをこのスレッド数で起動し直す。ワーカはすべての接続で共有するので、
+ * プロセス全体の設定になる。ほかの問合せが並列走査をしていれば、終わるのを待つ。
+ */
+void setScanThreads(int numThread)
+{
+  if (numThread >= 0) {
+    /* 設定とワーカの数が食い違わないよう、起動し直すまで放さない */
+    pthread_mutex_lock(&settingMutex);
+    scanThreads = numThread > MAX_SCAN_THREADS ? MAX_SCAN_THREADS : numThread;
+    initializeScheduler(countScanThreads(scanThreads));
+    pthread_mutex_unlock(&settingMutex);
+  }
+}
+
+/*
+ * getScanThreads -- 並列走査に使うスレッド数の取得
+ */
+int getScanThreads()
+{
+  int numThread;
+
+  pthread_mutex_lock(&settingMutex);
+  numThread = scanThreads;
+  pthread_mutex_unlock(&settingMutex);
+
+  return countScanThreads(numThread);
+}
+
+/*
+ * NUM_PARTITION -- グループ化で書き出しを行うときの分割数
+ */
+#define NUM_PARTITION 16
+
+/*
+ * MAX_PARTITION_LEVEL -- 分割したファイルをさらに分割する深さの上限
+ *
+ * これより深くなったら、メモリの上限を超えてもハッシュ表を大きくして処理する。
+ */
+#define MAX_PARTITION_LEVEL 4
+
+/*
+ * GroupQuery -- グループ化の問い合わせ全体で共通の情報
+ */
+typedef struct GroupQuery GroupQuery;
+struct GroupQuery {
+  int recordSize;                       /* 1レコードのバイト数 */
+  int numGroupField;                    /* グループ化するフィールド数 */
+  FieldInfo groupField[MAX_FIELD];      /* グループ化するフィールド */
+  int groupOffset[MAX_FIELD];           /* グループ化するフィールドの位置 */
+  int keySize;                          /* グループのキーのバイト数 */
+  Aggregate *aggregate;                 /* 集約関数(種類と対象のみ使う) */
+  int numAggregate;                     /* 集約関数の数 */
+  int aggregateOffset[MAX_AGGREGATE];   /* 集約関数の対象フィールドの位置 */
+};
+
+/*
+ * GroupTable -- グループを管理するオープンアドレス法のハッシュ表
+ *
+ * 1グループ分の領域(entry)は、ハッシュ値、キー、集約関数の状態の配列を
+ * この順に並べたもので、大きさはentrySizeバイトである。
+ */
+typedef struct GroupTable GroupTable;
+struct GroupTable {
+  int entrySize;                /* 1グループ分の領域のバイト数 */
+  int aggregatePosition;        /* 領域の中の集約関数の状態の位置 */
+  int numGroup;                 /* 登録済みのグループ数 */
+  int maxGroup;                 /* 登録できるグループ数の上限 */
+  int numSlot;                  /* ハッシュ表の大きさ(2のべき乗) */
+  int *slot;                    /* グループの番号(空きは-1) */
+  char *entry;                  /* グループの領域の配列 */
+};
+
+/*
+ * Partition -- グループ化で書き出したレコードを収める作業用ファイル
+ */
+typedef struct Partition Partition;
+struct Partition {
+  File *file;                   /* 作業用ファイル(未作成ならNULL) */
+  int numPage;                  /* 書き出したページ数 */
+  int numRecord;                /* pageに溜めているレコード数 */
+  char page[PAGE_SIZE];         /* 書き出し中のページ */
+};
+
+/*
+ * hashKey -- キーのハッシュ値の計算(FNV-1a)
+ *
+ * 引数:
+ *  key: キーのバイト列
+ *  size: キーのバイト数
+ *  seed: 分割の深さごとに変える種
+ */
+static unsigned int hashKey(char *key, int size, unsigned int seed)
+{
+  unsigned int hash = 2166136261u ^ (seed * 16777619u);
+  int i;
+
+  for (i = 0; i < size; i++) {
+    hash ^= (unsigned char) key[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+/*
+ * makeGroupKey -- レコードのバイト列からグループのキーを作る
+ *
+ * 文字列は終端文字より後ろを0で埋めて、同じ文字列が同じキーになるようにする。
+ */
+static void makeGroupKey(GroupQuery *query, char *record, char *key)
+{
+  int i;
+
+  for (i = 0; i < query->numGroupField; i++) {
+    if (query->groupField[i].dataType == TYPE_INTEGER) {
+      memcpy(key, record + query->groupOffset[i], sizeof(int));
+      key += sizeof(int);
+    } else {
+      strncpy(key, record + query->groupOffset[i], MAX_STRING);
+      key += MAX_STRING;
+    }
+  }
+}
+
+/*
+ * createGroupTable -- グループのハッシュ表の作成
+ *
+ * 引数:
+ *  query: グループ化の問い合わせ
+ *  table: 初期化するハッシュ表
+ *  maxGroup: 登録できるグループ数の上限
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+static Result createGroupTable(GroupQuery *query, GroupTable *table, int maxGroup)
+{
+  int i;
+
+  table->aggregatePosition = sizeof(unsigned int) + query->keySize;
+  table->aggregatePosition = (table->aggregatePosition + sizeof(long) - 1) / sizeof(long) * sizeof(long);
+  table->entrySize = table->aggregatePosition + sizeof(Aggregate) * query->numAggregate;
+  table->numGroup = 0;
+  table->maxGroup = maxGroup;
+
+  /* 使用率が半分以下になるように、2のべき乗の大きさにする */
+  for (table->numSlot = 16; table->numSlot < maxGroup * 2; table->numSlot *= 2)
+    ;
+
+  table->slot = malloc(sizeof(int) * table->numSlot);
+  table->entry = malloc((size_t) table->entrySize * maxGroup);
+  if (table->slot == NULL || table->entry == NULL) {
+    free(table->slot);
+    free(table->entry);
+    return NG;
+  }
+  for (i = 0; i < table->numSlot; i++) {
+    table->slot[i] = -1;
+  }
+
+  return OK;
+}
+
+/*
+ * freeGroupTable -- グループのハッシュ表の解放
+ */
+static void freeGroupTable(GroupTable *table)
+{
+  free(table->slot);
+  free(table->entry);
+}
+
+/*
+ * growGroupTable -- グループのハッシュ表を2倍に広げる
+ *
+ * これ以上分割できないときだけ使う。
+ */
+static Result growGroupTable(GroupTable *table)
+{
+  int *slot;
+  char *entry;
+  int numSlot = table->numSlot * 2;
+  int i, s;
+  unsigned int hash;
+
+  if ((entry = realloc(table->entry, (size_t) table->entrySize * table->maxGroup * 2)) == NULL) {
+    return NG;
+  }
+  table->entry = entry;
+
+  if ((slot = malloc(sizeof(int) * numSlot)) == NULL) {
+    return NG;
+  }
+  for (i = 0; i < numSlot; i++) {
+    slot[i] = -1;
+  }
+  for (i = 0; i < table->numGroup; i++) {
+    memcpy(&hash, table->entry + (size_t) table->entrySize * i, sizeof(hash));
+    for (s = hash & (numSlot - 1); slot[s] != -1; s = (s + 1) & (numSlot - 1))
+      ;
+    slot[s] = i;
+  }
+
+  free(table->slot);
+  table->slot = slot;
+  table->numSlot = numSlot;
+  table->maxGroup *= 2;
+
+  return OK;
+}
+
+/*
+ * findGroup -- キーに対応するグループの領域を探す
+ *
+ * 引数:
+ *  query: グループ化の問い合わせ
+ *  table: グループのハッシュ表
+ *  key: グループのキー
+ *  hash: キーのハッシュ値
+ *
+ * 返り値:
+ *  グループの領域へのポインタを返す。グループがまだなければ登録して返す。
+ *  ハッシュ表がいっぱいで登録できなければNULLを返す。
+ */
+static char *findGroup(GroupQuery *query, GroupTable *table, char *key, unsigned int hash)
+{
+  int s, i;
+  char *entry;
+  unsigned int entryHash;
+
+  /* 線形探査でキーの一致するグループを探す */
+  for (s = hash & (table->numSlot - 1); table->slot[s] != -1; s = (s + 1) & (table->numSlot - 1)) {
+    entry = table->entry + (size_t) table->entrySize * table->slot[s];
+    memcpy(&entryHash, entry, sizeof(entryHash));
+    if (entryHash == hash && memcmp(entry + sizeof(unsigned int), key, query->keySize) == 0) {
+      return entry;
+    }
+  }
+
+  if (table->numGroup >= table->maxGroup) {
+    return NULL;
+  }
+
+  /* 空いている場所に新しいグループを登録する */
+  table->slot[s] = table->numGroup;
+  entry = table->entry + (size_t) table->entrySize * table->numGroup;
+  table->numGroup++;
+
+  memcpy(entry, &hash, sizeof(hash));
+  memcpy(entry + sizeof(unsigned int), key, query->keySize);
+  memcpy(entry + table->aggregatePosition, query->aggregate, sizeof(Aggregate) * query->numAggregate);
+  for (i = 0; i < query->numAggregate; i++) {
+    resetAggregate((Aggregate *) (entry + table->aggregatePosition) + i);
+  }
+
+  return entry;
+}
+
+/*
+ * spillRecord -- レコードを作業用ファイルに書き出す
+ *
+ * 引数:
+ *  partition: 書き出し先
+ *  record: フラグを含むレコードのバイト列
+ *  recordSize: レコードのバイト数
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 書き出すページはデータファイルと同じ形式にしておく。
+ */
+static Result spillRecord(Partition *partition, char *record, int recordSize)
+{
+  if (partition->file == NULL) {
+    if ((partition->file = createTempFile()) == NULL) {
+      return NG;
+    }
+    partition->numPage = 0;
+    partition->numRecord = 0;
+    memset(partition->page, 0, PAGE_SIZE);
+  }
+
+  memcpy(partition->page + partition->numRecord * recordSize, record, recordSize);
+  partition->numRecord++;
+
+  /* ページがいっぱいになったら書き出す */
+  if (partition->numRecord == PAGE_SIZE / recordSize) {
+    if (writePage(partition->file, partition->numPage, partition->page) != OK) {
+      return NG;
+    }
+    partition->numPage++;
+    partition->numRecord = 0;
+    memset(partition->page, 0, PAGE_SIZE);
+  }
+
+  return OK;
+}
+
+/*
+ * emitGroups -- ハッシュ表のグループを結果のレコード集合に加える
+ *
+ * 結果のレコードは、グループ化したフィールド、集約関数の結果の順に並べる。
+ * count, sum, min, max はそのままの型で、avg は文字列にして収める。
+ */
+static Result emitGroups(GroupQuery *query, GroupTable *table, RecordSet *result)
+{
+  RecordData *record;
+  Aggregate *aggregate;
+  FieldData *field;
+  char *entry, *key;
+  int i, k;
+
+  for (i = 0; i < table->numGroup; i++) {
+    entry = table->entry + (size_t) table->entrySize * i;
+    key = entry + sizeof(unsigned int);
+    aggregate = (Aggregate *) (entry + table->aggregatePosition);
+
+    if ((record = (RecordData *) malloc(sizeof(RecordData))) == NULL) {
+      return NG;
+    }
+    record->numField = query->numGroupField + query->numAggregate;
+
+    /* グループ化したフィールドの値 */
+    for (k = 0; k < query->numGroupField; k++) {
+      field = &record->fieldData[k];
+      strcpy(field->name, query->groupField[k].name);
+      field->dataType = query->groupField[k].dataType;
+      if (field->dataType == TYPE_INTEGER) {
+        memcpy(&field->valueSet.intValue, key, sizeof(int));
+        key += sizeof(int);
+      } else {
+        memcpy(field->valueSet.stringValue, key, MAX_STRING);
+        field->valueSet.stringValue[MAX_STRING - 1] = '\0';
+        key += MAX_STRING;
+      }
+    }
+
+    /* 集約関数の結果 */
+    for (k = 0; k < query->numAggregate; k++) {
+      field = &record->fieldData[query->numGroupField + k];
+      getAggregateLabel(&aggregate[k], field->name, MAX_FIELD_NAME);
+      switch (aggregate[k].type) {
+        case AGG_COUNT:
+          field->dataType = TYPE_INTEGER;
+          field->valueSet.intValue = (int) aggregate[k].count;
+          break;
+        case AGG_SUM:
+          field->dataType = TYPE_INTEGER;
+          field->valueSet.intValue = (int) aggregate[k].sum;
+          break;
+        case AGG_MIN:
+          field->dataType = aggregate[k].dataType;
+          field->valueSet = aggregate[k].min;
+          break;
+        case AGG_MAX:
+          field->dataType = aggregate[k].dataType;
+          field->valueSet = aggregate[k].max;
+          break;
+        case AGG_AVG:
+          field->dataType = TYPE_STRING;
+          snprintf(field->valueSet.stringValue, MAX_STRING, "%.3f",
+                   (double) aggregate[k].sum / aggregate[k].count);
+          break;
+      }
+    }
+
+    record->next = result->recordData;
+    result->recordData = record;
+    result->numRecord++;
+  }
+
+  return OK;
+}
+
+/*
+ * hashGroupPages -- ファイルのページを読みながらハッシュ表でグループ化する
+ *
+ * 引数:
+ *  query: グループ化の問い合わせ
+ *  file: 読み込むファイル(データファイルまたは作業用ファイル)
+ *  numPage: fileのページ数
+ *  compiled: レコードの条件(作業用ファイルの場合はNULL)
+ *  snapshot: スナップショット(NULLなら最新の状態を見る)
+ *  level: 分割の深さ(データファイルは0)
+ *  result: 結果を加えるレコード集合
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * グループ数がメモリの上限を超えたら、表に入らなかったグループのレコードを
+ * ハッシュ値で分けて作業用ファイルに書き出し、表の結果を出力した後に
+ * それぞれの作業用ファイルを1つ深い段として同じように処理する。
+ */
+static Result hashGroupPages(GroupQuery *query, File *file, int numPage, CompiledCondition *compiled,
+                             Snapshot *snapshot, int level, RecordSet *result)
+{
+  GroupTable table;
+  Partition *partition = NULL;
+  char page[PAGE_SIZE];
+  char version[PAGE_SIZE];
+  char key[MAX_FIELD * MAX_STRING];
+  char *q, *entry;
+  unsigned int hash;
+  int i, j, k, p, maxGroup;
+  Result ret = NG;
+
+  /* メモリの上限からハッシュ表に入れられるグループ数を決める */
+  maxGroup = getWorkMemory() / (sizeof(unsigned int) + query->keySize + sizeof(long)
+                           + sizeof(Aggregate) * query->numAggregate + sizeof(int) * 2);
+  if (maxGroup < 1) {
+    maxGroup = 1;
+  }
+  if (createGroupTable(query, &table, maxGroup) != OK) {
+    return NG;
+  }
+
+  for (i = 0; i < numPage; i++) {
+    if (readPage(file, i, page) != OK) {
+      goto cleanup;
+    }
+
+    for (j = 0; j < PAGE_SIZE / query->recordSize; j++) {
+      q = findVisibleVersion(file, page + j * query->recordSize, query->recordSize, snapshot, version);
+      if (q == NULL || checkRawCondition(q, compiled) != OK) {
+        continue;
+      }
+
+      makeGroupKey(query, q, key);
+      hash = hashKey(key, query->keySize, level);
+
+      /* これ以上分割できないときは、表を広げて入れる */
+      while ((entry = findGroup(query, &table, key, hash)) == NULL && level >= MAX_PARTITION_LEVEL) {
+        if (growGroupTable(&table) != OK) {
+          goto cleanup;
+        }
+      }
+
+      if (entry == NULL) {
+        /* 表に入らないグループのレコードは、ハッシュ値の上位ビットで分けて書き出す */
+        if (partition == NULL && (partition = calloc(NUM_PARTITION, sizeof(Partition))) == NULL) {
+          goto cleanup;
+        }
+        p = (hash >> 28) % NUM_PARTITION;
+        if (spillRecord(&partition[p], q, query->recordSize) != OK) {
+          goto cleanup;
+        }
+        continue;
+      }
+
+      for (k = 0; k < query->numAggregate; k++) {
+        updateAggregate((Aggregate *) (entry + table.aggregatePosition) + k,
+                        query->aggregateOffset[k] < 0 ? NULL : q + query->aggregateOffset[k]);
+      }
+    }
+  }
+
+  /* 表に入ったグループを出力し、表を解放してから書き出した分を処理する */
+  if (emitGroups(query, &table, result) != OK) {
+    goto cleanup;
+  }
+  freeGroupTable(&table);
+  table.slot = NULL;
+  table.entry = NULL;
+
+  ret = OK;
+  if (partition != NULL) {
+    for (p = 0; p < NUM_PARTITION && ret == OK; p++) {
+      if (partition[p].file == NULL) {
+        continue;
+      }
+      /* 書きかけのページを書き出す */
+      if (partition[p].numRecord > 0) {
+        if (writePage(partition[p].file, partition[p].numPage, partition[p].page) != OK) {
+          ret = NG;
+          break;
+        }
+        partition[p].numPage++;
+      }
+      /* 書き出したレコードは見出しごと写したので、同じスナップショットで見える */
+      ret = hashGroupPages(query, partition[p].file, partition[p].numPage, NULL, snapshot, level + 1, result);
+    }
+  }
+
+cleanup:
+  if (partition != NULL) {
+    for (p = 0; p < NUM_PARTITION; p++) {
+      if (partition[p].file != NULL) {
+        deleteTempFile(partition[p].file);
+      }
+    }
+    free(partition);
+  }
+  freeGroupTable(&table);
+
+  return ret;
+}
+
+/*
+ * groupRecordUnlocked -- groupRecordの本体(テーブルのロックは呼び出し元で取る)
  */
-RecordSet *selectRecord(char *tableName, Condition *condition)
+static RecordSet *groupRecordUnlocked(char *tableName, Condition *condition, GroupBy *groupBy,
+                                      Aggregate *aggregate, int numAggregate,
+                                      Snapshot *snapshot)
 {
-  int i,j,k,l=0,len,recordSize,com;
-  char *filename;
-  File *file;
-  RecordData *p,*list;
-  char page[PAGE_SIZE]={0};
-  RecordSet *recordSet;
+  GroupQuery query;
   TableInfo *tableInfo;
+  CompiledCondition *compiled;
+  RecordSet *recordSet;
+  File *file;
+  char *filename;
+  int i, numPage;
+  Result ret;
 
-  /*レコードセットを用意する*/
-  if ((recordSet = (RecordSet *)malloc(sizeof(RecordSet))) == NULL) {
-      return NULL;
+  if (groupBy->numField < 1 || groupBy->numField + numAggregate > MAX_FIELD) {
+    return NULL;
   }
-  recordSet->recordData=NULL;
-  recordSet->numRecord=0;
 
   /* テーブルの定義情報を取得する */
-    if ((tableInfo = getTableInfo(tableName)) == NULL) {
-      /* テーブル情報の取得に失敗したので、処理をやめて返る */
-      return NULL;
-    }
-
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    return NULL;
+  }
 
-  /* [tableName].defという文字列を作る */
-    len = strlen(tableName) + strlen(DATA_FILE_EXT) + 1;
-    if ((filename = malloc(len)) == NULL) {
+  /* グループ化するフィールドと集約関数の位置を解決しておく */
+  query.recordSize = getRecordSize(tableInfo);
+  query.numGroupField = groupBy->numField;
+  query.keySize = 0;
+  for (i = 0; i < groupBy->numField; i++) {
+    strcpy(query.groupField[i].name, groupBy->name[i]);
+    query.groupOffset[i] = getFieldOffset(tableInfo, groupBy->name[i], &query.groupField[i].dataType);
+    if (query.groupOffset[i] < 0) {
+      freeTableInfo(tableInfo);
       return NULL;
     }
-    snprintf(filename, len, "%s%s", tableName, DATA_FILE_EXT);
+    query.keySize += (query.groupField[i].dataType == TYPE_INTEGER) ? sizeof(int) : MAX_STRING;
+  }
+  query.aggregate = aggregate;
+  query.numAggregate = numAggregate;
+  if (resolveAggregate(tableInfo, aggregate, numAggregate, query.aggregateOffset) != OK) {
+    freeTableInfo(tableInfo);
+    return NULL;
+  }
+  if (compileCondition(tableInfo, condition, &compiled) != OK) {
+    freeTableInfo(tableInfo);
+    return NULL;
+  }
+  freeTableInfo(tableInfo);
 
-    /* データファイルをオープンする */
-    if ((file = openFile(filename)) == NULL) {
-      return NULL;
-    }
+  /* レコードセットを用意する */
+  if ((recordSet = (RecordSet *) malloc(sizeof(RecordSet))) == NULL) {
+    free(compiled);
+    return NULL;
+  }
+  recordSet->recordData = NULL;
+  recordSet->numRecord = 0;
 
+  /* データファイルをオープンする */
+  if ((filename = getDataFileName(tableName)) == NULL) {
+    free(compiled);
+    free(recordSet);
+    return NULL;
+  }
+  numPage = getNumPages(filename);
+  if ((file = openFile(filename)) == NULL) {
+    free(filename);
+    free(compiled);
+    free(recordSet);
+    return NULL;
+  }
+  free(filename);
 
-  /*レコードの大きさを得る*/
-  recordSize = getRecordSize(tableInfo); 
+  ret = hashGroupPages(&query, file, numPage, compiled, snapshot, 0, recordSet);
 
-  /*ページを一つずつ読み込む*/
-  for (i = 0; i < getNumPages(filename); i++){
-    char *q;
-    readPage(file,i,page);
-    
-    /*レコードサイズごとに調べる*/
-    for (j = 0; j < PAGE_SIZE/recordSize; j++){
-      q = page + j * recordSize;
-      
-      /*使用中か調べる*/
-      if (*q==0){
-        continue;
-      }
-        
-      q += 1;
-      RecordData *record;
-        
-      /*データを収める領域を確保する*/
-      if ((record = (RecordData *) malloc(sizeof(RecordData))) == NULL) {
-        /* エラー処理 */
-        return NULL;
-      }
-
-      /*レコードの内容を領域に写す*/
-      record->numField = tableInfo->numField;
-      for (k = 0; k < tableInfo->numField; k++) {
-        strcpy(record->fieldData[k].name,tableInfo->fieldInfo[k].name);
-        switch (tableInfo->fieldInfo[k].dataType) {
-          case TYPE_INTEGER:
-            record->fieldData[k].dataType = TYPE_INTEGER;
-            memcpy(&record->fieldData[k].valueSet, q, sizeof(int));
-            q += sizeof(int);
-            break;
-          case TYPE_STRING:
-            record->fieldData[k].dataType = TYPE_STRING;
-            memcpy(&record->fieldData[k].valueSet, q, MAX_STRING);
-            q += MAX_STRING;
-            break;
-          default:
-            /* ここにくることはないはず */
-            freeTableInfo(tableInfo);
-            free(record);
-            return NULL;
-        }
-      }
-      /*写されたデータが条件に一致したら、レコードの集合に追加する*/
-      if (checkCondition(record,condition)==OK){    
-        if (recordSet->recordData==NULL){
-          recordSet->recordData = record;
-          record->next = NULL;
-        }else{
-          com = 0;
-          if (condition->distinct==DISTINCT){
-            list=recordSet->recordData;
-            while(list!= NULL){
-              if((com=compare(record,list))==1){
-                break;   
-              }
-              list=list->next;
-            }
-          }
-          if (com==0){
-            p = recordSet->recordData;
-            recordSet->recordData = record;
-            record->next = p;      
-          }else{
-            free(record);
-          }
-        }
-        l++;
-        recordSet->numRecord= l ;
-      }else{
-         free(record);
-      }   
-    }    
+  closeFile(file);
+  free(compiled);
+
+  if (ret != OK) {
+    freeRecordSet(recordSet);
+    free(recordSet);
+    return NULL;
   }
 
-  /*ファイルを閉じてレコードの集合を返す*/
-  closeFile(file);
   return recordSet;
-
 }
 
-
 /*
- * checkCondition -- レコードが条件を満足するかどうかのチェック
+ * groupRecord -- 条件を満たすレコードのグループ化と集約
  *
  * 引数:
- *  recordData: チェックするレコード
- *  condition: チェックする条件
+ *  tableName: 集約するテーブルの名前
+ *  condition: 集約するレコードの条件(NULLならすべてのレコード)
+ *  groupBy: グループ化するフィールドの並び
+ *  aggregate: 各グループについて計算する集約関数の配列
+ *  numAggregate: 集約関数の数
  *
  * 返り値:
- *  レコードrecordが条件conditionを満足すればOK、満足しなければNGを返す
+ *  成功したら1グループを1レコードとするレコード集合へのポインタを返し、
+ *  失敗したらNULLを返す。
+ *  各レコードは、グループ化したフィールド、集約関数の結果の順に並ぶ。
+ *
+ * ***注意***
+ *  この関数が返すレコードの集合を収めたメモリ領域は、不要になったら
+ *  必ずfreeRecordSetで解放すること。
+ *
+ * テーブルの共有ロックを取って行う。
  */
-int compare(RecordData *record1,RecordData *record2){
-  int i;
+RecordSet *groupRecord(char *tableName, Condition *condition, GroupBy *groupBy,
+                       Aggregate *aggregate, int numAggregate)
+{
+  RecordSet *recordSet;
+  Snapshot snapshot, *use;
 
-  for (i = 0; i < record1->numField; i++){
-    if (record1->fieldData[i].dataType==TYPE_INTEGER){
-      if (record1->fieldData[i].valueSet.intValue != record2->fieldData[i].valueSet.intValue){
-        return 0;       
-      }     
-    }else if(record1->fieldData[i].dataType==TYPE_STRING){
-      if(strcmp(record1->fieldData[i].valueSet.stringValue,record2->fieldData[i].valueSet.stringValue)!=0){
-        return 0;
-      }
-    }  
+  if (lockTableForRead(tableName, NULL, &snapshot, &use) != OK) {
+    return NULL;
   }
+  recordSet = groupRecordUnlocked(tableName, condition, groupBy, aggregate, numAggregate, use);
+  unlockTableForRead(tableName, use);
 
-  return 1;
+  return recordSet;
 }
 
+/*
+ * SortQuery -- 整列の問い合わせの情報
+ *
+ * 整列する要素は、正規化したキー(keySizeバイト)の後ろに
+ * フラグを含むレコードのバイト列を続けたものとする。
+ */
+typedef struct SortQuery SortQuery;
+struct SortQuery {
+  int recordSize;                       /* 1レコードのバイト数 */
+  int numField;                         /* 整列に使うフィールド数 */
+  int offset[MAX_FIELD];                /* 整列に使うフィールドの位置 */
+  DataType dataType[MAX_FIELD];         /* 整列に使うフィールドのデータ型 */
+  SortOrder order[MAX_FIELD];           /* 整列の向き */
+  int keySize;                          /* 正規化したキーのバイト数 */
+  int entrySize;                        /* 整列する要素のバイト数 */
+};
 
 /*
- * freeRecordSet -- レコード集合の情報を収めたメモリ領域の解放
+ * resolveOrderBy -- order byのフィールドの位置の解決
  *
  * 引数:
- *  recordSet: 解放するメモリ領域
+ *  tableInfo: データ定義情報
+ *  orderBy: order by句の指定
+ *  query: 結果を書き込む領域
  *
  * 返り値:
- *  なし
- *
- * ***注意***
- *  関数selectRecordが返すレコードの集合を収めたメモリ領域は、
- *  不要になったら必ずこの関数で解放すること。
+ *  成功ならOK、存在しないフィールドがあればNGを返す
  */
-void freeRecordSet(RecordSet *recordSet)
+static Result resolveOrderBy(TableInfo *tableInfo, OrderBy *orderBy, SortQuery *query)
 {
+  int i;
 
-
-  //char *p,*r;
-  RecordData *p;
-  //r = recordSet->recordData;
-  /*レコードがある限り読み込む*/
-  while(recordSet->recordData !=NULL){
-    p = recordSet->recordData->next;
-    free(recordSet->recordData);
-    recordSet->recordData = p;
+  if (orderBy->numField < 1 || orderBy->numField > MAX_FIELD) {
+    return NG;
   }
 
-  if (recordSet==NULL){
-    free(recordSet);
+  query->recordSize = getRecordSize(tableInfo);
+  query->numField = orderBy->numField;
+  query->keySize = 0;
+  for (i = 0; i < orderBy->numField; i++) {
+    if ((query->offset[i] = getFieldOffset(tableInfo, orderBy->name[i], &query->dataType[i])) < 0) {
+      return NG;
+    }
+    query->order[i] = orderBy->order[i];
+    query->keySize += (query->dataType[i] == TYPE_INTEGER) ? sizeof(int) : MAX_STRING;
   }
+  query->entrySize = query->keySize + query->recordSize;
 
+  return OK;
 }
 
 /*
- * deleteRecord -- レコードの削除
- *
- * 引数:
- *  tableName: レコードを削除するテーブルの名前
- *  condition: 削除するレコードの条件
+ * makeSortKey -- レコードから、バイト列の比較で順序の決まるキーを作る
  *
- * 返り値:
- *  削除に成功したらOK、失敗したらNGを返す
+ * 整数は符号ビットを反転してビッグエンディアンで並べ、文字列は終端文字より
+ * 後ろを0で埋める。降順のフィールドは、そのフィールドのバイトをすべて反転する。
  */
-Result deleteRecord(char *tableName, Condition *condition)
+static void makeSortKey(SortQuery *query, char *record, char *key)
 {
-  int i,j,k,flag,len,recordSize;
-  char *filename;
-  File *file;
-  char *p;
-  char page[PAGE_SIZE]={0};
-  //char *record;
-  TableInfo *tableInfo;
-  RecordData *record;
+  unsigned int u;
+  int i, j, size, value;
 
-  /* テーブルの定義情報を取得する */
-    if ((tableInfo = getTableInfo(tableName)) == NULL) {
-      /* テーブル情報の取得に失敗したので、処理をやめて返る */
-      return NG;
+  for (i = 0; i < query->numField; i++) {
+    if (query->dataType[i] == TYPE_INTEGER) {
+      memcpy(&value, record + query->offset[i], sizeof(int));
+      u = (unsigned int) value ^ 0x80000000u;
+      key[0] = (char) (u >> 24);
+      key[1] = (char) (u >> 16);
+      key[2] = (char) (u >> 8);
+      key[3] = (char) u;
+      size = sizeof(int);
+    } else {
+      strncpy(key, record + query->offset[i], MAX_STRING);
+      size = MAX_STRING;
     }
 
-  /* [tableName].defという文字列を作る */
-    len = strlen(tableName) + strlen(DATA_FILE_EXT) + 1;
-    if ((filename = malloc(len)) == NULL) {
-      return NG;
+    if (query->order[i] == ORDER_DESC) {
+      for (j = 0; j < size; j++) {
+        key[j] = ~key[j];
+      }
     }
-    snprintf(filename, len, "%s%s", tableName, DATA_FILE_EXT);
+    key += size;
+  }
+}
 
-    /* データファイルをオープンする */
-    if ((file = openFile(filename)) == NULL) {
-      return NG;
+/*
+ * normalizeRecord -- レコードの文字列の終端文字より後ろを0で埋める
+ *
+ * 同じ内容のレコードが同じバイト列になるようにする。
+ */
+static void normalizeRecord(TableInfo *tableInfo, char *record)
+{
+  char value[MAX_STRING];
+  int i;
+
+  /* 版ごとに異なるトランザクションのIDも0にする */
+  memset(record + 1, 0, RECORD_HEADER_SIZE - 1);
+  record += RECORD_HEADER_SIZE;
+  for (i = 0; i < tableInfo->numField; i++) {
+    if (tableInfo->fieldInfo[i].dataType == TYPE_INTEGER) {
+      record += sizeof(int);
+    } else if (tableInfo->fieldInfo[i].dataType == TYPE_STRING) {
+      strncpy(value, record, MAX_STRING);
+      memcpy(record, value, MAX_STRING);
+      record += MAX_STRING;
     }
+  }
+}
 
-  /*レコードの大きさを得る*/
-  recordSize = getRecordSize(tableInfo); 
-        
-    /*データを収める領域を確保する*/
-  if ((record = (RecordData *) malloc(sizeof(RecordData))) == NULL) {
-    /* エラー処理 */
+/*
+ * sortRecordUnlocked -- sortRecordの本体(テーブルのロックは呼び出し元で取る)
+ */
+static Result sortRecordUnlocked(char *tableName, Condition *condition, OrderBy *orderBy,
+                                 RecordHandler handler, void *arg,
+                                 Snapshot *snapshot)
+{
+  SortQuery query;
+  TableInfo *tableInfo;
+  RecordScan scan;
+  Sorter *sorter;
+  RecordData recordData;
+  char *entry, *prev = NULL, *q;
+  int i, distinct;
+  long numOutput = 0;
+  Result ret = NG;
+
+  /* 上限が0なら、レコードを読むまでもない */
+  if (orderBy->limit == 0) {
+    return OK;
+  }
+
+  /* テーブルの定義情報を取得する */
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
     return NG;
   }
 
-  /*ページを一つずつ読み込む*/
-  for (i = 0; i < getNumPages(filename); i++){
-    char *q;
-    readPage(file,i,page);
-    
-    /*レコードサイズごとに調べる*/
-    for (j = 0; j < PAGE_SIZE/recordSize; j++){
-      q = page + j * recordSize;
-      
-      /*使用中か調べる*/
-      if (*q==1){
-        p = q;
-        q += 1;
-        /*レコードの内容を領域に写す*/
-        record->numField = tableInfo->numField;
-        for (k = 0; k < tableInfo->numField; k++) {
-          strcpy(record->fieldData[k].name,tableInfo->fieldInfo[k].name);
-          switch (tableInfo->fieldInfo[k].dataType) {
-            case TYPE_INTEGER:
-              record->fieldData[k].dataType = TYPE_INTEGER;
-              memcpy(&record->fieldData[k].valueSet, q, sizeof(int));
-              q += sizeof(int);
-              break;
-            case TYPE_STRING:
-              record->fieldData[k].dataType =TYPE_STRING;
-              memcpy(&record->fieldData[k].valueSet, q, MAX_STRING);
-              q += MAX_STRING;
-              break;
-            default:
-              /* ここにくることはないはず */
-              freeTableInfo(tableInfo);
-              free(record);
-              return NG;
-          }
-        }
+  if (resolveOrderBy(tableInfo, orderBy, &query) != OK) {
+    freeTableInfo(tableInfo);
+    return NG;
+  }
 
-        /*写されたデータが条件に一致したら、フラグを0にする*/
-        if (checkCondition(record,condition)==OK){
-          *p = 0;
-          flag = 1;
-        }
-      } 
-    }
+  /*
+   * 重複除去の場合はレコード全体もキーに含めて整列し、
+   * 同じレコードが隣り合うようにする
+   */
+  distinct = (condition != NULL && condition->distinct == DISTINCT);
+  sorter = createSorter(query.entrySize, distinct ? query.entrySize : query.keySize, getWorkMemory());
+  if (sorter == NULL || (distinct && (prev = malloc(query.recordSize)) == NULL)) {
+    freeSorter(sorter);
+    freeTableInfo(tableInfo);
+    return NG;
+  }
 
-    /* ファイルに書き戻す */
-    if (flag==1){
-      if (writePage(file, i, page) != OK) {
-        return NG;
-      }  
+  /*
+   * 上限があれば、整列しながら上位の要素だけを残す。
+   * 重複除去の場合は、重複を除いた後で数える必要があるので行わない。
+   */
+  if (orderBy->limit != NO_LIMIT && !distinct
+      && setSortLimit(sorter, orderBy->limit) != OK) {
+    goto cleanup;
+  }
+  if ((entry = malloc(query.entrySize)) == NULL) {
+    goto cleanup;
+  }
+
+  /* 条件を満たすレコードを1つずつ取り出して追加していく */
+  if (openRecordScan(&scan, tableName, tableInfo, condition, NULL, NULL, snapshot) != OK) {
+    free(entry);
+    goto cleanup;
+  }
+  while ((ret = getNextRecord(&scan, &q)) == OK && q != NULL) {
+    makeSortKey(&query, q, entry);
+    memcpy(entry + query.keySize, q, query.recordSize);
+    normalizeRecord(tableInfo, entry + query.keySize);
+    if ((ret = addSortEntry(sorter, entry)) != OK) {
+      break;
     }
   }
+  closeRecordScan(&scan);
+  free(entry);
+  if (ret != OK || sortEntries(sorter) != OK) {
+    ret = NG;
+    goto cleanup;
+  }
 
-  free(record);
-  /*ファイルを閉じる*/
-  closeFile(file);
-  return OK;
+  /* 整列した順にレコードを渡す */
+  ret = OK;
+  for (i = 0; ; i++) {
+    if (getNextSortEntry(sorter, &entry) != OK) {
+      ret = NG;
+      break;
+    }
+    if (entry == NULL) {
+      break;
+    }
+
+    /* 重複除去の場合は、直前と同じレコードを読み飛ばす */
+    if (distinct) {
+      if (i > 0 && memcmp(prev, entry + query.keySize, query.recordSize) == 0) {
+        continue;
+      }
+      memcpy(prev, entry + query.keySize, query.recordSize);
+    }
+
+    decodeRecord(tableInfo, entry + query.keySize, &recordData);
+    if (handler(&recordData, arg) != OK) {
+      break;
+    }
+    if (++numOutput == orderBy->limit) {
+      break;
+    }
+  }
 
+cleanup:
+  freeSorter(sorter);
+  free(prev);
+  freeTableInfo(tableInfo);
+  return ret;
 }
 
 /*
- * createDataFile -- データファイルの作成
+ * sortRecord -- 条件を満たすレコードを整列して1つずつ渡す
  *
  * 引数:
- *  tableName: 作成するテーブルの名前
+ *  tableName: 検索するテーブルの名前
+ *  condition: 検索するレコードの条件(NULLならすべてのレコード)
+ *  orderBy: 整列の指定
+ *  handler: 整列したレコードを順に受け取る関数
+ *  arg: handlerに渡す引数
  *
  * 返り値:
- *  作成に成功したらOK、失敗したらNGを返す
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 条件を満たすレコードがメモリの上限(workMemory)に収まればメモリ上で整列し、
+ * 収まらなければ作業用ファイルを使った外部マージソートで整列する。
+ * どちらの場合も、使うメモリはworkMemory程度に抑えられる。
+ * orderBy->limitで上限を指定し、その数のレコードがメモリに収まるときは、
+ * 1回の走査の間に上位のレコードだけをヒープに保持し、全体は整列しない。
+ * handlerに渡したRecordDataは、handlerから戻ると無効になる。
+ *
+ * テーブルの共有ロックを取って行う。
  */
-Result createDataFile(char *tableName)
+Result sortRecord(char *tableName, Condition *condition, OrderBy *orderBy,
+                  RecordHandler handler, void *arg)
 {
-  int len;
-  char *filename;
+  Result ret;
+  Snapshot snapshot, *use;
 
-  /* [tableName].dafという文字列を作る */
-  len = strlen(tableName) + strlen(DATA_FILE_EXT) + 1;
-  if ((filename = malloc(len)) == NULL) {
-      return NG;
+  if (lockTableForRead(tableName, condition, &snapshot, &use) != OK) {
+    return NG;
   }
-  snprintf(filename, len, "%s%s", tableName, DATA_FILE_EXT);
+  ret = sortRecordUnlocked(tableName, condition, orderBy, handler, arg, use);
+  unlockTableForRead(tableName, use);
+
+  return ret;
+}
 
+/*
+ * RecordSetBuilder -- レコード集合を順に組み立てるための情報
+ */
+typedef struct RecordSetBuilder RecordSetBuilder;
+struct RecordSetBuilder {
+  RecordSet *recordSet;         /* 組み立て中のレコード集合 */
+  RecordData *tail;             /* リストの最後のレコード */
+};
 
-  if (createFile(filename) != OK) {
+/*
+ * appendRecord -- レコード集合の最後にレコードの複製を加える(RecordHandler)
+ */
+static Result appendRecord(RecordData *recordData, void *arg)
+{
+  RecordSetBuilder *builder = arg;
+  RecordData *record;
+
+  if ((record = (RecordData *) malloc(sizeof(RecordData))) == NULL) {
     return NG;
   }
+  *record = *recordData;
+  record->next = NULL;
 
-  return OK;
+  if (builder->tail == NULL) {
+    builder->recordSet->recordData = record;
+  } else {
+    builder->tail->next = record;
+  }
+  builder->tail = record;
+  builder->recordSet->numRecord++;
 
+  return OK;
 }
 
 /*
- * deleteDataFile -- データファイルの削除
+ * selectSortedRecord -- レコードの検索と整列
  *
  * 引数:
- *  tableName: 削除するテーブルの名前
+ *  tableName: レコードを検索するテーブルの名前
+ *  condition: 検索するレコードの条件(NULLならすべてのレコード)
+ *  orderBy: 整列の指定
  *
  * 返り値:
- *  削除に成功したらOK、失敗したらNGを返す
+ *  検索に成功したら、整列した順に並べたレコードの集合へのポインタを返し、
+ *  失敗したらNULLを返す。
+ *
+ * ***注意***
+ *  この関数が返すレコードの集合を収めたメモリ領域は、不要になったら
+ *  必ずfreeRecordSetで解放すること。
+ *  結果をすべてメモリ上に持つので、大きな結果はsortRecordで順に受け取ること。
  */
-Result deleteDataFile(char *tableName)
+RecordSet *selectSortedRecord(char *tableName, Condition *condition, OrderBy *orderBy)
 {
-  int len;
-  char *filename;
+  RecordSetBuilder builder;
 
-  /* [tableName].dafという文字列を作る */
-  len = strlen(tableName) + strlen(DATA_FILE_EXT) + 1;
-  if ((filename = malloc(len)) == NULL) {
-      return NG;
+  if ((builder.recordSet = (RecordSet *) malloc(sizeof(RecordSet))) == NULL) {
+    return NULL;
   }
-  snprintf(filename, len, "%s%s", tableName, DATA_FILE_EXT);
-
+  builder.recordSet->numRecord = 0;
+  builder.recordSet->recordData = NULL;
+  builder.tail = NULL;
 
-  if (deleteFile(filename) != OK) {
-    return NG;
+  if (sortRecord(tableName, condition, orderBy, appendRecord, &builder) != OK) {
+    freeRecordSet(builder.recordSet);
+    free(builder.recordSet);
+    return NULL;
   }
 
-  return OK;
-
+  return builder.recordSet;
 }
 
 /*
- * printTableData -- すべてのデータの表示(テスト用)
- *
- * 引数:
- *  tableName: データを表示するテーブルの名前
+ * printTableDataUnlocked -- printTableDataの本体(テーブルのロックは呼び出し元で取る)
  */
-void printTableData(char *tableName)
+static void printTableDataUnlocked(FILE *output, char *tableName, Snapshot *snapshot)
 {
     TableInfo *tableInfo;
     File *file;
@@ -756,6 +5383,7 @@ void printTableData(char *tableName)
     int numPage;
     char *filename;
     char page[PAGE_SIZE];
+    char version[PAGE_SIZE];
 
     /* テーブルのデータ定義情報を取得する */
     if ((tableInfo = getTableInfo(tableName)) == NULL) {
@@ -788,17 +5416,17 @@ void printTableData(char *tableName)
     free(filename);
 
     for (i = 0; i < tableInfo->numField; i++){
-      printf("+---------------");      
+      fprintf(output, "+---------------");      
     }
-    printf("+\n");
+    fprintf(output, "+\n");
     for (i = 0; i < tableInfo->numField; i++){
-      printf("|%-15s", tableInfo->fieldInfo[i].name);      
+      fprintf(output, "|%-15s", tableInfo->fieldInfo[i].name);      
     }
-    printf("|\n");
+    fprintf(output, "|\n");
     for (i = 0; i < tableInfo->numField; i++){
-      printf("+---------------");      
+      fprintf(output, "+---------------");      
     }
-    printf("+\n");
+    fprintf(output, "+\n");
 
     /* レコードを1つずつ取りだし、表示する */
     for (i = 0; i < numPage; i++) {
@@ -807,14 +5435,14 @@ void printTableData(char *tableName)
 
         /* pageの先頭からrecord_sizeバイトずつ切り取って処理する */
         for (j = 0; j < (PAGE_SIZE / recordSize); j++) {
-            /* 先頭の「使用中」のフラグが0だったら読み飛ばす */
-      char *p = &page[recordSize * j];
-      if (*p == 0) {
+            /* 見えないレコード(未使用や削除済み)は読み飛ばす */
+      char *p = findVisibleVersion(file, &page[recordSize * j], recordSize, snapshot, version);
+      if (p == NULL) {
     continue;
       }
 
-      /* フラグの分だけポインタを進める */
-      p++;
+      /* 見出しの分だけポインタを進める */
+      p += RECORD_HEADER_SIZE;
 
             /* 1レコード分のデータを出力する */
     for (k = 0; k < tableInfo->numField; k++) {
@@ -827,59 +5455,81 @@ void printTableData(char *tableName)
       case TYPE_INTEGER:
         memcpy(&intValue, p, sizeof(int));
         p += sizeof(int);
-        printf("|%15d", intValue);
+        fprintf(output, "|%15d", intValue);
         break;
       case TYPE_STRING:
         memcpy(stringValue, p, MAX_STRING);
         p += MAX_STRING;
-        printf("|%-15s", stringValue);
+        fprintf(output, "|%-15s", stringValue);
         break;
       default:
         /* ここに来ることはないはず */
         return;
       }
     }
-    printf("|\n");
+    fprintf(output, "|\n");
   }
   }
   for (i = 0; i < tableInfo->numField; i++){
-      printf("+---------------");      
+      fprintf(output, "+---------------");      
   }
-  printf("+\n");
+  fprintf(output, "+\n");
 
+  closeFile(file);
   freeTableInfo(tableInfo);
 }
 
+/*
+ * printTableData -- すべてのデータの表示(テスト用)
+ *
+ * 引数:
+ *  output: 出力先のストリーム
+ *  tableName: データを表示するテーブルの名前
+ *
+ * テーブルの共有ロックを取って行う。
+ */
+void printTableData(FILE *output, char *tableName)
+{
+  Snapshot snapshot, *use;
+
+  if (lockTableForRead(tableName, NULL, &snapshot, &use) != OK) {
+    return;
+  }
+  printTableDataUnlocked(output, tableName, use);
+  unlockTableForRead(tableName, use);
+}
+
 /*
  * printRecordSet -- レコード集合の表示
  *
  * 引数:
+ *  output: 出力先のストリーム
  *  recordSet: 表示するレコード集合
  */
-void printRecordSet(RecordSet *recordSet)
+void printRecordSet(FILE *output, RecordSet *recordSet)
 {
     RecordData *record;
     int i, j, k;
 
     /* レコード数の表示 */
-    printf("Number of Records: %d\n", recordSet->numRecord);
+    fprintf(output, "Number of Records: %d\n", recordSet->numRecord);
 
     if (recordSet->recordData==NULL){
       return;
     }
 
     for (i = 0; i < recordSet->recordData->numField; i++){
-      printf("+---------------");      
+      fprintf(output, "+---------------");      
     }
-    printf("+\n");
+    fprintf(output, "+\n");
     for (i = 0; i < recordSet->recordData->numField; i++){
-      printf("|%-15s", recordSet->recordData->fieldData[i].name);      
+      fprintf(output, "|%-15s", recordSet->recordData->fieldData[i].name);      
     }
-    printf("|\n");
+    fprintf(output, "|\n");
     for (i = 0; i < recordSet->recordData->numField; i++){
-      printf("+---------------");      
+      fprintf(output, "+---------------");      
     }
-    printf("+\n");
+    fprintf(output, "+\n");
 
     /* レコードを1つずつ取りだし、表示する */
     for (record = recordSet->recordData; record != NULL; record = record->next) {
@@ -887,10 +5537,10 @@ void printRecordSet(RecordSet *recordSet)
       for (i = 0; i < record->numField; i++) {
         switch (record->fieldData[i].dataType) {
         case TYPE_INTEGER:
-          printf("|%15d", record->fieldData[i].valueSet.intValue);
+          fprintf(output, "|%15d", record->fieldData[i].valueSet.intValue);
           break;
         case TYPE_STRING:
-          printf("|%-15s", record->fieldData[i].valueSet.stringValue);
+          fprintf(output, "|%-15s", record->fieldData[i].valueSet.stringValue);
           break;
         default:
           /* ここに来ることはないはず */
@@ -898,10 +5548,10 @@ void printRecordSet(RecordSet *recordSet)
         }
       }
 
-      printf("|\n");
+      fprintf(output, "|\n");
     }
     for (i = 0; i < recordSet->recordData->numField; i++){
-      printf("+---------------");      
+      fprintf(output, "+---------------");      
     }
-    printf("+\n");
+    fprintf(output, "+\n");
 }
@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "microdb.h"
 
 File *file;
@@ -27,6 +28,7 @@ typedef enum ErrorMessageNo {
   ERR_MSG_LSEEK = 6,
   ERR_MSG_ACCESS = 7,
   ERR_MSG_STAT = 8,
+  ERR_MSG_CONTAINER = 9,
 } ErrorMessageNo;
 
 /* エラーメッセージ */
@@ -40,12 +42,16 @@ char *errorMessage[] = {
   "ファイルのアクセス位置を変更に失敗しました。",     /* ERR_MSG_LSEEK */
   "ファイルの存在のチェックに失敗しました。",         /* ERR_MSG_ACCESS */
   "ファイルの大きさのチェックに失敗しました。",       /* ERR_MSG_STAT */
+  "データベースファイルの形式が正しくありません。",   /* ERR_MSG_CONTAINER */
 };
 
 /*
  * NUM_BUFFER -- ファイルアクセスモジュールが管理するバッファの大きさ(ページ数)
+ *
+ * 更新したページは、そのログがディスクに届くまで追い出せない。バッファが少ないと、
+ * ログの1回のfsyncで届けられる更新もその分しかないので、ある程度多く用意する。
  */
-#define NUM_BUFFER 4
+#define NUM_BUFFER 64
 #define UNDEFINED -1
 
 /*
@@ -65,8 +71,115 @@ struct Buffer {
   struct Buffer *prev;        /* 一つ前のバッファへのポインタ */
   struct Buffer *next;        /* 一つ後ろのバッファへのポインタ */
   modifyFlag modified;        /* ページの内容が更新されたかどうかを示すフラグ */
+  LogSequenceNumber lsn;      /* 最後の更新を記録したログの終わりの位置 */
+                              /* ファイルに書き戻す前に、ここまでflushLogする */
+};
+
+/*
+ * TEMP_FILE_PREFIX -- 作業用ファイルの名前の先頭に付ける文字列
+ */
+#define TEMP_FILE_PREFIX "microdb-tmp"
+
+/*
+ * tempFileCount -- これまでに作成した作業用ファイルの数(名前の重複を避けるため)
+ */
+static int tempFileCount = 0;
+
+/*
+ * isTempFile -- 作業用ファイルかどうか(作業用ファイルの変更はログに記録しない)
+ */
+static int isTempFile(char *filename)
+{
+  return strncmp(filename, TEMP_FILE_PREFIX, strlen(TEMP_FILE_PREFIX)) == 0;
+}
+
+/*
+ * 単一ファイル形式(コンテナ)
+ *
+ * openContainerでデータベースファイルを指定すると、作業用ファイル以外の
+ * すべてのファイル(.def, .dat, 索引)を、その1つのファイルの中に格納する。
+ * ファイル名はディレクトリで管理し、ファイルの各ページがデータベースファイルの
+ * どのページにあるかは、ファイルごとのページ対応表で管理する。
+ *
+ * データベースファイルの構造:
+ *   ページ0: 見出し(DIR_ENTRY_SIZEバイト)とディレクトリの要素DIR_PER_PAGE個
+ *   ディレクトリの続きのページ: ページ0と同じ形(見出しはnextDirPageだけ使う)
+ *   ページ対応表のページ: 次のページの番号と、MAP_PER_PAGE個のページ番号
+ * 空きページの一覧も、ページ対応表と同じ形で格納する。
+ */
+#define CONTAINER_MAGIC "MICRODB1"
+#define CONTAINER_MAGIC_SIZE 8
+#define DIR_ENTRY_SIZE 64
+#define DIR_NAME_SIZE 52
+#define DIR_PER_PAGE (PAGE_SIZE / DIR_ENTRY_SIZE - 1)
+#define MAP_PER_PAGE ((int) (PAGE_SIZE / sizeof(int)) - 1)
+
+/*
+ * ContainerHeader -- ディレクトリのページの見出し
+ */
+typedef struct ContainerHeader ContainerHeader;
+struct ContainerHeader {
+  char magic[CONTAINER_MAGIC_SIZE];   /* CONTAINER_MAGIC */
+  int numPage;                        /* データベースファイル全体のページ数 */
+  int freeMapPage;                    /* 空きページの一覧の最初のページ(なければ-1) */
+  int numFree;                        /* 空きページの数 */
+  int nextDirPage;                    /* ディレクトリの次のページ(なければ-1) */
+};
+
+/*
+ * DirEntry -- ディレクトリの要素(1ファイル分)
+ */
+typedef struct DirEntry DirEntry;
+struct DirEntry {
+  char name[DIR_NAME_SIZE];   /* ファイル名(空文字列なら未使用) */
+  int mapPage;                /* ページ対応表の最初のページ(なければ-1) */
+  int numPage;                /* ファイルのページ数 */
+  int reserved;
+};
+
+/*
+ * PageMap -- ページ対応表(または空きページの一覧)をメモリ上に展開したもの
+ */
+typedef struct PageMap PageMap;
+struct PageMap {
+  int *page;          /* 各ページのデータベースファイル内での位置 */
+  int numPage;        /* ページ数 */
+  int capacity;       /* pageの大きさ */
+  int *mapPage;       /* 対応表自身を格納しているページ */
+  int numMapPage;     /* mapPageの要素数 */
+};
+
+/*
+ * ContainerFile -- データベースファイルの中のファイルをオープンしたときの情報
+ */
+struct ContainerFile {
+  int entry;          /* ディレクトリの要素の番号 */
+  PageMap map;        /* ページ対応表 */
+  int modified;       /* ページ対応表を変更したかどうか */
 };
 
+static int containerDesc = -1;          /* データベースファイルのディスクリプタ(使わないなら-1) */
+static ContainerHeader containerHeader; /* ページ0の見出し */
+static DirEntry *directory = NULL;      /* ディレクトリ(numDirPage * DIR_PER_PAGE個) */
+static int *dirPage = NULL;             /* ディレクトリを格納しているページ */
+static int numDirPage = 0;
+static PageMap freeList;                /* 空きページの一覧 */
+
+static Result readPagesAt(int desc, int pageNum, char *pages, int numPage);
+static Result writePagesAt(int desc, int pageNum, char *pages, int numPage);
+static Result readFilePage(File *file, int pageNum, char *page);
+static Result writeFilePage(File *file, int pageNum, char *page);
+static Result addSyncName(File *file);
+static Result writeBackBuffer(Buffer *buf);
+static Buffer *chooseVictim();
+static Result lockFileMutex(File *file, int pageNum);
+static int getPhysicalPage(File *file, int pageNum, int allocate);
+static int findEntry(char *filename);
+static Result syncContainer();
+static Result createContainerFile(char *filename);
+static Result deleteContainerFile(char *filename);
+static File *openContainerFile(char *filename);
+static Result closeContainerFile(File *file);
 static Result initializeBufferList();
 static Result finalizeBufferList();
 static void moveBufferToListHead(Buffer *buf);
@@ -82,6 +195,49 @@ static Buffer *bufferListHead = NULL;
  */
 static Buffer *bufferListTail = NULL;
 
+/*
+ * fileMutex -- バッファのリストと単一ファイル形式の管理情報を守る
+ *
+ * 公開している関数は、これを取ってから処理を行うので、複数のスレッドから呼び出してよい。
+ * ただし、あるページを読んで書き戻すまでの間に、ほかのスレッドから同じページを
+ * 書き換えないこと(テーブルのロックかページのラッチで防ぐ)。
+ */
+static pthread_mutex_t fileMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * numDiskWrite -- ファイルに書き込んだ回数(fileMutexで守る)
+ *
+ * readPagesSharedが、fileMutexを取らずに読んでいる間に書き込みがあったかを知るために使う。
+ */
+static unsigned long numDiskWrite = 0;
+
+/*
+ * numPendingWrite -- ログに記録して、まだファイルに書いていないwritePagesの数(fileMutexで守る)
+ *
+ * writePagesはログを届ける間fileMutexを離すので、その間にチェックポイントが
+ * ログを空にしないよう、0になるまで待たせる。
+ */
+static int numPendingWrite = 0;
+static pthread_cond_t pendingWriteDone = PTHREAD_COND_INITIALIZER;
+
+/*
+ * openFiles -- オープンしているファイルの並び
+ *
+ * 同じファイルを何度オープンしても、File構造体(とバッファ)は1つを共有する。
+ * 別々のスレッドが同じファイルの別のページを書き換えても、ほかのスレッドの
+ * 書き換えがバッファから見えるようにするためである。
+ */
+static File *openFiles = NULL;
+
+/*
+ * syncNames -- 前回のチェックポイントから書き込んだファイルの名前(fileMutexで守る)
+ *
+ * チェックポイントで、これらのファイルをfsyncする(単一ファイル形式では使わない)。
+ */
+static char (*syncNames)[MAX_FILENAME] = NULL;
+static int numSyncName = 0;
+static int maxSyncName = 0;
+
 /*
  * printErrorMessage -- エラーメッセージの表示
  *
@@ -123,6 +279,34 @@ Result initializeFileModule()
 Result finalizeFileModule()
 {
   finalizeBufferList();
+  free(syncNames);
+  syncNames = NULL;
+  numSyncName = 0;
+  maxSyncName = 0;
+  return closeContainer();
+}
+
+/*
+ * createFileUnlocked -- createFileの本体(fileMutexは呼び出し元で取る)
+ */
+static Result createFileUnlocked(char *filename)
+{
+  int desc;
+
+  if (logFileCreate(filename) != OK) {
+    printErrorMessage(ERR_MSG_CREATE);
+    return NG;
+  }
+
+  if (containerDesc != -1) {
+    return createContainerFile(filename);
+  }
+
+  if ((desc = creat(filename,S_IRUSR|S_IWUSR))==-1){
+    printErrorMessage(ERR_MSG_CREATE);
+    return NG;
+  }
+  close(desc);
   return OK;
 }
 
@@ -137,10 +321,37 @@ Result finalizeFileModule()
  */
 Result createFile(char *filename)
 {
-  if (creat(filename,S_IRUSR|S_IWUSR)==-1){
-    printErrorMessage(ERR_MSG_CREATE);
+  Result ret;
+
+  pthread_mutex_lock(&fileMutex);
+  ret = createFileUnlocked(filename);
+  pthread_mutex_unlock(&fileMutex);
+
+  return ret;
+}
+
+/*
+ * deleteFileUnlocked -- deleteFileの本体(fileMutexは呼び出し元で取る)
+ */
+static Result deleteFileUnlocked(char *filename)
+{
+  if (logFileDelete(filename) != OK) {
+    printErrorMessage(ERR_MSG_UNLINK);
     return NG;
   }
+
+  if (containerDesc != -1) {
+    return deleteContainerFile(filename);
+  }
+
+  if (access(filename, F_OK) == 0) {
+    /* ファイルを削除 */
+    if (unlink(filename) == -1) {
+      printErrorMessage(ERR_MSG_UNLINK);
+      return NG;
+    }
+  }
+
   return OK;
 }
 
@@ -155,31 +366,72 @@ Result createFile(char *filename)
  */
 Result deleteFile(char *filename)
 {
-  if (access(filename, F_OK) == 0) {
-    /* ファイルを削除 */
-    if (unlink(filename) == -1) {
-      printErrorMessage(ERR_MSG_UNLINK);
-      return NG;
-    }
+  Result ret;
+
+  pthread_mutex_lock(&fileMutex);
+  ret = deleteFileUnlocked(filename);
+  pthread_mutex_unlock(&fileMutex);
+
+  return ret;
+}
+
+/*
+ * existFileUnlocked -- existFileの本体(fileMutexは呼び出し元で取る)
+ */
+static int existFileUnlocked(char *filename)
+{
+  if (containerDesc != -1) {
+    return findEntry(filename) >= 0;
   }
 
-  return OK;
+  return access(filename, F_OK) == 0;
 }
 
 /*
- * openFile -- ファイルのオープン
+ * existFile -- ファイルの存在のチェック
  *
  * 引数:
- *  filename: オープンするファイルのファイル名
+ *  filename: 調べるファイルのファイル名
  *
  * 返り値:
- *  オープンしたファイルのFile構造体
- *  オープンに失敗した場合にはNULLを返す
+ *  ファイルがあれば1、なければ0
  */
-File *openFile(char *filename)
+int existFile(char *filename)
+{
+  int ret;
+
+  pthread_mutex_lock(&fileMutex);
+  ret = existFileUnlocked(filename);
+  pthread_mutex_unlock(&fileMutex);
+
+  return ret;
+}
+
+/*
+ * openFileUnlocked -- openFileの本体(fileMutexは呼び出し元で取る)
+ */
+static File *openFileUnlocked(char *filename)
 {
   File *file;
 
+  /* すでにオープンしていれば、それを共有する */
+  for (file = openFiles; file != NULL; file = file->next) {
+    if (strcmp(file->name, filename) == 0) {
+      file->refCount++;
+      return file;
+    }
+  }
+
+  if (containerDesc != -1) {
+    if ((file = openContainerFile(filename)) == NULL) {
+      return NULL;
+    }
+    file->refCount = 1;
+    file->next = openFiles;
+    openFiles = file;
+    return file;
+  }
+
   /* File構造体の用意 */
   file = malloc(sizeof(File));
   if (file == NULL) {
@@ -187,12 +439,14 @@ File *openFile(char *filename)
     printErrorMessage(ERR_MSG_OPEN);
     return NULL;
   }
+  file->container = NULL;
 
   /*
   *ファイルのオープン
   */
   if ((file->desc = open(filename,O_RDWR))==-1){
     printErrorMessage(ERR_MSG_OPEN);
+    free(file);
     return NULL;
   }
 
@@ -201,33 +455,57 @@ File *openFile(char *filename)
   */
   strcpy(file->name,filename);
 
+  file->refCount = 1;
+  file->next = openFiles;
+  openFiles = file;
+
   return file;
 }
 
 /*
- * closeFile -- ファイルのクローズ
+ * openFile -- ファイルのオープン
  *
  * 引数:
- *  クローズするファイルのFile構造体
+ *  filename: オープンするファイルのファイル名
  *
  * 返り値:
- *  成功の場合OK、失敗の場合NG
+ *  オープンしたファイルのFile構造体
+ *  オープンに失敗した場合にはNULLを返す
+ *
+ * すでにオープンしているファイルなら、同じFile構造体を返す。
+ * オープンした回数だけcloseFileを呼ぶこと。
  */
-Result closeFile(File *file)
+File *openFile(char *filename)
+{
+  File *file;
+
+  pthread_mutex_lock(&fileMutex);
+  file = openFileUnlocked(filename);
+  pthread_mutex_unlock(&fileMutex);
+
+  return file;
+}
+
+/*
+ * closeFileUnlocked -- closeFileの本体(fileMutexは呼び出し元で取る)
+ */
+static Result closeFileUnlocked(File *file)
 {
   int i;
   Buffer *buf=bufferListHead;
+  File **p;
+
+  /* ほかに使っているところがあれば、まだクローズしない */
+  if (--file->refCount > 0) {
+    return OK;
+  }
+  for (p = &openFiles; *p != file; p = &(*p)->next) {
+  }
+  *p = file->next;
 
   for (i = 0; i < NUM_BUFFER; i++){
     if (file==buf->file){
-      if (lseek(file->desc,PAGE_SIZE*buf->pageNum,SEEK_SET)==-1){
-        printErrorMessage(ERR_MSG_LSEEK);
-        return NG;
-      }
-      /* writeシステムコールによるファイルへのアクセス */
-      if (write(file->desc, buf->page, PAGE_SIZE) < PAGE_SIZE) {
-        /* エラー処理 */
-        printErrorMessage(ERR_MSG_WRITE);
+      if (writeBackBuffer(buf) != OK) {
         return NG;
       }
       buf->modified=UNMODIFIED; 
@@ -236,6 +514,10 @@ Result closeFile(File *file)
     buf=buf->next;
   }
 
+  if (file->container != NULL) {
+    return closeContainerFile(file);
+  }
+
   if (close(file->desc) == -1) {
     printErrorMessage(ERR_MSG_CLOSE);
     return NG;
@@ -248,17 +530,33 @@ Result closeFile(File *file)
 }
 
 /*
- * readPage -- 1ページ分のデータのファイルからの読み出し
+ * closeFile -- ファイルのクローズ
  *
  * 引数:
- *  file: アクセスするファイルのFile構造体
- *  pageNum: 読み出すページの番号
- *  page: 読み出した内容を格納するPAGE_SIZEバイトの領域
+ *  クローズするファイルのFile構造体
  *
  * 返り値:
  *  成功の場合OK、失敗の場合NG
+ *
+ * 最後のcloseFileで、バッファを書き戻して本当にクローズする。
  */
-Result readPage(File *file, int pageNum, char *page)
+Result closeFile(File *file)
+{
+  Result ret;
+
+  if (lockFileMutex(file, -1) != OK) {
+    return NG;
+  }
+  ret = closeFileUnlocked(file);
+  pthread_mutex_unlock(&fileMutex);
+
+  return ret;
+}
+
+/*
+ * readPageUnlocked -- readPageの本体(fileMutexは呼び出し元で取る)
+ */
+static Result readPageUnlocked(File *file, int pageNum, char *page)
 {
   int i;
   Buffer *buf=bufferListHead;
@@ -283,34 +581,17 @@ Result readPage(File *file, int pageNum, char *page)
 
   /*なかったらバッファに読み込む*/
   if (emptyBuffer==NULL){
-    /* lseekシステムコールによる読み出し位置の移動 */
-    if (lseek(bufferListTail->file->desc,PAGE_SIZE*bufferListTail->pageNum,SEEK_SET)==-1){
-      printErrorMessage(ERR_MSG_LSEEK);
-      return NG;
-    }
-    /* writeシステムコールによるファイルへのアクセス */
-    if (write(bufferListTail->file->desc, bufferListTail->page, PAGE_SIZE) < PAGE_SIZE) {
-      /* エラー処理 */
-      printErrorMessage(ERR_MSG_WRITE);
+    emptyBuffer = chooseVictim();
+    if (writeBackBuffer(emptyBuffer) != OK) {
       return NG;
     }
-    bufferListTail->modified = UNMODIFIED;
-    emptyBuffer = bufferListTail;  
+    emptyBuffer->modified = UNMODIFIED;
   }
 
   /*bufferListTailの内容を変更する*/
   emptyBuffer->file = file;
   emptyBuffer->pageNum=pageNum;
-  /* lseekシステムコールによる読み出し位置の移動 */
-  if (lseek(file->desc,PAGE_SIZE*pageNum,SEEK_SET)==-1){
-    printErrorMessage(ERR_MSG_LSEEK);
-    return NG;
-  }
-
-  /* readシステムコールによるファイルへのアクセス */
-  if (read(file->desc, emptyBuffer->page, PAGE_SIZE) < PAGE_SIZE) {
-    /* エラー処理 */
-    printErrorMessage(ERR_MSG_READ);
+  if (readFilePage(file, pageNum, emptyBuffer->page) != OK) {
     return NG;
   }
 
@@ -326,21 +607,45 @@ Result readPage(File *file, int pageNum, char *page)
 }
 
 /*
- * writePage -- 1ページ分のデータのファイルへの書き出し
+ * readPage -- 1ページ分のデータのファイルからの読み出し
  *
  * 引数:
  *  file: アクセスするファイルのFile構造体
- *  pageNum: 書き出すページの番号
- *  page: 書き出す内容を格納するPAGE_SIZEバイトの領域
+ *  pageNum: 読み出すページの番号
+ *  page: 読み出した内容を格納するPAGE_SIZEバイトの領域
  *
  * 返り値:
  *  成功の場合OK、失敗の場合NG
  */
-Result writePage(File *file, int pageNum, char *page)
+Result readPage(File *file, int pageNum, char *page)
+{
+  Result ret;
+
+  if (lockFileMutex(file, pageNum) != OK) {
+    return NG;
+  }
+  ret = readPageUnlocked(file, pageNum, page);
+  pthread_mutex_unlock(&fileMutex);
+
+  return ret;
+}
+
+/*
+ * writePageUnlocked -- writePageの本体(fileMutexは呼び出し元で取る)
+ */
+static Result writePageUnlocked(File *file, int pageNum, char *page)
 {
   int i;
   Buffer *buf=bufferListHead;
   Buffer *emptyBuffer=NULL;
+  LogSequenceNumber lsn = 0;
+
+  /* バッファを書き換える前にログに記録する */
+  if (!isTempFile(file->name) && logPageWrite(file->name, pageNum, page, &lsn) != OK) {
+    printErrorMessage(ERR_MSG_WRITE);
+    return NG;
+  }
+
   /*バッファの中にページがあるか探す*/
   for (i = 0; i < NUM_BUFFER; i++){
     if (buf->pageNum==pageNum && file==buf->file){
@@ -350,6 +655,7 @@ Result writePage(File *file, int pageNum, char *page)
         return NG;
       }
       buf->modified = MODIFIED;
+      buf->lsn = lsn;
       moveBufferToListHead(buf);
       return OK;
     }
@@ -359,21 +665,13 @@ Result writePage(File *file, int pageNum, char *page)
     buf=buf->next;
   }
   
-  /*なかったらbufferListTailを書き戻し、読み込む*/
+  /*なかったら追い出すバッファを書き戻し、読み込む*/
   if (emptyBuffer==NULL){
-    /* lseekシステムコールによる読み出し位置の移動 */
-    if (lseek(bufferListTail->file->desc,PAGE_SIZE*bufferListTail->pageNum,SEEK_SET)==-1){
-      printErrorMessage(ERR_MSG_LSEEK);
+    emptyBuffer = chooseVictim();
+    if (writeBackBuffer(emptyBuffer) != OK) {
       return NG;
     }
-    /* writeシステムコールによるファイルへのアクセス */
-    if (write(bufferListTail->file->desc, bufferListTail->page, PAGE_SIZE) < PAGE_SIZE) {
-      /* エラー処理 */
-      printErrorMessage(ERR_MSG_WRITE);
-      return NG;
-    }  
-    bufferListTail->modified=UNMODIFIED;
-    emptyBuffer=bufferListTail;
+    emptyBuffer->modified=UNMODIFIED;
   }
 
   /*bufferListTailの内容を変更する*/
@@ -388,76 +686,452 @@ Result writePage(File *file, int pageNum, char *page)
   }
 
   emptyBuffer->modified = MODIFIED;
+  emptyBuffer->lsn = lsn;
   moveBufferToListHead(emptyBuffer);
   return OK;
 
 }
 
-
-
 /*
- * getNumPage -- ファイルのページ数の取得
+ * writePage -- 1ページ分のデータのファイルへの書き出し
  *
  * 引数:
- *  filename: ファイル名
+ *  file: アクセスするファイルのFile構造体
+ *  pageNum: 書き出すページの番号
+ *  page: 書き出す内容を格納するPAGE_SIZEバイトの領域
  *
  * 返り値:
- *  引数で指定されたファイルの大きさ(ページ数)
- *  エラーの場合には-1を返す
+ *  成功の場合OK、失敗の場合NG
  */
-int getNumPages(char *filename)
+Result writePage(File *file, int pageNum, char *page)
 {
-  if (stat(filename, &stbuf) == -1) {
-    printErrorMessage(ERR_MSG_READ);
-    return -1;
+  Result ret;
+
+  if (lockFileMutex(file, pageNum) != OK) {
+    return NG;
   }
+  ret = writePageUnlocked(file, pageNum, page);
+  pthread_mutex_unlock(&fileMutex);
 
-  return stbuf.st_size/PAGE_SIZE;
+  return ret;
 }
 
+
+
 /*
- * initializeBufferList -- バッファリストの初期化
- *
- * **注意**
- *  この関数は、ファイルアクセスモジュールを使用する前に必ず一度だけ呼び出すこと。
- *  (initializeFileModule()から呼び出すこと。)
+ * logPagesUnlocked -- writePagesで書くページをログに記録する(fileMutexは呼び出し元で取る)
  *
  * 引数:
- *  なし
+ *  file, pageNum, pages, numPage: writePagesと同じ
+ *  lsn: 最後のレコードの終わりの位置(記録しなければ0)を書き込む領域
  *
  * 返り値:
- *  初期化に成功すればOK、失敗すればNGを返す。
+ *  成功の場合OK、失敗の場合NG
  */
-static Result initializeBufferList()
+static Result logPagesUnlocked(File *file, int pageNum, char *pages, int numPage, LogSequenceNumber *lsn)
 {
-  Buffer *oldBuf = NULL;
-  Buffer *buf;
   int i;
 
-  /*
-   * NUM_BUFFER個分のバッファを用意し、
-   * ポインタをつないで両方向リストにする
-  */
-  for (i = 0; i < NUM_BUFFER; i++) {
-    /* 1個分のバッファ(Buffer構造体)のメモリ領域の確保 */
-    if ((buf = (Buffer *) malloc(sizeof(Buffer))) == NULL) {
-      /* メモリ不足なのでエラーを返す */
+  *lsn = 0;
+  if (isTempFile(file->name)) {
+    return OK;
+  }
+  for (i = 0; i < numPage; i++) {
+    if (logPageWrite(file->name, pageNum + i, pages + (size_t) PAGE_SIZE * i, lsn) != OK) {
+      printErrorMessage(ERR_MSG_WRITE);
       return NG;
     }
+  }
 
-    /* Buffer構造体の初期化 */
-    buf->file = NULL;
-    buf->pageNum = UNDEFINED;
-    buf->modified = UNMODIFIED;
-    memset(buf->page, 0, PAGE_SIZE);
-    buf->prev = NULL;
-    buf->next = NULL;
-
-    /* ポインタをつないで両方向リストにする */
-    if (oldBuf != NULL) {
-        oldBuf->next = buf;
-    }
-    buf->prev = oldBuf;
+  return OK;
+}
+
+/*
+ * writePagesUnlocked -- writePagesの本体(fileMutexは呼び出し元で取る)
+ *
+ * 書くページのログは、呼び出し元で先に届けておくこと。
+ */
+static Result writePagesUnlocked(File *file, int pageNum, char *pages, int numPage)
+{
+  int i, n, physical;
+  Buffer *buf = bufferListHead;
+
+  if (file->container == NULL) {
+    if (writePagesAt(file->desc, pageNum, pages, numPage) != OK || addSyncName(file) != OK) {
+      return NG;
+    }
+  } else {
+    for (i = 0; i < numPage; i += n) {
+      if ((physical = getPhysicalPage(file, pageNum + i, 1)) < 0) {
+        printErrorMessage(ERR_MSG_WRITE);
+        return NG;
+      }
+      for (n = 1; i + n < numPage; n++) {
+        if (getPhysicalPage(file, pageNum + i + n, 1) != physical + n) {
+          break;
+        }
+      }
+      if (writePagesAt(file->desc, physical, pages + (size_t) PAGE_SIZE * i, n) != OK) {
+        return NG;
+      }
+    }
+  }
+
+  /* バッファに古い内容が残っていれば置き換える */
+  for (i = 0; i < NUM_BUFFER; i++) {
+    if (buf->file == file && buf->pageNum >= pageNum && buf->pageNum < pageNum + numPage) {
+      memcpy(buf->page, pages + (size_t) PAGE_SIZE * (buf->pageNum - pageNum), PAGE_SIZE);
+      buf->modified = UNMODIFIED;
+    }
+    buf = buf->next;
+  }
+
+  return OK;
+}
+
+/*
+ * writePages -- 連続した複数のページの書き込み
+ *
+ * 引数:
+ *	file: アクセスするファイルのFile構造体
+ *	pageNum: 先頭のページ番号
+ *	pages: 書き込む内容(PAGE_SIZE * numPageバイト)
+ *	numPage: ページ数
+ *
+ * 返り値:
+ *	Result
+ *
+ * バッファを通さず、1回のwriteでまとめてファイルに書き込む。
+ * 書き込んだページがバッファにあれば、バッファの内容も新しくする。
+ * ファイルの最後に大量のページを加える場合に使う。
+ * 単一ファイル形式では、データベースファイルの中で連続しているページごとにまとめて書く。
+ *
+ * 書く前に、書くページをログに記録して届ける。届くのを待つ間はfileMutexを離すので、
+ * ほかのスレッドのページの読み書きは止まらない。
+ */
+Result writePages(File *file, int pageNum, char *pages, int numPage)
+{
+  LogSequenceNumber lsn;
+  Result ret;
+
+  pthread_mutex_lock(&fileMutex);
+  ret = logPagesUnlocked(file, pageNum, pages, numPage, &lsn);
+  numPendingWrite++;
+  pthread_mutex_unlock(&fileMutex);
+
+  if (ret == OK && flushLog(lsn) != OK) {
+    printErrorMessage(ERR_MSG_WRITE);
+    ret = NG;
+  }
+
+  pthread_mutex_lock(&fileMutex);
+  if (ret == OK) {
+    ret = writePagesUnlocked(file, pageNum, pages, numPage);
+  }
+  if (--numPendingWrite == 0) {
+    pthread_cond_broadcast(&pendingWriteDone);
+  }
+  pthread_mutex_unlock(&fileMutex);
+
+  return ret;
+}
+
+/*
+ * readPagesShared -- 複数のスレッドから同時に呼び出せるページの読み出し
+ *
+ * 引数:
+ *	file: アクセスするファイルのFile構造体
+ *	pageNum: 先頭のページ番号
+ *	pages: 読み出した内容を格納する領域(PAGE_SIZE * numPageバイト)
+ *	numPage: ページ数
+ *
+ * 返り値:
+ *	Result
+ *
+ * バッファのリストを書き換えないように、バッファを通さずpreadで読み出す
+ * (ファイルのアクセス位置も変えない)。バッファにあるページは書き戻していない
+ * 変更があるかもしれないので、バッファの内容で置き換える。
+ * preadはfileMutexを取らずに行うので、複数のスレッドの読み出しは並行して進む。
+ *
+ * 読み出している間に、ほかのスレッドがバッファのページをファイルに書き戻すと、
+ * 古い内容を読んだうえにバッファからも消えているかもしれない。そのときは
+ * fileMutexを取ったまま読み直す(スナップショットで読む操作は、書き換える操作と
+ * 並行して進むため)。
+ */
+Result readPagesShared(File *file, int pageNum, char *pages, int numPage)
+{
+  int i, n, physical, locked;
+  unsigned long writes;
+  ssize_t size, got;
+  Buffer *buf;
+
+  pthread_mutex_lock(&fileMutex);
+  writes = numDiskWrite;
+  pthread_mutex_unlock(&fileMutex);
+  locked = 0;
+
+retry:
+  for (i = 0; i < numPage; i += n) {
+    physical = pageNum + i;
+    n = numPage - i;
+    if (file->container != NULL) {
+      /* データベースファイルの中で連続しているところまでまとめて読む */
+      if (!locked) {
+        pthread_mutex_lock(&fileMutex);
+      }
+      physical = getPhysicalPage(file, pageNum + i, 0);
+      for (n = 1; physical >= 0 && i + n < numPage; n++) {
+        if (getPhysicalPage(file, pageNum + i + n, 0) != physical + n) {
+          break;
+        }
+      }
+      if (!locked) {
+        pthread_mutex_unlock(&fileMutex);
+      }
+      if (physical < 0) {
+        if (locked) {
+          pthread_mutex_unlock(&fileMutex);
+        }
+        printErrorMessage(ERR_MSG_READ);
+        return NG;
+      }
+    }
+    size = (ssize_t) PAGE_SIZE * n;
+    if ((got = pread(file->desc, pages + (size_t) PAGE_SIZE * i, size, (off_t) PAGE_SIZE * physical)) < 0) {
+      if (locked) {
+        pthread_mutex_unlock(&fileMutex);
+      }
+      printErrorMessage(ERR_MSG_READ);
+      return NG;
+    }
+    /* ファイルの最後より後ろのページは、まだバッファにしかない */
+    memset(pages + (size_t) PAGE_SIZE * i + got, 0, size - got);
+  }
+
+  if (!locked) {
+    pthread_mutex_lock(&fileMutex);
+    if (numDiskWrite != writes) {
+      locked = 1;
+      goto retry;
+    }
+  }
+  for (buf = bufferListHead; buf != NULL; buf = buf->next) {
+    if (buf->file == file && buf->pageNum >= pageNum && buf->pageNum < pageNum + numPage) {
+      memcpy(pages + (size_t) PAGE_SIZE * (buf->pageNum - pageNum), buf->page, PAGE_SIZE);
+    }
+  }
+  pthread_mutex_unlock(&fileMutex);
+
+  return OK;
+}
+
+/*
+ * getNumPagesUnlocked -- getNumPagesの本体(fileMutexは呼び出し元で取る)
+ */
+static int getNumPagesUnlocked(char *filename)
+{
+  int entry, numPage;
+  File *file;
+  Buffer *buf;
+
+  if (containerDesc != -1) {
+    if ((entry = findEntry(filename)) < 0) {
+      printErrorMessage(ERR_MSG_READ);
+      return -1;
+    }
+    numPage = directory[entry].numPage;
+  } else {
+    if (stat(filename, &stbuf) == -1) {
+      printErrorMessage(ERR_MSG_READ);
+      return -1;
+    }
+    numPage = stbuf.st_size/PAGE_SIZE;
+  }
+
+  /* オープン中なら、最後に加えてまだバッファにしかないページも数える */
+  for (file = openFiles; file != NULL; file = file->next) {
+    if (strcmp(file->name, filename) == 0) {
+      break;
+    }
+  }
+  if (file != NULL) {
+    for (buf = bufferListHead; buf != NULL; buf = buf->next) {
+      if (buf->file == file && buf->pageNum >= numPage) {
+        numPage = buf->pageNum + 1;
+      }
+    }
+  }
+
+  return numPage;
+}
+
+/*
+ * getNumPage -- ファイルのページ数の取得
+ *
+ * 引数:
+ *  filename: ファイル名
+ *
+ * 返り値:
+ *  引数で指定されたファイルの大きさ(ページ数)
+ *  エラーの場合には-1を返す
+ */
+int getNumPages(char *filename)
+{
+  int ret;
+
+  pthread_mutex_lock(&fileMutex);
+  ret = getNumPagesUnlocked(filename);
+  pthread_mutex_unlock(&fileMutex);
+
+  return ret;
+}
+
+/*
+ * createTempFileUnlocked -- createTempFileの本体(fileMutexは呼び出し元で取る)
+ */
+static File *createTempFileUnlocked()
+{
+  File *file;
+
+  if ((file = malloc(sizeof(File))) == NULL) {
+    printErrorMessage(ERR_MSG_CREATE);
+    return NULL;
+  }
+  file->container = NULL;
+
+  snprintf(file->name, MAX_FILENAME, "%s-%d-%d", TEMP_FILE_PREFIX, (int) getpid(), tempFileCount++);
+
+  if ((file->desc = open(file->name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) == -1) {
+    printErrorMessage(ERR_MSG_CREATE);
+    free(file);
+    return NULL;
+  }
+
+  return file;
+}
+
+/*
+ * createTempFile -- 作業用ファイルの作成とオープン
+ *
+ * 引数:
+ *  なし
+ *
+ * 返り値:
+ *  作成してオープンしたファイルのFile構造体
+ *  失敗した場合にはNULLを返す
+ *
+ * ***注意***
+ *  作業用ファイルは、不要になったら必ずdeleteTempFileで削除すること。
+ *  作業用ファイルは、単一ファイル形式のときもデータベースファイルの外に作る。
+ */
+File *createTempFile()
+{
+  File *file;
+
+  pthread_mutex_lock(&fileMutex);
+  file = createTempFileUnlocked();
+  pthread_mutex_unlock(&fileMutex);
+
+  return file;
+}
+
+/*
+ * deleteTempFileUnlocked -- deleteTempFileの本体(fileMutexは呼び出し元で取る)
+ */
+static Result deleteTempFileUnlocked(File *file)
+{
+  char filename[MAX_FILENAME];
+  Buffer *buf;
+
+  for (buf = bufferListHead; buf != NULL; buf = buf->next) {
+    if (buf->file == file) {
+      buf->file = NULL;
+      buf->pageNum = UNDEFINED;
+      buf->modified = UNMODIFIED;
+    }
+  }
+
+  strcpy(filename, file->name);
+  if (close(file->desc) == -1) {
+    printErrorMessage(ERR_MSG_CLOSE);
+    return NG;
+  }
+  free(file);
+
+  if (unlink(filename) == -1) {
+    printErrorMessage(ERR_MSG_UNLINK);
+    return NG;
+  }
+
+  return OK;
+}
+
+/*
+ * deleteTempFile -- 作業用ファイルのクローズと削除
+ *
+ * 引数:
+ *  file: createTempFileで作成したファイルのFile構造体
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ *
+ * 削除するファイルなので、バッファに残っているページは書き戻さずに捨てる。
+ */
+Result deleteTempFile(File *file)
+{
+  Result ret;
+
+  pthread_mutex_lock(&fileMutex);
+  ret = deleteTempFileUnlocked(file);
+  pthread_mutex_unlock(&fileMutex);
+
+  return ret;
+}
+
+/*
+ * initializeBufferList -- バッファリストの初期化
+ *
+ * **注意**
+ *  この関数は、ファイルアクセスモジュールを使用する前に必ず一度だけ呼び出すこと。
+ *  (initializeFileModule()から呼び出すこと。)
+ *
+ * 引数:
+ *  なし
+ *
+ * 返り値:
+ *  初期化に成功すればOK、失敗すればNGを返す。
+ */
+static Result initializeBufferList()
+{
+  Buffer *oldBuf = NULL;
+  Buffer *buf;
+  int i;
+
+  /*
+   * NUM_BUFFER個分のバッファを用意し、
+   * ポインタをつないで両方向リストにする
+  */
+  for (i = 0; i < NUM_BUFFER; i++) {
+    /* 1個分のバッファ(Buffer構造体)のメモリ領域の確保 */
+    if ((buf = (Buffer *) malloc(sizeof(Buffer))) == NULL) {
+      /* メモリ不足なのでエラーを返す */
+      return NG;
+    }
+
+    /* Buffer構造体の初期化 */
+    buf->file = NULL;
+    buf->pageNum = UNDEFINED;
+    buf->modified = UNMODIFIED;
+    buf->lsn = 0;
+    memset(buf->page, 0, PAGE_SIZE);
+    buf->prev = NULL;
+    buf->next = NULL;
+
+    /* ポインタをつないで両方向リストにする */
+    if (oldBuf != NULL) {
+        oldBuf->next = buf;
+    }
+    buf->prev = oldBuf;
 
     /* リストの一番最初の要素へのポインタを保存 */
     if (buf->prev == NULL) {
@@ -528,6 +1202,7 @@ static void moveBufferToListHead(Buffer *buf)
   }else if (bufferListTail==buf){
     bufferListTail = bufferListTail->prev;
     bufferListTail->next = NULL;
+    buf->prev = NULL;
     buf->next = bufferListHead;
     bufferListHead -> prev = buf;
     bufferListHead = buf;
@@ -560,4 +1235,924 @@ void printBufferList()
     }
 
     printf("\n");
-}
\ No newline at end of file
+}
+/*
+ * readPagesAt -- ファイルの指定した位置からのページの読み出し(バッファを通さない)
+ *
+ * 引数:
+ *  desc: ファイルディスクリプタ
+ *  pageNum: 先頭のページ番号
+ *  pages: 読み出した内容を格納する領域(PAGE_SIZE * numPageバイト)
+ *  numPage: ページ数
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ */
+static Result readPagesAt(int desc, int pageNum, char *pages, int numPage)
+{
+  ssize_t size = (ssize_t) PAGE_SIZE * numPage;
+
+  if (lseek(desc, (off_t) PAGE_SIZE * pageNum, SEEK_SET) == -1) {
+    printErrorMessage(ERR_MSG_LSEEK);
+    return NG;
+  }
+  if (read(desc, pages, size) < size) {
+    printErrorMessage(ERR_MSG_READ);
+    return NG;
+  }
+
+  return OK;
+}
+
+/*
+ * writePagesAt -- ファイルの指定した位置へのページの書き込み(バッファを通さない)
+ *
+ * 引数:
+ *  desc: ファイルディスクリプタ
+ *  pageNum: 先頭のページ番号
+ *  pages: 書き込む内容(PAGE_SIZE * numPageバイト)
+ *  numPage: ページ数
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ */
+static Result writePagesAt(int desc, int pageNum, char *pages, int numPage)
+{
+  ssize_t size = (ssize_t) PAGE_SIZE * numPage;
+
+  numDiskWrite++;
+  if (lseek(desc, (off_t) PAGE_SIZE * pageNum, SEEK_SET) == -1) {
+    printErrorMessage(ERR_MSG_LSEEK);
+    return NG;
+  }
+  if (write(desc, pages, size) < size) {
+    printErrorMessage(ERR_MSG_WRITE);
+    return NG;
+  }
+
+  return OK;
+}
+
+/*
+ * readFilePage -- ファイルの1ページの読み出し(バッファを通さない)
+ *
+ * 引数:
+ *  file: アクセスするファイルのFile構造体
+ *  pageNum: 読み出すページの番号
+ *  page: 読み出した内容を格納するPAGE_SIZEバイトの領域
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ *
+ * 単一ファイル形式なら、ページ対応表でデータベースファイルの中の位置に変換する。
+ */
+static Result readFilePage(File *file, int pageNum, char *page)
+{
+  int physical = pageNum;
+
+  if (file->container != NULL && (physical = getPhysicalPage(file, pageNum, 0)) < 0) {
+    printErrorMessage(ERR_MSG_READ);
+    return NG;
+  }
+
+  return readPagesAt(file->desc, physical, page, 1);
+}
+
+/*
+ * writeFilePage -- ファイルの1ページの書き込み(バッファを通さない)
+ *
+ * 引数:
+ *  file: アクセスするファイルのFile構造体
+ *  pageNum: 書き込むページの番号
+ *  page: 書き込む内容を格納するPAGE_SIZEバイトの領域
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ *
+ * 単一ファイル形式で、ファイルの最後より後ろのページならページを割り当てる。
+ */
+static Result writeFilePage(File *file, int pageNum, char *page)
+{
+  int physical = pageNum;
+
+  if (file->container != NULL && (physical = getPhysicalPage(file, pageNum, 1)) < 0) {
+    printErrorMessage(ERR_MSG_WRITE);
+    return NG;
+  }
+
+  if (writePagesAt(file->desc, physical, page, 1) != OK) {
+    return NG;
+  }
+
+  return addSyncName(file);
+}
+
+/*
+ * addSyncName -- 次のチェックポイントでfsyncするファイルに加える
+ *
+ * 引数:
+ *  file: 書き込んだファイルのFile構造体
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ *
+ * 単一ファイル形式のファイルと作業用ファイルは加えない。
+ */
+static Result addSyncName(File *file)
+{
+  char (*p)[MAX_FILENAME];
+  int i, n;
+
+  if (file->container != NULL || isTempFile(file->name)) {
+    return OK;
+  }
+  for (i = numSyncName - 1; i >= 0; i--) {
+    if (strcmp(syncNames[i], file->name) == 0) {
+      return OK;
+    }
+  }
+
+  if (numSyncName == maxSyncName) {
+    n = (maxSyncName == 0) ? 16 : maxSyncName * 2;
+    if ((p = realloc(syncNames, sizeof(*syncNames) * n)) == NULL) {
+      printErrorMessage(ERR_MSG_WRITE);
+      return NG;
+    }
+    syncNames = p;
+    maxSyncName = n;
+  }
+  strcpy(syncNames[numSyncName++], file->name);
+
+  return OK;
+}
+
+/*
+ * writeBackBuffer -- バッファのページをファイルに書き戻す
+ *
+ * 引数:
+ *  buf: 書き戻すバッファ
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ *
+ * 更新したページなら、その更新を記録したログがディスクに届いてから書く
+ * (先書きログ)。ログはlockFileMutexがfileMutexを取る前に届けておくので、
+ * ここでfsyncを待つことはない。
+ */
+static Result writeBackBuffer(Buffer *buf)
+{
+  if (buf->modified == MODIFIED && flushLog(buf->lsn) != OK) {
+    printErrorMessage(ERR_MSG_WRITE);
+    return NG;
+  }
+
+  return writeFilePage(buf->file, buf->pageNum, buf->page);
+}
+
+/*
+ * chooseVictim -- 追い出すバッファを選ぶ(fileMutexは呼び出し元で取る)
+ *
+ * 引数:
+ *  なし
+ *
+ * 返り値:
+ *  LRUリストの最後から見て、最初に見つかった、すぐに書き戻せるバッファ
+ *  (更新していないか、更新のログがもうディスクに届いているもの)。
+ *  なければLRUリストの最後のバッファを返す。
+ */
+static Buffer *chooseVictim()
+{
+  LogSequenceNumber durable = getDurableLsn();
+  Buffer *buf;
+
+  for (buf = bufferListTail; buf != NULL; buf = buf->prev) {
+    if (buf->modified == UNMODIFIED || buf->lsn <= durable) {
+      return buf;
+    }
+  }
+
+  return bufferListTail;
+}
+
+/*
+ * pendingLsnUnlocked -- ページを読み書きする前に届けておくログの位置(fileMutexは呼び出し元で取る)
+ *
+ * 引数:
+ *  file: アクセスするファイルのFile構造体
+ *  pageNum: 読み書きするページの番号(-1ならファイルのクローズ)
+ *
+ * 返り値:
+ *  バッファを書き戻すのに、まだディスクに届いていないログが必要なら、その位置を返す。
+ *  必要なければ0を返す。
+ */
+static LogSequenceNumber pendingLsnUnlocked(File *file, int pageNum)
+{
+  LogSequenceNumber lsn = 0;
+  Buffer *buf;
+
+  if (pageNum < 0) {
+    /* 最後のクローズなら、このファイルのバッファをすべて書き戻す */
+    if (file->refCount > 1) {
+      return 0;
+    }
+    for (buf = bufferListHead; buf != NULL; buf = buf->next) {
+      if (buf->file == file && buf->modified == MODIFIED && buf->lsn > lsn) {
+        lsn = buf->lsn;
+      }
+    }
+  } else {
+    /* バッファにあるか、空きがあれば追い出さない */
+    for (buf = bufferListHead; buf != NULL; buf = buf->next) {
+      if (buf->file == NULL || (buf->file == file && buf->pageNum == pageNum)) {
+        return 0;
+      }
+    }
+    buf = chooseVictim();
+    if (buf->modified == MODIFIED) {
+      lsn = buf->lsn;
+    }
+  }
+
+  return lsn > getDurableLsn() ? lsn : 0;
+}
+
+/*
+ * requestEarlyFlushUnlocked -- 追い出せるバッファが減ったら、ログを先に届けておく(fileMutexは呼び出し元で取る)
+ *
+ * バッファの半分以上が、ログの届いていない更新を持っていたら、ログの書き込みスレッドに
+ * 書き込みを依頼しておく(届くのは待たない)。次に追い出すときに待たずに済む。
+ */
+static void requestEarlyFlushUnlocked()
+{
+  LogSequenceNumber durable = getDurableLsn();
+  Buffer *buf;
+  int n = 0;
+
+  for (buf = bufferListHead; buf != NULL; buf = buf->next) {
+    if (buf->modified == MODIFIED && buf->lsn > durable) {
+      n++;
+    }
+  }
+  if (n * 2 >= NUM_BUFFER) {
+    requestFlushLog(getLogEnd());
+  }
+}
+
+/*
+ * lockFileMutex -- ページを読み書きするためにfileMutexを取る
+ *
+ * 引数:
+ *  file: アクセスするファイルのFile構造体
+ *  pageNum: 読み書きするページの番号(-1ならファイルのクローズ)
+ *
+ * 返り値:
+ *  fileMutexを取ったらOK、ログを届けられなければ(fileMutexを取らずに)NGを返す
+ *
+ * バッファを書き戻すのにログを届ける必要があれば、fileMutexを離してから
+ * flushLogで待つ。その間もほかのスレッドはバッファを使えるし、同時に待っている
+ * スレッドの分は、ログの書き込みスレッドが1回のfsyncでまとめて届ける。
+ */
+static Result lockFileMutex(File *file, int pageNum)
+{
+  LogSequenceNumber lsn;
+
+  for (;;) {
+    pthread_mutex_lock(&fileMutex);
+    if ((lsn = pendingLsnUnlocked(file, pageNum)) == 0) {
+      requestEarlyFlushUnlocked();
+      return OK;
+    }
+    pthread_mutex_unlock(&fileMutex);
+    if (flushLog(lsn) != OK) {
+      printErrorMessage(ERR_MSG_WRITE);
+      return NG;
+    }
+  }
+}
+
+/*
+ * appendPageMap -- ページ対応表の最後にページを加える
+ *
+ * 引数:
+ *  map: ページ対応表
+ *  pageNum: 加えるページ(データベースファイルの中の位置)
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ */
+static Result appendPageMap(PageMap *map, int pageNum)
+{
+  int capacity;
+  int *page;
+
+  if (map->numPage == map->capacity) {
+    capacity = map->capacity == 0 ? MAP_PER_PAGE : map->capacity * 2;
+    if ((page = realloc(map->page, sizeof(int) * capacity)) == NULL) {
+      return NG;
+    }
+    map->page = page;
+    map->capacity = capacity;
+  }
+
+  map->page[map->numPage++] = pageNum;
+  return OK;
+}
+
+/*
+ * freePageMap -- ページ対応表のメモリの解放
+ */
+static void freePageMap(PageMap *map)
+{
+  free(map->page);
+  free(map->mapPage);
+  memset(map, 0, sizeof(PageMap));
+}
+
+/*
+ * allocatePage -- データベースファイルのページの割り当て
+ *
+ * 引数:
+ *  なし
+ *
+ * 返り値:
+ *  割り当てたページの番号
+ *
+ * 空きページがあればそれを使い、なければデータベースファイルを1ページ伸ばす。
+ */
+static int allocatePage()
+{
+  if (freeList.numPage > 0) {
+    return freeList.page[--freeList.numPage];
+  }
+
+  return containerHeader.numPage++;
+}
+
+/*
+ * loadPageMap -- ページ対応表の読み込み
+ *
+ * 引数:
+ *  map: 読み込んだ内容を格納するPageMap(空であること)
+ *  mapPage: ページ対応表の最初のページ(なければ-1)
+ *  numPage: 対応表に記録されているページ数
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ */
+static Result loadPageMap(PageMap *map, int mapPage, int numPage)
+{
+  int buf[PAGE_SIZE / sizeof(int)];
+  int *pages;
+  int i;
+
+  while (mapPage != -1) {
+    if (readPagesAt(containerDesc, mapPage, (char *) buf, 1) != OK) {
+      return NG;
+    }
+    if ((pages = realloc(map->mapPage, sizeof(int) * (map->numMapPage + 1))) == NULL) {
+      return NG;
+    }
+    map->mapPage = pages;
+    map->mapPage[map->numMapPage++] = mapPage;
+
+    for (i = 1; i <= MAP_PER_PAGE && map->numPage < numPage; i++) {
+      if (appendPageMap(map, buf[i]) != OK) {
+        return NG;
+      }
+    }
+    mapPage = buf[0];
+  }
+
+  if (map->numPage < numPage) {
+    printErrorMessage(ERR_MSG_CONTAINER);
+    return NG;
+  }
+
+  return OK;
+}
+
+/*
+ * savePageMap -- ページ対応表の書き込み
+ *
+ * 引数:
+ *  map: 書き込むページ対応表
+ *  mapPage: 対応表の最初のページを返す領域(ページがなければ-1)
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ *
+ * 対応表を格納するページが足りなければ割り当てる(ページは減らさない)。
+ * 空きページの一覧を書き込む場合には、割り当てで一覧自身が短くなる。
+ */
+static Result savePageMap(PageMap *map, int *mapPage)
+{
+  int buf[PAGE_SIZE / sizeof(int)];
+  int *pages;
+  int i, j, n;
+
+  while (map->numMapPage * MAP_PER_PAGE < map->numPage) {
+    if ((pages = realloc(map->mapPage, sizeof(int) * (map->numMapPage + 1))) == NULL) {
+      return NG;
+    }
+    map->mapPage = pages;
+    map->mapPage[map->numMapPage++] = allocatePage();
+  }
+
+  for (i = 0; i < map->numMapPage; i++) {
+    memset(buf, 0, PAGE_SIZE);
+    buf[0] = i + 1 < map->numMapPage ? map->mapPage[i + 1] : -1;
+    n = map->numPage - i * MAP_PER_PAGE;
+    for (j = 0; j < n && j < MAP_PER_PAGE; j++) {
+      buf[j + 1] = map->page[i * MAP_PER_PAGE + j];
+    }
+    if (writePagesAt(containerDesc, map->mapPage[i], (char *) buf, 1) != OK) {
+      return NG;
+    }
+  }
+
+  *mapPage = map->numMapPage > 0 ? map->mapPage[0] : -1;
+  return OK;
+}
+
+/*
+ * syncContainer -- 空きページの一覧、ディレクトリ、見出しの書き込み
+ *
+ * 引数:
+ *  なし
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ */
+static Result syncContainer()
+{
+  char page[PAGE_SIZE];
+  ContainerHeader header;
+  int i;
+
+  if (savePageMap(&freeList, &containerHeader.freeMapPage) != OK) {
+    return NG;
+  }
+  containerHeader.numFree = freeList.numPage;
+
+  for (i = 0; i < numDirPage; i++) {
+    memset(page, 0, PAGE_SIZE);
+    if (i == 0) {
+      header = containerHeader;
+    } else {
+      memset(&header, 0, sizeof(header));
+    }
+    header.nextDirPage = i + 1 < numDirPage ? dirPage[i + 1] : -1;
+    memcpy(page, &header, sizeof(header));
+    memcpy(page + DIR_ENTRY_SIZE, &directory[i * DIR_PER_PAGE], sizeof(DirEntry) * DIR_PER_PAGE);
+    if (writePagesAt(containerDesc, dirPage[i], page, 1) != OK) {
+      return NG;
+    }
+  }
+
+  return OK;
+}
+
+/*
+ * findEntry -- ディレクトリからのファイルの検索
+ *
+ * 引数:
+ *  filename: ファイル名
+ *
+ * 返り値:
+ *  ディレクトリの要素の番号、見つからなければ-1
+ */
+static int findEntry(char *filename)
+{
+  int i;
+
+  for (i = 0; i < numDirPage * DIR_PER_PAGE; i++) {
+    if (directory[i].name[0] != '\0' && strcmp(directory[i].name, filename) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * addDirPage -- ディレクトリのページを1つ増やす
+ *
+ * 引数:
+ *  pageNum: ディレクトリに使うページ
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ */
+static Result addDirPage(int pageNum)
+{
+  int *pages;
+  DirEntry *entries;
+
+  if ((pages = realloc(dirPage, sizeof(int) * (numDirPage + 1))) == NULL) {
+    return NG;
+  }
+  dirPage = pages;
+  if ((entries = realloc(directory, sizeof(DirEntry) * DIR_PER_PAGE * (numDirPage + 1))) == NULL) {
+    return NG;
+  }
+  directory = entries;
+
+  memset(&directory[numDirPage * DIR_PER_PAGE], 0, sizeof(DirEntry) * DIR_PER_PAGE);
+  dirPage[numDirPage++] = pageNum;
+  return OK;
+}
+
+/*
+ * createContainerFile -- データベースファイルの中へのファイルの作成
+ *
+ * 引数:
+ *  filename: 作成するファイルのファイル名
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ *
+ * 同じ名前のファイルがあれば、creatと同様に中身を捨てて作り直す。
+ */
+static Result createContainerFile(char *filename)
+{
+  int entry;
+
+  if (strlen(filename) >= DIR_NAME_SIZE) {
+    printErrorMessage(ERR_MSG_CREATE);
+    return NG;
+  }
+
+  if (deleteContainerFile(filename) != OK) {
+    return NG;
+  }
+
+  /* 空いている要素を探す。なければディレクトリのページを増やす */
+  for (entry = 0; entry < numDirPage * DIR_PER_PAGE; entry++) {
+    if (directory[entry].name[0] == '\0') {
+      break;
+    }
+  }
+  if (entry == numDirPage * DIR_PER_PAGE && addDirPage(allocatePage()) != OK) {
+    printErrorMessage(ERR_MSG_CREATE);
+    return NG;
+  }
+
+  strcpy(directory[entry].name, filename);
+  directory[entry].mapPage = -1;
+  directory[entry].numPage = 0;
+
+  return syncContainer();
+}
+
+/*
+ * deleteContainerFile -- データベースファイルの中のファイルの削除
+ *
+ * 引数:
+ *  filename: 削除するファイルのファイル名
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ *
+ * ファイルが使っていたページは空きページの一覧に戻す。
+ */
+static Result deleteContainerFile(char *filename)
+{
+  PageMap map;
+  int entry, i;
+  Result ret = OK;
+
+  if ((entry = findEntry(filename)) < 0) {
+    return OK;
+  }
+
+  memset(&map, 0, sizeof(map));
+  if (loadPageMap(&map, directory[entry].mapPage, directory[entry].numPage) != OK) {
+    freePageMap(&map);
+    printErrorMessage(ERR_MSG_UNLINK);
+    return NG;
+  }
+  for (i = 0; i < map.numPage && ret == OK; i++) {
+    ret = appendPageMap(&freeList, map.page[i]);
+  }
+  for (i = 0; i < map.numMapPage && ret == OK; i++) {
+    ret = appendPageMap(&freeList, map.mapPage[i]);
+  }
+  freePageMap(&map);
+
+  memset(&directory[entry], 0, sizeof(DirEntry));
+
+  if (ret != OK || syncContainer() != OK) {
+    printErrorMessage(ERR_MSG_UNLINK);
+    return NG;
+  }
+
+  return OK;
+}
+
+/*
+ * openContainerFile -- データベースファイルの中のファイルのオープン
+ *
+ * 引数:
+ *  filename: オープンするファイルのファイル名
+ *
+ * 返り値:
+ *  オープンしたファイルのFile構造体
+ *  オープンに失敗した場合にはNULLを返す
+ */
+static File *openContainerFile(char *filename)
+{
+  File *file;
+  int entry;
+
+  if ((entry = findEntry(filename)) < 0) {
+    printErrorMessage(ERR_MSG_OPEN);
+    return NULL;
+  }
+
+  if ((file = malloc(sizeof(File))) == NULL) {
+    printErrorMessage(ERR_MSG_OPEN);
+    return NULL;
+  }
+  if ((file->container = calloc(1, sizeof(struct ContainerFile))) == NULL) {
+    free(file);
+    printErrorMessage(ERR_MSG_OPEN);
+    return NULL;
+  }
+
+  file->desc = containerDesc;
+  strcpy(file->name, filename);
+  file->container->entry = entry;
+
+  if (loadPageMap(&file->container->map, directory[entry].mapPage, directory[entry].numPage) != OK) {
+    freePageMap(&file->container->map);
+    free(file->container);
+    free(file);
+    printErrorMessage(ERR_MSG_OPEN);
+    return NULL;
+  }
+
+  return file;
+}
+
+/*
+ * closeContainerFile -- データベースファイルの中のファイルのクローズ
+ *
+ * 引数:
+ *  file: クローズするファイルのFile構造体(バッファは書き戻してあること)
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ */
+static Result closeContainerFile(File *file)
+{
+  struct ContainerFile *container = file->container;
+  DirEntry *entry = &directory[container->entry];
+  Result ret = OK;
+
+  if (container->modified) {
+    if (savePageMap(&container->map, &entry->mapPage) != OK || syncContainer() != OK) {
+      printErrorMessage(ERR_MSG_CLOSE);
+      ret = NG;
+    }
+  }
+
+  freePageMap(&container->map);
+  free(container);
+  free(file);
+
+  return ret;
+}
+
+/*
+ * getPhysicalPage -- ページ番号からデータベースファイルの中の位置への変換
+ *
+ * 引数:
+ *  file: データベースファイルの中のファイルのFile構造体
+ *  pageNum: ページ番号
+ *  allocate: ファイルの最後より後ろのページなら割り当てるかどうか
+ *
+ * 返り値:
+ *  データベースファイルの中のページ番号、ページがなければ-1
+ *
+ * 途中のページを飛ばして割り当てた場合、飛ばしたページは0で埋める。
+ */
+static int getPhysicalPage(File *file, int pageNum, int allocate)
+{
+  struct ContainerFile *container = file->container;
+  char zero[PAGE_SIZE];
+
+  if (pageNum < container->map.numPage) {
+    return container->map.page[pageNum];
+  }
+  if (!allocate) {
+    return -1;
+  }
+
+  memset(zero, 0, PAGE_SIZE);
+  while (container->map.numPage <= pageNum) {
+    if (appendPageMap(&container->map, allocatePage()) != OK) {
+      return -1;
+    }
+    if (container->map.numPage <= pageNum &&
+        writePagesAt(containerDesc, container->map.page[container->map.numPage - 1], zero, 1) != OK) {
+      return -1;
+    }
+  }
+  container->modified = 1;
+  directory[container->entry].numPage = container->map.numPage;
+
+  return container->map.page[pageNum];
+}
+
+/*
+ * openContainer -- 単一ファイル形式のデータベースファイルを使い始める
+ *
+ * 引数:
+ *  filename: データベースファイルのファイル名(なければ作成する)
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ *
+ * これ以降、作業用ファイル以外のファイルはすべてこのファイルの中に作られる。
+ * ファイルを1つもオープンしていないときに呼び出すこと。
+ */
+Result openContainer(char *filename)
+{
+  char page[PAGE_SIZE];
+  ContainerHeader header;
+  int desc, pageNum;
+
+  if (containerDesc != -1) {
+    return NG;
+  }
+
+  if ((desc = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) == -1) {
+    printErrorMessage(ERR_MSG_OPEN);
+    return NG;
+  }
+  if (fstat(desc, &stbuf) == -1) {
+    printErrorMessage(ERR_MSG_STAT);
+    close(desc);
+    return NG;
+  }
+  if (stbuf.st_size % PAGE_SIZE != 0) {
+    printErrorMessage(ERR_MSG_CONTAINER);
+    close(desc);
+    return NG;
+  }
+  containerDesc = desc;
+
+  if (stbuf.st_size == 0) {
+    /* 新しいデータベースファイル */
+    memset(&containerHeader, 0, sizeof(containerHeader));
+    memcpy(containerHeader.magic, CONTAINER_MAGIC, CONTAINER_MAGIC_SIZE);
+    containerHeader.numPage = 1;
+    containerHeader.freeMapPage = -1;
+    containerHeader.numFree = 0;
+    if (addDirPage(0) != OK || syncContainer() != OK) {
+      closeContainer();
+      return NG;
+    }
+    return OK;
+  }
+
+  /* ディレクトリのページをたどって読み込む */
+  for (pageNum = 0; pageNum != -1; pageNum = header.nextDirPage) {
+    if (readPagesAt(desc, pageNum, page, 1) != OK || addDirPage(pageNum) != OK) {
+      closeContainer();
+      return NG;
+    }
+    memcpy(&header, page, sizeof(header));
+    if (pageNum == 0) {
+      if (memcmp(header.magic, CONTAINER_MAGIC, CONTAINER_MAGIC_SIZE) != 0) {
+        printErrorMessage(ERR_MSG_CONTAINER);
+        closeContainer();
+        return NG;
+      }
+      containerHeader = header;
+    }
+    memcpy(&directory[(numDirPage - 1) * DIR_PER_PAGE], page + DIR_ENTRY_SIZE,
+           sizeof(DirEntry) * DIR_PER_PAGE);
+  }
+
+  if (loadPageMap(&freeList, containerHeader.freeMapPage, containerHeader.numFree) != OK) {
+    closeContainer();
+    return NG;
+  }
+
+  return OK;
+}
+
+/*
+ * closeContainer -- 単一ファイル形式のデータベースファイルの使用の終了
+ *
+ * 引数:
+ *  なし
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ */
+Result closeContainer()
+{
+  Result ret = OK;
+
+  if (containerDesc == -1) {
+    return OK;
+  }
+
+  if (numDirPage > 0 && memcmp(containerHeader.magic, CONTAINER_MAGIC, CONTAINER_MAGIC_SIZE) == 0) {
+    ret = syncContainer();
+  }
+  if (close(containerDesc) == -1) {
+    printErrorMessage(ERR_MSG_CLOSE);
+    ret = NG;
+  }
+
+  containerDesc = -1;
+  free(directory);
+  free(dirPage);
+  directory = NULL;
+  dirPage = NULL;
+  numDirPage = 0;
+  freePageMap(&freeList);
+  memset(&containerHeader, 0, sizeof(containerHeader));
+
+  return ret;
+}
+
+/*
+ * checkpoint -- チェックポイント
+ *
+ * 引数:
+ *  なし
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ *
+ * ログをディスクに届けてから、バッファの更新したページをすべて書き戻して
+ * ファイル(単一ファイル形式ならデータベースファイルとその管理情報)をfsyncし、
+ * ログを空にする。fileMutexを取ったまま行うので、その間にログは増えない。
+ * ログに記録してまだ書いていないwritePagesがあれば、書き終えるのを待つ。
+ */
+Result checkpoint()
+{
+  Buffer *buf;
+  Result ret = OK;
+  int i, desc;
+
+  /* ほとんどのログは、fileMutexを取る前に届けておく */
+  if (flushLog(getLogEnd()) != OK) {
+    return NG;
+  }
+
+  pthread_mutex_lock(&fileMutex);
+  while (numPendingWrite > 0) {
+    pthread_cond_wait(&pendingWriteDone, &fileMutex);
+  }
+
+  if (flushLog(getLogEnd()) != OK) {
+    pthread_mutex_unlock(&fileMutex);
+    return NG;
+  }
+
+  for (buf = bufferListHead; buf != NULL; buf = buf->next) {
+    if (buf->file != NULL && buf->modified == MODIFIED && !isTempFile(buf->file->name)) {
+      if (writeFilePage(buf->file, buf->pageNum, buf->page) != OK) {
+        pthread_mutex_unlock(&fileMutex);
+        return NG;
+      }
+      buf->modified = UNMODIFIED;
+    }
+  }
+
+  if (containerDesc != -1) {
+    if (syncContainer() != OK || fsync(containerDesc) == -1) {
+      ret = NG;
+    }
+  } else {
+    for (i = 0; i < numSyncName; i++) {
+      /* その後で削除したファイルは飛ばす */
+      if ((desc = open(syncNames[i], O_RDONLY)) == -1) {
+        continue;
+      }
+      if (fsync(desc) == -1) {
+        ret = NG;
+      }
+      close(desc);
+    }
+    /* 作成や削除したファイルのディレクトリの要素も届ける */
+    if ((desc = open(".", O_RDONLY)) != -1) {
+      fsync(desc);
+      close(desc);
+    }
+  }
+
+  if (ret == OK) {
+    numSyncName = 0;
+    ret = truncateLog();
+  }
+
+  pthread_mutex_unlock(&fileMutex);
+
+  return ret;
+}
@@ -0,0 +1,855 @@
+/*
+ * hash.c -- ハッシュ索引モジュール
+ *
+ * フィールドの値からレコードIDを引く拡張ハッシュを、索引ファイルに
+ * ページ単位で保存する。値の順序は保たないので、=の検索にだけ使える。
+ * 索引ファイルのオープンとクローズは索引モジュール(index.c)が行う。
+ *
+ * キーのハッシュ値の下位globalDepthビットで、ディレクトリからバケットの
+ * ページ番号を引く。ディレクトリを1ページ、バケットを1ページ読めば、
+ * テーブルの大きさによらず、その値を持つ要素がすべて見つかる。
+ *
+ * 索引ファイルの構造
+ *  ページ0: メタ情報(globalDepth、ページ数、キーのデータ型、
+ *           ディレクトリのページ数、ディレクトリのページ番号の配列)
+ *  それ以外: ディレクトリ(バケットのページ番号の配列)またはバケット
+ *
+ * バケットのページの構造
+ *   +-----------+-----------+--------------------+----------------------
+ *   |localDepth |要素数     |あふれページの番号  |要素(キーの値、レコードID)...
+ *   +-----------+-----------+--------------------+----------------------
+ *
+ * バケットがいっぱいになったら2つに分割する(必要ならディレクトリを倍にする)。
+ * 同じ値ばかりで分割しても分かれない場合や、ディレクトリが上限に達した
+ * 場合は、あふれページをつないで格納する。
+ * 削除ではバケットの併合をしない。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "microdb.h"
+
+/*
+ * META_PAGE -- メタ情報を置くページの番号
+ */
+#define META_PAGE 0
+
+/*
+ * NO_PAGE -- ページがないことを表すページ番号
+ */
+#define NO_PAGE (-1)
+
+/*
+ * DIR_PER_PAGE -- ディレクトリの1ページに入るバケットのページ番号の数
+ */
+#define DIR_PER_PAGE ((int) (PAGE_SIZE / sizeof(int)))
+
+/*
+ * MAX_GLOBAL_DEPTH -- ディレクトリの大きさ(2のglobalDepth乗)の上限
+ *
+ * ディレクトリのページ番号はすべてメタ情報のページに収める。
+ */
+#define MAX_GLOBAL_DEPTH 18
+
+/*
+ * MAX_DIR_PAGE -- ディレクトリのページ数の上限
+ */
+#define MAX_DIR_PAGE ((1 << MAX_GLOBAL_DEPTH) / DIR_PER_PAGE)
+
+/*
+ * BUCKET_HEADER_SIZE -- バケットのページの先頭の管理情報のバイト数
+ */
+#define BUCKET_HEADER_SIZE (sizeof(int) * 3)
+
+/*
+ * MAX_BUCKET_ENTRY -- 1つのバケットのページに収める要素数の上限
+ *
+ * 整数型のキーの場合の数。文字列型ではこれより少ない(getCapacityを参照)。
+ */
+#define MAX_BUCKET_ENTRY ((PAGE_SIZE - BUCKET_HEADER_SIZE) / (sizeof(int) * 3))
+
+/*
+ * Bucket -- ページから読み出したバケット
+ */
+typedef struct Bucket Bucket;
+struct Bucket {
+  int pageNum;                  /* ページ番号 */
+  int localDepth;               /* このバケットの要素が共有するハッシュ値の下位ビット数 */
+  int numEntry;                 /* 要素数 */
+  int next;                     /* あふれページの番号(なければNO_PAGE) */
+  IndexEntry entry[MAX_BUCKET_ENTRY];
+};
+
+/*
+ * HashIndex -- オープンしたハッシュ索引の情報
+ */
+struct HashIndex {
+  File *file;                   /* 索引ファイル */
+  DataType keyType;             /* キーのデータ型 */
+  int globalDepth;              /* ディレクトリの大きさは2のglobalDepth乗 */
+  int numPage;                  /* 索引ファイルのページ数 */
+  int numDirPage;               /* ディレクトリのページ数 */
+  int dirPage[MAX_DIR_PAGE];    /* ディレクトリのページ番号 */
+  int dirChunk;                 /* dirに読み込んだディレクトリのページの順番(なければ-1) */
+  int dirModified;              /* dirを書き換えたなら1 */
+  int dir[DIR_PER_PAGE];        /* 読み込んだディレクトリのページ */
+};
+
+/*
+ * HashScan -- 同じ値を持つ要素を、バケットの順にたどる走査の状態
+ */
+struct HashScan {
+  HashIndex *hash;              /* 走査する索引 */
+  ValueSet key;                 /* 探す値 */
+  Bucket *bucket;               /* 読んでいるバケット(走査が終わったらNULL) */
+  int position;                 /* バケットの中で次に調べる要素の番号 */
+};
+
+/*
+ * getKeySize -- キーの値を保存するのに使うバイト数
+ */
+static int getKeySize(HashIndex *hash)
+{
+  return (hash->keyType == TYPE_INTEGER) ? sizeof(int) : MAX_STRING;
+}
+
+/*
+ * getCapacity -- 1つのバケットのページに収める要素数
+ */
+static int getCapacity(HashIndex *hash)
+{
+  return (PAGE_SIZE - BUCKET_HEADER_SIZE) / (getKeySize(hash) + sizeof(int) * 2);
+}
+
+/*
+ * hashKey -- キーの値のハッシュ値(FNV-1a)
+ */
+static unsigned int hashKey(HashIndex *hash, ValueSet *key)
+{
+  unsigned int h = 2166136261u;
+  unsigned char *p;
+  int i, len;
+
+  if (hash->keyType == TYPE_INTEGER) {
+    p = (unsigned char *) &key->intValue;
+    len = sizeof(int);
+  } else {
+    p = (unsigned char *) key->stringValue;
+    for (len = 0; len < MAX_STRING && p[len] != '\0'; len++) {
+    }
+  }
+
+  for (i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= 16777619u;
+  }
+
+  return h;
+}
+
+/*
+ * equalKey -- キーの値が等しいかどうか
+ */
+static int equalKey(HashIndex *hash, ValueSet *a, ValueSet *b)
+{
+  if (hash->keyType == TYPE_INTEGER) {
+    return a->intValue == b->intValue;
+  }
+
+  return strncmp(a->stringValue, b->stringValue, MAX_STRING) == 0;
+}
+
+/*
+ * equalEntry -- 要素(キーの値とレコードID)が等しいかどうか
+ */
+static int equalEntry(HashIndex *hash, IndexEntry *a, IndexEntry *b)
+{
+  return equalKey(hash, &a->key, &b->key)
+    && a->recordId.pageNum == b->recordId.pageNum
+    && a->recordId.slotNum == b->recordId.slotNum;
+}
+
+/*
+ * readBucket -- バケットの読み出し
+ */
+static Result readBucket(HashIndex *hash, int pageNum, Bucket *bucket)
+{
+  char page[PAGE_SIZE];
+  char *p = page;
+  int i, keySize = getKeySize(hash);
+
+  if (pageNum <= META_PAGE || pageNum >= hash->numPage) {
+    return NG;
+  }
+  if (readPage(hash->file, pageNum, page) != OK) {
+    return NG;
+  }
+
+  bucket->pageNum = pageNum;
+  memcpy(&bucket->localDepth, p, sizeof(int));
+  p += sizeof(int);
+  memcpy(&bucket->numEntry, p, sizeof(int));
+  p += sizeof(int);
+  memcpy(&bucket->next, p, sizeof(int));
+  p += sizeof(int);
+  if (bucket->numEntry < 0 || bucket->numEntry > getCapacity(hash)) {
+    return NG;
+  }
+
+  for (i = 0; i < bucket->numEntry; i++) {
+    memset(&bucket->entry[i].key, 0, sizeof(ValueSet));
+    memcpy(&bucket->entry[i].key, p, keySize);
+    p += keySize;
+    memcpy(&bucket->entry[i].recordId.pageNum, p, sizeof(int));
+    p += sizeof(int);
+    memcpy(&bucket->entry[i].recordId.slotNum, p, sizeof(int));
+    p += sizeof(int);
+  }
+
+  return OK;
+}
+
+/*
+ * writeBucket -- バケットの書き出し
+ */
+static Result writeBucket(HashIndex *hash, Bucket *bucket)
+{
+  char page[PAGE_SIZE];
+  char *p = page;
+  int i, keySize = getKeySize(hash);
+
+  memset(page, 0, PAGE_SIZE);
+  memcpy(p, &bucket->localDepth, sizeof(int));
+  p += sizeof(int);
+  memcpy(p, &bucket->numEntry, sizeof(int));
+  p += sizeof(int);
+  memcpy(p, &bucket->next, sizeof(int));
+  p += sizeof(int);
+
+  for (i = 0; i < bucket->numEntry; i++) {
+    memcpy(p, &bucket->entry[i].key, keySize);
+    p += keySize;
+    memcpy(p, &bucket->entry[i].recordId.pageNum, sizeof(int));
+    p += sizeof(int);
+    memcpy(p, &bucket->entry[i].recordId.slotNum, sizeof(int));
+    p += sizeof(int);
+  }
+
+  return writePage(hash->file, bucket->pageNum, page);
+}
+
+/*
+ * writeMeta -- メタ情報の書き出し
+ */
+static Result writeMeta(HashIndex *hash)
+{
+  char page[PAGE_SIZE];
+  char *p = page;
+
+  memset(page, 0, PAGE_SIZE);
+  memcpy(p, &hash->globalDepth, sizeof(int));
+  p += sizeof(int);
+  memcpy(p, &hash->numPage, sizeof(int));
+  p += sizeof(int);
+  memcpy(p, &hash->keyType, sizeof(DataType));
+  p += sizeof(DataType);
+  memcpy(p, &hash->numDirPage, sizeof(int));
+  p += sizeof(int);
+  memcpy(p, hash->dirPage, sizeof(int) * hash->numDirPage);
+
+  return writePage(hash->file, META_PAGE, page);
+}
+
+/*
+ * readMeta -- メタ情報の読み出し
+ */
+static Result readMeta(HashIndex *hash)
+{
+  char page[PAGE_SIZE];
+  char *p = page;
+
+  if (readPage(hash->file, META_PAGE, page) != OK) {
+    return NG;
+  }
+  memcpy(&hash->globalDepth, p, sizeof(int));
+  p += sizeof(int);
+  memcpy(&hash->numPage, p, sizeof(int));
+  p += sizeof(int);
+  memcpy(&hash->keyType, p, sizeof(DataType));
+  p += sizeof(DataType);
+  memcpy(&hash->numDirPage, p, sizeof(int));
+  p += sizeof(int);
+  if (hash->numDirPage < 1 || hash->numDirPage > MAX_DIR_PAGE) {
+    return NG;
+  }
+  memcpy(hash->dirPage, p, sizeof(int) * hash->numDirPage);
+
+  return OK;
+}
+
+/*
+ * flushDirectory -- 書き換えたディレクトリのページを書き戻す
+ */
+static Result flushDirectory(HashIndex *hash)
+{
+  if (hash->dirModified) {
+    if (writePage(hash->file, hash->dirPage[hash->dirChunk], (char *) hash->dir) != OK) {
+      return NG;
+    }
+    hash->dirModified = 0;
+  }
+
+  return OK;
+}
+
+/*
+ * loadDirectory -- ディレクトリのchunk番目のページを読み込む
+ */
+static Result loadDirectory(HashIndex *hash, int chunk)
+{
+  if (hash->dirChunk == chunk) {
+    return OK;
+  }
+  if (flushDirectory(hash) != OK) {
+    return NG;
+  }
+
+  hash->dirChunk = -1;
+  if (readPage(hash->file, hash->dirPage[chunk], (char *) hash->dir) != OK) {
+    return NG;
+  }
+  hash->dirChunk = chunk;
+
+  return OK;
+}
+
+/*
+ * getDirectory -- ディレクトリのslot番目のバケットのページ番号を得る
+ */
+static Result getDirectory(HashIndex *hash, unsigned int slot, int *pageNum)
+{
+  if (loadDirectory(hash, slot / DIR_PER_PAGE) != OK) {
+    return NG;
+  }
+  *pageNum = hash->dir[slot % DIR_PER_PAGE];
+
+  return OK;
+}
+
+/*
+ * setDirectory -- ディレクトリのslot番目のバケットのページ番号を書き換える
+ */
+static Result setDirectory(HashIndex *hash, unsigned int slot, int pageNum)
+{
+  if (loadDirectory(hash, slot / DIR_PER_PAGE) != OK) {
+    return NG;
+  }
+  hash->dir[slot % DIR_PER_PAGE] = pageNum;
+  hash->dirModified = 1;
+
+  return OK;
+}
+
+/*
+ * findBucket -- キーの値が入るバケットのページ番号を得る
+ */
+static Result findBucket(HashIndex *hash, ValueSet *key, int *pageNum)
+{
+  unsigned int mask = (1u << hash->globalDepth) - 1;
+
+  return getDirectory(hash, hashKey(hash, key) & mask, pageNum);
+}
+
+/*
+ * doubleDirectory -- ディレクトリの大きさを倍にする
+ *
+ * 後半には前半と同じページ番号を並べる(どのバケットもまだ分割していない)。
+ */
+static Result doubleDirectory(HashIndex *hash)
+{
+  int size = 1 << hash->globalDepth;
+  int i, numChunk;
+
+  if (size * 2 <= DIR_PER_PAGE) {
+    /* ディレクトリが1ページに収まるうちは、そのページの中で複写する */
+    if (loadDirectory(hash, 0) != OK) {
+      return NG;
+    }
+    memcpy(hash->dir + size, hash->dir, sizeof(int) * size);
+    hash->dirModified = 1;
+  } else {
+    /* ディレクトリのページを、同じ内容の新しいページで倍の数にする */
+    numChunk = size / DIR_PER_PAGE;
+    for (i = 0; i < numChunk; i++) {
+      if (loadDirectory(hash, i) != OK) {
+        return NG;
+      }
+      hash->dirPage[numChunk + i] = hash->numPage;
+      if (writePage(hash->file, hash->numPage, (char *) hash->dir) != OK) {
+        return NG;
+      }
+      hash->numPage++;
+    }
+    hash->numDirPage = numChunk * 2;
+  }
+
+  hash->globalDepth++;
+  return writeMeta(hash);
+}
+
+/*
+ * writeChain -- 要素の配列を、バケットとあふれページのつながりに書き出す
+ *
+ * 引数:
+ *  hash: 索引
+ *  pages: 使ってよいページの番号の配列(先頭がバケットのページ)
+ *  numPages: pagesの数(0なら新しいページから始める)
+ *  localDepth: バケットのlocalDepth
+ *  entries: 書き出す要素の配列
+ *  numEntry: 要素数
+ *  bucket: 作業に使う領域
+ *
+ * 返り値:
+ *  先頭のページ番号を返す。失敗したらNO_PAGEを返す。
+ *
+ * pagesはすべてつないだまま使い(空のページも残す)、足りなければ新しいページを足す。
+ */
+static int writeChain(HashIndex *hash, int *pages, int numPages, int localDepth,
+                      IndexEntry *entries, int numEntry, Bucket *bucket)
+{
+  int i, n, first, capacity = getCapacity(hash);
+
+  first = (numPages > 0) ? pages[0] : hash->numPage++;
+  bucket->pageNum = first;
+  for (i = 0;; i++) {
+    n = (numEntry > capacity) ? capacity : numEntry;
+    bucket->localDepth = localDepth;
+    bucket->numEntry = n;
+    memcpy(bucket->entry, entries, sizeof(IndexEntry) * n);
+    entries += n;
+    numEntry -= n;
+
+    if (i + 1 < numPages) {
+      bucket->next = pages[i + 1];
+    } else if (numEntry > 0) {
+      bucket->next = hash->numPage++;
+    } else {
+      bucket->next = NO_PAGE;
+    }
+    if (writeBucket(hash, bucket) != OK) {
+      return NO_PAGE;
+    }
+    if (bucket->next == NO_PAGE) {
+      return first;
+    }
+    bucket->pageNum = bucket->next;
+  }
+}
+
+/*
+ * splitBucket -- バケットを2つに分割する
+ *
+ * 引数:
+ *  hash: 索引
+ *  pageNum: 分割するバケットのページ番号
+ *  h: そのバケットに入る値のハッシュ値のどれか
+ *  bucket: 作業に使う領域
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * あふれページの要素も含めて、ハッシュ値のlocalDepth番目のビットが0の
+ * 要素を元のページに、1の要素を新しいページに分ける。
+ * バケットのlocalDepthはglobalDepthより小さくなければならない。
+ */
+static Result splitBucket(HashIndex *hash, int pageNum, unsigned int h, Bucket *bucket)
+{
+  IndexEntry *entries = NULL, *p, tmp;
+  int *pages, *q;
+  int numPages = 0, maxPages = 16, numEntry = 0, numKept;
+  int i, localDepth = 0, newPage;
+  unsigned int bit, slot;
+  Result ret = NG;
+
+  /* あふれページまで含めて、すべての要素を集める */
+  if ((pages = malloc(sizeof(int) * maxPages)) == NULL) {
+    return NG;
+  }
+  for (;;) {
+    if (readBucket(hash, pageNum, bucket) != OK) {
+      goto cleanup;
+    }
+    if (numPages == maxPages) {
+      maxPages *= 2;
+      if ((q = realloc(pages, sizeof(int) * maxPages)) == NULL) {
+        goto cleanup;
+      }
+      pages = q;
+    }
+    pages[numPages++] = pageNum;
+    if ((p = realloc(entries, sizeof(IndexEntry) * (numEntry + bucket->numEntry + 1))) == NULL) {
+      goto cleanup;
+    }
+    entries = p;
+    memcpy(entries + numEntry, bucket->entry, sizeof(IndexEntry) * bucket->numEntry);
+    numEntry += bucket->numEntry;
+    localDepth = bucket->localDepth;
+    if (bucket->next == NO_PAGE) {
+      break;
+    }
+    pageNum = bucket->next;
+  }
+
+  /* ビットが0の要素を前に、1の要素を後ろに集める */
+  bit = 1u << localDepth;
+  numKept = 0;
+  for (i = 0; i < numEntry; i++) {
+    if ((hashKey(hash, &entries[i].key) & bit) == 0) {
+      tmp = entries[numKept];
+      entries[numKept] = entries[i];
+      entries[i] = tmp;
+      numKept++;
+    }
+  }
+
+  if (writeChain(hash, pages, numPages, localDepth + 1, entries, numKept, bucket) == NO_PAGE) {
+    goto cleanup;
+  }
+  if ((newPage = writeChain(hash, NULL, 0, localDepth + 1, entries + numKept,
+                            numEntry - numKept, bucket)) == NO_PAGE) {
+    goto cleanup;
+  }
+
+  /* 下位localDepth+1ビットが新しいバケットを表すディレクトリの要素を書き換える */
+  for (slot = (h & (bit - 1)) | bit; slot < (1u << hash->globalDepth); slot += bit << 1) {
+    if (setDirectory(hash, slot, newPage) != OK) {
+      goto cleanup;
+    }
+  }
+  ret = OK;
+
+cleanup:
+  free(entries);
+  free(pages);
+  return ret;
+}
+
+/*
+ * createHashFile -- 空のハッシュ索引の作成
+ *
+ * 引数:
+ *  file: 作成した空の索引ファイル
+ *  keyType: キーのデータ型
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+Result createHashFile(File *file, DataType keyType)
+{
+  HashIndex *hash;
+  Bucket *bucket;
+  Result ret = NG;
+
+  if ((hash = malloc(sizeof(HashIndex))) == NULL) {
+    return NG;
+  }
+  if ((bucket = malloc(sizeof(Bucket))) == NULL) {
+    free(hash);
+    return NG;
+  }
+
+  /* ディレクトリの要素が1つだけで、空のバケットを1つ持つ索引にする */
+  hash->file = file;
+  hash->keyType = keyType;
+  hash->globalDepth = 0;
+  hash->numPage = 3;
+  hash->numDirPage = 1;
+  hash->dirPage[0] = 1;
+  memset(hash->dir, 0, sizeof(hash->dir));
+  hash->dir[0] = 2;
+  hash->dirChunk = 0;
+  hash->dirModified = 1;
+
+  bucket->pageNum = 2;
+  bucket->localDepth = 0;
+  bucket->numEntry = 0;
+  bucket->next = NO_PAGE;
+
+  if (writeMeta(hash) == OK && flushDirectory(hash) == OK && writeBucket(hash, bucket) == OK) {
+    ret = OK;
+  }
+
+  free(bucket);
+  free(hash);
+  return ret;
+}
+
+/*
+ * openHashIndex -- ハッシュ索引のオープン
+ *
+ * 引数:
+ *  file: オープンした索引ファイル(closeHashIndexの後でクローズすること)
+ *
+ * 返り値:
+ *  オープンした索引を返す。失敗したらNULLを返す。
+ */
+HashIndex *openHashIndex(File *file)
+{
+  HashIndex *hash;
+
+  if ((hash = malloc(sizeof(HashIndex))) == NULL) {
+    return NULL;
+  }
+  hash->file = file;
+  hash->dirChunk = -1;
+  hash->dirModified = 0;
+  if (readMeta(hash) != OK) {
+    free(hash);
+    return NULL;
+  }
+
+  return hash;
+}
+
+/*
+ * closeHashIndex -- ハッシュ索引のクローズ
+ *
+ * 引数:
+ *  hash: クローズする索引
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 書き換えたディレクトリとメタ情報を書き戻す。索引ファイルはクローズしない。
+ */
+Result closeHashIndex(HashIndex *hash)
+{
+  Result ret = OK;
+
+  if (hash == NULL) {
+    return OK;
+  }
+
+  if (flushDirectory(hash) != OK || writeMeta(hash) != OK) {
+    ret = NG;
+  }
+  free(hash);
+
+  return ret;
+}
+
+/*
+ * insertHashEntry -- ハッシュ索引への要素の挿入
+ *
+ * 引数:
+ *  hash: 索引
+ *  entry: 挿入するキーの値とレコードID
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+Result insertHashEntry(HashIndex *hash, IndexEntry *entry)
+{
+  Bucket *bucket;
+  unsigned int h = hashKey(hash, &entry->key);
+  int i, first, pageNum, sameHash;
+  Result ret = NG;
+
+  if ((bucket = malloc(sizeof(Bucket))) == NULL) {
+    return NG;
+  }
+
+  for (;;) {
+    /* あふれページまでたどって、空きのあるページを探す */
+    if (findBucket(hash, &entry->key, &first) != OK) {
+      break;
+    }
+    pageNum = first;
+    sameHash = 1;
+    for (;;) {
+      if (readBucket(hash, pageNum, bucket) != OK) {
+        goto done;
+      }
+      if (bucket->numEntry < getCapacity(hash)) {
+        bucket->entry[bucket->numEntry++] = *entry;
+        ret = writeBucket(hash, bucket);
+        goto done;
+      }
+      for (i = 0; i < bucket->numEntry && sameHash; i++) {
+        sameHash = (hashKey(hash, &bucket->entry[i].key) == h);
+      }
+      if (bucket->next == NO_PAGE) {
+        break;
+      }
+      pageNum = bucket->next;
+    }
+
+    /* 分割しても要素が分かれないか、ディレクトリを倍にできなければ、あふれページを足す */
+    if (sameHash
+        || (bucket->localDepth == hash->globalDepth && hash->globalDepth >= MAX_GLOBAL_DEPTH)) {
+      bucket->next = hash->numPage++;
+      if (writeBucket(hash, bucket) != OK) {
+        goto done;
+      }
+      bucket->pageNum = bucket->next;
+      bucket->numEntry = 1;
+      bucket->entry[0] = *entry;
+      bucket->next = NO_PAGE;
+      ret = writeBucket(hash, bucket);
+      goto done;
+    }
+
+    /* バケットを分割してから、もう一度入れる場所を探す */
+    if (bucket->localDepth == hash->globalDepth && doubleDirectory(hash) != OK) {
+      goto done;
+    }
+    if (splitBucket(hash, first, h, bucket) != OK) {
+      goto done;
+    }
+  }
+
+done:
+  free(bucket);
+  return ret;
+}
+
+/*
+ * deleteHashEntry -- ハッシュ索引からの要素の削除
+ *
+ * 引数:
+ *  hash: 索引
+ *  entry: 削除するキーの値とレコードID
+ *
+ * 返り値:
+ *  成功ならOK、要素が見つからないか失敗ならNGを返す
+ */
+Result deleteHashEntry(HashIndex *hash, IndexEntry *entry)
+{
+  Bucket *bucket;
+  int i, pageNum;
+  Result ret = NG;
+
+  if ((bucket = malloc(sizeof(Bucket))) == NULL) {
+    return NG;
+  }
+
+  if (findBucket(hash, &entry->key, &pageNum) != OK) {
+    free(bucket);
+    return NG;
+  }
+  while (pageNum != NO_PAGE) {
+    if (readBucket(hash, pageNum, bucket) != OK) {
+      break;
+    }
+    for (i = 0; i < bucket->numEntry; i++) {
+      if (equalEntry(hash, &bucket->entry[i], entry)) {
+        /* ページの最後の要素で埋める */
+        bucket->entry[i] = bucket->entry[--bucket->numEntry];
+        ret = writeBucket(hash, bucket);
+        free(bucket);
+        return ret;
+      }
+    }
+    pageNum = bucket->next;
+  }
+
+  free(bucket);
+  return NG;
+}
+
+/*
+ * openHashScan -- ハッシュ索引の走査の開始
+ *
+ * 引数:
+ *  hash: 走査する索引
+ *  key: 探す値
+ *
+ * 返り値:
+ *  keyと等しい値を持つ要素を返す走査を返す(順序は決まっていない)。
+ *  失敗したらNULLを返す。
+ *
+ * ***注意***
+ *  返した走査は、不要になったら必ずcloseHashScanで解放すること。
+ */
+HashScan *openHashScan(HashIndex *hash, ValueSet *key)
+{
+  HashScan *scan;
+  int pageNum;
+
+  if ((scan = malloc(sizeof(HashScan))) == NULL) {
+    return NULL;
+  }
+  if ((scan->bucket = malloc(sizeof(Bucket))) == NULL) {
+    free(scan);
+    return NULL;
+  }
+  scan->hash = hash;
+  scan->key = *key;
+  scan->position = 0;
+
+  if (findBucket(hash, key, &pageNum) != OK || readBucket(hash, pageNum, scan->bucket) != OK) {
+    closeHashScan(scan);
+    return NULL;
+  }
+
+  return scan;
+}
+
+/*
+ * getNextHashEntry -- ハッシュ索引の走査で次の要素を取り出す
+ *
+ * 引数:
+ *  scan: ハッシュ索引の走査
+ *  entry: 要素へのポインタを返す領域(もう要素がなければNULL)
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 返した要素の領域は、次にこの関数を呼び出すまで有効である。
+ */
+Result getNextHashEntry(HashScan *scan, IndexEntry **entry)
+{
+  IndexEntry *e;
+
+  *entry = NULL;
+  for (;;) {
+    if (scan->bucket == NULL) {
+      return OK;
+    }
+
+    /* 読んでいるページを使い切ったら、あふれページに移る */
+    if (scan->position >= scan->bucket->numEntry) {
+      if (scan->bucket->next == NO_PAGE) {
+        free(scan->bucket);
+        scan->bucket = NULL;
+        return OK;
+      }
+      if (readBucket(scan->hash, scan->bucket->next, scan->bucket) != OK) {
+        return NG;
+      }
+      scan->position = 0;
+      continue;
+    }
+
+    /* 同じバケットには別の値の要素も入っている */
+    e = &scan->bucket->entry[scan->position++];
+    if (equalKey(scan->hash, &e->key, &scan->key)) {
+      *entry = e;
+      return OK;
+    }
+  }
+}
+
+/*
+ * closeHashScan -- ハッシュ索引の走査の終了
+ */
+void closeHashScan(HashScan *scan)
+{
+  if (scan == NULL) {
+    return;
+  }
+
+  free(scan->bucket);
+  free(scan);
+}
@@ -0,0 +1,1412 @@
+/*
+ * index.c -- 索引モジュール
+ *
+ * フィールドの値とレコードIDの組をキーとするB+木を、索引ファイル
+ * ([テーブル名].[索引名].idx)にページ単位で保存する。
+ * 値が同じレコードもレコードIDで区別できるので、木の中のキーはすべて異なる。
+ *
+ * 索引ファイルの構造
+ *  ページ0: メタ情報(根のページ番号、ページ数、キーのデータ型、木の高さ)
+ *  ページ1以降: 木の節
+ *
+ * 節のページの構造
+ *   +-----------+-----------+----------------------------------+--------
+ *   |葉かどうか |要素数     |葉: 右隣の葉のページ番号          |要素...
+ *   |           |           |内部節: 最も左の子のページ番号    |
+ *   +-----------+-----------+----------------------------------+--------
+ *  葉の要素: キーの値、レコードID、索引に含めるフィールドの値(あれば)
+ *  内部節の要素: キーの値、レコードID、子のページ番号
+ *  (内部節の要素のキー以上のキーは、その要素の子から右にある)
+ *
+ * 文字列型のキーは、直前の要素のキーと共通する先頭部分のバイト数と、
+ * 残りの部分だけを保存する(前方圧縮)。
+ *   +-----------------+-----------------+----------+-----------+-------
+ *   |共通部分の長さ   |残りの長さ       |残りの部分|レコードID |(子)
+ *   |(1バイト)        |(1バイト)        |          |           |
+ *   +-----------------+-----------------+----------+-----------+-------
+ * また、葉を分割したときに親に上げるキーは、左右を区別できる最も短い
+ * 先頭部分だけにする(内部節のキーは実在のキーでなくてよい)。
+ * こうして、MAX_STRINGバイトをそのまま並べるよりも多くの要素を1ページに収める。
+ *
+ * 削除では節の併合をしない(空になった葉も、右隣の葉へのつながりは残す)。
+ *
+ * 既にあるレコードから索引を作るときは、要素を1つずつ挿入するのではなく、
+ * 要素を整列してから、葉を左から順に満杯まで詰めて書き出し、その上の段を
+ * 下から順に作る(IndexBuilder)。
+ *
+ * 種類がハッシュの索引(INDEX_HASH)は、同じ名前の索引ファイルの中身を
+ * ハッシュ索引モジュール(hash.c)に任せる。このファイルの関数は、索引の
+ * 種類によらず同じように呼び出せる。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "microdb.h"
+
+/*
+ * INDEX_FILE_EXT -- 索引ファイルの拡張子
+ */
+#define INDEX_FILE_EXT ".idx"
+
+/*
+ * META_PAGE -- メタ情報を置くページの番号
+ */
+#define META_PAGE 0
+
+/*
+ * NO_PAGE -- ページがないことを表すページ番号
+ */
+#define NO_PAGE (-1)
+
+/*
+ * NODE_HEADER_SIZE -- 節のページの先頭の管理情報のバイト数
+ */
+#define NODE_HEADER_SIZE (sizeof(int) * 3)
+
+/*
+ * MAX_NODE_ENTRY -- 1つの節に収める要素数の上限
+ */
+#define MAX_NODE_ENTRY (PAGE_SIZE / 8)
+
+/*
+ * NodeEntry -- 節の要素
+ */
+typedef struct NodeEntry NodeEntry;
+struct NodeEntry {
+  IndexEntry entry;             /* キーの値とレコードID */
+  int child;                    /* 内部節の場合、この要素以上のキーを持つ子のページ番号 */
+};
+
+/*
+ * Node -- ページから読み出した節
+ *
+ * 分割する前に一時的に上限を1つ超えられるようにしてある。
+ */
+typedef struct Node Node;
+struct Node {
+  int pageNum;                  /* ページ番号 */
+  int isLeaf;                   /* 葉なら1 */
+  int numEntry;                 /* 要素数 */
+  int link;                     /* 葉: 右隣の葉、内部節: 最も左の子のページ番号 */
+  NodeEntry entry[MAX_NODE_ENTRY + 1];
+};
+
+/*
+ * Index -- オープンした索引の情報
+ */
+struct Index {
+  File *file;                   /* 索引ファイル */
+  HashIndex *hash;              /* ハッシュ索引の場合、その情報(B+木ならNULL) */
+  DataType keyType;             /* キーのデータ型 */
+  int payloadSize;              /* 葉の要素に含めるフィールドの値のバイト数 */
+  int rootPage;                 /* 根のページ番号 */
+  int numPage;                  /* 索引ファイルのページ数 */
+  int height;                   /* 木の高さ(根だけなら1) */
+};
+
+/*
+ * IndexScan -- 索引を葉の順にたどる走査の状態
+ */
+struct IndexScan {
+  Index *index;                 /* 走査する索引 */
+  HashScan *hashScan;           /* ハッシュ索引の場合、その走査(B+木ならNULL) */
+  OperatorType operator;        /* 比較演算子 */
+  ValueSet key;                 /* 比較する値 */
+  Node *leaf;                   /* 読んでいる葉(走査が終わったらNULL) */
+  int position;                 /* 葉の中で次に返す要素の番号 */
+};
+
+/*
+ * MAX_LEVEL -- 一括作成で扱う木の高さの上限
+ */
+#define MAX_LEVEL 32
+
+/*
+ * IndexBuilder -- 整列した要素から索引を一括作成する途中の状態
+ *
+ * 葉から根に向かって、各段で作成中の節を1つずつ持つ。
+ * 節がいっぱいになったら書き出し、次の節への要素を1つ上の段に加える。
+ */
+struct IndexBuilder {
+  Index *index;                 /* 作成する索引 */
+  Sorter *sorter;               /* 要素の整列(ハッシュ索引ならNULL) */
+  int keyBytes;                 /* 整列用の要素の中のキーのバイト数 */
+  char *sortEntry;              /* 整列用の要素を作る領域 */
+  int height;                   /* 作成中の段の数 */
+  Node *level[MAX_LEVEL];       /* 各段で作成中の節(0が葉) */
+  int size[MAX_LEVEL];          /* 作成中の節をページに書き出すのに必要なバイト数 */
+};
+
+/*
+ * getIndexFileName -- 索引ファイルのファイル名の作成
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  indexName: 索引の名前
+ *
+ * 返り値:
+ *  [tableName].[indexName].idxという文字列を返す。失敗したらNULLを返す。
+ *  返した文字列は、不要になったらfreeで解放すること。
+ */
+static char *getIndexFileName(char *tableName, char *indexName)
+{
+  int len;
+  char *filename;
+
+  len = strlen(tableName) + strlen(indexName) + strlen(INDEX_FILE_EXT) + 2;
+  if ((filename = malloc(len)) == NULL) {
+    return NULL;
+  }
+  snprintf(filename, len, "%s.%s%s", tableName, indexName, INDEX_FILE_EXT);
+
+  return filename;
+}
+
+/*
+ * getPayloadSize -- 索引の葉の要素に含めるフィールドの値のバイト数
+ */
+static int getPayloadSize(IndexInfo *indexInfo)
+{
+  int i, size = 0;
+
+  for (i = 0; i < indexInfo->numInclude; i++) {
+    size += (indexInfo->includeType[i] == TYPE_INTEGER) ? sizeof(int) : MAX_STRING;
+  }
+
+  return size;
+}
+
+/*
+ * compareKey -- キーの値の比較
+ *
+ * 返り値:
+ *  aがbより小さければ負、等しければ0、大きければ正の値
+ */
+static int compareKey(DataType keyType, ValueSet *a, ValueSet *b)
+{
+  if (keyType == TYPE_INTEGER) {
+    return (a->intValue > b->intValue) - (a->intValue < b->intValue);
+  }
+
+  return strncmp(a->stringValue, b->stringValue, MAX_STRING);
+}
+
+/*
+ * compareEntry -- キーの値とレコードIDの組の比較
+ */
+static int compareEntry(DataType keyType, IndexEntry *a, IndexEntry *b)
+{
+  int cmp;
+
+  if ((cmp = compareKey(keyType, &a->key, &b->key)) != 0) {
+    return cmp;
+  }
+  if (a->recordId.pageNum != b->recordId.pageNum) {
+    return (a->recordId.pageNum > b->recordId.pageNum) ? 1 : -1;
+  }
+
+  return (a->recordId.slotNum > b->recordId.slotNum) - (a->recordId.slotNum < b->recordId.slotNum);
+}
+
+/*
+ * getKeyLength -- 文字列型のキーの長さ(終端文字を含まない、MAX_STRING以下)
+ */
+static int getKeyLength(ValueSet *key)
+{
+  int len;
+
+  for (len = 0; len < MAX_STRING && key->stringValue[len] != '\0'; len++) {
+  }
+
+  return len;
+}
+
+/*
+ * getCommonPrefix -- 2つの文字列型のキーの、共通する先頭部分のバイト数
+ */
+static int getCommonPrefix(ValueSet *a, int lenA, ValueSet *b, int lenB)
+{
+  int n = 0;
+
+  while (n < lenA && n < lenB && a->stringValue[n] == b->stringValue[n]) {
+    n++;
+  }
+
+  return n;
+}
+
+/*
+ * getEntrySize -- 節のi番目の要素を書き出すのに必要なバイト数
+ */
+static int getEntrySize(Index *index, Node *node, int i)
+{
+  int size, len;
+
+  if (index->keyType == TYPE_INTEGER) {
+    size = sizeof(int);
+  } else {
+    /* 直前の要素と共通する先頭部分は保存しない */
+    len = getKeyLength(&node->entry[i].entry.key);
+    size = 2 + len;
+    if (i > 0) {
+      size -= getCommonPrefix(&node->entry[i - 1].entry.key, getKeyLength(&node->entry[i - 1].entry.key),
+                              &node->entry[i].entry.key, len);
+    }
+  }
+  size += sizeof(int) * 2;
+  if (node->isLeaf) {
+    size += index->payloadSize;
+  } else {
+    size += sizeof(int);
+  }
+
+  return size;
+}
+
+/*
+ * getNodeSize -- 節をページに書き出すのに必要なバイト数
+ */
+static int getNodeSize(Index *index, Node *node)
+{
+  int i, size = NODE_HEADER_SIZE;
+
+  for (i = 0; i < node->numEntry; i++) {
+    size += getEntrySize(index, node, i);
+  }
+
+  return size;
+}
+
+/*
+ * encodeKey -- キーをページに書き込む
+ *
+ * 引数:
+ *  index: 索引
+ *  node: 節
+ *  i: 書き込む要素の番号
+ *  p: 書き込む位置
+ *
+ * 返り値:
+ *  書き込んだバイト数
+ */
+static int encodeKey(Index *index, Node *node, int i, char *p)
+{
+  ValueSet *key = &node->entry[i].entry.key;
+  int len, prefix = 0;
+
+  if (index->keyType == TYPE_INTEGER) {
+    memcpy(p, &key->intValue, sizeof(int));
+    return sizeof(int);
+  }
+
+  len = getKeyLength(key);
+  if (i > 0) {
+    prefix = getCommonPrefix(&node->entry[i - 1].entry.key, getKeyLength(&node->entry[i - 1].entry.key),
+                             key, len);
+  }
+  p[0] = (char) prefix;
+  p[1] = (char) (len - prefix);
+  memcpy(p + 2, key->stringValue + prefix, len - prefix);
+
+  return 2 + len - prefix;
+}
+
+/*
+ * decodeKey -- ページからキーを読み出す
+ *
+ * 引数:
+ *  index: 索引
+ *  node: 節(i-1番目までの要素は読み出し済み)
+ *  i: 読み出す要素の番号
+ *  p: 読み出す位置
+ *
+ * 返り値:
+ *  読み出したバイト数
+ */
+static int decodeKey(Index *index, Node *node, int i, char *p)
+{
+  ValueSet *key = &node->entry[i].entry.key;
+  int prefix, suffix;
+
+  memset(key, 0, sizeof(ValueSet));
+  if (index->keyType == TYPE_INTEGER) {
+    memcpy(&key->intValue, p, sizeof(int));
+    return sizeof(int);
+  }
+
+  prefix = (unsigned char) p[0];
+  suffix = (unsigned char) p[1];
+  if (i > 0) {
+    memcpy(key->stringValue, node->entry[i - 1].entry.key.stringValue, prefix);
+  }
+  memcpy(key->stringValue + prefix, p + 2, suffix);
+
+  return 2 + suffix;
+}
+
+/*
+ * encodeNode -- 節をページのバイト列にする
+ */
+static void encodeNode(Index *index, Node *node, char *page)
+{
+  int i;
+  char *p = page;
+
+  memset(page, 0, PAGE_SIZE);
+  memcpy(p, &node->isLeaf, sizeof(int));
+  p += sizeof(int);
+  memcpy(p, &node->numEntry, sizeof(int));
+  p += sizeof(int);
+  memcpy(p, &node->link, sizeof(int));
+  p += sizeof(int);
+
+  for (i = 0; i < node->numEntry; i++) {
+    p += encodeKey(index, node, i, p);
+    memcpy(p, &node->entry[i].entry.recordId.pageNum, sizeof(int));
+    p += sizeof(int);
+    memcpy(p, &node->entry[i].entry.recordId.slotNum, sizeof(int));
+    p += sizeof(int);
+    if (node->isLeaf) {
+      memcpy(p, node->entry[i].entry.payload, index->payloadSize);
+      p += index->payloadSize;
+    } else {
+      memcpy(p, &node->entry[i].child, sizeof(int));
+      p += sizeof(int);
+    }
+  }
+}
+
+/*
+ * decodeNode -- ページのバイト列から節を読み出す
+ */
+static void decodeNode(Index *index, char *page, Node *node)
+{
+  int i;
+  char *p = page;
+
+  memcpy(&node->isLeaf, p, sizeof(int));
+  p += sizeof(int);
+  memcpy(&node->numEntry, p, sizeof(int));
+  p += sizeof(int);
+  memcpy(&node->link, p, sizeof(int));
+  p += sizeof(int);
+
+  for (i = 0; i < node->numEntry; i++) {
+    p += decodeKey(index, node, i, p);
+    memcpy(&node->entry[i].entry.recordId.pageNum, p, sizeof(int));
+    p += sizeof(int);
+    memcpy(&node->entry[i].entry.recordId.slotNum, p, sizeof(int));
+    p += sizeof(int);
+    node->entry[i].child = NO_PAGE;
+    if (node->isLeaf) {
+      memcpy(node->entry[i].entry.payload, p, index->payloadSize);
+      p += index->payloadSize;
+    } else {
+      memcpy(&node->entry[i].child, p, sizeof(int));
+      p += sizeof(int);
+    }
+  }
+}
+
+/*
+ * readNode -- 節の読み出し
+ */
+static Result readNode(Index *index, int pageNum, Node *node)
+{
+  char page[PAGE_SIZE];
+
+  if (pageNum <= META_PAGE || pageNum >= index->numPage) {
+    return NG;
+  }
+  if (readPage(index->file, pageNum, page) != OK) {
+    return NG;
+  }
+  decodeNode(index, page, node);
+  node->pageNum = pageNum;
+
+  return OK;
+}
+
+/*
+ * writeNode -- 節の書き出し
+ */
+static Result writeNode(Index *index, Node *node)
+{
+  char page[PAGE_SIZE];
+
+  encodeNode(index, node, page);
+  return writePage(index->file, node->pageNum, page);
+}
+
+/*
+ * writeMeta -- メタ情報の書き出し
+ */
+static Result writeMeta(Index *index)
+{
+  char page[PAGE_SIZE];
+  char *p = page;
+
+  memset(page, 0, PAGE_SIZE);
+  memcpy(p, &index->rootPage, sizeof(int));
+  p += sizeof(int);
+  memcpy(p, &index->numPage, sizeof(int));
+  p += sizeof(int);
+  memcpy(p, &index->keyType, sizeof(DataType));
+  p += sizeof(DataType);
+  memcpy(p, &index->height, sizeof(int));
+
+  return writePage(index->file, META_PAGE, page);
+}
+
+/*
+ * readMeta -- メタ情報の読み出し
+ */
+static Result readMeta(Index *index)
+{
+  char page[PAGE_SIZE];
+  char *p = page;
+
+  if (readPage(index->file, META_PAGE, page) != OK) {
+    return NG;
+  }
+  memcpy(&index->rootPage, p, sizeof(int));
+  p += sizeof(int);
+  memcpy(&index->numPage, p, sizeof(int));
+  p += sizeof(int);
+  memcpy(&index->keyType, p, sizeof(DataType));
+  p += sizeof(DataType);
+  memcpy(&index->height, p, sizeof(int));
+
+  return OK;
+}
+
+/*
+ * lowerBound -- 節の中で、entry以上の最初の要素の番号を二分探索で求める
+ */
+static int lowerBound(Index *index, Node *node, IndexEntry *entry)
+{
+  int lo = 0, hi = node->numEntry, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (compareEntry(index->keyType, &node->entry[mid].entry, entry) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+/*
+ * findChild -- 内部節で、entryをたどるべき子を求める
+ *
+ * 返り値:
+ *  entry以下の要素の数(子は、0なら最も左の子、そうでなければその直前の要素の子)
+ */
+static int findChild(Index *index, Node *node, IndexEntry *entry)
+{
+  int lo = 0, hi = node->numEntry, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (compareEntry(index->keyType, &node->entry[mid].entry, entry) <= 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+/*
+ * childPage -- findChildの結果から子のページ番号を得る
+ */
+static int childPage(Node *node, int position)
+{
+  return (position == 0) ? node->link : node->entry[position - 1].child;
+}
+
+/*
+ * createIndexFile -- 空の索引ファイルの作成
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  indexInfo: 作成する索引の定義
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+Result createIndexFile(char *tableName, IndexInfo *indexInfo)
+{
+  Index index;
+  Node *root;
+  char *filename;
+  Result ret;
+
+  if ((filename = getIndexFileName(tableName, indexInfo->name)) == NULL) {
+    return NG;
+  }
+  if (createFile(filename) != OK || (index.file = openFile(filename)) == NULL) {
+    free(filename);
+    return NG;
+  }
+  free(filename);
+
+  if (indexInfo->indexType == INDEX_HASH) {
+    ret = createHashFile(index.file, indexInfo->dataType);
+    if (closeFile(index.file) != OK) {
+      return NG;
+    }
+    return ret;
+  }
+
+  /* 空の葉を1つだけ持つ木にする */
+  index.keyType = indexInfo->dataType;
+  index.payloadSize = getPayloadSize(indexInfo);
+  index.rootPage = 1;
+  index.numPage = 2;
+  index.height = 1;
+
+  if ((root = malloc(sizeof(Node))) == NULL) {
+    closeFile(index.file);
+    return NG;
+  }
+  root->pageNum = index.rootPage;
+  root->isLeaf = 1;
+  root->numEntry = 0;
+  root->link = NO_PAGE;
+
+  ret = writeMeta(&index);
+  if (ret == OK) {
+    ret = writeNode(&index, root);
+  }
+  free(root);
+
+  if (closeFile(index.file) != OK) {
+    return NG;
+  }
+
+  return ret;
+}
+
+/*
+ * deleteIndexFile -- 索引ファイルの削除
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  indexName: 削除する索引の名前
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+Result deleteIndexFile(char *tableName, char *indexName)
+{
+  char *filename;
+  Result ret;
+
+  if ((filename = getIndexFileName(tableName, indexName)) == NULL) {
+    return NG;
+  }
+  ret = deleteFile(filename);
+  free(filename);
+
+  return ret;
+}
+
+/*
+ * openIndex -- 索引のオープン
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  indexInfo: オープンする索引の定義
+ *
+ * 返り値:
+ *  オープンした索引を返す。失敗したらNULLを返す。
+ *
+ * ***注意***
+ *  同じ索引を同時に2回オープンしないこと(バッファがファイルごとに別になるため)。
+ *  使い終わったら必ずcloseIndexでクローズすること。
+ */
+Index *openIndex(char *tableName, IndexInfo *indexInfo)
+{
+  Index *index;
+  char *filename;
+
+  if ((filename = getIndexFileName(tableName, indexInfo->name)) == NULL) {
+    return NULL;
+  }
+  if ((index = malloc(sizeof(Index))) == NULL) {
+    free(filename);
+    return NULL;
+  }
+  if ((index->file = openFile(filename)) == NULL) {
+    free(filename);
+    free(index);
+    return NULL;
+  }
+  free(filename);
+
+  index->hash = NULL;
+  index->payloadSize = getPayloadSize(indexInfo);
+  if (indexInfo->indexType == INDEX_HASH) {
+    index->keyType = indexInfo->dataType;
+    index->hash = openHashIndex(index->file);
+    if (index->hash == NULL) {
+      closeFile(index->file);
+      free(index);
+      return NULL;
+    }
+  } else if (readMeta(index) != OK) {
+    closeFile(index->file);
+    free(index);
+    return NULL;
+  }
+
+  return index;
+}
+
+/*
+ * closeIndex -- 索引のクローズ
+ *
+ * 引数:
+ *  index: クローズする索引
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+Result closeIndex(Index *index)
+{
+  Result ret;
+
+  if (index == NULL) {
+    return OK;
+  }
+
+  if (index->hash != NULL) {
+    ret = closeHashIndex(index->hash);
+  } else {
+    ret = writeMeta(index);
+  }
+  if (closeFile(index->file) != OK) {
+    ret = NG;
+  }
+  free(index);
+
+  return ret;
+}
+
+/*
+ * makeSeparator -- 葉を分割したときに親に上げるキーを作る
+ *
+ * 引数:
+ *  index: 索引
+ *  left: 左の葉の最後の要素
+ *  right: 右の葉の最初の要素
+ *  separator: 作ったキーを書き込む領域
+ *
+ * 返り値:
+ *  なし
+ *
+ * left < separator <= rightであればよいので、文字列型のキーの値が
+ * 異なるときは、leftより大きくなるrightの最も短い先頭部分を使い、
+ * レコードIDは最小の値にする。
+ */
+static void makeSeparator(Index *index, IndexEntry *left, IndexEntry *right, IndexEntry *separator)
+{
+  int n, len;
+
+  *separator = *right;
+  if (index->keyType != TYPE_STRING || compareKey(index->keyType, &left->key, &right->key) == 0) {
+    return;
+  }
+
+  len = getKeyLength(&right->key);
+  for (n = 1; n < len; n++) {
+    memset(&separator->key, 0, sizeof(ValueSet));
+    memcpy(separator->key.stringValue, right->key.stringValue, n);
+    if (compareKey(index->keyType, &left->key, &separator->key) < 0) {
+      break;
+    }
+  }
+  if (n == len) {
+    separator->key = right->key;
+  }
+  separator->recordId.pageNum = INT_MIN;
+  separator->recordId.slotNum = INT_MIN;
+}
+
+/*
+ * splitNode -- 大きくなりすぎた節を2つに分ける
+ *
+ * 引数:
+ *  index: 索引
+ *  node: 分ける節(左半分が残る)
+ *  separator: 親に加える要素(右の節の最小のキーと、右の節のページ番号)を返す領域
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+static Result splitNode(Index *index, Node *node, NodeEntry *separator)
+{
+  Node *right;
+  int mid;
+  Result ret;
+
+  if ((right = malloc(sizeof(Node))) == NULL) {
+    return NG;
+  }
+  right->pageNum = index->numPage++;
+  right->isLeaf = node->isLeaf;
+  mid = node->numEntry / 2;
+  if (mid < 1) {
+    mid = 1;
+  }
+
+  if (node->isLeaf) {
+    /* 葉は後半をそのまま右の葉に移し、右の葉の先頭を親に加える */
+    right->numEntry = node->numEntry - mid;
+    memcpy(right->entry, node->entry + mid, sizeof(NodeEntry) * right->numEntry);
+    right->link = node->link;
+    node->link = right->pageNum;
+    makeSeparator(index, &node->entry[mid - 1].entry, &right->entry[0].entry, &separator->entry);
+  } else {
+    /* 内部節は真ん中の要素を親に上げ、その子を右の節の最も左の子にする */
+    separator->entry = node->entry[mid].entry;
+    right->link = node->entry[mid].child;
+    right->numEntry = node->numEntry - mid - 1;
+    memcpy(right->entry, node->entry + mid + 1, sizeof(NodeEntry) * right->numEntry);
+  }
+  node->numEntry = mid;
+  separator->child = right->pageNum;
+
+  ret = writeNode(index, right);
+  if (ret == OK) {
+    ret = writeNode(index, node);
+  }
+  free(right);
+
+  return ret;
+}
+
+/*
+ * insertIntoNode -- 部分木への要素の挿入
+ *
+ * 引数:
+ *  index: 索引
+ *  pageNum: 部分木の根のページ番号
+ *  newEntry: 挿入する要素
+ *  separator: 部分木の根が分割されたとき、親に加える要素を返す領域
+ *  split: 部分木の根が分割されたら1、そうでなければ0を返す領域
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+static Result insertIntoNode(Index *index, int pageNum, IndexEntry *newEntry,
+                             NodeEntry *separator, int *split)
+{
+  Node *node;
+  NodeEntry childSeparator;
+  int position, childSplit;
+  Result ret = NG;
+
+  *split = 0;
+  if ((node = malloc(sizeof(Node))) == NULL) {
+    return NG;
+  }
+  if (readNode(index, pageNum, node) != OK) {
+    goto cleanup;
+  }
+
+  if (node->isLeaf) {
+    position = lowerBound(index, node, newEntry);
+    if (position < node->numEntry
+        && compareEntry(index->keyType, &node->entry[position].entry, newEntry) == 0) {
+      /* 既に同じ要素がある */
+      ret = OK;
+      goto cleanup;
+    }
+    childSeparator.entry = *newEntry;
+    childSeparator.child = NO_PAGE;
+  } else {
+    position = findChild(index, node, newEntry);
+    if (insertIntoNode(index, childPage(node, position), newEntry,
+                       &childSeparator, &childSplit) != OK) {
+      goto cleanup;
+    }
+    if (!childSplit) {
+      ret = OK;
+      goto cleanup;
+    }
+  }
+
+  /* 節に要素を加え、ページに収まらなければ分割する */
+  memmove(node->entry + position + 1, node->entry + position,
+          sizeof(NodeEntry) * (node->numEntry - position));
+  node->entry[position] = childSeparator;
+  node->numEntry++;
+
+  if (node->numEntry <= MAX_NODE_ENTRY && getNodeSize(index, node) <= PAGE_SIZE) {
+    ret = writeNode(index, node);
+  } else {
+    ret = splitNode(index, node, separator);
+    *split = (ret == OK);
+  }
+
+cleanup:
+  free(node);
+  return ret;
+}
+
+/*
+ * insertIndexEntry -- 索引への要素の挿入
+ *
+ * 引数:
+ *  index: 索引
+ *  entry: 挿入するキーの値とレコードID
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+Result insertIndexEntry(Index *index, IndexEntry *entry)
+{
+  Node *root;
+  NodeEntry separator;
+  int split;
+  Result ret;
+
+  if (index->hash != NULL) {
+    return insertHashEntry(index->hash, entry);
+  }
+
+  if (insertIntoNode(index, index->rootPage, entry, &separator, &split) != OK) {
+    return NG;
+  }
+  if (!split) {
+    return OK;
+  }
+
+  /* 根が分割されたら、2つの節を子に持つ新しい根を作る */
+  if ((root = malloc(sizeof(Node))) == NULL) {
+    return NG;
+  }
+  root->pageNum = index->numPage++;
+  root->isLeaf = 0;
+  root->link = index->rootPage;
+  root->numEntry = 1;
+  root->entry[0] = separator;
+
+  ret = writeNode(index, root);
+  if (ret == OK) {
+    index->rootPage = root->pageNum;
+    index->height++;
+  }
+  free(root);
+  if (ret != OK) {
+    return NG;
+  }
+
+
+  return writeMeta(index);
+}
+
+/*
+ * deleteIndexEntry -- 索引からの要素の削除
+ *
+ * 引数:
+ *  index: 索引
+ *  entry: 削除するキーの値とレコードID
+ *
+ * 返り値:
+ *  成功ならOK、要素が見つからないか失敗ならNGを返す
+ */
+Result deleteIndexEntry(Index *index, IndexEntry *entry)
+{
+  Node *node;
+  int pageNum, position;
+  Result ret = NG;
+
+  if (index->hash != NULL) {
+    return deleteHashEntry(index->hash, entry);
+  }
+
+  if ((node = malloc(sizeof(Node))) == NULL) {
+    return NG;
+  }
+
+  /* 要素のある葉までたどる */
+  pageNum = index->rootPage;
+  for (;;) {
+    if (readNode(index, pageNum, node) != OK) {
+      free(node);
+      return NG;
+    }
+    if (node->isLeaf) {
+      break;
+    }
+    pageNum = childPage(node, findChild(index, node, entry));
+  }
+
+  position = lowerBound(index, node, entry);
+  if (position < node->numEntry
+      && compareEntry(index->keyType, &node->entry[position].entry, entry) == 0) {
+    memmove(node->entry + position, node->entry + position + 1,
+            sizeof(NodeEntry) * (node->numEntry - position - 1));
+    node->numEntry--;
+    ret = writeNode(index, node);
+  }
+
+  free(node);
+  return ret;
+}
+
+/*
+ * putOrderedInt -- 整数を、バイト列の大小が値の大小と一致する形で書き込む
+ */
+static void putOrderedInt(char *p, int value)
+{
+  unsigned int u = (unsigned int) value ^ 0x80000000u;
+
+  p[0] = (u >> 24) & 0xff;
+  p[1] = (u >> 16) & 0xff;
+  p[2] = (u >> 8) & 0xff;
+  p[3] = u & 0xff;
+}
+
+/*
+ * getOrderedInt -- putOrderedIntで書き込んだ整数を読み出す
+ */
+static int getOrderedInt(char *p)
+{
+  unsigned int u;
+
+  u = ((unsigned int) (p[0] & 0xff) << 24) | ((p[1] & 0xff) << 16) | ((p[2] & 0xff) << 8) | (p[3] & 0xff);
+  return (int) (u ^ 0x80000000u);
+}
+
+/*
+ * encodeSortEntry -- 要素を、整列用のバイト列にする
+ *
+ * キーの値、レコードIDのページ番号、ページの中での番号の順に並べ、
+ * バイト列の大小(memcmp)が要素の大小(compareEntry)と一致するようにする。
+ * 文字列型のキーは0で埋めたMAX_STRINGバイトをそのまま使う。
+ * 索引に含めるフィールドの値は、整列のキーにしない部分として後ろに付ける。
+ */
+static void encodeSortEntry(IndexBuilder *builder, IndexEntry *entry, char *p)
+{
+  if (builder->index->keyType == TYPE_INTEGER) {
+    putOrderedInt(p, entry->key.intValue);
+  } else {
+    memcpy(p, entry->key.stringValue, MAX_STRING);
+  }
+  p += builder->keyBytes;
+  putOrderedInt(p, entry->recordId.pageNum);
+  putOrderedInt(p + sizeof(int), entry->recordId.slotNum);
+  memcpy(p + sizeof(int) * 2, entry->payload, builder->index->payloadSize);
+}
+
+/*
+ * decodeSortEntry -- 整列用のバイト列から要素を読み出す
+ */
+static void decodeSortEntry(IndexBuilder *builder, char *p, IndexEntry *entry)
+{
+  memset(&entry->key, 0, sizeof(ValueSet));
+  if (builder->index->keyType == TYPE_INTEGER) {
+    entry->key.intValue = getOrderedInt(p);
+  } else {
+    memcpy(entry->key.stringValue, p, MAX_STRING);
+  }
+  p += builder->keyBytes;
+  entry->recordId.pageNum = getOrderedInt(p);
+  entry->recordId.slotNum = getOrderedInt(p + sizeof(int));
+  memcpy(entry->payload, p + sizeof(int) * 2, builder->index->payloadSize);
+}
+
+/*
+ * createIndexBuilder -- 索引の一括作成の開始
+ *
+ * 引数:
+ *  index: 作成する索引(createIndexFileで作ったばかりの空の索引)
+ *  memoryLimit: 要素の整列に使うメモリの上限(バイト数)
+ *
+ * 返り値:
+ *  一括作成の状態を返す。索引が空でないか、失敗したらNULLを返す。
+ *
+ * ***注意***
+ *  addBuildEntryで要素を加え、buildIndexで索引を書き出した後、
+ *  必ずfreeIndexBuilderで解放すること。
+ *  ハッシュ索引の場合は、加えた要素をそのまま挿入する。
+ */
+IndexBuilder *createIndexBuilder(Index *index, long memoryLimit)
+{
+  IndexBuilder *builder;
+  Node *root;
+  int keySize;
+
+  if ((builder = malloc(sizeof(IndexBuilder))) == NULL) {
+    return NULL;
+  }
+  builder->index = index;
+  builder->sorter = NULL;
+  builder->sortEntry = NULL;
+  builder->height = 0;
+  if (index->hash != NULL) {
+    return builder;
+  }
+
+  /* 空の葉だけの木でなければならない(その葉を最も左の葉として使う) */
+  if (index->height != 1 || (root = malloc(sizeof(Node))) == NULL) {
+    free(builder);
+    return NULL;
+  }
+  if (readNode(index, index->rootPage, root) != OK || root->numEntry != 0) {
+    free(root);
+    free(builder);
+    return NULL;
+  }
+  builder->level[0] = root;
+  builder->size[0] = NODE_HEADER_SIZE;
+  builder->height = 1;
+
+  builder->keyBytes = (index->keyType == TYPE_INTEGER) ? sizeof(int) : MAX_STRING;
+  keySize = builder->keyBytes + sizeof(int) * 2;
+  if ((builder->sortEntry = malloc(keySize + index->payloadSize)) == NULL
+      || (builder->sorter = createSorter(keySize + index->payloadSize, keySize, memoryLimit)) == NULL) {
+    freeIndexBuilder(builder);
+    return NULL;
+  }
+
+  return builder;
+}
+
+/*
+ * addBuildEntry -- 一括作成する索引への要素の追加
+ *
+ * 引数:
+ *  builder: 一括作成の状態
+ *  entry: 追加するキーの値とレコードID(順序は問わない)
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+Result addBuildEntry(IndexBuilder *builder, IndexEntry *entry)
+{
+  if (builder->sorter == NULL) {
+    return insertHashEntry(builder->index->hash, entry);
+  }
+
+  encodeSortEntry(builder, entry, builder->sortEntry);
+  return addSortEntry(builder->sorter, builder->sortEntry);
+}
+
+/*
+ * appendBuildEntry -- 作成中の節の右端に要素を加える
+ *
+ * 引数:
+ *  builder: 一括作成の状態
+ *  k: 要素を加える段(0が葉)
+ *  newEntry: 加える要素(内部節の場合、childが新しい子のページ番号)
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 節がページに収まらなくなったら、それを書き出して同じ段の次の節を始め、
+ * 次の節への要素を1つ上の段に加える(なければ上の段を作る)。
+ * 葉の場合は次の葉の最初の要素がnewEntryになり、内部節の場合は
+ * newEntryのキーが上の段に上がって、その子が次の節の最も左の子になる。
+ */
+static Result appendBuildEntry(IndexBuilder *builder, int k, NodeEntry *newEntry)
+{
+  Index *index = builder->index;
+  Node *node = builder->level[k];
+  Node *parent;
+  NodeEntry separator;
+  int size, nextPage, prevPage;
+
+  node->entry[node->numEntry] = *newEntry;
+  size = builder->size[k] + getEntrySize(index, node, node->numEntry);
+  if (node->numEntry < MAX_NODE_ENTRY && size <= PAGE_SIZE) {
+    node->numEntry++;
+    builder->size[k] = size;
+    return OK;
+  }
+  if (node->numEntry == 0) {
+    return NG;
+  }
+
+  /* 今の節を書き出す(次の節のページは書き出す前に決める) */
+  nextPage = index->numPage++;
+  if (node->isLeaf) {
+    makeSeparator(index, &node->entry[node->numEntry - 1].entry, &newEntry->entry, &separator.entry);
+    node->link = nextPage;
+  } else {
+    separator.entry = newEntry->entry;
+  }
+  separator.child = nextPage;
+  prevPage = node->pageNum;
+  if (writeNode(index, node) != OK) {
+    return NG;
+  }
+
+  /* 同じ段の次の節を始める */
+  node->pageNum = nextPage;
+  node->numEntry = 0;
+  builder->size[k] = NODE_HEADER_SIZE;
+  if (node->isLeaf) {
+    node->link = NO_PAGE;
+    node->entry[0] = *newEntry;
+    node->numEntry = 1;
+    builder->size[k] += getEntrySize(index, node, 0);
+  } else {
+    node->link = newEntry->child;
+  }
+
+  /* 上の段がなければ、今の節を最も左の子とする節を作る */
+  if (k + 1 == builder->height) {
+    if (builder->height == MAX_LEVEL || (parent = malloc(sizeof(Node))) == NULL) {
+      return NG;
+    }
+    parent->pageNum = index->numPage++;
+    parent->isLeaf = 0;
+    parent->numEntry = 0;
+    parent->link = prevPage;
+    builder->level[k + 1] = parent;
+    builder->size[k + 1] = NODE_HEADER_SIZE;
+    builder->height++;
+  }
+
+  return appendBuildEntry(builder, k + 1, &separator);
+}
+
+/*
+ * buildIndex -- 追加した要素を整列し、索引を書き出す
+ *
+ * 引数:
+ *  builder: 一括作成の状態
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 葉は左から順に、ページに収まるだけ要素を詰めて書き出す。
+ */
+Result buildIndex(IndexBuilder *builder)
+{
+  Index *index = builder->index;
+  NodeEntry newEntry;
+  char *p;
+  int k;
+
+  if (builder->sorter == NULL) {
+    return OK;
+  }
+
+  if (sortEntries(builder->sorter) != OK) {
+    return NG;
+  }
+  newEntry.child = NO_PAGE;
+  for (;;) {
+    if (getNextSortEntry(builder->sorter, &p) != OK) {
+      return NG;
+    }
+    if (p == NULL) {
+      break;
+    }
+    decodeSortEntry(builder, p, &newEntry.entry);
+    if (appendBuildEntry(builder, 0, &newEntry) != OK) {
+      return NG;
+    }
+  }
+
+  /* 各段で作成中の節を書き出し、最も上の段の節を根にする */
+  for (k = 0; k < builder->height; k++) {
+    if (writeNode(index, builder->level[k]) != OK) {
+      return NG;
+    }
+  }
+  index->rootPage = builder->level[builder->height - 1]->pageNum;
+  index->height = builder->height;
+
+  return writeMeta(index);
+}
+
+/*
+ * freeIndexBuilder -- 索引の一括作成の状態の解放
+ */
+void freeIndexBuilder(IndexBuilder *builder)
+{
+  int k;
+
+  if (builder == NULL) {
+    return;
+  }
+
+  for (k = 0; k < builder->height; k++) {
+    free(builder->level[k]);
+  }
+  if (builder->sorter != NULL) {
+    freeSorter(builder->sorter);
+  }
+  free(builder->sortEntry);
+  free(builder);
+}
+
+/*
+ * openIndexScan -- 索引の走査の開始
+ *
+ * 引数:
+ *  index: 走査する索引
+ *  operator: 比較演算子(OPR_EQUAL, OPR_LESS_THAN, OPR_GREATER_THAN)
+ *  key: 比較する値
+ *
+ * 返り値:
+ *  「フィールドの値 operator key」を満たす要素を、キーの順に返す走査を返す。
+ *  失敗したらNULLを返す。
+ *  ハッシュ索引はOPR_EQUALだけを扱い、要素の順序は決まっていない。
+ *
+ * ***注意***
+ *  返した走査は、不要になったら必ずcloseIndexScanで解放すること。
+ */
+IndexScan *openIndexScan(Index *index, OperatorType operator, ValueSet *key)
+{
+  IndexScan *scan;
+  IndexEntry target;
+  int pageNum;
+
+  if (operator != OPR_EQUAL && operator != OPR_LESS_THAN && operator != OPR_GREATER_THAN) {
+    return NULL;
+  }
+
+  if (index->hash != NULL && operator != OPR_EQUAL) {
+    return NULL;
+  }
+
+  if ((scan = malloc(sizeof(IndexScan))) == NULL) {
+    return NULL;
+  }
+  scan->hashScan = NULL;
+  scan->leaf = NULL;
+  if (index->hash != NULL) {
+    scan->index = index;
+    if ((scan->hashScan = openHashScan(index->hash, key)) == NULL) {
+      free(scan);
+      return NULL;
+    }
+    return scan;
+  }
+
+  if ((scan->leaf = malloc(sizeof(Node))) == NULL) {
+    free(scan);
+    return NULL;
+  }
+  scan->index = index;
+  scan->operator = operator;
+  scan->key = *key;
+
+  /*
+   * 等しい値は、その値を持つ最小の要素から、大きい値は、その値を持つ
+   * 最大の要素の次から始める。小さい値は、最も左の葉から始める。
+   */
+  target.key = *key;
+  if (operator == OPR_GREATER_THAN) {
+    target.recordId.pageNum = INT_MAX;
+    target.recordId.slotNum = INT_MAX;
+  } else {
+    target.recordId.pageNum = INT_MIN;
+    target.recordId.slotNum = INT_MIN;
+  }
+
+  pageNum = index->rootPage;
+  for (;;) {
+    if (readNode(index, pageNum, scan->leaf) != OK) {
+      closeIndexScan(scan);
+      return NULL;
+    }
+    if (scan->leaf->isLeaf) {
+      break;
+    }
+    if (operator == OPR_LESS_THAN) {
+      pageNum = scan->leaf->link;
+    } else {
+      pageNum = childPage(scan->leaf, findChild(index, scan->leaf, &target));
+    }
+  }
+
+  scan->position = (operator == OPR_LESS_THAN) ? 0 : lowerBound(index, scan->leaf, &target);
+
+  return scan;
+}
+
+/*
+ * getNextIndexEntry -- 索引の走査で次の要素を取り出す
+ *
+ * 引数:
+ *  scan: 索引の走査
+ *  entry: 要素へのポインタを返す領域(もう要素がなければNULL)
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 返した要素の領域は、次にこの関数を呼び出すまで有効である。
+ */
+Result getNextIndexEntry(IndexScan *scan, IndexEntry **entry)
+{
+  IndexEntry *e;
+  int cmp;
+
+  *entry = NULL;
+
+  if (scan->hashScan != NULL) {
+    return getNextHashEntry(scan->hashScan, entry);
+  }
+
+  /* 読んでいる葉を使い切ったら、右隣の葉に移る */
+  for (;;) {
+    if (scan->leaf == NULL) {
+      return OK;
+    }
+    if (scan->position < scan->leaf->numEntry) {
+      break;
+    }
+    if (scan->leaf->link == NO_PAGE) {
+      free(scan->leaf);
+      scan->leaf = NULL;
+      return OK;
+    }
+    if (readNode(scan->index, scan->leaf->link, scan->leaf) != OK) {
+      return NG;
+    }
+    scan->position = 0;
+  }
+
+  /* 条件を満たさない値に達したら、それ以降もすべて満たさない */
+  e = &scan->leaf->entry[scan->position].entry;
+  cmp = compareKey(scan->index->keyType, &e->key, &scan->key);
+  if ((scan->operator == OPR_EQUAL && cmp != 0)
+      || (scan->operator == OPR_LESS_THAN && cmp >= 0)) {
+    free(scan->leaf);
+    scan->leaf = NULL;
+    return OK;
+  }
+
+  scan->position++;
+  *entry = e;
+  return OK;
+}
+
+/*
+ * closeIndexScan -- 索引の走査の終了
+ */
+void closeIndexScan(IndexScan *scan)
+{
+  if (scan == NULL) {
+    return;
+  }
+
+  closeHashScan(scan->hashScan);
+  free(scan->leaf);
+  free(scan);
+}
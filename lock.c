@@ -0,0 +1,503 @@
+/*
+ * lock.c -- ロック管理モジュール
+ *
+ * テーブルとレコードのロックを管理する。
+ *   共有ロック(LOCK_SHARED) -- 読むだけの操作で取る。共有ロックどうしは待たない。
+ *   排他ロック(LOCK_EXCLUSIVE) -- 書き換える操作で取る。
+ *   インテンション共有ロック(LOCK_INTENTION_SHARED) -- テーブルに取り、その中の
+ *     レコードの共有ロックを取るつもりであることを表す。
+ *   インテンション排他ロック(LOCK_INTENTION_EXCLUSIVE) -- テーブルに取り、その中の
+ *     レコードの排他ロックを取るつもりであることを表す。
+ *   共有インテンション排他ロック(LOCK_SHARED_INTENTION_EXCLUSIVE) -- テーブル全体を
+ *     読みながら、その一部を書き換える操作で取る。
+ * インテンション排他ロックどうしは待たないので、別々のレコードを書き換える操作は
+ * 並行して進む。テーブル全体を読む共有ロックとは両立しない。
+ * インテンション共有ロックと両立しないのは排他ロックだけなので、これを取って
+ * スナップショットで読む操作が待つのは、テーブルの定義を変える操作だけである。
+ *
+ * ロックの要求は対象ごとに到着順に並べ、前にある要求と両立しなければ待つ
+ * (読む操作が続いても、書き換える操作がいつまでも待たされることはない)。
+ * 待つ前に待ち合わせのグラフ(waits-for graph)をたどり、自分に戻ってくる
+ * (デッドロックになる)ときは、待たずにNGを返す。
+ *
+ * 関数の中から別の関数を呼ぶことがあるので、同じスレッドは同じ対象のロックを
+ * 重ねて取ってよい。ただし、持っているロックより強いロックに変えることはできない。
+ *
+ * ページのラッチは、ページを読んでから書き戻すまでの短い間だけ取る排他ロックである。
+ * ラッチを持ったままレコードのロックを待ってはいけない(tryLockRecordを使う)。
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "microdb.h"
+
+/*
+ * LOCK_TABLE_SIZE -- ロックのハッシュ表の大きさ
+ */
+#define LOCK_TABLE_SIZE 1024
+
+/*
+ * NUM_LOCK_MODE -- ロックの種類の数
+ */
+#define NUM_LOCK_MODE 5
+
+/*
+ * compatible -- 2つのロックが両立するかどうか(LockModeの順に並べる)
+ */
+static const int compatible[NUM_LOCK_MODE][NUM_LOCK_MODE] = {
+  /*           S  X  IS IX SIX */
+  /* S   */  { 1, 0, 1, 0, 0 },
+  /* X   */  { 0, 0, 0, 0, 0 },
+  /* IS  */  { 1, 0, 1, 1, 1 },
+  /* IX  */  { 0, 0, 1, 1, 0 },
+  /* SIX */  { 0, 0, 1, 0, 0 },
+};
+
+/*
+ * covers -- 持っているロック(行)で、要求したロック(列)も取ったことになるかどうか
+ */
+static const int covers[NUM_LOCK_MODE][NUM_LOCK_MODE] = {
+  /*           S  X  IS IX SIX */
+  /* S   */  { 1, 0, 1, 0, 0 },
+  /* X   */  { 1, 1, 1, 1, 1 },
+  /* IS  */  { 0, 0, 1, 0, 0 },
+  /* IX  */  { 0, 0, 1, 1, 0 },
+  /* SIX */  { 1, 0, 1, 1, 1 },
+};
+
+typedef struct Locker Locker;
+typedef struct LockRequest LockRequest;
+typedef struct LockObject LockObject;
+
+/*
+ * LockObject -- ロックの対象(テーブル、ページ、またはレコード)
+ *
+ * テーブルはpageNumとslotNumが-1、ページはslotNumが-1である。
+ * 要求がなくなったら解放する。
+ */
+struct LockObject {
+  char tableName[MAX_FILENAME];         /* テーブルの名前 */
+  int pageNum;                          /* ページ番号 */
+  int slotNum;                          /* ページの中の位置 */
+  LockRequest *queue;                   /* 要求の並び(到着順) */
+  pthread_cond_t released;              /* ロックが返されたことを知らせる */
+  LockObject *next;                     /* ハッシュ表の同じ場所の次の要素 */
+};
+
+/*
+ * LockRequest -- 1つのスレッドの、1つの対象へのロックの要求
+ */
+struct LockRequest {
+  LockObject *object;                   /* ロックの対象 */
+  Locker *owner;                        /* 要求したスレッド */
+  LockMode mode;                        /* ロックの種類 */
+  int granted;                          /* 取れていれば1 */
+  int count;                            /* 重ねて取った回数 */
+  LockRequest *next;                    /* 対象の要求の並びの次の要素 */
+  LockRequest *nextHeld;                /* スレッドが持っているロックの並びの次の要素 */
+};
+
+/*
+ * Locker -- ロックを取るスレッド
+ */
+struct Locker {
+  LockRequest *held;                    /* 持っているロックの並び */
+  LockRequest *waiting;                 /* 待っている要求(待っていなければNULL) */
+  unsigned int visited;                 /* デッドロックを調べるときの印 */
+};
+
+static pthread_mutex_t lockMutex = PTHREAD_MUTEX_INITIALIZER;  /* 以下を守る */
+static LockObject *lockObjects[LOCK_TABLE_SIZE];               /* 対象からロックを引く */
+static unsigned int visitCount = 0;                            /* 最後に使った印 */
+
+/*
+ * locker -- このスレッド
+ *
+ * 持っているロックの並びはこのスレッドだけが使うが、waitingとvisitedは
+ * デッドロックを調べるほかのスレッドも読み書きするので、lockMutexで守る。
+ */
+static __thread Locker locker;
+
+/*
+ * getLockSlot -- 対象から、ロックのハッシュ表の場所を求める
+ */
+static LockObject **getLockSlot(char *tableName, int pageNum, int slotNum)
+{
+  unsigned int hash = 2166136261u;
+  unsigned char *p;
+
+  for (p = (unsigned char *) tableName; *p != '\0'; p++) {
+    hash = (hash ^ *p) * 16777619u;
+  }
+  hash = (hash ^ (unsigned int) pageNum) * 16777619u;
+  hash = (hash ^ (unsigned int) slotNum) * 16777619u;
+
+  return &lockObjects[hash % LOCK_TABLE_SIZE];
+}
+
+/*
+ * isSameObject -- ロックの対象が等しいかどうか
+ */
+static int isSameObject(LockObject *object, char *tableName, int pageNum, int slotNum)
+{
+  return object->pageNum == pageNum && object->slotNum == slotNum
+    && strcmp(object->tableName, tableName) == 0;
+}
+
+/*
+ * findHeldLock -- このスレッドが持っている対象のロックを探す
+ */
+static LockRequest *findHeldLock(char *tableName, int pageNum, int slotNum)
+{
+  LockRequest *request;
+
+  for (request = locker.held; request != NULL; request = request->nextHeld) {
+    if (isSameObject(request->object, tableName, pageNum, slotNum)) {
+      return request;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * isBlockedBy -- 待っている要求requestが、other(同じ対象の要求)を待たなければならないか
+ *
+ * 取れているものと、前に並んでいるものとが両立しなければ待つ。
+ */
+static int isBlockedBy(LockRequest *request, LockRequest *other, int ahead)
+{
+  if (other == request || (!other->granted && !ahead)) {
+    return 0;
+  }
+
+  return !compatible[other->mode][request->mode];
+}
+
+/*
+ * canGrant -- 要求を取れるかどうか
+ */
+static int canGrant(LockRequest *request)
+{
+  LockRequest *other;
+  int ahead = 1;
+
+  for (other = request->object->queue; other != NULL; other = other->next) {
+    if (other == request) {
+      ahead = 0;
+    } else if (isBlockedBy(request, other, ahead)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/*
+ * reaches -- 待ち合わせのグラフをfromからたどって、targetに着くかどうか
+ *
+ * fromが待っている要求の邪魔をしている要求の持ち主を、順にたどる。
+ * lockMutexを取ってから呼ぶこと。
+ */
+static int reaches(Locker *from, Locker *target)
+{
+  LockRequest *request, *other;
+  int ahead = 1;
+
+  if ((request = from->waiting) == NULL || from->visited == visitCount) {
+    return 0;
+  }
+  from->visited = visitCount;
+
+  for (other = request->object->queue; other != NULL; other = other->next) {
+    if (other == request) {
+      ahead = 0;
+    } else if (isBlockedBy(request, other, ahead)) {
+      if (other->owner == target || reaches(other->owner, target)) {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * removeRequest -- 要求を対象の並びから外し、対象を使わなくなったら解放する
+ *
+ * lockMutexを取ってから呼ぶこと。
+ */
+static void removeRequest(LockRequest *request)
+{
+  LockObject *object = request->object;
+  LockObject **slot;
+  LockRequest **p;
+
+  for (p = &object->queue; *p != request; p = &(*p)->next) {
+  }
+  *p = request->next;
+
+  /* 後ろで待っている要求が取れるようになったかもしれない */
+  pthread_cond_broadcast(&object->released);
+
+  if (object->queue == NULL) {
+    for (slot = getLockSlot(object->tableName, object->pageNum, object->slotNum);
+         *slot != object; slot = &(*slot)->next) {
+    }
+    *slot = object->next;
+    pthread_cond_destroy(&object->released);
+    free(object);
+  }
+
+  free(request);
+}
+
+/*
+ * acquireLock -- ロックを取る
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  pageNum: ページ番号(テーブルなら-1)
+ *  slotNum: ページの中の位置(テーブルかページなら-1)
+ *  mode: ロックの種類
+ *  wait: 取れなければ待つなら1、待たずにNGを返すなら0
+ *
+ * 返り値:
+ *  ロックを取れたらOK、取れなかったらNGを返す
+ */
+static Result acquireLock(char *tableName, int pageNum, int slotNum, LockMode mode, int wait)
+{
+  LockObject **slot, *object;
+  LockRequest *request, **p;
+
+  /* このスレッドがすでに持っていれば、重ねて取る */
+  if ((request = findHeldLock(tableName, pageNum, slotNum)) != NULL) {
+    if (!covers[request->mode][mode]) {
+      return NG;
+    }
+    request->count++;
+    return OK;
+  }
+
+  if (strlen(tableName) >= MAX_FILENAME || (request = malloc(sizeof(LockRequest))) == NULL) {
+    return NG;
+  }
+
+  pthread_mutex_lock(&lockMutex);
+
+  /* 対象を探し、なければ作る */
+  slot = getLockSlot(tableName, pageNum, slotNum);
+  for (object = *slot; object != NULL; object = object->next) {
+    if (isSameObject(object, tableName, pageNum, slotNum)) {
+      break;
+    }
+  }
+  if (object == NULL) {
+    if ((object = calloc(1, sizeof(LockObject))) == NULL) {
+      pthread_mutex_unlock(&lockMutex);
+      free(request);
+      return NG;
+    }
+    strcpy(object->tableName, tableName);
+    object->pageNum = pageNum;
+    object->slotNum = slotNum;
+    pthread_cond_init(&object->released, NULL);
+    object->next = *slot;
+    *slot = object;
+  }
+
+  /* 要求を並びの最後に加える */
+  request->object = object;
+  request->owner = &locker;
+  request->mode = mode;
+  request->granted = 0;
+  request->count = 1;
+  request->next = NULL;
+  for (p = &object->queue; *p != NULL; p = &(*p)->next) {
+  }
+  *p = request;
+
+  if (!canGrant(request)) {
+    if (!wait) {
+      removeRequest(request);
+      pthread_mutex_unlock(&lockMutex);
+      return NG;
+    }
+
+    /* 待つとデッドロックになるなら、待たずにあきらめる */
+    locker.waiting = request;
+    visitCount++;
+    if (reaches(&locker, &locker)) {
+      locker.waiting = NULL;
+      removeRequest(request);
+      pthread_mutex_unlock(&lockMutex);
+      return NG;
+    }
+
+    do {
+      pthread_cond_wait(&object->released, &lockMutex);
+    } while (!canGrant(request));
+    locker.waiting = NULL;
+  }
+  request->granted = 1;
+
+  pthread_mutex_unlock(&lockMutex);
+
+  request->nextHeld = locker.held;
+  locker.held = request;
+
+  return OK;
+}
+
+/*
+ * releaseLock -- ロックを返す
+ *
+ * 重ねて取ったロックは、最後に返したときに本当に返す。
+ */
+static void releaseLock(char *tableName, int pageNum, int slotNum)
+{
+  LockRequest **p, *request;
+
+  for (p = &locker.held; (request = *p) != NULL; p = &request->nextHeld) {
+    if (isSameObject(request->object, tableName, pageNum, slotNum)) {
+      break;
+    }
+  }
+  if (request == NULL || --request->count > 0) {
+    return;
+  }
+  *p = request->nextHeld;
+
+  pthread_mutex_lock(&lockMutex);
+  removeRequest(request);
+  pthread_mutex_unlock(&lockMutex);
+}
+
+/*
+ * lockTable -- テーブルのロックを取る
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  mode: ロックの種類
+ *
+ * 返り値:
+ *  ロックを取れたらOK、持っているロックより強いロックを取ろうとしたか、
+ *  デッドロックになるか、失敗したらNGを返す
+ *
+ * ほかのスレッドのロックと両立しなければ、返されるまで待つ。
+ * 取ったロックは、必ずunlockTableで返すこと。
+ */
+Result lockTable(char *tableName, LockMode mode)
+{
+  return acquireLock(tableName, -1, -1, mode, 1);
+}
+
+/*
+ * unlockTable -- テーブルのロックを返す
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *
+ * 返り値:
+ *  なし
+ */
+void unlockTable(char *tableName)
+{
+  releaseLock(tableName, -1, -1);
+}
+
+/*
+ * lockRecord -- レコードのロックを取る
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  recordId: レコードの位置
+ *  mode: LOCK_SHAREDかLOCK_EXCLUSIVE
+ *
+ * 返り値:
+ *  ロックを取れたらOK、位置が正しくないか、デッドロックになるか、失敗したらNGを返す
+ *
+ * テーブルのインテンションロック(か、より強いロック)を取ってから呼ぶこと。
+ * 取ったロックは、必ずunlockRecordで返すこと。
+ */
+Result lockRecord(char *tableName, RecordId *recordId, LockMode mode)
+{
+  if (recordId->pageNum < 0 || recordId->slotNum < 0) {
+    return NG;
+  }
+
+  return acquireLock(tableName, recordId->pageNum, recordId->slotNum, mode, 1);
+}
+
+/*
+ * tryLockRecord -- レコードのロックを、待たずに取る
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  recordId: レコードの位置
+ *  mode: LOCK_SHAREDかLOCK_EXCLUSIVE
+ *
+ * 返り値:
+ *  すぐにロックを取れたらOK、取れなければNGを返す
+ */
+Result tryLockRecord(char *tableName, RecordId *recordId, LockMode mode)
+{
+  if (recordId->pageNum < 0 || recordId->slotNum < 0) {
+    return NG;
+  }
+
+  return acquireLock(tableName, recordId->pageNum, recordId->slotNum, mode, 0);
+}
+
+/*
+ * unlockRecord -- レコードのロックを返す
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  recordId: レコードの位置
+ *
+ * 返り値:
+ *  なし
+ */
+void unlockRecord(char *tableName, RecordId *recordId)
+{
+  releaseLock(tableName, recordId->pageNum, recordId->slotNum);
+}
+
+/*
+ * latchPage -- ページのラッチを取る
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  pageNum: ページ番号
+ *
+ * 返り値:
+ *  ラッチを取れたらOK、失敗したらNGを返す
+ *
+ * ページを読んでから書き戻すまでの間、ほかのスレッドに同じページを書き換えさせない。
+ * 一度に持つラッチは1つだけにすること。
+ */
+Result latchPage(char *tableName, int pageNum)
+{
+  if (pageNum < 0) {
+    return NG;
+  }
+
+  return acquireLock(tableName, pageNum, -1, LOCK_EXCLUSIVE, 1);
+}
+
+/*
+ * unlatchPage -- ページのラッチを返す
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  pageNum: ページ番号
+ *
+ * 返り値:
+ *  なし
+ */
+void unlatchPage(char *tableName, int pageNum)
+{
+  releaseLock(tableName, pageNum, -1);
+}
@@ -0,0 +1,794 @@
+/*
+ * log.c -- ログ管理モジュール
+ *
+ * ページをバッファに書き込むたびに、その内容をログファイルの最後に加える
+ * (先書きログ)。データファイルのページは、そのページのログがディスクに
+ * 届くまでファイルに書き戻さない。ログにはページ全体を記録するので、
+ * 書き戻している途中で止まって壊れたページも、起動したときにログから直せる。
+ *
+ * ログはメモリ上のログバッファにためておき、ログ書き込みスレッドが
+ * まとめてファイルに書いてからfdatasyncする。操作を終える(コミットする)
+ * スレッドは、自分の書いたところまでディスクに届くのを待つだけである。
+ * 同時にコミットする操作がいくつあっても、書き込みスレッドが1回の
+ * fdatasyncでまとめて届ける(グループコミット)。
+ *
+ * ログが大きくなったら、バッファのページをすべて書き戻してデータファイルを
+ * fsyncし、ログを空にする(チェックポイント)。
+ *
+ * レコードを書き換える操作(トランザクション)を始めたとき、コミットしたとき、
+ * 書き換えを元に戻して終えたときにも、そのIDをログに記録する。ページの内容は
+ * 取り消しには使わないので、起動したときは、始めたがコミットもabortもしないうちに
+ * 止まった操作の一覧をgetOpenTransactionsで渡し、データ操作モジュールが
+ * その書き換えを元に戻す。チェックポイントでログを空にするときは、まだ終えて
+ * いない操作を始めた記録だけを残す(データファイルに書き戻した書き換えも、
+ * 元に戻せるように)。
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "microdb.h"
+
+/*
+ * LOG_FILE -- ログファイルの名前
+ */
+#define LOG_FILE "microdb.log"
+
+/*
+ * LOG_BUFFER_SIZE -- ログバッファの大きさ(バイト数)
+ *
+ * バッファは2つ用意し、一方をファイルに書いている間は、もう一方にためる。
+ */
+#define LOG_BUFFER_SIZE (1024 * 1024)
+
+/*
+ * LOG_CHECKPOINT_SIZE -- チェックポイントを行うログファイルの大きさ(バイト数)
+ */
+#define LOG_CHECKPOINT_SIZE (64 * 1024 * 1024)
+
+/*
+ * LogType -- ログレコードの種類
+ */
+typedef enum { LOG_PAGE, LOG_CREATE, LOG_DELETE, LOG_BEGIN, LOG_COMMIT, LOG_ABORT } LogType;
+
+/*
+ * LogHeader -- ログレコードの見出し
+ *
+ * LOG_PAGEのレコードは、見出しに続けてページの内容(PAGE_SIZEバイト)を置く。
+ */
+typedef struct LogHeader LogHeader;
+struct LogHeader {
+  unsigned int size;                    /* 見出しを含むレコードのバイト数 */
+  unsigned int checksum;                /* このフィールドを0として計算したレコードの検査和 */
+  int type;                             /* レコードの種類(LogType) */
+  int pageNum;                          /* ページ番号(LOG_PAGEのみ) */
+  TransactionId xid;                    /* トランザクションID(LOG_BEGIN, LOG_COMMIT, LOG_ABORTのみ) */
+  char filename[MAX_FILENAME];          /* ファイル名(LOG_BEGINでは書き換えるテーブルの名前) */
+};
+
+static pthread_mutex_t logMutex = PTHREAD_MUTEX_INITIALIZER;          /* 以下を守る */
+static pthread_cond_t flushRequested = PTHREAD_COND_INITIALIZER;      /* 書き込みの依頼を知らせる */
+static pthread_cond_t flushed = PTHREAD_COND_INITIALIZER;             /* 書き込みの完了を知らせる */
+static int logDesc = -1;                /* ログファイルのディスクリプタ(ログを取らないなら-1) */
+static char *logBuffer[2];              /* ログバッファ */
+static int activeBuffer;                /* レコードをためているバッファ */
+static size_t logLength;                /* そのバッファにたまっているバイト数 */
+static LogSequenceNumber appendedLsn;   /* ためたレコードの終わりの位置 */
+static LogSequenceNumber requestedLsn;  /* ディスクに届けるよう依頼された位置 */
+static LogSequenceNumber durableLsn;    /* ディスクに届いた位置 */
+static off_t logSize;                   /* ログファイルの大きさ */
+static int logError;                    /* ログファイルへの書き込みに失敗したら1 */
+static int stopping;                    /* 書き込みスレッドを止めるなら1 */
+static pthread_t writer;                /* ログ書き込みスレッド */
+static LoggedTransaction *openTransaction = NULL;  /* 始めて、まだ終えていないトランザクション */
+static int numOpen = 0;                 /* その数 */
+static int maxOpen = 0;                 /* openTransactionに入る数 */
+
+/*
+ * computeChecksum -- バイト列の検査和(FNV-1a)
+ */
+static unsigned int computeChecksum(unsigned int hash, char *p, size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++) {
+    hash ^= (unsigned char) p[i];
+    hash *= 16777619U;
+  }
+
+  return hash;
+}
+
+/*
+ * makeLogHeader -- ログレコードの見出しを作る
+ *
+ * 引数と返り値はappendLogと同じ(headerは見出しを書き込む領域)。
+ */
+static void makeLogHeader(LogHeader *header, LogType type, char *filename, int pageNum, char *page,
+                          TransactionId xid)
+{
+  unsigned int hash;
+
+  memset(header, 0, sizeof(LogHeader));
+  header->size = sizeof(LogHeader) + (type == LOG_PAGE ? PAGE_SIZE : 0);
+  header->type = type;
+  header->pageNum = pageNum;
+  header->xid = xid;
+  strncpy(header->filename, filename, MAX_FILENAME - 1);
+  hash = computeChecksum(2166136261U, (char *) header, sizeof(LogHeader));
+  if (type == LOG_PAGE) {
+    hash = computeChecksum(hash, page, PAGE_SIZE);
+  }
+  header->checksum = hash;
+}
+
+/*
+ * trackTransaction -- ログレコードに合わせて、終えていないトランザクションの一覧を更新する
+ *
+ * 引数:
+ *  header: 記録する(かやり直す)レコードの見出し
+ *
+ * 返り値:
+ *  成功ならOK、一覧を広げられなければNGを返す
+ *
+ * logMutexを取ってから呼ぶこと。
+ */
+static Result trackTransaction(LogHeader *header)
+{
+  LoggedTransaction *p;
+  int i, n;
+
+  if (header->type == LOG_BEGIN) {
+    if (numOpen == maxOpen) {
+      n = (maxOpen == 0) ? 16 : maxOpen * 2;
+      if ((p = realloc(openTransaction, sizeof(LoggedTransaction) * n)) == NULL) {
+        return NG;
+      }
+      openTransaction = p;
+      maxOpen = n;
+    }
+    openTransaction[numOpen].xid = header->xid;
+    strcpy(openTransaction[numOpen].tableName, header->filename);
+    numOpen++;
+  } else if (header->type == LOG_COMMIT || header->type == LOG_ABORT) {
+    for (i = 0; i < numOpen; i++) {
+      if (openTransaction[i].xid == header->xid) {
+        openTransaction[i] = openTransaction[--numOpen];
+        break;
+      }
+    }
+  }
+
+  return OK;
+}
+
+/*
+ * logWriterMain -- ログ書き込みスレッド
+ *
+ * 依頼があるたびに、それまでにたまったレコードをまとめてファイルに書いて
+ * fdatasyncする。書いている間にコミットしたスレッドの分は、次の1回で届ける。
+ */
+static void *logWriterMain(void *arg)
+{
+  LogSequenceNumber end;
+  char *buffer;
+  size_t length;
+  ssize_t n;
+  size_t done;
+  int error;
+
+  (void) arg;
+  pthread_mutex_lock(&logMutex);
+  for (;;) {
+    /* 書き込みに失敗したら、それ以降は書かない(止めるのを待つだけ) */
+    while ((requestedLsn <= durableLsn || logError) && !stopping) {
+      pthread_cond_wait(&flushRequested, &logMutex);
+    }
+    if (stopping && (logError || appendedLsn == durableLsn)) {
+      break;
+    }
+    if (appendedLsn == durableLsn) {
+      requestedLsn = durableLsn;
+      continue;
+    }
+
+    /* ためたバッファを受け取り、もう一方のバッファにためてもらう */
+    buffer = logBuffer[activeBuffer];
+    length = logLength;
+    end = appendedLsn;
+    activeBuffer = 1 - activeBuffer;
+    logLength = 0;
+    pthread_mutex_unlock(&logMutex);
+
+    error = 0;
+    for (done = 0; done < length; done += n) {
+      if ((n = write(logDesc, buffer + done, length - done)) <= 0) {
+        error = 1;
+        break;
+      }
+    }
+    if (!error && fdatasync(logDesc) == -1) {
+      error = 1;
+    }
+
+    pthread_mutex_lock(&logMutex);
+    if (error) {
+      /* 届いたかどうか分からないので、durableLsnは進めない */
+      logError = 1;
+    } else {
+      logSize += length;
+      durableLsn = end;
+    }
+    pthread_cond_broadcast(&flushed);
+  }
+  pthread_mutex_unlock(&logMutex);
+
+  return NULL;
+}
+
+/*
+ * appendLog -- ログレコードをログバッファに加える
+ *
+ * 引数:
+ *  type: レコードの種類
+ *  filename: ファイル名
+ *  pageNum: ページ番号(LOG_PAGEのみ)
+ *  page: ページの内容(LOG_PAGEのみ)
+ *  xid: トランザクションID(LOG_BEGIN, LOG_COMMIT, LOG_ABORTのみ)
+ *  lsn: レコードの終わりの位置(ログを取っていなければ0)を書き込む領域
+ *
+ * 返り値:
+ *  成功ならOK、ログファイルへの書き込みに失敗していたらNGを返す
+ *
+ * バッファが一杯なら、書き込みスレッドが空けるのを待つ。
+ */
+static Result appendLog(LogType type, char *filename, int pageNum, char *page, TransactionId xid,
+                        LogSequenceNumber *lsn)
+{
+  LogHeader header;
+  char *p;
+
+  makeLogHeader(&header, type, filename, pageNum, page, xid);
+
+  pthread_mutex_lock(&logMutex);
+  if (logDesc == -1) {
+    pthread_mutex_unlock(&logMutex);
+    *lsn = 0;
+    return OK;
+  }
+  while (logLength + header.size > LOG_BUFFER_SIZE && !logError) {
+    requestedLsn = appendedLsn;
+    pthread_cond_signal(&flushRequested);
+    pthread_cond_wait(&flushed, &logMutex);
+  }
+  if (logError || trackTransaction(&header) != OK) {
+    pthread_mutex_unlock(&logMutex);
+    return NG;
+  }
+
+  p = logBuffer[activeBuffer] + logLength;
+  memcpy(p, &header, sizeof(header));
+  if (type == LOG_PAGE) {
+    memcpy(p + sizeof(header), page, PAGE_SIZE);
+  }
+  logLength += header.size;
+  appendedLsn += header.size;
+  *lsn = appendedLsn;
+  pthread_mutex_unlock(&logMutex);
+
+  return OK;
+}
+
+/*
+ * logPageWrite -- ページの書き込みをログに記録する
+ *
+ * 引数:
+ *  filename: ファイル名
+ *  pageNum: ページ番号
+ *  page: 書き込んだページの内容
+ *  lsn: レコードの終わりの位置(ログを取っていなければ0)を書き込む領域。
+ *       ページをファイルに書き戻す前に、この位置までflushLogすること。
+ *
+ * 返り値:
+ *  成功ならOK、ログファイルへの書き込みに失敗していたらNGを返す
+ */
+Result logPageWrite(char *filename, int pageNum, char *page, LogSequenceNumber *lsn)
+{
+  return appendLog(LOG_PAGE, filename, pageNum, page, 0, lsn);
+}
+
+/*
+ * logFileCreate -- ファイルの作成をログに記録する
+ *
+ * 引数:
+ *  filename: ファイル名
+ *
+ * 返り値:
+ *  成功ならOK、ログファイルへの書き込みに失敗していたらNGを返す
+ */
+Result logFileCreate(char *filename)
+{
+  LogSequenceNumber lsn;
+
+  return appendLog(LOG_CREATE, filename, 0, NULL, 0, &lsn);
+}
+
+/*
+ * logFileDelete -- ファイルの削除をログに記録する
+ *
+ * 引数:
+ *  filename: ファイル名
+ *
+ * 返り値:
+ *  成功ならOK、ログファイルへの書き込みに失敗していたらNGを返す
+ */
+Result logFileDelete(char *filename)
+{
+  LogSequenceNumber lsn;
+
+  return appendLog(LOG_DELETE, filename, 0, NULL, 0, &lsn);
+}
+
+/*
+ * logBegin -- レコードを書き換える操作を始めたことをログに記録する
+ *
+ * 引数:
+ *  xid: 操作のトランザクションID
+ *  tableName: 書き換えるテーブルの名前
+ *
+ * 返り値:
+ *  成功ならOK、失敗したらNGを返す
+ *
+ * logCommitかlogAbortを記録するまで、チェックポイントを越えてもこの記録を残す。
+ */
+Result logBegin(TransactionId xid, char *tableName)
+{
+  LogSequenceNumber lsn;
+
+  return appendLog(LOG_BEGIN, tableName, 0, NULL, xid, &lsn);
+}
+
+/*
+ * logCommit -- 操作をコミットしたことをログに記録する
+ *
+ * 引数:
+ *  xid: 操作のトランザクションID
+ *
+ * 返り値:
+ *  成功ならOK、ログファイルへの書き込みに失敗していたらNGを返す
+ *
+ * この記録がディスクに届いた操作だけが、再起動した後もコミットしたものとして残る。
+ * 続けてcommitLogで届けること。
+ */
+Result logCommit(TransactionId xid)
+{
+  LogSequenceNumber lsn;
+
+  return appendLog(LOG_COMMIT, "", 0, NULL, xid, &lsn);
+}
+
+/*
+ * logAbort -- 操作の書き換えをすべて元に戻して終えたことをログに記録する
+ *
+ * 引数:
+ *  xid: 操作のトランザクションID
+ *
+ * 返り値:
+ *  成功ならOK、ログファイルへの書き込みに失敗していたらNGを返す
+ *
+ * 届く前に止まっても、起動したときにもう一度元に戻すだけなので、届くのは待たない。
+ */
+Result logAbort(TransactionId xid)
+{
+  LogSequenceNumber lsn;
+
+  return appendLog(LOG_ABORT, "", 0, NULL, xid, &lsn);
+}
+
+/*
+ * getOpenTransactions -- 始めたことを記録して、まだ終えていないトランザクションの一覧
+ *
+ * 引数:
+ *  num: 一覧の数を書き込む領域
+ *
+ * 返り値:
+ *  一覧を収めた配列(不要になったらfreeすること)、失敗ならNULLを返す
+ *
+ * initializeLogModuleの直後に呼ぶと、前回コミットもabortもしないうちに止まった
+ * 操作の一覧が得られる。
+ */
+LoggedTransaction *getOpenTransactions(int *num)
+{
+  LoggedTransaction *list;
+
+  pthread_mutex_lock(&logMutex);
+  if ((list = malloc(sizeof(LoggedTransaction) * (numOpen > 0 ? numOpen : 1))) != NULL) {
+    memcpy(list, openTransaction, sizeof(LoggedTransaction) * numOpen);
+    *num = numOpen;
+  }
+  pthread_mutex_unlock(&logMutex);
+
+  return list;
+}
+
+/*
+ * getLogEnd -- これまでにログに加えたレコードの終わりの位置
+ */
+LogSequenceNumber getLogEnd()
+{
+  LogSequenceNumber lsn;
+
+  pthread_mutex_lock(&logMutex);
+  lsn = appendedLsn;
+  pthread_mutex_unlock(&logMutex);
+
+  return lsn;
+}
+
+/*
+ * getDurableLsn -- ディスクに届いたログの終わりの位置
+ */
+LogSequenceNumber getDurableLsn()
+{
+  LogSequenceNumber lsn;
+
+  pthread_mutex_lock(&logMutex);
+  lsn = (logDesc == -1) ? appendedLsn : durableLsn;
+  pthread_mutex_unlock(&logMutex);
+
+  return lsn;
+}
+
+/*
+ * flushLog -- ログが指定した位置までディスクに届くのを待つ
+ *
+ * 引数:
+ *  lsn: 待つ位置
+ *
+ * 返り値:
+ *  届いたらOK、ログファイルへの書き込みに失敗していたらNGを返す
+ */
+Result flushLog(LogSequenceNumber lsn)
+{
+  Result ret;
+
+  pthread_mutex_lock(&logMutex);
+  if (logDesc != -1) {
+    if (lsn > requestedLsn) {
+      requestedLsn = lsn;
+      pthread_cond_signal(&flushRequested);
+    }
+    while (durableLsn < lsn && !logError) {
+      pthread_cond_wait(&flushed, &logMutex);
+    }
+  }
+  ret = logError ? NG : OK;
+  pthread_mutex_unlock(&logMutex);
+
+  return ret;
+}
+
+/*
+ * requestFlushLog -- ログを指定した位置までディスクに届けるよう依頼する(届くのは待たない)
+ *
+ * 引数:
+ *  lsn: 届ける位置
+ *
+ * 返り値:
+ *  なし
+ */
+void requestFlushLog(LogSequenceNumber lsn)
+{
+  pthread_mutex_lock(&logMutex);
+  if (logDesc != -1 && lsn > requestedLsn) {
+    requestedLsn = lsn;
+    pthread_cond_signal(&flushRequested);
+  }
+  pthread_mutex_unlock(&logMutex);
+}
+
+/*
+ * commitLog -- それまでに記録した変更がディスクに届くのを待つ(コミット)
+ *
+ * 引数:
+ *  なし
+ *
+ * 返り値:
+ *  届いたらOK、失敗したらNGを返す
+ *
+ * ログファイルが大きくなっていたら、ついでにチェックポイントを行う。
+ */
+Result commitLog()
+{
+  off_t size;
+
+  if (flushLog(getLogEnd()) != OK) {
+    return NG;
+  }
+
+  pthread_mutex_lock(&logMutex);
+  size = logSize;
+  pthread_mutex_unlock(&logMutex);
+  if (size >= LOG_CHECKPOINT_SIZE) {
+    return checkpoint();
+  }
+
+  return OK;
+}
+
+/*
+ * rewriteOpenTransactions -- ログファイルを、終えていない操作を始めた記録だけにする
+ *
+ * 引数:
+ *  なし
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 記録をファイルの先頭に上書きして届けてから、その後ろを切り詰める。途中で
+ * 止まっても、前のログ全体か、先頭の記録(その後ろは検査和が合わないので読まない)の
+ * どちらかが残る。logMutexを取り、書き込みスレッドが書き終えてから呼ぶこと。
+ */
+static Result rewriteOpenTransactions()
+{
+  LogHeader *records;
+  size_t size, done;
+  ssize_t n;
+  int i;
+  Result ret = OK;
+
+  size = sizeof(LogHeader) * numOpen;
+  if (size > 0) {
+    if ((records = malloc(size)) == NULL) {
+      return NG;
+    }
+    for (i = 0; i < numOpen; i++) {
+      makeLogHeader(&records[i], LOG_BEGIN, openTransaction[i].tableName, 0, NULL, openTransaction[i].xid);
+    }
+    for (done = 0; done < size; done += n) {
+      if ((n = pwrite(logDesc, (char *) records + done, size - done, done)) <= 0) {
+        ret = NG;
+        break;
+      }
+    }
+    free(records);
+    if (ret != OK || fdatasync(logDesc) == -1) {
+      return NG;
+    }
+  }
+
+  if (ftruncate(logDesc, size) == -1 || lseek(logDesc, size, SEEK_SET) == -1 || fsync(logDesc) == -1) {
+    return NG;
+  }
+  logSize = size;
+
+  return OK;
+}
+
+/*
+ * truncateLog -- ログファイルを空にする
+ *
+ * 引数:
+ *  なし
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * ログに記録したページをすべてデータファイルに書き戻してfsyncしてから、
+ * ほかのスレッドがログに加えないようにして(fileMutexを取って)呼ぶこと。
+ * まだ終えていない操作を始めた記録だけは残す。
+ */
+Result truncateLog()
+{
+  Result ret = OK;
+
+  pthread_mutex_lock(&logMutex);
+  if (logDesc != -1) {
+    /* 書き込みスレッドが書いている途中なら、書き終えるのを待つ */
+    while (durableLsn < appendedLsn && !logError) {
+      requestedLsn = appendedLsn;
+      pthread_cond_signal(&flushRequested);
+      pthread_cond_wait(&flushed, &logMutex);
+    }
+    if (logError || rewriteOpenTransactions() != OK) {
+      ret = NG;
+    }
+  }
+  pthread_mutex_unlock(&logMutex);
+
+  return ret;
+}
+
+/*
+ * replayLog -- ログファイルに記録した変更をやり直す
+ *
+ * 引数:
+ *  desc: ログファイルのディスクリプタ
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 書き込みの途中で止まった最後のレコード(大きさか検査和が合わないもの)から先は捨てる。
+ * もうないファイルのページは読み飛ばす(後で削除したファイル)。
+ * 操作を始めた記録とコミットやabortの記録から、終えていない操作の一覧を作る。
+ */
+static Result replayLog(int desc)
+{
+  LogHeader header;
+  char page[PAGE_SIZE];
+  unsigned int checksum, hash;
+  File *file;
+  Result ret = OK;
+
+  while (ret == OK && read(desc, &header, sizeof(header)) == sizeof(header)) {
+    if (header.size != sizeof(header) + (header.type == LOG_PAGE ? PAGE_SIZE : 0)
+        || header.filename[MAX_FILENAME - 1] != '\0') {
+      break;
+    }
+    if (header.type == LOG_PAGE && read(desc, page, PAGE_SIZE) != PAGE_SIZE) {
+      break;
+    }
+    checksum = header.checksum;
+    header.checksum = 0;
+    hash = computeChecksum(2166136261U, (char *) &header, sizeof(header));
+    if (header.type == LOG_PAGE) {
+      hash = computeChecksum(hash, page, PAGE_SIZE);
+    }
+    if (hash != checksum) {
+      break;
+    }
+
+    switch (header.type) {
+      case LOG_CREATE:
+        /* 作り直したファイルは、作ったときの状態から変更をやり直す */
+        if (existFile(header.filename) && deleteFile(header.filename) != OK) {
+          ret = NG;
+        } else if (createFile(header.filename) != OK) {
+          ret = NG;
+        }
+        break;
+      case LOG_DELETE:
+        if (existFile(header.filename) && deleteFile(header.filename) != OK) {
+          ret = NG;
+        }
+        break;
+      case LOG_BEGIN:
+      case LOG_COMMIT:
+      case LOG_ABORT:
+        pthread_mutex_lock(&logMutex);
+        ret = trackTransaction(&header);
+        pthread_mutex_unlock(&logMutex);
+        break;
+      case LOG_PAGE:
+        if (!existFile(header.filename)) {
+          break;
+        }
+        if ((file = openFile(header.filename)) == NULL) {
+          ret = NG;
+          break;
+        }
+        if (writePage(file, header.pageNum, page) != OK) {
+          ret = NG;
+        }
+        if (closeFile(file) != OK) {
+          ret = NG;
+        }
+        break;
+      default:
+        ret = NG;
+        break;
+    }
+  }
+
+  return ret;
+}
+
+/*
+ * initializeLogModule -- ログ管理モジュールの初期化
+ *
+ * 引数:
+ *  なし
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 前回ログに記録した変更をやり直してから、ログを取り始める。
+ * ファイルモジュールを初期化し、データベースファイルを使うならオープンしてから呼ぶこと。
+ */
+Result initializeLogModule()
+{
+  struct stat st;
+  int desc;
+
+  if ((desc = open(LOG_FILE, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) == -1) {
+    return NG;
+  }
+  numOpen = 0;
+
+  /* やり直している間の書き込みは、ログに記録しない */
+  if (replayLog(desc) != OK || fstat(desc, &st) == -1 || lseek(desc, 0, SEEK_END) == -1) {
+    close(desc);
+    return NG;
+  }
+
+  logBuffer[0] = malloc(LOG_BUFFER_SIZE);
+  logBuffer[1] = malloc(LOG_BUFFER_SIZE);
+  if (logBuffer[0] == NULL || logBuffer[1] == NULL) {
+    free(logBuffer[0]);
+    free(logBuffer[1]);
+    close(desc);
+    return NG;
+  }
+
+  pthread_mutex_lock(&logMutex);
+  logDesc = desc;
+  activeBuffer = 0;
+  logLength = 0;
+  appendedLsn = 0;
+  requestedLsn = 0;
+  durableLsn = 0;
+  logSize = st.st_size;
+  logError = 0;
+  stopping = 0;
+  pthread_mutex_unlock(&logMutex);
+
+  if (pthread_create(&writer, NULL, logWriterMain, NULL) != 0) {
+    pthread_mutex_lock(&logMutex);
+    logDesc = -1;
+    pthread_mutex_unlock(&logMutex);
+    free(logBuffer[0]);
+    free(logBuffer[1]);
+    close(desc);
+    return NG;
+  }
+
+  /* やり直した変更をデータファイルに書き戻して、ログを空にする */
+  return checkpoint();
+}
+
+/*
+ * finalizeLogModule -- ログ管理モジュールの終了処理
+ *
+ * 引数:
+ *  なし
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * チェックポイントを行ってから、ログを取るのをやめる。
+ */
+Result finalizeLogModule()
+{
+  Result ret;
+  int desc;
+
+  ret = checkpoint();
+
+  pthread_mutex_lock(&logMutex);
+  stopping = 1;
+  pthread_cond_signal(&flushRequested);
+  pthread_mutex_unlock(&logMutex);
+  pthread_join(writer, NULL);
+
+  pthread_mutex_lock(&logMutex);
+  desc = logDesc;
+  logDesc = -1;
+  pthread_mutex_unlock(&logMutex);
+
+  if (desc != -1 && close(desc) == -1) {
+    ret = NG;
+  }
+  free(logBuffer[0]);
+  free(logBuffer[1]);
+  logBuffer[0] = NULL;
+  logBuffer[1] = NULL;
+  free(openTransaction);
+  openTransaction = NULL;
+  numOpen = 0;
+  maxOpen = 0;
+
+  return ret;
+}
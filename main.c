@@ -5,41 +5,62 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "microdb.h"
 
 /*
  * MAX_INPUT -- 入力行の最大文字数
+ *
+ * 複数のレコードをまとめて指定するinsert文が1行に収まるよう、大きめにとる。
  */
-#define MAX_INPUT 256
+#define MAX_INPUT 65536
 
 /*
- * inputString -- 字句解析中の文字列を収める配列
+ * Parser -- 1つの文を解析して実行する間の状態
  *
- * 大きさを「3 * MAX_INPUT」とするのは、入力行のすべての文字が区切り記号でも
- * バッファオーバーフローを起こさないようにするため。
+ * 文ごとに作るので、別々のスレッドで同時に別の文を解析して実行できる。
  */
-static char inputString[3 * MAX_INPUT];
+typedef struct Parser Parser;
+struct Parser {
+    /*
+     * 字句解析中の文字列
+     *
+     * 大きさを「3 * MAX_INPUT」とするのは、入力行のすべての文字が区切り記号でも
+     * バッファオーバーフローを起こさないようにするため。
+     */
+    char inputString[3 * MAX_INPUT];
+    char *nextPosition;                 /* 字句解析中の場所 */
+    char *pushedBackToken;              /* ungetTokenで戻された字句(なければNULL) */
 
-/*
- * nextPosition -- 字句解析中の場所
- */
-static char *nextPosition;
+    /*
+     * prepare文の中の文を解析しているなら1
+     *
+     * このとき、各文の解析関数は文を実行せずにpreparedに準備済みの文を作り、
+     * 値の代わりにパラメータ(?)を書くことを許す。
+     */
+    int preparing;
+    int numParam;                       /* prepare文の中で、これまでに現れたパラメータの数 */
+    PreparedStatement *prepared;        /* prepare文の中の文から作った準備済みの文(失敗ならNULL) */
+    FILE *output;                       /* 結果やメッセージの出力先 */
+    Session *session;                   /* 文を受け取った接続の設定 */
+};
 
 /*
  * setInputString -- 字句解析する文字列の設定
  *
  * 引数:
+ *	parser: 解析の状態
  *	string: 解析する文字列
  *
  * 返り値:
  *	なし
  */
-static void setInputString(char *string)
+static void setInputString(Parser *parser, char *string)
 {
     char *p = string;
-    char *q = inputString;
+    char *q = parser->inputString;
 
   /* 入力行をコピーして保存する */
   while (*p != '\0') {
@@ -74,37 +95,45 @@ static void setInputString(char *string)
     *q = '\0';
 
     /* getNextToken()の読み出し開始位置を文字列の先頭に設定する */
-    nextPosition = inputString;
+    parser->nextPosition = parser->inputString;
+    parser->pushedBackToken = NULL;
 }
 
 /*
  * getNextToken -- setInputStringで設定した文字列からの字句の取り出し
  *
  * 引数:
- *	なし
+ *	parser: 解析の状態
  *
  * 返り値:
  *	次の字句の先頭番地を返す。最後までたどり着いたらNULLを返す。
  */
-static char *getNextToken()
+static char *getNextToken(Parser *parser)
 {
     char *start;
     char *end;
     char *p;
 
+    /* ungetTokenで戻された字句があれば、それを返す */
+    if (parser->pushedBackToken != NULL) {
+	    start = parser->pushedBackToken;
+	    parser->pushedBackToken = NULL;
+	    return start;
+    }
+
     /* 空白文字が複数続いていたら、その分nextPositionを移動させる */
-    while (*nextPosition == ' ') {
-	    nextPosition++;
+    while (*parser->nextPosition == ' ') {
+	    parser->nextPosition++;
     }
-    start = nextPosition;
+    start = parser->nextPosition;
 
     /* nextPositionの位置が文字列の最後('\0')だったら、解析終了 */
-    if (*nextPosition == '\0') {
+    if (*parser->nextPosition == '\0') {
 	    return NULL;
     }
 
     /* nextPositionの位置以降で、最初に見つかる空白文字の場所を探す */
-    p = nextPosition;
+    p = parser->nextPosition;
     while (*p != ' ' && *p != '\0') {
 	    /* 引用符の場合には、次の引用符まで読み飛ばす */
 	    if (*p == '\'' || *p == '"') {
@@ -135,14 +164,14 @@ static char *getNextToken()
      */
     if (*end != '\0') {
 	    *end = '\0';
-	    nextPosition = end + 1;
+	    parser->nextPosition = end + 1;
     } else {
 	/*
 	 * (*end == '\0')の場合は文字列の最後まで解析が終わっているので、
 	 * 次回のgetNextToken()の呼び出しのときにNULLが返るように、
 	 * nextPositionを文字列の一番最後に移動させる
 	 */
-	    nextPosition = end;
+	    parser->nextPosition = end;
     }
 
     /* 字句の先頭番地を返す */
@@ -150,18 +179,143 @@ static char *getNextToken()
 }
 
 /*
- * callCreateTable -- create文の構文解析とcreateTableの呼び出し
+ * ungetToken -- getNextTokenで取り出した字句を戻す
+ *
+ * 引数:
+ *	parser: 解析の状態
+ *	token: 戻す字句(次のgetNextTokenがこれを返す)
+ *
+ * 返り値:
+ *	なし
+ */
+static void ungetToken(Parser *parser, char *token)
+{
+    parser->pushedBackToken = token;
+}
+
+/*
+ * isClauseKeyword -- 条件式の後に続く句のキーワードかどうかを調べる
+ */
+static int isClauseKeyword(char *token)
+{
+    return strcmp(token, "group") == 0 || strcmp(token, "order") == 0
+      || strcmp(token, "to") == 0;
+}
+
+/*
+ * callCreateIndex -- create index文の構文解析とcreateIndexの呼び出し
  *
  * 引数:
+ *	parser: 解析の状態
+ *	indexType: 作成する索引の種類
+ *
+ * 返り値:
  *	なし
  *
+ * create indexの書式("create index"または"create hash index"は読み込み済み):
+ *	create [hash] index 索引名 on テーブル名 ( フィールド名 )
+ *	    [ include ( フィールド名 , ... ) ]
+ *	includeに指定したフィールドの値も索引に含め、索引だけで検索できるようにする。
+ */
+void callCreateIndex(Parser *parser, IndexType indexType)
+{
+  char *token;
+  char tableName[MAX_FILENAME];
+  IndexInfo indexInfo;
+
+  memset(&indexInfo, 0, sizeof(IndexInfo));
+  indexInfo.indexType = indexType;
+
+  /* 索引名を読み込む */
+  if ((token = getNextToken(parser)) == NULL || strlen(token) >= MAX_INDEX_NAME) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+  strcpy(indexInfo.name, token);
+
+  /* "on"とテーブル名を読み込む */
+  token = getNextToken(parser);
+  if (token == NULL || strcmp(token, "on") != 0) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+  if ((token = getNextToken(parser)) == NULL || strlen(token) >= MAX_FILENAME) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+  strcpy(tableName, token);
+
+  /* ( フィールド名 ) を読み込む */
+  token = getNextToken(parser);
+  if (token == NULL || strcmp(token, "(") != 0) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+  if ((token = getNextToken(parser)) == NULL || strlen(token) >= MAX_FIELD_NAME) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+  strcpy(indexInfo.fieldName, token);
+  token = getNextToken(parser);
+  if (token == NULL || strcmp(token, ")") != 0) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+
+  /* include ( フィールド名 , ... ) */
+  token = getNextToken(parser);
+  if (token != NULL && strcmp(token, "include") == 0) {
+    token = getNextToken(parser);
+    if (token == NULL || strcmp(token, "(") != 0) {
+      fprintf(parser->output, "入力行に間違いがあります。\n");
+      return;
+    }
+    for (;;) {
+      if ((token = getNextToken(parser)) == NULL || strlen(token) >= MAX_FIELD_NAME) {
+        fprintf(parser->output, "入力行に間違いがあります。\n");
+        return;
+      }
+      if (indexInfo.numInclude >= MAX_INCLUDE) {
+        fprintf(parser->output, "索引に含めるフィールドの数が上限を超えています。\n");
+        return;
+      }
+      strcpy(indexInfo.includeName[indexInfo.numInclude++], token);
+      if ((token = getNextToken(parser)) == NULL || strcmp(token, ",") != 0) {
+        break;
+      }
+    }
+    if (token == NULL || strcmp(token, ")") != 0) {
+      fprintf(parser->output, "入力行に間違いがあります。\n");
+      return;
+    }
+    token = getNextToken(parser);
+  }
+  if (token != NULL) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+
+  if (createIndex(tableName, &indexInfo) == OK) {
+    fprintf(parser->output, "索引を作成しました。\n");
+  } else {
+    fprintf(parser->output, "索引の作成に失敗しました。\n");
+  }
+}
+
+/*
+ * callCreateTable -- create文の構文解析とcreateTableの呼び出し
+ *
+ * 引数:
+ *	parser: 解析の状態
+ *
  * 返り値:
  *	なし
  *
  * create tableの書式:
  *	create table テーブル名 ( フィールド名 データ型, ... )
+ * create indexとcreate hash indexはcallCreateIndexで解析する。
  */
-void callCreateTable()
+void callCreateTable(Parser *parser)
 {
   char *token;
   char *tableName;
@@ -169,25 +323,38 @@ void callCreateTable()
   TableInfo tableInfo;
 
   /* createの次のトークンを読み込み、それが"table"かどうかをチェック */
-  token = getNextToken();
+  token = getNextToken(parser);
+  if (token != NULL && strcmp(token, "index") == 0) {
+    callCreateIndex(parser, INDEX_BTREE);
+    return;
+  }
+  if (token != NULL && strcmp(token, "hash") == 0) {
+    token = getNextToken(parser);
+    if (token == NULL || strcmp(token, "index") != 0) {
+      fprintf(parser->output, "入力行に間違いがあります。\n");
+      return;
+    }
+    callCreateIndex(parser, INDEX_HASH);
+    return;
+  }
   if (token == NULL || strcmp(token, "table") != 0) {
 	  /* 文法エラー */
-  	printf("入力行に間違いがあります。\n");
+  	fprintf(parser->output, "入力行に間違いがあります。\n");
     return;
   }
 
   /* テーブル名を読み込む */
-  if ((tableName = getNextToken()) == NULL) {
+  if ((tableName = getNextToken(parser)) == NULL) {
 	   /* 文法エラー */
-	  printf("入力行に間違いがあります。\n");
+	  fprintf(parser->output, "入力行に間違いがあります。\n");
   	return;
   }
 
   /* 次のトークンを読み込み、それが"("かどうかをチェック */
-  token = getNextToken();
+  token = getNextToken(parser);
   if (token == NULL || strcmp(token, "(") != 0) {
   	/* 文法エラー */
-  	printf("入力行に間違いがあります。\n");
+  	fprintf(parser->output, "入力行に間違いがあります。\n");
   	return;
   }
 
@@ -198,9 +365,9 @@ void callCreateTable()
   numField = 0;
   for(;;) {
   	/* フィールド名の読み込み */
-  	if ((token = getNextToken()) == NULL) {
+  	if ((token = getNextToken(parser)) == NULL) {
 	    /* 文法エラー */
-  	  printf("入力行に間違いがあります。\n");
+  	  fprintf(parser->output, "入力行に間違いがあります。\n");
   	  return;
   	}
 
@@ -213,9 +380,9 @@ void callCreateTable()
   	strcpy(tableInfo.fieldInfo[numField].name, token);
 
   	/* データ型の読み込み */
-  	if ((token = getNextToken())== NULL){
+  	if ((token = getNextToken(parser))== NULL){
       /* 文法エラー */
-      printf("入力行に間違いがあります。\n");
+      fprintf(parser->output, "入力行に間違いがあります。\n");
       return;    
     }
 
@@ -226,7 +393,7 @@ void callCreateTable()
       tableInfo.fieldInfo[numField].dataType = TYPE_STRING;
     }else{
       /* 文法エラー */
-      printf("入力行に間違いがあります。\n");
+      fprintf(parser->output, "入力行に間違いがあります。\n");
       return;
     }
 
@@ -235,14 +402,14 @@ void callCreateTable()
 
   	/* フィールド数が上限を超えていたらエラー */
   	if (numField > MAX_FIELD) {
-	    printf("フィールド数が上限を超えています。\n");
+	    fprintf(parser->output, "フィールド数が上限を超えています。\n");
 	    return;
   	}
 
   	/* 次のトークンの読み込み */
-    if ((token = getNextToken())== NULL){
+    if ((token = getNextToken(parser))== NULL){
       /* 文法エラー */
-      printf("入力行に間違いがあります。\n");
+      fprintf(parser->output, "入力行に間違いがあります。\n");
       return;    
     }	
 
@@ -254,7 +421,7 @@ void callCreateTable()
 	    continue;
 	  } else {
 	    /* 文法エラー */
-	    printf("入力行に間違いがあります。\n");
+	    fprintf(parser->output, "入力行に間違いがあります。\n");
 	    return;
   	}
   }
@@ -263,191 +430,328 @@ void callCreateTable()
 
   /* createTableを呼び出し、テーブルを作成 */
   if (createTable(tableName, &tableInfo) == OK) {
-  	printf("テーブルを作成しました。\n");
+  	fprintf(parser->output, "テーブルを作成しました。\n");
   } else {
-  	printf("テーブルの作成に失敗しました。\n");
+  	fprintf(parser->output, "テーブルの作成に失敗しました。\n");
   }
 }
 
 /*
- * callDropTable -- drop文の構文解析とdropTableの呼び出し
+ * callDropIndex -- drop index文の構文解析とdropIndexの呼び出し
  *
  * 引数:
+ *	parser: 解析の状態
+ *
+ * 返り値:
  *	なし
  *
+ * drop indexの書式("drop index"は読み込み済み):
+ *	drop index 索引名 on テーブル名
+ */
+void callDropIndex(Parser *parser)
+{
+  char *token;
+  char indexName[MAX_INDEX_NAME];
+
+  /* 索引名を読み込む */
+  if ((token = getNextToken(parser)) == NULL || strlen(token) >= MAX_INDEX_NAME) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+  strcpy(indexName, token);
+
+  /* "on"とテーブル名を読み込む */
+  token = getNextToken(parser);
+  if (token == NULL || strcmp(token, "on") != 0 || (token = getNextToken(parser)) == NULL) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+
+  if (dropIndex(token, indexName) == OK) {
+    fprintf(parser->output, "索引を削除しました。\n");
+  } else {
+    fprintf(parser->output, "索引の削除に失敗しました。\n");
+  }
+}
+
+/*
+ * callDropTable -- drop文の構文解析とdropTableの呼び出し
+ *
+ * 引数:
+ *	parser: 解析の状態
+ *
  * 返り値:
  *	なし
  *
  * drop tableの書式:
  *	drop table テーブル名
+ * drop indexはcallDropIndexで解析する。
  */
-void callDropTable()
+void callDropTable(Parser *parser)
 {
   char *token;
   char *tableName;
 
   /* dropの次のトークンを読み込み、それが"table"かどうかをチェック */
-  token = getNextToken();
+  token = getNextToken(parser);
+  if (token != NULL && strcmp(token, "index") == 0) {
+    callDropIndex(parser);
+    return;
+  }
   if (token == NULL || strcmp(token, "table") != 0) {
     /* 文法エラー */
-    printf("入力行に間違いがあります。\n");
+    fprintf(parser->output, "入力行に間違いがあります。\n");
     return;
   }
 
   /* テーブル名を読み込む */
-  if ((tableName = getNextToken()) == NULL) {
+  if ((tableName = getNextToken(parser)) == NULL) {
      /* 文法エラー */
-    printf("入力行に間違いがあります。\n");
+    fprintf(parser->output, "入力行に間違いがあります。\n");
     return;
   }
 
   /* dropTableを呼び出し、テーブルを作成 */
   if (dropTable(tableName) == OK) {
-    printf("テーブルを削除しました。\n");
+    fprintf(parser->output, "テーブルを削除しました。\n");
   } else {
-    printf("テーブルの削除に失敗しました。\n");
+    fprintf(parser->output, "テーブルの削除に失敗しました。\n");
   }
 }
 
 /*
- * callInsertRecord -- insert文の構文解析とinsertRecordの呼び出し
+ * callInsertRecord -- insert文の構文解析とinsertRecordsの呼び出し
  *
  * 引数:
- *	なし
+ *	parser: 解析の状態
  *
  * 返り値:
  *	なし
  *
  * insertの書式:
- *	insert into テーブル名 values ( フィールド値 , ... )
+ *	insert into テーブル名 values ( フィールド値 , ... ) [ , ( フィールド値 , ... ) ... ]
+ *	複数のレコードをまとめて指定すると、insertRecordsで一度に挿入する。
  */
-void callInsertRecord()
+void callInsertRecord(Parser *parser)
 {
   char *token;
   char *tableName;
-  int numField;
-  RecordData record;
+  int numField, numRecord, maxRecord, len;
+  int param[MAX_FIELD];
+  RecordData *records, *record, *p;
   TableInfo *tableInfo;
 
   /* insertの次のトークンを読み込み、それが"into"かどうかをチェック */
-  token = getNextToken();
+  token = getNextToken(parser);
   if (token == NULL || strcmp(token, "into") != 0) {
     /* 文法エラー */
-    printf("入力行に間違いがあります。\n");
+    fprintf(parser->output, "入力行に間違いがあります。\n");
     return;
   }
 
   /* テーブル名を読み込む */
-  if ((tableName = getNextToken()) == NULL) {
+  if ((tableName = getNextToken(parser)) == NULL) {
      /* 文法エラー */
-    printf("入力行に間違いがあります。\n");
+    fprintf(parser->output, "入力行に間違いがあります。\n");
     return;
   }
 
   /* テーブル名の次のトークンを読み込み、それが"values"かどうかをチェック */
-  token = getNextToken();
+  token = getNextToken(parser);
   if (token == NULL || strcmp(token, "values") != 0) {
     /* 文法エラー */
-    printf("入力行に間違いがあります。\n");
+    fprintf(parser->output, "入力行に間違いがあります。\n");
     return;
   }
 
-  /* 次のトークンを読み込み、それが"("かどうかをチェック */
-  token = getNextToken();
-  if (token == NULL || strcmp(token, "(") != 0) {
-    /* 文法エラー */
-    printf("入力行に間違いがあります。\n");
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    fprintf(parser->output, "テーブルが存在しません。\n");
+    return;
+  }
+
+  /* レコードを入れる配列(足りなくなったら広げる) */
+  maxRecord = 16;
+  if ((records = malloc(sizeof(RecordData) * maxRecord)) == NULL) {
+    freeTableInfo(tableInfo);
     return;
   }
+  numRecord = 0;
+
+  /* ( フィールド値 , ... ) の並びを","で区切って読み込む */
+  for (;;) {
+    /* 次のトークンを読み込み、それが"("かどうかをチェック */
+    token = getNextToken(parser);
+    if (token == NULL || strcmp(token, "(") != 0) {
+      /* 文法エラー */
+      fprintf(parser->output, "入力行に間違いがあります。\n");
+      goto done;
+    }
+
+    if (numRecord == maxRecord) {
+      if ((p = realloc(records, sizeof(RecordData) * maxRecord * 2)) == NULL) {
+        fprintf(parser->output, "メモリが足りません。\n");
+        goto done;
+      }
+      records = p;
+      maxRecord *= 2;
+    }
+    record = &records[numRecord];
+    memset(record, 0, sizeof(RecordData));
+    memset(param, 0, sizeof(param));
 
     /*
      * ここから、フィールド値を読み込み、
      * 配列fieldDataに入れていく。
      */
-  tableInfo = getTableInfo(tableName);
-  record.numField = tableInfo->numField;
-  numField = 0;
-  for(;;) {
-    /* フィールド値の読み込み */
-    if ((token = getNextToken()) == NULL) {
-      /* 文法エラー */
-      printf("入力行に間違いがあります。\n");
-      return;
-    }
+    record->numField = tableInfo->numField;
+    numField = 0;
+    for(;;) {
+      /* フィールド値の読み込み */
+      if ((token = getNextToken(parser)) == NULL) {
+        /* 文法エラー */
+        fprintf(parser->output, "入力行に間違いがあります。\n");
+        goto done;
+      }
 
-    /* 読み込んだトークンが")"だったら、ループから抜ける */
-    if (strcmp(token, ")") == 0) {
-      break;
-    }
+      /* 読み込んだトークンが")"だったら、ループから抜ける */
+      if (strcmp(token, ")") == 0) {
+        break;
+      }
 
-    strcpy(record.fieldData[numField].name, tableInfo->fieldInfo[numField].name);
+      if (numField >= tableInfo->numField) {
+        fprintf(parser->output, "フィールド数が上限を超えています。\n");
+        goto done;
+      }
+      strcpy(record->fieldData[numField].name, tableInfo->fieldInfo[numField].name);
+
+      param[numField] = 0;
+      if (parser->preparing && strcmp(token, "?") == 0) {
+        /* 値はprepareした文を実行するときに決める */
+        record->fieldData[numField].dataType = tableInfo->fieldInfo[numField].dataType;
+        param[numField] = ++parser->numParam;
+      }else if (tableInfo->fieldInfo[numField].dataType==TYPE_INTEGER){
+        record->fieldData[numField].dataType = TYPE_INTEGER;
+        record->fieldData[numField].valueSet.intValue = atoi(token);
+      }else if (tableInfo->fieldInfo[numField].dataType==TYPE_STRING){
+        record->fieldData[numField].dataType = TYPE_STRING;
+        /* where句の条件と同じく、文字列を囲む引用符は値に含めない */
+        len = strlen(token);
+        if (len >= 2 && (token[0] == '\'' || token[0] == '"') && token[len - 1] == token[0]) {
+          token[len - 1] = '\0';
+          token++;
+        }
+        strcpy(record->fieldData[numField].valueSet.stringValue, token);
+      }else{
+        fprintf(parser->output, "エラーが発生しました\n");
+        goto done;
+      }
 
-    if (tableInfo->fieldInfo[numField].dataType==TYPE_INTEGER){
-      record.fieldData[numField].dataType = TYPE_INTEGER;
-      int intnum = atoi(token);
-      record.fieldData[numField].valueSet.intValue = intnum; 
-    }else if (tableInfo->fieldInfo[numField].dataType==TYPE_STRING){
-      record.fieldData[numField].dataType = TYPE_STRING;
-      strcpy(record.fieldData[numField].valueSet.stringValue, token);
-    }else{
-      printf("エラーが発生しました\n");
-      return;
-    }
+      numField++;
 
-    numField++;
+      /* 次のトークンの読み込み */
+      if ((token = getNextToken(parser))== NULL){
+        /* 文法エラー */
+        fprintf(parser->output, "入力行に間違いがあります。\n");
+        goto done;
+      }
 
-    /* 次のトークンの読み込み */
-    if ((token = getNextToken())== NULL){
-      /* 文法エラー */
-      printf("入力行に間違いがあります。\n");
-      return;    
-    } 
+      /* 読み込んだトークンが")"だったら、ループから抜ける */
+      if (strcmp(token, ")") == 0) {
+        break;
+      } else if (strcmp(token, ",") == 0) {
+        /* 次のフィールドを読み込むため、ループの先頭へ */
+        continue;
+      } else {
+        /* 文法エラー */
+        fprintf(parser->output, "入力行に間違いがあります。\n");
+        goto done;
+      }
+    }
+    numRecord++;
 
-    /* 読み込んだトークンが")"だったら、ループから抜ける */
-    if (strcmp(token, ")") == 0) {
+    /* ","が続けば次のレコード、なければ終わり */
+    if ((token = getNextToken(parser)) == NULL) {
       break;
-    } else if (strcmp(token, ",") == 0) {
-      /* 次のフィールドを読み込むため、ループの先頭へ */
-      continue;
-    } else {
-      /* 文法エラー */
-      printf("入力行に間違いがあります。\n");
-      return;
+    }
+    if (strcmp(token, ",") != 0) {
+      fprintf(parser->output, "入力行に間違いがあります。\n");
+      goto done;
     }
   }
 
-  /* createTableを呼び出し、テーブルを作成 */
-  if (insertRecord(tableName, &record) == OK) {
-    printf("データの挿入に成功しました。\n");
+  if (parser->preparing) {
+    /* prepare文の中なら、実行せずに準備済みの文を作る */
+    if (numRecord == 1) {
+      parser->prepared = prepareInsert(tableName, records, param);
+    } else {
+      fprintf(parser->output, "準備できるのは1件のレコードを挿入する文だけです。\n");
+    }
+  } else if (insertRecords(tableName, records, numRecord) == OK) {
+    /* insertRecordsを呼び出し、まとめて挿入した */
+    if (numRecord == 1) {
+      fprintf(parser->output, "データの挿入に成功しました。\n");
+    } else {
+      fprintf(parser->output, "%d件のデータの挿入に成功しました。\n", numRecord);
+    }
   } else {
-    printf("データの挿入に失敗しました。\n");
+    fprintf(parser->output, "データの挿入に失敗しました。\n");
+  }
+
+done:
+  free(records);
+  freeTableInfo(tableInfo);
+}
+
+/*freeCond--条件の解放
+*
+* 引数:
+*  Condition
+*
+* 返り値:
+*  なし
+*/
+void freeCond(Condition *condition){
+  Condition *p,*q;
+  if (condition->andCondition!=NULL){
+    freeCond(condition->andCondition);
+  }
+  if (condition->orCondition!=NULL){
+    freeCond(condition->orCondition);
   }
+
+  free(condition);
+  return;
+
 }
 
 /*analizeCond--条件の構文解析
 *
 * 引数:
+*  parser
 *  tableInfo
 *
 * 返り値:
-*  Condition
+*  Condition(誤りがあればメッセージを出力してNULL)
 */
-Condition *analizeCond(TableInfo *tableInfo){
+Condition *analizeCond(Parser *parser, TableInfo *tableInfo){
   int i;
   char *token,*p;
   Condition *condition;
 
   condition = (Condition *)malloc(sizeof(Condition));
   if (condition==NULL){
-    printf("malloc error\n");
+    fprintf(parser->output, "malloc error\n");
     return NULL;
   }
+  condition->param = 0;
+  condition->andCondition = NULL;
+  condition->orCondition = NULL;
 
   /* フィールド名を読み込む */
-  if ((token = getNextToken()) == NULL) {
+  if ((token = getNextToken(parser)) == NULL) {
      /* 文法エラー */
-    printf("入力行に間違いがあります。\n");
-    return NULL;
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    goto error;
   }
 
   strcpy(condition->name, token);
@@ -464,11 +768,14 @@ Condition *analizeCond(TableInfo *tableInfo){
 
   /* フィールドのデータ型がわからなければ、文法エラー */
   if (condition->dataType == TYPE_UNKNOWN) {
-    printf("指定したフィールドが存在しません。\n");
-    return NULL;
+    fprintf(parser->output, "指定したフィールドが存在しません。\n");
+    goto error;
   }
   /*比較演算子を入力する*/
-  if ((token = getNextToken()) != NULL) {
+  if ((token = getNextToken(parser)) == NULL) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    goto error;
+  } else {
     if (strcmp(token,"=")==0){
       condition->operator = OPR_EQUAL;      
     }else if (strcmp(token,"!=")==0){
@@ -478,13 +785,20 @@ Condition *analizeCond(TableInfo *tableInfo){
     }else if (strcmp(token,"<")==0){
       condition->operator = OPR_LESS_THAN;     
     }else{
-      printf("比較演算子が間違っています\n");
-      return NULL;
+      fprintf(parser->output, "比較演算子が間違っています\n");
+      goto error;
     }
   }
 
-  if ((token = getNextToken()) != NULL) {
-    if (condition->dataType == TYPE_INTEGER){
+  if ((token = getNextToken(parser)) == NULL) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    goto error;
+  } else {
+    if (parser->preparing && strcmp(token, "?") == 0) {
+      /* 値はprepareした文を実行するときに決める */
+      condition->param = ++parser->numParam;
+      memset(&condition->valueSet, 0, sizeof(ValueSet));
+    }else if (condition->dataType == TYPE_INTEGER){
       int intnum = atoi(token);
       condition->valueSet.intValue = intnum;
     }else if (condition->dataType == TYPE_STRING){
@@ -503,137 +817,483 @@ Condition *analizeCond(TableInfo *tableInfo){
         if (*p == *quote) {
           *p = '\0';
         }else{
-          printf("入力にミスがあります\n");
-          return NULL;
+          fprintf(parser->output, "入力にミスがあります\n");
+          goto error;
         }
       }else{
-        printf("入力にミスがあります\n");
-        return NULL;
+        fprintf(parser->output, "入力にミスがあります\n");
+        goto error;
       }
       strcpy(condition->valueSet.stringValue,token);
     }else{
-      fprintf(stderr, "Unknown data type found.\n");
-      exit(1);    
+      /* サーバでは他の接続も止めてしまうので、終了せずに失敗を返す */
+      fprintf(parser->output, "フィールドのデータ型がわかりません。\n");
+      goto error;
     }
   }
 
-  if ((token = getNextToken()) != NULL) {
+  if ((token = getNextToken(parser)) != NULL) {
     if ((strcmp("&&",token)==0)||(strcmp("and",token)==0)){
-      condition->orCondition = NULL;
-      condition->andCondition = analizeCond(tableInfo);
+      if ((condition->andCondition = analizeCond(parser, tableInfo)) == NULL) {
+        goto error;
+      }
     }else if ((strcmp("||",token)==0)||(strcmp("or",token)==0)){
-      condition->andCondition = NULL;
-      condition->orCondition = analizeCond(tableInfo);
+      if ((condition->orCondition = analizeCond(parser, tableInfo)) == NULL) {
+        goto error;
+      }
+    }else if (isClauseKeyword(token)){
+      /* 条件式の終わりなので、キーワードは呼び出し元に戻す */
+      ungetToken(parser, token);
     }else{
-      printf("演算子に間違いがあります。\n");
-      return NULL;
+      fprintf(parser->output, "演算子に間違いがあります。\n");
+      goto error;
     }
-  }else{
-    condition->andCondition = NULL;
-    condition->orCondition = NULL;
   }
   return condition;
+
+error:
+  /* 誤りのメッセージは出力済み */
+  freeCond(condition);
+  return NULL;
 }
 
-/*freeCond--条件の解放
-*
-* 引数:
-*  Condition
-*
-* 返り値:
-*  なし
-*/
-void freeCond(Condition *condition){
-  Condition *p,*q;
-  if (condition->andCondition!=NULL){
-    freeCond(condition->andCondition);
-  }
-  if (condition->orCondition!=NULL){
-    freeCond(condition->orCondition);
+/*
+ * getAggregateType -- 集約関数の名前から種類を調べる
+ *
+ * 引数:
+ *	token: 集約関数の名前
+ *	type: 集約関数の種類を返す領域(NULLでもよい)
+ *
+ * 返り値:
+ *	集約関数の名前ならOK、そうでなければNG
+ */
+static Result getAggregateType(char *token, AggregateType *type)
+{
+  AggregateType found;
+
+  if (strcmp(token, "count") == 0) {
+    found = AGG_COUNT;
+  } else if (strcmp(token, "sum") == 0) {
+    found = AGG_SUM;
+  } else if (strcmp(token, "min") == 0) {
+    found = AGG_MIN;
+  } else if (strcmp(token, "max") == 0) {
+    found = AGG_MAX;
+  } else if (strcmp(token, "avg") == 0) {
+    found = AGG_AVG;
+  } else {
+    return NG;
   }
 
-  free(condition);
-  return;
-
+  if (type != NULL) {
+    *type = found;
+  }
+  return OK;
 }
 
 /*
- * callSelectRecord -- select文の構文解析とselectRecordの呼び出し
+ * callAggregateRecord -- 集約関数を含むselect文の構文解析と
+ *                        aggregateRecord/groupRecordの呼び出し
  *
  * 引数:
- *	なし
+ *	parser: 解析の状態
+ *	token: selectの次のトークン
  *
  * 返り値:
  *	なし
  *
- * selectの書式:
- *	select * from テーブル名 where 条件式
- *	select フィールド名 , ... from テーブル名 where 条件式 (発展課題)
+ * 書式:
+ *	select 集約関数 ( フィールド名 ) , ... from テーブル名 [ where 条件式 ]
+ *	select フィールド名 , 集約関数 ( フィールド名 ) , ... from テーブル名
+ *	    [ where 条件式 ] group by フィールド名 , ...
+ *	select フィールド名 , ... from テーブル名 [ where 条件式 ]
+ *	集約関数はcount, sum, min, max, avgのいずれか。count(*)も指定できる。
+ *	group byを指定した場合、結果はgroup byのフィールド、集約関数の順に並ぶ。
+ *	集約関数もgroup byもなければ、指定したフィールドだけを取り出す(selectFields)。
  */
-void callSelectRecord()
+static void callAggregateRecord(Parser *parser, char *token)
 {
-  char *token;
   char *tableName;
-  int connum;
-  RecordSet *record;
+  int i, j, numAggregate, numSelected;
+  Aggregate aggregate[MAX_AGGREGATE];
+  Projection projection;
+  GroupBy groupBy;
   TableInfo *tableInfo;
-  Condition *condition;
+  Condition *condition = NULL;
+  RecordSet *recordSet;
+
+  /* 集約関数とフィールド名の並びを読み込む */
+  numAggregate = 0;
+  numSelected = 0;
+  for (;;) {
+    if (token == NULL || strlen(token) >= MAX_FIELD_NAME) {
+      fprintf(parser->output, "入力行に間違いがあります。\n");
+      return;
+    }
 
-  /* selectの次のトークンを読み込み、それが"*"かどうかをチェック */
-  token = getNextToken();
-  if (token == NULL ) {
-    /* 文法エラー */
-    printf("入力行に間違いがあります。\n");
-    return;
-  }
-  if (strcmp(token, "distinct") == 0){
-    condition->distinct=DISTINCT;
-    token = getNextToken();
-  }else{
-    condition->distinct=NOT_DISTINCT;
-  }
-  if (token == NULL || strcmp(token, "*") != 0) {
-    /* 文法エラー */
-    printf("入力行に間違いがあります。\n");
-    return;
-  }
+    if (getAggregateType(token, NULL) == OK) {
+      /* 配列に書き込む前に、数が上限を超えていないか調べる */
+      if (numAggregate >= MAX_AGGREGATE) {
+        fprintf(parser->output, "集約関数の数が上限を超えています。\n");
+        return;
+      }
+      getAggregateType(token, &aggregate[numAggregate].type);
 
-  /* selectの次のトークンを読み込み、それが"from"かどうかをチェック */
-  token = getNextToken();
-  if (token == NULL || strcmp(token, "from") != 0) {
-    /* 文法エラー */
-    printf("入力行に間違いがあります。\n");
-    return;
+      /* "(" フィールド名 ")" */
+      token = getNextToken(parser);
+      if (token == NULL || strcmp(token, "(") != 0) {
+        fprintf(parser->output, "入力行に間違いがあります。\n");
+        return;
+      }
+      if ((token = getNextToken(parser)) == NULL || strlen(token) >= MAX_FIELD_NAME) {
+        fprintf(parser->output, "入力行に間違いがあります。\n");
+        return;
+      }
+      strcpy(aggregate[numAggregate].name, token);
+      token = getNextToken(parser);
+      if (token == NULL || strcmp(token, ")") != 0) {
+        fprintf(parser->output, "入力行に間違いがあります。\n");
+        return;
+      }
+      numAggregate++;
+    } else {
+      /* 集約関数でなければ、group byで指定するフィールド名 */
+      if (numSelected >= MAX_FIELD) {
+        fprintf(parser->output, "フィールド数が上限を超えています。\n");
+        return;
+      }
+      strcpy(projection.name[numSelected++], token);
+    }
+
+    /* ","なら次の要素、"from"なら並びの終わり */
+    token = getNextToken(parser);
+    if (token != NULL && strcmp(token, ",") == 0) {
+      token = getNextToken(parser);
+      continue;
+    } else if (token != NULL && strcmp(token, "from") == 0) {
+      break;
+    } else {
+      fprintf(parser->output, "入力行に間違いがあります。\n");
+      return;
+    }
   }
 
   /* テーブル名を読み込む */
-  if ((tableName = getNextToken()) == NULL) {
-     /* 文法エラー */
-    printf("入力行に間違いがあります。\n");
+  if ((tableName = getNextToken(parser)) == NULL) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
     return;
   }
 
-  /* テーブル名の次のトークンを読み込み、それが"where"かどうかをチェック */
-  token = getNextToken();
-  if (token == NULL || strcmp(token, "where") != 0) {
-    /* 文法エラー */
-    printf("入力行に間違いがあります。\n");
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    fprintf(parser->output, "テーブルが存在しません。\n");
     return;
   }
 
-  tableInfo = getTableInfo(tableName);
-  if((condition = analizeCond(tableInfo))==NULL){
-    return;
-  }
-  if ((record = selectRecord(tableName, condition)) == NULL) {
-    fprintf(stderr, "Cannot select records.\n");
-    exit(1);
+  /* where句は省略できる */
+  token = getNextToken(parser);
+  if (token != NULL && strcmp(token, "where") == 0) {
+    if ((condition = analizeCond(parser, tableInfo)) == NULL) {
+      freeTableInfo(tableInfo);
+      return;
+    }
+    token = getNextToken(parser);
   }
-  printRecordSet(record);
 
+  /* group by句 */
+  groupBy.numField = 0;
+  if (token != NULL && strcmp(token, "group") == 0) {
+    token = getNextToken(parser);
+    if (token == NULL || strcmp(token, "by") != 0) {
+      token = "";
+    } else {
+      for (;;) {
+        if ((token = getNextToken(parser)) == NULL || strlen(token) >= MAX_FIELD_NAME
+            || groupBy.numField >= MAX_FIELD) {
+          token = "";
+          break;
+        }
+        strcpy(groupBy.name[groupBy.numField++], token);
+        if ((token = getNextToken(parser)) == NULL || strcmp(token, ",") != 0) {
+          break;
+        }
+      }
+    }
+  }
+
+  /* 余計なトークンが残っていたら文法エラー */
+  if (token != NULL) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    freeTableInfo(tableInfo);
+    if (condition != NULL) {
+      freeCond(condition);
+    }
+    return;
+  }
+
+  /* 集約関数がなければ、指定したフィールドを取り出す */
+  if (numAggregate == 0 && groupBy.numField == 0) {
+    projection.numField = numSelected;
+    if ((recordSet = selectFields(tableName, condition, &projection)) != NULL) {
+      printRecordSet(parser->output, recordSet);
+      freeRecordSet(recordSet);
+      free(recordSet);
+    } else {
+      fprintf(parser->output, "検索に失敗しました。\n");
+    }
+    freeTableInfo(tableInfo);
+    if (condition != NULL) {
+      freeCond(condition);
+    }
+    return;
+  }
+
+  /* 集約関数以外のフィールドは、group byで指定したものでなければならない */
+  for (i = 0; i < numSelected; i++) {
+    for (j = 0; j < groupBy.numField; j++) {
+      if (strcmp(projection.name[i], groupBy.name[j]) == 0) {
+        break;
+      }
+    }
+    if (j == groupBy.numField) {
+      fprintf(parser->output, "フィールド%sはgroup byで指定してください。\n", projection.name[i]);
+      freeTableInfo(tableInfo);
+      if (condition != NULL) {
+        freeCond(condition);
+      }
+      return;
+    }
+  }
+
+  if (groupBy.numField == 0) {
+    if (aggregateRecord(tableName, condition, aggregate, numAggregate) == OK) {
+      printAggregate(parser->output, aggregate, numAggregate);
+    } else {
+      fprintf(parser->output, "集約関数の計算に失敗しました。\n");
+    }
+  } else {
+    if ((recordSet = groupRecord(tableName, condition, &groupBy, aggregate, numAggregate)) != NULL) {
+      printRecordSet(parser->output, recordSet);
+      freeRecordSet(recordSet);
+      free(recordSet);
+    } else {
+      fprintf(parser->output, "グループ化に失敗しました。\n");
+    }
+  }
 
   freeTableInfo(tableInfo);
-  freeCond(condition);
+  if (condition != NULL) {
+    freeCond(condition);
+  }
+}
+
+/*
+ * parseOrderBy -- order by句の構文解析
+ *
+ * 引数:
+ *	parser: 解析の状態
+ *	tableInfo: 検索するテーブルのデータ定義情報
+ *	orderBy: 解析結果を書き込む領域
+ *
+ * 返り値:
+ *	成功ならOK、文法エラーならNG
+ *
+ * order byの書式("order"は読み込み済み):
+ *	order by フィールド名 [ asc | desc ] , ... [ limit レコード数 ]
+ */
+static Result parseOrderBy(Parser *parser, TableInfo *tableInfo, OrderBy *orderBy)
+{
+  char *token;
+  int i;
+
+  token = getNextToken(parser);
+  if (token == NULL || strcmp(token, "by") != 0) {
+    return NG;
+  }
+
+  orderBy->numField = 0;
+  orderBy->limit = NO_LIMIT;
+  for (;;) {
+    /* フィールド名 */
+    if ((token = getNextToken(parser)) == NULL || orderBy->numField >= MAX_FIELD) {
+      return NG;
+    }
+    for (i = 0; i < tableInfo->numField; i++) {
+      if (strcmp(tableInfo->fieldInfo[i].name, token) == 0) {
+        break;
+      }
+    }
+    if (i == tableInfo->numField) {
+      fprintf(parser->output, "指定したフィールドが存在しません。\n");
+      return NG;
+    }
+    strcpy(orderBy->name[orderBy->numField], token);
+    orderBy->order[orderBy->numField] = ORDER_ASC;
+
+    /* 整列の向き(省略したら昇順) */
+    token = getNextToken(parser);
+    if (token != NULL && strcmp(token, "asc") == 0) {
+      token = getNextToken(parser);
+    } else if (token != NULL && strcmp(token, "desc") == 0) {
+      orderBy->order[orderBy->numField] = ORDER_DESC;
+      token = getNextToken(parser);
+    }
+    orderBy->numField++;
+
+    if (token == NULL) {
+      return OK;
+    } else if (strcmp(token, "limit") == 0) {
+      break;
+    } else if (strcmp(token, ",") != 0) {
+      return NG;
+    }
+  }
+
+  /* limit句(0以上の整数) */
+  token = getNextToken(parser);
+  if (token == NULL || token[0] == '\0' || strspn(token, "0123456789") != strlen(token)) {
+    return NG;
+  }
+  orderBy->limit = atol(token);
+
+  if (getNextToken(parser) != NULL) {
+    return NG;
+  }
+  return OK;
+}
+
+/*
+ * callSelectRecord -- select文の構文解析とselectRecordの呼び出し
+ *
+ * 引数:
+ *	parser: 解析の状態
+ *
+ * 返り値:
+ *	なし
+ *
+ * selectの書式:
+ *	select * from テーブル名 where 条件式
+ *	select [ distinct ] * from テーブル名 [ where 条件式 ] order by フィールド名 [ asc | desc ] , ...
+ *		[ limit レコード数 ]
+ *	select フィールド名 , ... from テーブル名 [ where 条件式 ] (callAggregateRecordで処理する)
+ */
+void callSelectRecord(Parser *parser)
+{
+  char *token;
+  char *tableName;
+  int connum;
+  RecordSet *record;
+  TableInfo *tableInfo;
+  Condition *condition;
+  distinctFlag distinct;
+  OrderBy orderBy;
+
+  /* selectの次のトークンを読み込み、それが"*"かどうかをチェック */
+  token = getNextToken(parser);
+  if (token == NULL ) {
+    /* 文法エラー */
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+  if (strcmp(token, "distinct") == 0){
+    distinct = DISTINCT;
+    token = getNextToken(parser);
+  }else{
+    distinct = NOT_DISTINCT;
+    /* "*"でなければ、集約関数を含むselect文として処理する */
+    if (strcmp(token, "*") != 0) {
+      callAggregateRecord(parser, token);
+      return;
+    }
+  }
+  if (token == NULL || strcmp(token, "*") != 0) {
+    /* 文法エラー */
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+
+  /* selectの次のトークンを読み込み、それが"from"かどうかをチェック */
+  token = getNextToken(parser);
+  if (token == NULL || strcmp(token, "from") != 0) {
+    /* 文法エラー */
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+
+  /* テーブル名を読み込む */
+  if ((tableName = getNextToken(parser)) == NULL) {
+     /* 文法エラー */
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+
+  /* テーブル名の次のトークンを読み込み、それが"where"か"order"かをチェック */
+  token = getNextToken(parser);
+  if (token == NULL || (strcmp(token, "where") != 0 && strcmp(token, "order") != 0)) {
+    /* 文法エラー */
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    fprintf(parser->output, "テーブルが存在しません。\n");
+    return;
+  }
+
+  /* where句(order byがあれば省略できる) */
+  condition = NULL;
+  if (strcmp(token, "where") == 0) {
+    if((condition = analizeCond(parser, tableInfo))==NULL){
+      freeTableInfo(tableInfo);
+      return;
+    }
+    condition->distinct = distinct;
+    token = getNextToken(parser);
+  } else if (distinct == DISTINCT) {
+    fprintf(parser->output, "distinctを指定するときはwhere句も指定してください。\n");
+    freeTableInfo(tableInfo);
+    return;
+  }
+
+  /* order by句 */
+  orderBy.numField = 0;
+  orderBy.limit = NO_LIMIT;
+  if (token != NULL) {
+    if (strcmp(token, "order") != 0 || parseOrderBy(parser, tableInfo, &orderBy) != OK) {
+      fprintf(parser->output, "入力行に間違いがあります。\n");
+      freeTableInfo(tableInfo);
+      if (condition != NULL) {
+        freeCond(condition);
+      }
+      return;
+    }
+  }
+
+  if (parser->preparing) {
+    /* prepare文の中なら、実行せずに準備済みの文を作る */
+    parser->prepared = prepareSelect(tableName, condition, &orderBy);
+  } else if (orderBy.numField == 0) {
+    /* ロックが取れない場合や、他の接続がテーブルを削除した場合にも失敗する */
+    if ((record = selectRecord(tableName, condition)) != NULL) {
+      printRecordSet(parser->output, record);
+      freeRecordSet(record);
+      free(record);
+    } else {
+      fprintf(parser->output, "検索に失敗しました。\n");
+    }
+  } else {
+    if ((record = selectSortedRecord(tableName, condition, &orderBy)) != NULL) {
+      printRecordSet(parser->output, record);
+      freeRecordSet(record);
+      free(record);
+    } else {
+      fprintf(parser->output, "検索に失敗しました。\n");
+    }
+  }
+
+  freeTableInfo(tableInfo);
+  if (condition != NULL) {
+    freeCond(condition);
+  }
 
   return;
 }
@@ -644,7 +1304,7 @@ void callSelectRecord()
  * callDeleteRecord -- delete文の構文解析とdeleteRecordの呼び出し
  *
  * 引数:
- *	なし
+ *	parser: 解析の状態
  *
  * 返り値:
  *	なし
@@ -652,7 +1312,7 @@ void callSelectRecord()
  * deleteの書式:
  *	delete from テーブル名 where 条件式
  */
-void callDeleteRecord()
+void callDeleteRecord(Parser *parser)
 {
   char *token;
   char *tableName;
@@ -662,34 +1322,48 @@ void callDeleteRecord()
   Condition *condition;
 
   /* deleteの次のトークンを読み込み、それが"from"かどうかをチェック */
-  token = getNextToken();
+  token = getNextToken(parser);
   if (token == NULL || strcmp(token, "from") != 0) {
     /* 文法エラー */
-    printf("入力行に間違いがあります。\n");
+    fprintf(parser->output, "入力行に間違いがあります。\n");
     return;
   }
 
   /* テーブル名を読み込む */
-  if ((tableName = getNextToken()) == NULL) {
+  if ((tableName = getNextToken(parser)) == NULL) {
      /* 文法エラー */
-    printf("入力行に間違いがあります。\n");
+    fprintf(parser->output, "入力行に間違いがあります。\n");
     return;
   }
 
   /* テーブル名の次のトークンを読み込み、それが"where"かどうかをチェック */
-  token = getNextToken();
+  token = getNextToken(parser);
   if (token == NULL || strcmp(token, "where") != 0) {
     /* 文法エラー */
-    printf("入力行に間違いがあります。\n");
+    fprintf(parser->output, "入力行に間違いがあります。\n");
     return;
   }
 
-  tableInfo = getTableInfo(tableName);
-  condition = analizeCond(tableInfo);
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    fprintf(parser->output, "テーブルが存在しません。\n");
+    return;
+  }
+  if ((condition = analizeCond(parser, tableInfo)) == NULL) {
+    freeTableInfo(tableInfo);
+    return;
+  }
+
+  if (parser->preparing) {
+    /* prepare文の中なら、実行せずに準備済みの文を作る */
+    parser->prepared = prepareDelete(tableName, condition);
+    freeCond(condition);
+    freeTableInfo(tableInfo);
+    return;
+  }
 
+  /* ロックが取れない場合や、他の接続がテーブルを削除した場合にも失敗する */
   if (deleteRecord(tableName, condition) == NG){
-    fprintf(stderr, "delete error.\n");
-    exit(1);
+    fprintf(parser->output, "データの削除に失敗しました。\n");
   }
     
 
@@ -700,13 +1374,661 @@ void callDeleteRecord()
 }
 
 /*
- * main -- マイクロDBシステムのエントリポイント
+ * callUpdateRecord -- update文の構文解析とupdateRecordの呼び出し
+ *
+ * 引数:
+ *	parser: 解析の状態
+ *
+ * 返り値:
+ *	なし
+ *
+ * updateの書式:
+ *	update テーブル名 set フィールド名 = 値 , ... [ where 条件式 ]
  */
-int main()
+void callUpdateRecord(Parser *parser)
+{
+  char *token;
+  char *tableName;
+  int i, k, len;
+  TableInfo *tableInfo;
+  Condition *condition = NULL;
+  Assignment assignment;
+
+  /* テーブル名を読み込む */
+  if ((tableName = getNextToken(parser)) == NULL) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+  if ((tableInfo = getTableInfo(tableName)) == NULL) {
+    fprintf(parser->output, "テーブルが存在しません。\n");
+    return;
+  }
+
+  token = getNextToken(parser);
+  if (token == NULL || strcmp(token, "set") != 0) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    freeTableInfo(tableInfo);
+    return;
+  }
+
+  /* フィールド名 = 値 の組を読み込む */
+  assignment.numField = 0;
+  for (;;) {
+    if ((token = getNextToken(parser)) == NULL) {
+      fprintf(parser->output, "入力行に間違いがあります。\n");
+      freeTableInfo(tableInfo);
+      return;
+    }
+    for (k = 0; k < tableInfo->numField; k++) {
+      if (strcmp(tableInfo->fieldInfo[k].name, token) == 0) {
+        break;
+      }
+    }
+    if (k == tableInfo->numField) {
+      fprintf(parser->output, "指定したフィールドが存在しません。\n");
+      freeTableInfo(tableInfo);
+      return;
+    }
+    if (assignment.numField >= MAX_FIELD) {
+      fprintf(parser->output, "フィールド数が上限を超えています。\n");
+      freeTableInfo(tableInfo);
+      return;
+    }
+    i = assignment.numField++;
+    strcpy(assignment.name[i], token);
+    assignment.dataType[i] = tableInfo->fieldInfo[k].dataType;
+    assignment.param[i] = 0;
+
+    token = getNextToken(parser);
+    if (token == NULL || strcmp(token, "=") != 0 || (token = getNextToken(parser)) == NULL) {
+      fprintf(parser->output, "入力行に間違いがあります。\n");
+      freeTableInfo(tableInfo);
+      return;
+    }
+    memset(&assignment.valueSet[i], 0, sizeof(ValueSet));
+    if (parser->preparing && strcmp(token, "?") == 0) {
+      /* 値はprepareした文を実行するときに決める */
+      assignment.param[i] = ++parser->numParam;
+    } else if (assignment.dataType[i] == TYPE_INTEGER) {
+      assignment.valueSet[i].intValue = atoi(token);
+    } else {
+      /* insertと同じく、文字列を囲む引用符は値に含めない */
+      len = strlen(token);
+      if (len >= 2 && (token[0] == '\'' || token[0] == '"') && token[len - 1] == token[0]) {
+        token[len - 1] = '\0';
+        token++;
+      }
+      strncpy(assignment.valueSet[i].stringValue, token, MAX_STRING - 1);
+    }
+
+    /* ","なら次の組へ、そうでなければ組の並びの終わり */
+    if ((token = getNextToken(parser)) == NULL || strcmp(token, ",") != 0) {
+      break;
+    }
+  }
+
+  if (token != NULL) {
+    if (strcmp(token, "where") != 0 || (condition = analizeCond(parser, tableInfo)) == NULL) {
+      fprintf(parser->output, "入力行に間違いがあります。\n");
+      freeTableInfo(tableInfo);
+      return;
+    }
+  }
+
+  if (parser->preparing) {
+    /* prepare文の中なら、実行せずに準備済みの文を作る */
+    parser->prepared = prepareUpdate(tableName, &assignment, condition);
+  } else if (updateRecord(tableName, &assignment, condition) == OK) {
+    fprintf(parser->output, "データの更新に成功しました。\n");
+  } else {
+    fprintf(parser->output, "データの更新に失敗しました。\n");
+  }
+
+  freeTableInfo(tableInfo);
+  if (condition != NULL) {
+    freeCond(condition);
+  }
+}
+
+/*
+ * callCopy -- copy文の構文解析とcopyFrom、copyToの呼び出し
+ *
+ * 引数:
+ *	parser: 解析の状態
+ *
+ * 返り値:
+ *	なし
+ *
+ * copyの書式:
+ *	copy テーブル名 from 'ファイル名'
+ *	copy テーブル名 [ where 条件式 ] to 'ファイル名'
+ *	ファイルはCSV(ファイル名が.tsvで終わればTSV)で、1行が1レコード。
+ *	書き出す場合は、ファイル名が.binで終わればバイナリ形式にする。
+ */
+void callCopy(Parser *parser)
+{
+  char *tableName;
+  char *token;
+  char *filename;
+  TableInfo *tableInfo;
+  Condition *condition = NULL;
+  long numRecord;
+  int len, export;
+
+  if ((tableName = getNextToken(parser)) == NULL || (token = getNextToken(parser)) == NULL) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+
+  /* 書き出しの場合は、where句で書き出すレコードを絞り込める */
+  if (strcmp(token, "where") == 0) {
+    if ((tableInfo = getTableInfo(tableName)) == NULL) {
+      fprintf(parser->output, "テーブルが存在しません。\n");
+      return;
+    }
+    condition = analizeCond(parser, tableInfo);
+    freeTableInfo(tableInfo);
+    if (condition == NULL) {
+      return;
+    }
+    token = getNextToken(parser);
+  }
+  export = (token != NULL && strcmp(token, "to") == 0);
+  if (token == NULL || (!export && (condition != NULL || strcmp(token, "from") != 0))
+      || (filename = getNextToken(parser)) == NULL || getNextToken(parser) != NULL) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    if (condition != NULL) {
+      freeCond(condition);
+    }
+    return;
+  }
+
+  /* ファイル名を囲む引用符は取り除く */
+  len = strlen(filename);
+  if (len >= 2 && (filename[0] == '\'' || filename[0] == '"') && filename[len - 1] == filename[0]) {
+    filename[len - 1] = '\0';
+    filename++;
+  }
+
+  if (export) {
+    if (copyTo(tableName, condition, filename, &numRecord) == OK) {
+      fprintf(parser->output, "%ld件のデータを書き出しました。\n", numRecord);
+    } else {
+      fprintf(parser->output, "データの書き出しに失敗しました。\n");
+    }
+  } else if (copyFrom(tableName, filename, &numRecord) == OK) {
+    fprintf(parser->output, "%ld件のデータを読み込みました。\n", numRecord);
+  } else {
+    fprintf(parser->output, "データの読み込みに失敗しました(%ld件は読み込み済み)。\n", numRecord);
+  }
+
+  if (condition != NULL) {
+    freeCond(condition);
+  }
+}
+
+/*
+ * callVacuum -- vacuum文の構文解析とvacuumTableの呼び出し
+ *
+ * 引数:
+ *	parser: 解析の状態
+ *
+ * 返り値:
+ *	なし
+ *
+ * vacuumの書式:
+ *	vacuum テーブル名
+ */
+void callVacuum(Parser *parser)
+{
+  char *tableName;
+  long numRecord;
+
+  if ((tableName = getNextToken(parser)) == NULL || getNextToken(parser) != NULL) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+
+  if (vacuumTable(tableName, &numRecord) == OK) {
+    fprintf(parser->output, "%ld件の削除済みのデータを片付けました。\n", numRecord);
+  } else {
+    fprintf(parser->output, "削除済みのデータの片付けに失敗しました。\n");
+  }
+}
+
+/*
+ * callSet -- set文の構文解析と設定の変更
+ *
+ * 引数:
+ *	parser: 解析の状態
+ *
+ * 返り値:
+ *	なし
+ *
+ * setの書式:
+ *	set 設定名 値
+ *	設定名:
+ *	  work_memory -- 集約などの作業に使うメモリの上限(バイト数、この接続だけ)
+ *	  threads -- 並列走査に使うスレッド数(1なら並列にしない、0ならCPUの数)
+ *	             ワーカはすべての接続で共有するので、全体の設定を変える
+ */
+void callSet(Parser *parser)
+{
+  char *name;
+  char *value;
+
+  if ((name = getNextToken(parser)) == NULL || (value = getNextToken(parser)) == NULL) {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+    return;
+  }
+
+  if (strcmp(name, "work_memory") == 0 && atol(value) > 0) {
+    parser->session->workMemory = atol(value);
+    fprintf(parser->output, "work_memoryを%ldバイトにしました。\n", getWorkMemory());
+  } else if (strcmp(name, "threads") == 0 && value[0] >= '0' && value[0] <= '9') {
+    setScanThreads(atoi(value));
+    fprintf(parser->output, "threadsを%dにしました。\n", getScanThreads());
+  } else {
+    fprintf(parser->output, "入力行に間違いがあります。\n");
+  }
+}
+
+/*
+ * MAX_STATEMENT_NAME -- 準備済みの文の名前の長さの上限(バイト数)
+ */
+#define MAX_STATEMENT_NAME 64
+
+/*
+ * NamedStatement -- 名前を付けて登録した準備済みの文
+ */
+typedef struct NamedStatement NamedStatement;
+struct NamedStatement {
+    char name[MAX_STATEMENT_NAME];      /* 文の名前 */
+    PreparedStatement *statement;       /* 準備済みの文 */
+    NamedStatement *next;
+};
+
+/*
+ * namedStatements -- 登録した準備済みの文の並び
+ *
+ * サーバとして動いているときは、すべてのクライアントで共有する。
+ * 準備済みの文はパラメータの値を中に持つので、prepare, execute, deallocateの
+ * 各文はnamedMutexを取って1つずつ実行する。
+ */
+static NamedStatement *namedStatements = NULL;
+static pthread_mutex_t namedMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * findNamedStatement -- 名前から登録した準備済みの文を探す
+ *
+ * 引数:
+ *	name: 文の名前
+ *
+ * 返り値:
+ *	見つかればその要素を指す場所、見つからなければ並びの最後(NULLを指す場所)
+ */
+static NamedStatement **findNamedStatement(char *name)
+{
+    NamedStatement **p;
+
+    for (p = &namedStatements; *p != NULL; p = &(*p)->next) {
+	if (strcmp((*p)->name, name) == 0) {
+	    break;
+	}
+    }
+
+    return p;
+}
+
+/*
+ * callPrepare -- prepare文の構文解析と準備済みの文の登録
+ *
+ * 引数:
+ *	parser: 解析の状態
+ *
+ * 返り値:
+ *	なし
+ *
+ * prepareの書式:
+ *	prepare 文の名前 as 文
+ *	文はselect * from、insert(1件のみ)、update、deleteのいずれかで、
+ *	値の代わりにパラメータ(?)を書ける。パラメータには前から順に1, 2, ...の番号が付く。
+ */
+void callPrepare(Parser *parser)
+{
+    char *name;
+    char *token;
+    NamedStatement *named;
+
+    /* 文の名前と"as"を読み込む */
+    if ((name = getNextToken(parser)) == NULL || (token = getNextToken(parser)) == NULL
+	|| strcmp(token, "as") != 0 || (token = getNextToken(parser)) == NULL) {
+	fprintf(parser->output, "入力行に間違いがあります。\n");
+	return;
+    }
+    if (strlen(name) >= MAX_STATEMENT_NAME) {
+	fprintf(parser->output, "文の名前が長すぎます。\n");
+	return;
+    }
+    if (*findNamedStatement(name) != NULL) {
+	fprintf(parser->output, "同じ名前の準備済みの文があります。\n");
+	return;
+    }
+
+    /* 文を解析して、実行する代わりに準備済みの文を作る */
+    parser->preparing = 1;
+    parser->numParam = 0;
+    parser->prepared = NULL;
+    if (strcmp(token, "select") == 0) {
+	/* 集約関数を含むselect文は準備できない */
+	token = getNextToken(parser);
+	if (token != NULL && (strcmp(token, "*") == 0 || strcmp(token, "distinct") == 0)) {
+	    ungetToken(parser, token);
+	    callSelectRecord(parser);
+	}
+    } else if (strcmp(token, "insert") == 0) {
+	callInsertRecord(parser);
+    } else if (strcmp(token, "update") == 0) {
+	callUpdateRecord(parser);
+    } else if (strcmp(token, "delete") == 0) {
+	callDeleteRecord(parser);
+    }
+    parser->preparing = 0;
+
+    if (parser->prepared == NULL) {
+	fprintf(parser->output, "文を準備できませんでした。\n");
+	return;
+    }
+
+    /* 名前を付けて登録する */
+    if ((named = malloc(sizeof(NamedStatement))) == NULL) {
+	freePreparedStatement(parser->prepared);
+	fprintf(parser->output, "メモリが足りません。\n");
+	return;
+    }
+    strcpy(named->name, name);
+    named->statement = parser->prepared;
+    named->next = namedStatements;
+    namedStatements = named;
+    parser->prepared = NULL;
+
+    fprintf(parser->output, "文を準備しました(パラメータ%d個)。\n", getParameterCount(named->statement));
+}
+
+/*
+ * callExecute -- execute文の構文解析と準備済みの文の実行
+ *
+ * 引数:
+ *	parser: 解析の状態
+ *
+ * 返り値:
+ *	なし
+ *
+ * executeの書式:
+ *	execute 文の名前 [ ( 値 , ... ) ]
+ *	値は、準備した文のパラメータに番号の順に当てはめる。
+ */
+void callExecute(Parser *parser)
+{
+    char *token;
+    int i, len;
+    NamedStatement *named;
+    PreparedStatement *statement;
+    RecordSet *recordSet;
+    Result ret;
+
+    if ((token = getNextToken(parser)) == NULL) {
+	fprintf(parser->output, "入力行に間違いがあります。\n");
+	return;
+    }
+    if ((named = *findNamedStatement(token)) == NULL) {
+	fprintf(parser->output, "準備済みの文が存在しません。\n");
+	return;
+    }
+    statement = named->statement;
+
+    /* ( 値 , ... ) を読み込んで、パラメータに設定する */
+    i = 0;
+    if ((token = getNextToken(parser)) != NULL) {
+	if (strcmp(token, "(") != 0) {
+	    fprintf(parser->output, "入力行に間違いがあります。\n");
+	    return;
+	}
+	for (;;) {
+	    if ((token = getNextToken(parser)) == NULL) {
+		fprintf(parser->output, "入力行に間違いがあります。\n");
+		return;
+	    }
+	    if (i == 0 && strcmp(token, ")") == 0) {
+		break;
+	    }
+	    i++;
+	    if (getParameterType(statement, i) == TYPE_INTEGER) {
+		ret = bindInteger(statement, i, atoi(token));
+	    } else {
+		/* insertと同じく、文字列を囲む引用符は値に含めない */
+		len = strlen(token);
+		if (len >= 2 && (token[0] == '\'' || token[0] == '"') && token[len - 1] == token[0]) {
+		    token[len - 1] = '\0';
+		    token++;
+		}
+		ret = bindString(statement, i, token);
+	    }
+	    if (ret != OK) {
+		fprintf(parser->output, "パラメータの数が合いません。\n");
+		return;
+	    }
+
+	    /* ","なら次の値へ、")"なら値の並びの終わり */
+	    if ((token = getNextToken(parser)) == NULL
+		|| (strcmp(token, ",") != 0 && strcmp(token, ")") != 0)) {
+		fprintf(parser->output, "入力行に間違いがあります。\n");
+		return;
+	    }
+	    if (strcmp(token, ")") == 0) {
+		break;
+	    }
+	}
+    }
+    if (i != getParameterCount(statement)) {
+	fprintf(parser->output, "パラメータの数が合いません。\n");
+	return;
+    }
+
+    /* 準備済みの文を実行する */
+    switch (getStatementType(statement)) {
+    case STMT_SELECT:
+	if ((recordSet = executeQuery(statement)) == NULL) {
+	    fprintf(parser->output, "検索に失敗しました。\n");
+	    return;
+	}
+	printRecordSet(parser->output, recordSet);
+	freeRecordSet(recordSet);
+	free(recordSet);
+	break;
+    case STMT_INSERT:
+	if (executeUpdate(statement) == OK) {
+	    fprintf(parser->output, "データの挿入に成功しました。\n");
+	} else {
+	    fprintf(parser->output, "データの挿入に失敗しました。\n");
+	}
+	break;
+    case STMT_UPDATE:
+	if (executeUpdate(statement) == OK) {
+	    fprintf(parser->output, "データの更新に成功しました。\n");
+	} else {
+	    fprintf(parser->output, "データの更新に失敗しました。\n");
+	}
+	break;
+    case STMT_DELETE:
+	if (executeUpdate(statement) != OK) {
+	    fprintf(parser->output, "データの削除に失敗しました。\n");
+	}
+	break;
+    }
+}
+
+/*
+ * callDeallocate -- deallocate文の構文解析と準備済みの文の削除
+ *
+ * 引数:
+ *	parser: 解析の状態
+ *
+ * 返り値:
+ *	なし
+ *
+ * deallocateの書式:
+ *	deallocate 文の名前
+ */
+void callDeallocate(Parser *parser)
+{
+    char *token;
+    NamedStatement **p, *named;
+
+    if ((token = getNextToken(parser)) == NULL) {
+	fprintf(parser->output, "入力行に間違いがあります。\n");
+	return;
+    }
+    p = findNamedStatement(token);
+    if ((named = *p) == NULL) {
+	fprintf(parser->output, "準備済みの文が存在しません。\n");
+	return;
+    }
+
+    *p = named->next;
+    freePreparedStatement(named->statement);
+    free(named);
+    fprintf(parser->output, "準備済みの文を削除しました。\n");
+}
+
+/*
+ * freeNamedStatements -- 登録したすべての準備済みの文の削除
+ */
+static void freeNamedStatements()
+{
+    NamedStatement *named;
+
+    while ((named = namedStatements) != NULL) {
+	namedStatements = named->next;
+	freePreparedStatement(named->statement);
+	free(named);
+    }
+}
+
+/*
+ * executeStatement -- 1行分の文の実行
+ *
+ * 引数:
+ *	line: 入力行
+ *	output: 結果やメッセージの出力先
+ *	session: 文を受け取った接続の設定
+ *
+ * 返り値:
+ *	入力が"quit"なら1、それ以外は0
+ *
+ * 解析の状態は呼び出しごとに作るので、別々のスレッドから同時に呼び出してよい。
+ */
+static int executeStatement(char *line, FILE *output, Session *session)
 {
     char input[MAX_INPUT];
     char *token;
+    Parser *parser;
+    int quit = 0;
+
+    if ((parser = malloc(sizeof(Parser))) == NULL) {
+	fprintf(output, "メモリが足りません。\n");
+	return 0;
+    }
+    parser->preparing = 0;
+    parser->numParam = 0;
+    parser->prepared = NULL;
+    parser->output = output;
+    parser->session = session;
+
+    /* 作業用のメモリの上限などは、この接続の設定を使う */
+    useSession(session);
+
+    /* 字句解析するために入力文字列を設定する */
+    strncpy(input, line, MAX_INPUT - 1);
+    input[MAX_INPUT - 1] = '\0';
+    setInputString(parser, input);
+
+    /* 最初のトークンを取り出す */
+    token = getNextToken(parser);
+
+    /* 最初のトークンが何かによって、呼び出す関数を決める */
+    if (token == NULL) {
+	/* 入力が空行だったら、何もしない */
+    } else if (strcmp(token, "quit") == 0) {
+	/* 入力が"quit"だったら、終了を知らせる */
+	quit = 1;
+    } else if (strcmp(token, "create") == 0) {
+	callCreateTable(parser);
+    } else if (strcmp(token, "drop") == 0) {
+	callDropTable(parser);
+    } else if (strcmp(token, "insert") == 0) {
+	callInsertRecord(parser);
+    } else if (strcmp(token, "select") == 0) {
+	callSelectRecord(parser);
+    } else if (strcmp(token, "delete") == 0) {
+	callDeleteRecord(parser);
+    } else if (strcmp(token, "update") == 0) {
+	callUpdateRecord(parser);
+    } else if (strcmp(token, "copy") == 0) {
+	callCopy(parser);
+    } else if (strcmp(token, "vacuum") == 0) {
+	callVacuum(parser);
+    } else if (strcmp(token, "set") == 0) {
+	callSet(parser);
+    } else if (strcmp(token, "prepare") == 0) {
+	pthread_mutex_lock(&namedMutex);
+	callPrepare(parser);
+	pthread_mutex_unlock(&namedMutex);
+    } else if (strcmp(token, "execute") == 0) {
+	pthread_mutex_lock(&namedMutex);
+	callExecute(parser);
+	pthread_mutex_unlock(&namedMutex);
+    } else if (strcmp(token, "deallocate") == 0) {
+	pthread_mutex_lock(&namedMutex);
+	callDeallocate(parser);
+	pthread_mutex_unlock(&namedMutex);
+    } else {
+	/* 入力に間違いがあった */
+	fprintf(output, "入力に間違いがあります。\n");
+	fprintf(output, "もう一度入力し直してください。\n\n");
+    }
+
+    useSession(NULL);
+    free(parser);
+    return quit;
+}
+
+/*
+ * main -- マイクロDBシステムのエントリポイント
+ *
+ * オプション:
+ *	-f ファイル名 -- すべてのテーブルを1つのデータベースファイルに格納する
+ *	--serve ソケット名 -- 対話的に入力を読む代わりに、UNIXドメインソケットで
+ *	                      複数のクライアントからの文を受け付ける
+ */
+int main(int argc, char *argv[])
+{
     char *line;
+    char *dbFile = NULL;
+    char *socketPath = NULL;
+    Session session = {0};
+    int i, quit;
+
+    for (i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+        dbFile = argv[++i];
+      } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+        socketPath = argv[++i];
+      } else {
+        fprintf(stderr, "Usage: %s [-f dbfile] [--serve socket]\n", argv[0]);
+        exit(1);
+      }
+    }
 
     /* ファイルモジュールの初期化 */
     if (initializeFileModule() != OK) {
@@ -714,6 +2036,12 @@ int main()
 	    exit(1);
     }
 
+    /* 単一ファイル形式のデータベースファイルを使う */
+    if (dbFile != NULL && openContainer(dbFile) != OK) {
+      fprintf(stderr, "Cannot open database file %s.\n", dbFile);
+      exit(1);
+    }
+
     /* データ定義ジュールの初期化 */
     if (initializeDataDefModule() != OK) {
 	    fprintf(stderr, "Cannot initialize data definition module.\n");
@@ -729,62 +2057,43 @@ int main()
     /* ウェルカムメッセージを出力 */
     printf("マイクロDBMSを起動しました。\n");
 
-    /* 1行ずつ入力を読み込みながら、処理を行う */
-    for(;;) {
-	    /* プロンプトを出力して、キーボード入力を1行読み込む */
-      printf("\nDDLまたはDMLを入力してください。\n");
-      line = readline("> ");
-
-	  /* EOFになったら終了 */
-    if (line == NULL) {
+    if (socketPath != NULL) {
+      /* サーバとして、終了のシグナルを受け取るまでクライアントの文を実行する */
+      if (runServer(socketPath, executeStatement) != OK) {
+        exit(1);
+      }
       printf("マイクロDBMSを終了します。\n\n");
-      break;
-    }
-
-	  /* 字句解析するために入力文字列を設定する */
-    strncpy(input,line,MAX_INPUT);
-  	setInputString(input);
-
-    /* 入力の履歴を保存する */
-    if (line && *line) {
-      add_history(line);
-    }
-
-    free(line);
-
-  	/* 最初のトークンを取り出す */
-	  token = getNextToken();
+    } else {
+      /* 1行ずつ入力を読み込みながら、処理を行う */
+      for(;;) {
+        /* プロンプトを出力して、キーボード入力を1行読み込む */
+        printf("\nDDLまたはDMLを入力してください。\n");
+        line = readline("> ");
+
+        /* EOFになったら終了 */
+        if (line == NULL) {
+          printf("マイクロDBMSを終了します。\n\n");
+          break;
+        }
 
-	  /* 入力が空行だったら、ループの先頭に戻ってやり直し */
-	  if (token == NULL) {
-	    continue;
-	  }
+        /* 入力の履歴を保存する */
+        if (*line) {
+          add_history(line);
+        }
 
-  	/* 入力が"quit"だったら、ループを抜けてプログラムを終了させる */
-  	if (strcmp(token, "quit") == 0) {
-	    printf("マイクロDBMSを終了します。\n\n");
-	    break;
-  	}
+        quit = executeStatement(line, stdout, &session);
+        free(line);
 
-  	/* 最初のトークンが何かによって、呼び出す関数を決める */
-  	if (strcmp(token, "create") == 0) {
-	    callCreateTable();
-  	} else if (strcmp(token, "drop") == 0) {
-	    callDropTable();
-  	} else if (strcmp(token, "insert") == 0) {
-	    callInsertRecord();
-  	} else if (strcmp(token, "select") == 0) {
-	    callSelectRecord();
-  	} else if (strcmp(token, "delete") == 0) {
-	    callDeleteRecord();
-  	} else {
-	    /* 入力に間違いがあった */
-	    printf("入力に間違いがあります。\n");
-	    printf("もう一度入力し直してください。\n\n");
-  	}
-  }
+        /* 入力が"quit"だったら、ループを抜けてプログラムを終了させる */
+        if (quit) {
+          printf("マイクロDBMSを終了します。\n\n");
+          break;
+        }
+      }
+    }
 
-    /* 各モジュールの終了処理 */
+    /* 準備済みの文が持っているデータ定義情報を返してから、各モジュールの終了処理をする */
+    freeNamedStatements();
     finalizeDataManipModule();
     finalizeDataDefModule();
     finalizeFileModule();
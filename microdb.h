@@ -2,6 +2,8 @@
  * microdb.h - 共通定義ファイル
  */
 
+#include <stdio.h>
+
 /*
  * Result -- 成功/失敗を返す返り値
  */
@@ -24,6 +26,9 @@ typedef struct File File;
 struct File {
     int desc;                           /* ファイルディスクリプタ */
     char name[MAX_FILENAME];            /* ファイル名 */
+    struct ContainerFile *container;    /* 単一ファイル形式のときの情報(そうでなければNULL) */
+    int refCount;                       /* このFile構造体を使っているopenFileの数 */
+    struct File *next;                  /* オープンしているファイルの並びの次の要素 */
 };
 
 /*
@@ -55,6 +60,74 @@ struct FieldInfo {
     DataType dataType;      /* フィールドのデータ型 */
 };
 
+/*
+ * MAX_INDEX -- 1つのテーブルに作成できる索引の数の上限
+ */
+#define MAX_INDEX 8
+
+/*
+ * MAX_INDEX_NAME -- 索引名の長さの上限(バイト数)
+ */
+#define MAX_INDEX_NAME 20
+
+/*
+ * MAX_INCLUDE -- 1つの索引に含めるフィールド(キー以外)の数の上限
+ */
+#define MAX_INCLUDE 4
+
+/*
+ * IndexType -- 索引の種類
+ */
+typedef enum IndexType IndexType;
+enum IndexType {
+    INDEX_BTREE = 0,    /* B+木(=、<、>で使える) */
+    INDEX_HASH = 1      /* 拡張ハッシュ(=だけで使える) */
+};
+
+/*
+ * IndexInfo -- 索引の定義を表現する構造体
+ */
+typedef struct IndexInfo IndexInfo;
+struct IndexInfo {
+    char name[MAX_INDEX_NAME];          /* 索引名 */
+    char fieldName[MAX_FIELD_NAME];     /* 索引を付けたフィールド名 */
+    DataType dataType;                  /* そのフィールドのデータ型 */
+    IndexType indexType;                /* 索引の種類 */
+    int numInclude;                     /* 葉に値を含めるフィールドの数(B+木のみ) */
+    char includeName[MAX_INCLUDE][MAX_FIELD_NAME];      /* そのフィールド名 */
+    DataType includeType[MAX_INCLUDE];  /* そのフィールドのデータ型 */
+};
+
+/*
+ * TransactionId -- レコードを書き換える操作ごとに振る番号(0は使わない)
+ *
+ * 振り直しはしないので、使い切ることのないように64ビットにしている。
+ */
+typedef unsigned long long TransactionId;
+
+/*
+ * LogSequenceNumber -- ログの中の位置(記録したバイト数)
+ */
+typedef unsigned long LogSequenceNumber;
+
+/*
+ * LoggedTransaction -- 始めたことをログに記録して、まだ終えていないトランザクション
+ */
+typedef struct LoggedTransaction LoggedTransaction;
+struct LoggedTransaction {
+    TransactionId xid;                  /* トランザクションID */
+    char tableName[MAX_FILENAME];       /* 書き換えるテーブルの名前 */
+};
+
+/*
+ * RECORD_HEADER_SIZE -- データファイルの各レコードの先頭に置く見出しのバイト数
+ *
+ * 「使用中」フラグ(1バイト)に続けて、レコードを作ったトランザクションのIDと、
+ * 消したトランザクションのID(消していなければ0)と、書き換える前の版の写しの
+ * 位置(ページ番号とレコードの番号、なければ-1)を置く。
+ */
+#define RECORD_HEADER_SIZE (1 + 2 * (int) sizeof(TransactionId) + 2 * (int) sizeof(int))
+
 /*
  * TableInfo -- テーブルの情報を表現する構造体
  */
@@ -62,6 +135,10 @@ typedef struct TableInfo TableInfo;
 struct TableInfo {
     int numField;        /* フィールド数 */
     FieldInfo fieldInfo[MAX_FIELD];   /* フィールド情報の配列 */
+    int numIndex;        /* 索引の数 */
+    IndexInfo indexInfo[MAX_INDEX];   /* 索引の定義の配列 */
+    int recordSize;      /* 見出しを含む1レコードのバイト数(getTableInfoが計算する) */
+    int fieldOffset[MAX_FIELD];       /* レコードの先頭からの各フィールドの位置 */
 };
 
 /*
@@ -85,6 +162,15 @@ struct FieldData {
     ValueSet valueSet; /*データを納める共用体*/
 };
 
+/*
+ * RecordId -- データファイルの中でのレコードの位置
+ */
+typedef struct RecordId RecordId;
+struct RecordId {
+    int pageNum;        /* ページ番号 */
+    int slotNum;        /* ページの中でのレコードの番号 */
+};
+
 /*
  * RecordData -- 1つのレコードのデータを表現する構造体
  */
@@ -92,6 +178,7 @@ typedef struct RecordData RecordData;
 struct RecordData {
     int numField;     /* フィールド数 */
     FieldData fieldData[MAX_FIELD]; /* フィールド情報 */
+    RecordId recordId;  /* データファイルの中での位置(わからなければページ番号が-1) */
     RecordData *next;
 };
 
@@ -134,8 +221,233 @@ struct Condition {
     struct Condition *andCondition;
     struct Condition *orCondition;
     distinctFlag distinct;      /* 重複除去フラグ */
+    int param;                  /* 値がパラメータ(?)なら番号(1から)、そうでなければ0 */
+};
+
+/*
+ * AggregateType -- 集約関数の種類を表す列挙型
+ */
+typedef enum AggregateType AggregateType;
+enum AggregateType {
+    AGG_COUNT,              /* count */
+    AGG_SUM,                /* sum */
+    AGG_MIN,                /* min */
+    AGG_MAX,                /* max */
+    AGG_AVG                 /* avg */
+};
+
+/*
+ * MAX_AGGREGATE -- 1つの問い合わせに指定できる集約関数の数の上限
+ */
+#define MAX_AGGREGATE MAX_FIELD
+
+/*
+ * Aggregate -- 集約関数とその計算途中の状態を表現する構造体
+ *
+ * count(*)の場合、nameは"*"とする。
+ * 集計中に保持する状態はレコード数によらず一定の大きさである。
+ */
+typedef struct Aggregate Aggregate;
+struct Aggregate {
+    AggregateType type;         /* 集約関数の種類 */
+    char name[MAX_FIELD_NAME];  /* 対象のフィールド名 */
+    DataType dataType;          /* 対象のフィールドのデータ型 */
+    long count;                 /* 集計したレコード数 */
+    long sum;                   /* 合計値(整数型のみ) */
+    ValueSet min;               /* 最小値 */
+    ValueSet max;               /* 最大値 */
+};
+
+
+/*
+ * GroupBy -- group by句で指定するフィールドの並びを表現する構造体
+ */
+typedef struct GroupBy GroupBy;
+struct GroupBy {
+    int numField;                           /* フィールド数 */
+    char name[MAX_FIELD][MAX_FIELD_NAME];   /* フィールド名の配列 */
+};
+
+/*
+ * Projection -- select文で取り出すフィールドの並びを表現する構造体
+ */
+typedef struct Projection Projection;
+struct Projection {
+    int numField;                           /* フィールド数 */
+    char name[MAX_FIELD][MAX_FIELD_NAME];   /* フィールド名の配列 */
+};
+
+/*
+ * Assignment -- update文で書き換えるフィールドと新しい値の並びを表現する構造体
+ */
+typedef struct Assignment Assignment;
+struct Assignment {
+    int numField;                           /* フィールド数 */
+    char name[MAX_FIELD][MAX_FIELD_NAME];   /* フィールド名の配列 */
+    DataType dataType[MAX_FIELD];           /* 新しい値のデータ型 */
+    ValueSet valueSet[MAX_FIELD];           /* 新しい値 */
+    int param[MAX_FIELD];                   /* 値がパラメータ(?)なら番号(1から)、そうでなければ0 */
+};
+
+/*
+ * SortOrder -- 整列の向きを表す列挙型
+ */
+typedef enum SortOrder SortOrder;
+enum SortOrder {
+    ORDER_ASC = 0,          /* 昇順 */
+    ORDER_DESC = 1          /* 降順 */
+};
+
+/*
+ * OrderBy -- order by句の指定を表現する構造体
+ */
+typedef struct OrderBy OrderBy;
+struct OrderBy {
+    int numField;                           /* 整列に使うフィールド数 */
+    char name[MAX_FIELD][MAX_FIELD_NAME];   /* フィールド名の配列 */
+    SortOrder order[MAX_FIELD];             /* それぞれのフィールドの整列の向き */
+    long limit;                             /* 結果のレコード数の上限(NO_LIMITなら上限なし) */
+};
+
+/*
+ * NO_LIMIT -- 結果のレコード数に上限がないことを表す値
+ */
+#define NO_LIMIT (-1L)
+
+/*
+ * RecordHandler -- 検索したレコードを1つずつ受け取る関数
+ *
+ * NGを返すと、検索をそこで打ち切る。
+ */
+typedef Result (*RecordHandler)(RecordData *recordData, void *arg);
+
+/*
+ * Sorter -- 整列の途中の状態(中身はsort.cで定義)
+ */
+typedef struct Sorter Sorter;
+
+/*
+ * MAX_PAYLOAD -- 索引の要素に含めるフィールドの値のバイト数の上限
+ */
+#define MAX_PAYLOAD (MAX_INCLUDE * MAX_STRING)
+
+/*
+ * IndexEntry -- 索引の要素(キーの値とレコードIDの組)
+ *
+ * payloadには、索引の定義のincludeNameのフィールドの値を、その順に
+ * レコードと同じ形式(整数型は4バイト、文字列型はMAX_STRINGバイト)で並べる。
+ */
+typedef struct IndexEntry IndexEntry;
+struct IndexEntry {
+    ValueSet key;               /* フィールドの値 */
+    RecordId recordId;          /* その値を持つレコードの位置 */
+    char payload[MAX_PAYLOAD];  /* 索引に含めるフィールドの値 */
 };
 
+/*
+ * Index -- オープンした索引(中身はindex.cで定義)
+ */
+typedef struct Index Index;
+
+/*
+ * IndexScan -- 索引の走査の状態(中身はindex.cで定義)
+ */
+typedef struct IndexScan IndexScan;
+
+/*
+ * IndexBuilder -- 索引の一括作成の途中の状態(中身はindex.cで定義)
+ */
+typedef struct IndexBuilder IndexBuilder;
+
+/*
+ * HashIndex -- オープンしたハッシュ索引(中身はhash.cで定義)
+ */
+typedef struct HashIndex HashIndex;
+
+/*
+ * HashScan -- ハッシュ索引の走査の状態(中身はhash.cで定義)
+ */
+typedef struct HashScan HashScan;
+
+/*
+ * TaskFunction -- スケジューラで実行するタスクの関数
+ */
+typedef void (*TaskFunction)(void *arg);
+
+/*
+ * TaskGroup -- 完了を待つ単位となるタスクの集まり(中身はsched.cで定義)
+ */
+typedef struct TaskGroup TaskGroup;
+
+/*
+ * Session -- 接続ごとの設定
+ *
+ * 0のメンバは、プロセス全体の設定に従う。
+ */
+typedef struct Session Session;
+struct Session {
+  long workMemory;                      /* 集約などの作業に使うメモリの上限(バイト数) */
+};
+
+/*
+ * StatementExecutor -- サーバが1行分の文を実行するのに使う関数
+ *
+ * 結果は第2引数のストリームに書き、"quit"なら1を返す。
+ * 第3引数は文を受け取った接続の設定で、set文はこれを書き換える。
+ * 接続ごとに別のスレッドから同時に呼ばれる(同じ接続の文は順に呼ばれる)。
+ */
+typedef int (*StatementExecutor)(char *statement, FILE *output, Session *session);
+
+/*
+ * LockMode -- テーブルやレコードのロックの種類を表す列挙型
+ *
+ * インテンションロックはテーブルにだけ取り、その中のレコードのロックを
+ * 取るつもりであることを表す。
+ */
+typedef enum LockMode LockMode;
+enum LockMode {
+    LOCK_SHARED,                /* 共有ロック(読むだけ) */
+    LOCK_EXCLUSIVE,             /* 排他ロック(書き換える) */
+    LOCK_INTENTION_SHARED,      /* インテンション共有ロック(一部のレコードを読む) */
+    LOCK_INTENTION_EXCLUSIVE,   /* インテンション排他ロック(一部のレコードを書き換える) */
+    LOCK_SHARED_INTENTION_EXCLUSIVE /* 共有インテンション排他ロック(全体を読んで一部を書き換える) */
+};
+
+/*
+ * Snapshot -- ある時点で終わっていたトランザクションの記録
+ *
+ * 読む操作はこれを取り、その時点で終わっていたトランザクションが作って、
+ * まだ消していなかったレコードだけを見る。
+ */
+typedef struct Snapshot Snapshot;
+struct Snapshot {
+    TransactionId xmin;         /* これより小さいIDのトランザクションは終わっていた */
+    TransactionId xmax;         /* これ以上のIDのトランザクションは始まっていなかった */
+    TransactionId *active;      /* その間で、まだ実行中だったトランザクションのID */
+    int numActive;              /* その数 */
+    Snapshot *next;             /* 使用中のスナップショットの並びの次の要素 */
+};
+
+/*
+ * MAX_PARAMETER -- 1つの準備済みの文に含められるパラメータの数の上限
+ */
+#define MAX_PARAMETER 64
+
+/*
+ * StatementType -- 準備済みの文の種類を表す列挙型
+ */
+typedef enum StatementType StatementType;
+enum StatementType {
+    STMT_SELECT,            /* select * from ... */
+    STMT_INSERT,            /* insert into ... */
+    STMT_UPDATE,            /* update ... */
+    STMT_DELETE             /* delete from ... */
+};
+
+/*
+ * PreparedStatement -- 準備済みの文(中身はprepare.cで定義する)
+ */
+typedef struct PreparedStatement PreparedStatement;
 
 /*
  * file.cに定義されている関数群
@@ -145,11 +457,19 @@ extern Result initializeFileModule();
 extern Result finalizeFileModule();
 extern Result createFile(char *);
 extern Result deleteFile(char *);
+extern int existFile(char *);
 extern File *openFile(char *);
 extern Result closeFile(File *);
 extern Result readPage(File *, int, char *);
 extern Result writePage(File *, int, char *);
+extern Result writePages(File *file, int pageNum, char *pages, int numPage);
+extern Result readPagesShared(File *file, int pageNum, char *pages, int numPage);
 extern int getNumPages(char *);
+extern File *createTempFile();
+extern Result deleteTempFile(File *file);
+extern Result openContainer(char *filename);
+extern Result closeContainer();
+extern Result checkpoint();
 
 /*
  * datadef.cに定義されている関数群
@@ -160,18 +480,159 @@ extern Result createTable(char *, TableInfo *);
 extern Result dropTable(char *tableName);
 extern TableInfo *getTableInfo(char *);
 extern void freeTableInfo(TableInfo *table);
+extern int isTableInfoValid(TableInfo *table);
+extern Result addIndexInfo(char *tableName, IndexInfo *indexInfo);
+extern Result removeIndexInfo(char *tableName, char *indexName);
 
 /*
  * datamanip.cに定義されている関数群
  */
 extern Result initializeDataManipModule();
 extern Result finalizeDataManipModule();
-extern Result insertRecord(char *tableName, RecordData *recordData);
+extern Result insertRecord(char *tableName, RecordData *recordData, RecordId *recordId);
+extern Result insertRecords(char *tableName, RecordData *recordData, int numRecord);
+extern Result copyFrom(char *tableName, char *filename, long *numRecord);
+extern Result copyTo(char *tableName, Condition *condition, char *filename, long *numRecord);
+extern Result fetchRecordById(char *tableName, RecordId *recordId, RecordData *recordData);
+extern Result deleteRecordById(char *tableName, RecordId *recordId);
+extern Result updateRecordById(char *tableName, RecordId *recordId, RecordData *recordData);
+extern RecordSet *selectRecordAfter(char *tableName, Condition *condition, RecordId *after, int limit);
 extern Result deleteRecord(char *tableName, Condition *condition);
+extern Result updateRecord(char *tableName, Assignment *assignment, Condition *condition);
 extern RecordSet *selectRecord(char *tableName, Condition *condition);
 extern void freeRecordSet(RecordSet *recordSet);
 extern Result createDataFile(char *tableName);
 extern Result deleteDataFile(char *tableName);
-extern void printTableData(char *tableName);
-extern void printRecordSet(RecordSet *recordSet);
-extern int compare(RecordData *record1,RecordData *record2);
\ No newline at end of file
+extern void printTableData(FILE *output, char *tableName);
+extern void printRecordSet(FILE *output, RecordSet *recordSet);
+extern int compare(RecordData *record1,RecordData *record2);
+extern Result aggregateRecord(char *tableName, Condition *condition, Aggregate *aggregate, int numAggregate);
+extern void printAggregate(FILE *output, Aggregate *aggregate, int numAggregate);
+extern RecordSet *groupRecord(char *tableName, Condition *condition, GroupBy *groupBy,
+                              Aggregate *aggregate, int numAggregate);
+extern void useSession(Session *session);
+extern void setWorkMemory(long bytes);
+extern long getWorkMemory();
+extern void setScanThreads(int numThread);
+extern int getScanThreads();
+extern Result sortRecord(char *tableName, Condition *condition, OrderBy *orderBy,
+                         RecordHandler handler, void *arg);
+extern RecordSet *selectSortedRecord(char *tableName, Condition *condition, OrderBy *orderBy);
+extern RecordSet *selectFields(char *tableName, Condition *condition, Projection *projection);
+extern Result createIndex(char *tableName, IndexInfo *indexInfo);
+extern Result dropIndex(char *tableName, char *indexName);
+extern Result vacuumTable(char *tableName, long *numRecord);
+
+/*
+ * sort.cに定義されている関数群
+ */
+extern Sorter *createSorter(int entrySize, int keySize, long memoryLimit);
+extern Result setSortLimit(Sorter *sorter, long limit);
+extern Result addSortEntry(Sorter *sorter, char *entry);
+extern Result sortEntries(Sorter *sorter);
+extern Result getNextSortEntry(Sorter *sorter, char **entry);
+extern void freeSorter(Sorter *sorter);
+/*
+ * index.cに定義されている関数群
+ */
+extern Result createIndexFile(char *tableName, IndexInfo *indexInfo);
+extern Result deleteIndexFile(char *tableName, char *indexName);
+extern Index *openIndex(char *tableName, IndexInfo *indexInfo);
+extern Result closeIndex(Index *index);
+extern Result insertIndexEntry(Index *index, IndexEntry *entry);
+extern Result deleteIndexEntry(Index *index, IndexEntry *entry);
+extern IndexScan *openIndexScan(Index *index, OperatorType operator, ValueSet *key);
+extern Result getNextIndexEntry(IndexScan *scan, IndexEntry **entry);
+extern void closeIndexScan(IndexScan *scan);
+extern IndexBuilder *createIndexBuilder(Index *index, long memoryLimit);
+extern Result addBuildEntry(IndexBuilder *builder, IndexEntry *entry);
+extern Result buildIndex(IndexBuilder *builder);
+extern void freeIndexBuilder(IndexBuilder *builder);
+
+/*
+ * hash.cに定義されている関数群
+ */
+extern Result createHashFile(File *file, DataType keyType);
+extern HashIndex *openHashIndex(File *file);
+extern Result closeHashIndex(HashIndex *hash);
+extern Result insertHashEntry(HashIndex *hash, IndexEntry *entry);
+extern Result deleteHashEntry(HashIndex *hash, IndexEntry *entry);
+extern HashScan *openHashScan(HashIndex *hash, ValueSet *key);
+extern Result getNextHashEntry(HashScan *scan, IndexEntry **entry);
+extern void closeHashScan(HashScan *scan);
+
+/*
+ * sched.cに定義されている関数群
+ */
+extern Result initializeScheduler(int numThread);
+extern void finalizeScheduler();
+extern int getSchedulerThreads();
+extern TaskGroup *createTaskGroup();
+extern void freeTaskGroup(TaskGroup *group);
+extern Result submitTask(TaskGroup *group, TaskFunction function, void *arg);
+extern void waitTaskGroup(TaskGroup *group);
+
+/*
+ * server.cに定義されている関数群
+ */
+extern Result runServer(char *path, StatementExecutor executor);
+
+/*
+ * lock.cに定義されている関数群
+ */
+extern Result lockTable(char *tableName, LockMode mode);
+extern void unlockTable(char *tableName);
+extern Result lockRecord(char *tableName, RecordId *recordId, LockMode mode);
+extern Result tryLockRecord(char *tableName, RecordId *recordId, LockMode mode);
+extern void unlockRecord(char *tableName, RecordId *recordId);
+extern Result latchPage(char *tableName, int pageNum);
+extern void unlatchPage(char *tableName, int pageNum);
+
+/*
+ * mvcc.cに定義されている関数群
+ */
+extern Result initializeMvccModule();
+extern Result finalizeMvccModule();
+extern TransactionId beginTransaction(char *tableName);
+extern Result recoverTransaction(TransactionId xid);
+extern Result commitTransaction(TransactionId xid);
+extern void abortTransaction(TransactionId xid, int undone);
+extern Result takeSnapshot(Snapshot *snapshot);
+extern void releaseSnapshot(Snapshot *snapshot);
+extern int isVisibleVersion(Snapshot *snapshot, TransactionId createXid, TransactionId deleteXid);
+extern TransactionId getVacuumHorizon();
+
+/*
+ * log.cに定義されている関数群
+ */
+extern Result initializeLogModule();
+extern Result finalizeLogModule();
+extern Result logPageWrite(char *filename, int pageNum, char *page, LogSequenceNumber *lsn);
+extern Result logFileCreate(char *filename);
+extern Result logFileDelete(char *filename);
+extern Result logBegin(TransactionId xid, char *tableName);
+extern Result logCommit(TransactionId xid);
+extern Result logAbort(TransactionId xid);
+extern LoggedTransaction *getOpenTransactions(int *num);
+extern LogSequenceNumber getLogEnd();
+extern LogSequenceNumber getDurableLsn();
+extern Result flushLog(LogSequenceNumber lsn);
+extern void requestFlushLog(LogSequenceNumber lsn);
+extern Result commitLog();
+extern Result truncateLog();
+
+/*
+ * prepare.cに定義されている関数群
+ */
+extern PreparedStatement *prepareSelect(char *tableName, Condition *condition, OrderBy *orderBy);
+extern PreparedStatement *prepareInsert(char *tableName, RecordData *recordData, int *param);
+extern PreparedStatement *prepareUpdate(char *tableName, Assignment *assignment, Condition *condition);
+extern PreparedStatement *prepareDelete(char *tableName, Condition *condition);
+extern void freePreparedStatement(PreparedStatement *statement);
+extern StatementType getStatementType(PreparedStatement *statement);
+extern int getParameterCount(PreparedStatement *statement);
+extern DataType getParameterType(PreparedStatement *statement, int param);
+extern Result bindInteger(PreparedStatement *statement, int param, int value);
+extern Result bindString(PreparedStatement *statement, int param, char *value);
+extern RecordSet *executeQuery(PreparedStatement *statement);
+extern Result executeUpdate(PreparedStatement *statement);
@@ -0,0 +1,461 @@
+/*
+ * mvcc.c -- 版管理モジュール
+ *
+ * レコードを書き換える操作ごとにトランザクションIDを振る。データ操作モジュールは
+ * レコードの見出しに、レコードを作ったトランザクションと消したトランザクションの
+ * IDを記録する。レコードを消しても場所はすぐには空けず、書き換えは古い版を写しに
+ * して別の場所に置いてから、元の場所を新しい版にする。
+ *
+ * 読む操作は始めにスナップショットを取り、その時点で終わっていたトランザクションが
+ * 作って、まだ消していなかったレコードだけを見る。そのため、読んでいる途中で
+ * ほかのスレッドがレコードを書き換えても、同じ時点の内容を読み通せる。
+ *
+ * 消したレコードは、それを見る可能性のあるスナップショットがなくなってから
+ * (IDがgetVacuumHorizonより小さいトランザクションが消したものを)片付ける。
+ *
+ * 書き換える操作は1文ずつ終わらせる。失敗した操作は、データ操作モジュールが
+ * 書き換えを元に戻してからabortTransactionで終える。元に戻せなかった操作のIDは
+ * 実行中のまま残すので、その版はどのスナップショットからも見えない。
+ *
+ * 操作を始めたこと、コミットしたこと、元に戻して終えたことはログに記録する。
+ * コミットの記録がディスクに届かないうちに止まった操作は、起動したときに
+ * recoverTransactionで実行中に戻し、同じように元に戻してから終える。
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "microdb.h"
+
+/*
+ * XID_FILE -- 次に振るトランザクションIDを記録しておくファイルの名前
+ *
+ * レコードに残ったIDより小さいIDを振り直さないように、IDは再起動しても
+ * 続きから振る。
+ */
+#define XID_FILE "microdb.xid"
+
+/*
+ * XID_RESERVE -- 一度にファイルに記録して確保しておくIDの数
+ *
+ * 確保した分を使い切るまではファイルを書き換えない。
+ */
+#define XID_RESERVE 1024
+
+/*
+ * MAX_XID -- 振ることのできる最大のトランザクションID
+ *
+ * これを越えると0(消していないことを表す)に戻ってしまうので、使い切ったら
+ * それ以上は振らない(64ビットなので、実際には使い切らない)。
+ */
+#define MAX_XID ((TransactionId) -1)
+
+static pthread_mutex_t mvccMutex = PTHREAD_MUTEX_INITIALIZER;  /* 以下を守る */
+static TransactionId nextXid = 1;           /* 次に振るID */
+static TransactionId reservedXid = 1;       /* ファイルに記録した、振ってよいIDの上限 */
+static TransactionId *activeXid = NULL;     /* 実行中のトランザクションのID */
+static int numActive = 0;                   /* その数 */
+static int maxActive = 0;                   /* activeXidに入る数 */
+static Snapshot *snapshots = NULL;          /* 使用中のスナップショットの並び */
+
+/*
+ * saveXid -- トランザクションIDをファイルに記録する
+ *
+ * 引数:
+ *  xid: 記録するID(次に起動したときは、これから振る)
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+static Result saveXid(TransactionId xid)
+{
+  File *file;
+  char page[PAGE_SIZE];
+  Result ret;
+
+  if ((file = openFile(XID_FILE)) == NULL) {
+    return NG;
+  }
+  memset(page, 0, PAGE_SIZE);
+  memcpy(page, &xid, sizeof(TransactionId));
+  ret = writePage(file, 0, page);
+  if (closeFile(file) != OK) {
+    ret = NG;
+  }
+
+  return ret;
+}
+
+/*
+ * reserveXid -- 次にファイルに記録して確保するIDの上限(MAX_XIDを越えない)
+ */
+static TransactionId reserveXid(TransactionId xid)
+{
+  return (MAX_XID - xid < XID_RESERVE) ? MAX_XID : xid + XID_RESERVE;
+}
+
+/*
+ * initializeMvccModule -- 版管理モジュールの初期化
+ *
+ * 引数:
+ *  なし
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * ファイルモジュールを初期化してから呼ぶこと。
+ */
+Result initializeMvccModule()
+{
+  File *file;
+  char page[PAGE_SIZE];
+
+  nextXid = 1;
+  if (existFile(XID_FILE)) {
+    if ((file = openFile(XID_FILE)) == NULL) {
+      return NG;
+    }
+    if (readPage(file, 0, page) != OK) {
+      closeFile(file);
+      return NG;
+    }
+    memcpy(&nextXid, page, sizeof(TransactionId));
+    if (closeFile(file) != OK) {
+      return NG;
+    }
+  } else if (createFile(XID_FILE) != OK) {
+    return NG;
+  }
+
+  /* 前回確保した分は使ったかもしれないので、その続きから確保する */
+  reservedXid = reserveXid(nextXid);
+  return saveXid(reservedXid);
+}
+
+/*
+ * finalizeMvccModule -- 版管理モジュールの終了処理
+ *
+ * 引数:
+ *  なし
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+Result finalizeMvccModule()
+{
+  Result ret;
+
+  /* 確保して使わなかった分は、次に起動したときに使う */
+  ret = saveXid(nextXid);
+
+  free(activeXid);
+  activeXid = NULL;
+  numActive = 0;
+  maxActive = 0;
+  snapshots = NULL;
+
+  return ret;
+}
+
+/*
+ * addActiveXid -- 実行中のトランザクションの並びにIDを加える
+ *
+ * mvccMutexを取ってから呼ぶこと。
+ */
+static Result addActiveXid(TransactionId xid)
+{
+  TransactionId *p;
+  int n;
+
+  if (numActive == maxActive) {
+    n = (maxActive == 0) ? 16 : maxActive * 2;
+    if ((p = realloc(activeXid, sizeof(TransactionId) * n)) == NULL) {
+      return NG;
+    }
+    activeXid = p;
+    maxActive = n;
+  }
+  activeXid[numActive++] = xid;
+
+  return OK;
+}
+
+/*
+ * removeActiveXid -- 実行中のトランザクションの並びからIDを除く
+ */
+static void removeActiveXid(TransactionId xid)
+{
+  int i;
+
+  pthread_mutex_lock(&mvccMutex);
+  for (i = 0; i < numActive; i++) {
+    if (activeXid[i] == xid) {
+      activeXid[i] = activeXid[--numActive];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&mvccMutex);
+}
+
+/*
+ * beginTransaction -- レコードを書き換える操作を始める
+ *
+ * 引数:
+ *  tableName: 書き換えるテーブルの名前(止まったときに元に戻すため、ログに記録する)
+ *
+ * 返り値:
+ *  振ったトランザクションIDを返す。失敗したか、IDを使い切っていたら0を返す。
+ *
+ * 書き換えが終わったら、必ずcommitTransactionかabortTransactionを呼ぶこと。
+ */
+TransactionId beginTransaction(char *tableName)
+{
+  TransactionId xid;
+
+  pthread_mutex_lock(&mvccMutex);
+
+  if (nextXid == MAX_XID) {
+    pthread_mutex_unlock(&mvccMutex);
+    return 0;
+  }
+
+  /* 確保した分を使い切ったら、次の分を確保する */
+  if (nextXid >= reservedXid) {
+    if (saveXid(reserveXid(reservedXid)) != OK) {
+      pthread_mutex_unlock(&mvccMutex);
+      return 0;
+    }
+    reservedXid = reserveXid(reservedXid);
+  }
+
+  if (addActiveXid(nextXid) != OK) {
+    pthread_mutex_unlock(&mvccMutex);
+    return 0;
+  }
+  xid = nextXid++;
+
+  pthread_mutex_unlock(&mvccMutex);
+
+  /* 書き換えたページより先にログに届くよう、書き換える前に記録する */
+  if (logBegin(xid, tableName) != OK) {
+    removeActiveXid(xid);
+    return 0;
+  }
+
+  return xid;
+}
+
+/*
+ * recoverTransaction -- 前回コミットしないうちに止まった操作を、実行中に戻す
+ *
+ * 引数:
+ *  xid: getOpenTransactionsで得た操作のID
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 起動したときに、スナップショットを取る前に呼ぶ。書き換えを元に戻してから
+ * abortTransactionで終えること。
+ */
+Result recoverTransaction(TransactionId xid)
+{
+  Result ret;
+
+  pthread_mutex_lock(&mvccMutex);
+  ret = addActiveXid(xid);
+  pthread_mutex_unlock(&mvccMutex);
+
+  return ret;
+}
+
+/*
+ * commitTransaction -- レコードを書き換える操作を終える
+ *
+ * 引数:
+ *  xid: beginTransactionが返したID
+ *
+ * 返り値:
+ *  成功ならOK、書き換えた結果をログに届けられなければNGを返す
+ *
+ * これより後に取ったスナップショットからは、書き換えた結果が見える。
+ * 書き換えた結果とコミットの記録は、ほかから見えるようになる前にログでディスクに
+ * 届ける。同時に終える操作の分は、ログの書き込みスレッドがまとめて届ける。
+ */
+Result commitTransaction(TransactionId xid)
+{
+  Result ret;
+
+  if ((ret = logCommit(xid)) == OK) {
+    ret = commitLog();
+  }
+  removeActiveXid(xid);
+
+  return ret;
+}
+
+/*
+ * abortTransaction -- 失敗した、レコードを書き換える操作を終える
+ *
+ * 引数:
+ *  xid: beginTransactionが返したID
+ *  undone: 書き換えた版をすべて元に戻した(か、どこからも見えない版しか残って
+ *          いない)なら1、そうでなければ0
+ *
+ * 返り値:
+ *  なし
+ *
+ * 元に戻せなかった版が残っている場合は、失敗したことをIDを実行中のまま残して
+ * 記録する。それより後に取ったスナップショットからも、その操作が作った版は見えず、
+ * 消した版は見え続ける(getVacuumHorizonもそのIDを越えないので、消した版は
+ * 片付けない)。ログにも終えたことを記録しないので、再起動したときにもう一度
+ * 元に戻す。
+ */
+void abortTransaction(TransactionId xid, int undone)
+{
+  if (undone) {
+    /* 記録が届かないうちに止まっても、もう一度元に戻すだけなので失敗は無視する */
+    logAbort(xid);
+    removeActiveXid(xid);
+  }
+}
+
+/*
+ * takeSnapshot -- スナップショットを取る
+ *
+ * 引数:
+ *  snapshot: スナップショットを書き込む領域
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 使い終わったら、必ずreleaseSnapshotを呼ぶこと(それまで、このスナップショットで
+ * 見えるレコードは片付けない)。
+ */
+Result takeSnapshot(Snapshot *snapshot)
+{
+  int i;
+
+  pthread_mutex_lock(&mvccMutex);
+
+  snapshot->numActive = numActive;
+  if ((snapshot->active = malloc(sizeof(TransactionId) * (numActive > 0 ? numActive : 1))) == NULL) {
+    pthread_mutex_unlock(&mvccMutex);
+    return NG;
+  }
+  snapshot->xmax = nextXid;
+  snapshot->xmin = nextXid;
+  for (i = 0; i < numActive; i++) {
+    snapshot->active[i] = activeXid[i];
+    if (activeXid[i] < snapshot->xmin) {
+      snapshot->xmin = activeXid[i];
+    }
+  }
+
+  snapshot->next = snapshots;
+  snapshots = snapshot;
+
+  pthread_mutex_unlock(&mvccMutex);
+
+  return OK;
+}
+
+/*
+ * releaseSnapshot -- スナップショットを使い終える
+ *
+ * 引数:
+ *  snapshot: takeSnapshotで取ったスナップショット
+ *
+ * 返り値:
+ *  なし
+ */
+void releaseSnapshot(Snapshot *snapshot)
+{
+  Snapshot **p;
+
+  pthread_mutex_lock(&mvccMutex);
+  for (p = &snapshots; *p != NULL; p = &(*p)->next) {
+    if (*p == snapshot) {
+      *p = snapshot->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&mvccMutex);
+
+  free(snapshot->active);
+  snapshot->active = NULL;
+}
+
+/*
+ * isCommitted -- スナップショットを取った時点で、トランザクションが終わっていたか
+ */
+static int isCommitted(Snapshot *snapshot, TransactionId xid)
+{
+  int i;
+
+  if (xid < snapshot->xmin) {
+    return 1;
+  }
+  if (xid >= snapshot->xmax) {
+    return 0;
+  }
+  for (i = 0; i < snapshot->numActive; i++) {
+    if (snapshot->active[i] == xid) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/*
+ * isVisibleVersion -- レコードがスナップショットから見えるかどうか
+ *
+ * 引数:
+ *  snapshot: スナップショット
+ *  createXid: レコードを作ったトランザクションのID
+ *  deleteXid: レコードを消したトランザクションのID(消していなければ0)
+ *
+ * 返り値:
+ *  作ったトランザクションが終わっていて、消したトランザクションがないか
+ *  まだ終わっていなければ1、そうでなければ0を返す
+ */
+int isVisibleVersion(Snapshot *snapshot, TransactionId createXid, TransactionId deleteXid)
+{
+  return isCommitted(snapshot, createXid)
+    && (deleteXid == 0 || !isCommitted(snapshot, deleteXid));
+}
+
+/*
+ * getVacuumHorizon -- 消したレコードを片付けてよいトランザクションIDの境目
+ *
+ * 引数:
+ *  なし
+ *
+ * 返り値:
+ *  このIDより小さいトランザクションが消したレコードは、どのスナップショットからも
+ *  見えないので片付けてよい
+ *
+ * 実行中のトランザクションと、使用中のスナップショットのxminのうち、最も小さいもの。
+ */
+TransactionId getVacuumHorizon()
+{
+  TransactionId horizon;
+  Snapshot *snapshot;
+  int i;
+
+  pthread_mutex_lock(&mvccMutex);
+  horizon = nextXid;
+  for (i = 0; i < numActive; i++) {
+    if (activeXid[i] < horizon) {
+      horizon = activeXid[i];
+    }
+  }
+  for (snapshot = snapshots; snapshot != NULL; snapshot = snapshot->next) {
+    if (snapshot->xmin < horizon) {
+      horizon = snapshot->xmin;
+    }
+  }
+  pthread_mutex_unlock(&mvccMutex);
+
+  return horizon;
+}
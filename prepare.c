@@ -0,0 +1,551 @@
+/*
+ * prepare.c -- 準備済みの文のモジュール
+ *
+ * 同じ形の文を何度も実行するときのために、テーブルのデータ定義情報と
+ * 条件式などを解析済みの形で持っておき、実行するたびにパラメータ(?)の値だけを
+ * 埋めて実行する。
+ *
+ * 使い方:
+ *   statement = prepareSelect("t", condition, NULL);  (conditionのparamが1)
+ *   bindInteger(statement, 1, 42);
+ *   recordSet = executeQuery(statement);
+ *   ...
+ *   freePreparedStatement(statement);
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "microdb.h"
+
+/*
+ * Parameter -- パラメータの値を書き込む場所
+ */
+typedef struct Parameter Parameter;
+struct Parameter {
+  DataType dataType;                    /* 値のデータ型 */
+  ValueSet *valueSet;                   /* 値を書き込む場所(準備済みの文の中) */
+  int bound;                            /* 値を設定済みなら1 */
+};
+
+/*
+ * PreparedStatement -- 準備済みの文
+ *
+ * 条件式や値はすべて準備したときにコピーし、この中に持つ。
+ */
+struct PreparedStatement {
+  StatementType type;                   /* 文の種類 */
+  char tableName[MAX_FILENAME];         /* テーブルの名前 */
+  TableInfo *tableInfo;                 /* 準備したときのデータ定義情報 */
+  Condition *condition;                 /* 条件式(なければNULL) */
+  OrderBy orderBy;                      /* 整列の指定(selectのみ) */
+  Assignment assignment;                /* 書き換える値(updateのみ) */
+  RecordData recordData;                /* 挿入するレコード(insertのみ) */
+  int numParam;                         /* パラメータの数 */
+  Parameter param[MAX_PARAMETER];       /* パラメータ(番号1がparam[0]) */
+};
+
+/*
+ * freeCondition -- コピーした条件式の解放
+ */
+static void freeCondition(Condition *condition)
+{
+  if (condition == NULL) {
+    return;
+  }
+
+  freeCondition(condition->andCondition);
+  freeCondition(condition->orCondition);
+  free(condition);
+}
+
+/*
+ * copyCondition -- 条件式のコピー
+ *
+ * 引数:
+ *  condition: コピーする条件式(NULLでもよい)
+ *  copy: コピーを返す領域
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+static Result copyCondition(Condition *condition, Condition **copy)
+{
+  *copy = NULL;
+  if (condition == NULL) {
+    return OK;
+  }
+
+  if ((*copy = malloc(sizeof(Condition))) == NULL) {
+    return NG;
+  }
+  **copy = *condition;
+  (*copy)->andCondition = NULL;
+  (*copy)->orCondition = NULL;
+
+  if (copyCondition(condition->andCondition, &(*copy)->andCondition) != OK
+      || copyCondition(condition->orCondition, &(*copy)->orCondition) != OK) {
+    freeCondition(*copy);
+    *copy = NULL;
+    return NG;
+  }
+
+  return OK;
+}
+
+/*
+ * addParameter -- パラメータの値を書き込む場所の登録
+ *
+ * 引数:
+ *  statement: 準備中の文
+ *  param: パラメータの番号(0ならパラメータではないので何もしない)
+ *  dataType: 値のデータ型
+ *  valueSet: 値を書き込む場所
+ *
+ * 返り値:
+ *  成功ならOK、番号が範囲外か重なっていればNGを返す
+ */
+static Result addParameter(PreparedStatement *statement, int param, DataType dataType,
+                           ValueSet *valueSet)
+{
+  Parameter *p;
+
+  if (param == 0) {
+    return OK;
+  }
+  if (param < 0 || param > MAX_PARAMETER) {
+    return NG;
+  }
+
+  p = &statement->param[param - 1];
+  if (p->valueSet != NULL) {
+    return NG;
+  }
+  p->dataType = dataType;
+  p->valueSet = valueSet;
+  p->bound = 0;
+
+  if (param > statement->numParam) {
+    statement->numParam = param;
+  }
+
+  return OK;
+}
+
+/*
+ * addConditionParameters -- 条件式に含まれるパラメータの登録
+ */
+static Result addConditionParameters(PreparedStatement *statement, Condition *condition)
+{
+  if (condition == NULL) {
+    return OK;
+  }
+
+  if (addParameter(statement, condition->param, condition->dataType, &condition->valueSet) != OK
+      || addConditionParameters(statement, condition->andCondition) != OK
+      || addConditionParameters(statement, condition->orCondition) != OK) {
+    return NG;
+  }
+
+  return OK;
+}
+
+/*
+ * createPreparedStatement -- 準備済みの文の作成(共通部分)
+ *
+ * 引数:
+ *  type: 文の種類
+ *  tableName: テーブルの名前
+ *  condition: 条件式(NULLでもよい)
+ *
+ * 返り値:
+ *  作成した文。テーブルがないか失敗したらNULLを返す
+ */
+static PreparedStatement *createPreparedStatement(StatementType type, char *tableName,
+                                                  Condition *condition)
+{
+  PreparedStatement *statement;
+
+  if (strlen(tableName) >= MAX_FILENAME
+      || (statement = calloc(1, sizeof(PreparedStatement))) == NULL) {
+    return NULL;
+  }
+  statement->type = type;
+  strcpy(statement->tableName, tableName);
+
+  if ((statement->tableInfo = getTableInfo(tableName)) == NULL) {
+    free(statement);
+    return NULL;
+  }
+
+  if (copyCondition(condition, &statement->condition) != OK
+      || addConditionParameters(statement, statement->condition) != OK) {
+    freePreparedStatement(statement);
+    return NULL;
+  }
+
+  return statement;
+}
+
+/*
+ * checkParameters -- パラメータの番号が1から抜けなく付いているかどうかの確認
+ *
+ * 引数:
+ *  statement: 準備した文(不正なら解放する)
+ *
+ * 返り値:
+ *  正しければstatement、そうでなければNULLを返す
+ */
+static PreparedStatement *checkParameters(PreparedStatement *statement)
+{
+  int i;
+
+  for (i = 0; i < statement->numParam; i++) {
+    if (statement->param[i].valueSet == NULL) {
+      freePreparedStatement(statement);
+      return NULL;
+    }
+  }
+
+  return statement;
+}
+
+/*
+ * prepareSelect -- select文の準備
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  condition: 条件式(NULLならすべてのレコード)
+ *  orderBy: 整列の指定(NULLなら整列しない)
+ *
+ * 返り値:
+ *  準備済みの文。失敗したらNULLを返す
+ *
+ * 条件式の比較のうちparamが1以上のものは、値の代わりにパラメータとして扱う。
+ * パラメータの番号は1から抜けなく付けること。
+ * conditionとorderByはコピーするので、呼び出し後は解放してよい。
+ */
+PreparedStatement *prepareSelect(char *tableName, Condition *condition, OrderBy *orderBy)
+{
+  PreparedStatement *statement;
+
+  if ((statement = createPreparedStatement(STMT_SELECT, tableName, condition)) == NULL) {
+    return NULL;
+  }
+  if (orderBy != NULL) {
+    statement->orderBy = *orderBy;
+  } else {
+    statement->orderBy.numField = 0;
+    statement->orderBy.limit = NO_LIMIT;
+  }
+
+  return checkParameters(statement);
+}
+
+/*
+ * prepareInsert -- 1件のレコードを挿入するinsert文の準備
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  recordData: 挿入するレコード
+ *  param: 各フィールドのパラメータの番号の配列(0なら値はrecordDataのまま。NULLでもよい)
+ *
+ * 返り値:
+ *  準備済みの文。失敗したらNULLを返す
+ */
+PreparedStatement *prepareInsert(char *tableName, RecordData *recordData, int *param)
+{
+  PreparedStatement *statement;
+  FieldData *field;
+  int i;
+
+  if ((statement = createPreparedStatement(STMT_INSERT, tableName, NULL)) == NULL) {
+    return NULL;
+  }
+  statement->recordData = *recordData;
+  statement->recordData.next = NULL;
+
+  for (i = 0; param != NULL && i < recordData->numField; i++) {
+    field = &statement->recordData.fieldData[i];
+    if (addParameter(statement, param[i], field->dataType, &field->valueSet) != OK) {
+      freePreparedStatement(statement);
+      return NULL;
+    }
+  }
+
+  return checkParameters(statement);
+}
+
+/*
+ * prepareUpdate -- update文の準備
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  assignment: 書き換えるフィールドと新しい値(paramが1以上ならパラメータ)
+ *  condition: 条件式(NULLならすべてのレコード)
+ *
+ * 返り値:
+ *  準備済みの文。失敗したらNULLを返す
+ */
+PreparedStatement *prepareUpdate(char *tableName, Assignment *assignment, Condition *condition)
+{
+  PreparedStatement *statement;
+  Assignment *copy;
+  int i;
+
+  if ((statement = createPreparedStatement(STMT_UPDATE, tableName, condition)) == NULL) {
+    return NULL;
+  }
+  statement->assignment = *assignment;
+
+  copy = &statement->assignment;
+  for (i = 0; i < copy->numField; i++) {
+    if (addParameter(statement, copy->param[i], copy->dataType[i], &copy->valueSet[i]) != OK) {
+      freePreparedStatement(statement);
+      return NULL;
+    }
+  }
+
+  return checkParameters(statement);
+}
+
+/*
+ * prepareDelete -- delete文の準備
+ *
+ * 引数:
+ *  tableName: テーブルの名前
+ *  condition: 条件式
+ *
+ * 返り値:
+ *  準備済みの文。失敗したらNULLを返す
+ */
+PreparedStatement *prepareDelete(char *tableName, Condition *condition)
+{
+  PreparedStatement *statement;
+
+  if ((statement = createPreparedStatement(STMT_DELETE, tableName, condition)) == NULL) {
+    return NULL;
+  }
+
+  return checkParameters(statement);
+}
+
+/*
+ * freePreparedStatement -- 準備済みの文の解放
+ *
+ * 引数:
+ *  statement: 準備済みの文(NULLでもよい)
+ *
+ * 返り値:
+ *  なし
+ */
+void freePreparedStatement(PreparedStatement *statement)
+{
+  if (statement == NULL) {
+    return;
+  }
+
+  freeCondition(statement->condition);
+  freeTableInfo(statement->tableInfo);
+  free(statement);
+}
+
+/*
+ * getStatementType -- 準備済みの文の種類の取得
+ */
+StatementType getStatementType(PreparedStatement *statement)
+{
+  return statement->type;
+}
+
+/*
+ * getParameterCount -- 準備済みの文のパラメータの数の取得
+ */
+int getParameterCount(PreparedStatement *statement)
+{
+  return statement->numParam;
+}
+
+/*
+ * getParameterType -- パラメータのデータ型の取得
+ *
+ * 引数:
+ *  statement: 準備済みの文
+ *  param: パラメータの番号(1から)
+ *
+ * 返り値:
+ *  パラメータのデータ型。番号が範囲外ならTYPE_UNKNOWNを返す
+ */
+DataType getParameterType(PreparedStatement *statement, int param)
+{
+  if (param < 1 || param > statement->numParam) {
+    return TYPE_UNKNOWN;
+  }
+
+  return statement->param[param - 1].dataType;
+}
+
+/*
+ * bindInteger -- 整数型のパラメータへの値の設定
+ *
+ * 引数:
+ *  statement: 準備済みの文
+ *  param: パラメータの番号(1から)
+ *  value: 値
+ *
+ * 返り値:
+ *  成功ならOK、番号が範囲外かデータ型が違えばNGを返す
+ *
+ * 設定した値は、設定し直すまで以後の実行でも使われる。
+ */
+Result bindInteger(PreparedStatement *statement, int param, int value)
+{
+  Parameter *p;
+
+  if (getParameterType(statement, param) != TYPE_INTEGER) {
+    return NG;
+  }
+
+  p = &statement->param[param - 1];
+  p->valueSet->intValue = value;
+  p->bound = 1;
+
+  return OK;
+}
+
+/*
+ * bindString -- 文字列型のパラメータへの値の設定
+ *
+ * 引数:
+ *  statement: 準備済みの文
+ *  param: パラメータの番号(1から)
+ *  value: 値(MAX_STRING - 1バイトを超える部分は切り捨てる)
+ *
+ * 返り値:
+ *  成功ならOK、番号が範囲外かデータ型が違えばNGを返す
+ */
+Result bindString(PreparedStatement *statement, int param, char *value)
+{
+  Parameter *p;
+
+  if (getParameterType(statement, param) != TYPE_STRING) {
+    return NG;
+  }
+
+  p = &statement->param[param - 1];
+  memset(p->valueSet->stringValue, 0, MAX_STRING);
+  strncpy(p->valueSet->stringValue, value, MAX_STRING - 1);
+  p->bound = 1;
+
+  return OK;
+}
+
+/*
+ * isSameDefinition -- 2つのデータ定義情報のフィールドの並びが同じかどうかを調べる
+ */
+static int isSameDefinition(TableInfo *table1, TableInfo *table2)
+{
+  int i;
+
+  if (table1->numField != table2->numField) {
+    return 0;
+  }
+  for (i = 0; i < table1->numField; i++) {
+    if (strcmp(table1->fieldInfo[i].name, table2->fieldInfo[i].name) != 0
+        || table1->fieldInfo[i].dataType != table2->fieldInfo[i].dataType) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/*
+ * checkStatement -- 準備済みの文を実行できるかどうかの確認
+ *
+ * 引数:
+ *  statement: 準備済みの文
+ *
+ * 返り値:
+ *  実行できればOK、値の設定されていないパラメータがあるか、
+ *  準備した後にテーブルのフィールドが変えられていればNGを返す
+ *
+ * 索引の追加などでデータ定義情報が古くなっただけなら、取得し直して続ける。
+ */
+static Result checkStatement(PreparedStatement *statement)
+{
+  TableInfo *tableInfo;
+  int i;
+
+  for (i = 0; i < statement->numParam; i++) {
+    if (!statement->param[i].bound) {
+      return NG;
+    }
+  }
+
+  if (isTableInfoValid(statement->tableInfo)) {
+    return OK;
+  }
+  if ((tableInfo = getTableInfo(statement->tableName)) == NULL) {
+    return NG;
+  }
+  if (!isSameDefinition(statement->tableInfo, tableInfo)) {
+    freeTableInfo(tableInfo);
+    return NG;
+  }
+  freeTableInfo(statement->tableInfo);
+  statement->tableInfo = tableInfo;
+
+  return OK;
+}
+
+/*
+ * executeQuery -- 準備済みのselect文の実行
+ *
+ * 引数:
+ *  statement: 準備済みのselect文
+ *
+ * 返り値:
+ *  検索結果のレコードの集合。失敗したらNULLを返す
+ *
+ * ***注意***
+ *  返したレコードの集合は、不要になったらfreeRecordSetとfreeで解放すること。
+ */
+RecordSet *executeQuery(PreparedStatement *statement)
+{
+  if (statement->type != STMT_SELECT || checkStatement(statement) != OK) {
+    return NULL;
+  }
+
+  if (statement->orderBy.numField == 0) {
+    return selectRecord(statement->tableName, statement->condition);
+  }
+  return selectSortedRecord(statement->tableName, statement->condition, &statement->orderBy);
+}
+
+/*
+ * executeUpdate -- 準備済みのinsert文、update文、delete文の実行
+ *
+ * 引数:
+ *  statement: 準備済みの文
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+Result executeUpdate(PreparedStatement *statement)
+{
+  if (checkStatement(statement) != OK) {
+    return NG;
+  }
+
+  switch (statement->type) {
+  case STMT_INSERT:
+    return insertRecords(statement->tableName, &statement->recordData, 1);
+  case STMT_UPDATE:
+    return updateRecord(statement->tableName, &statement->assignment, statement->condition);
+  case STMT_DELETE:
+    return deleteRecord(statement->tableName, statement->condition);
+  default:
+    return NG;
+  }
+}
@@ -0,0 +1,526 @@
+/*
+ * sched.c -- タスクスケジューラ
+ *
+ * 決まった数のワーカスレッドで、投入されたタスクを実行する。
+ * ワーカはそれぞれ両端キューを持ち、自分のキューの後ろからタスクを取り出して
+ * 実行する。自分のキューが空になったら、ほかのワーカのキューの前から盗む
+ * (ワークスティーリング)。時間のかかるタスクがあっても空いたワーカが残りを
+ * 引き受けるので、負荷は自然に均される。
+ *
+ * タスクは必ずタスクグループに属し、waitTaskGroupでグループのタスクがすべて
+ * 終わるのを待つ。待っている間、呼び出したスレッドもタスクを実行する。
+ * 同時に実行される複数の問合せは、同じワーカを共有する。
+ * タスクグループがある間はワーカを入れ替えないので、問合せの実行中に
+ * initializeSchedulerを呼んでもよい(グループがなくなるまで待つ)。
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "microdb.h"
+
+/*
+ * MAX_WORKER -- ワーカスレッドの数の上限
+ */
+#define MAX_WORKER 64
+
+/*
+ * INITIAL_DEQUE_SIZE -- 両端キューの最初の大きさ(2のべき)
+ */
+#define INITIAL_DEQUE_SIZE 64
+
+/*
+ * Task -- 投入されたタスク
+ */
+typedef struct Task Task;
+struct Task {
+  TaskFunction function;                /* 実行する関数 */
+  void *arg;                            /* 関数に渡す引数 */
+  TaskGroup *group;                     /* 属するタスクグループ */
+};
+
+/*
+ * TaskDeque -- ワーカごとの両端キュー(環状の配列)
+ */
+typedef struct TaskDeque TaskDeque;
+struct TaskDeque {
+  pthread_mutex_t mutex;                /* 以下を守る */
+  Task *task;                           /* タスクの配列 */
+  int capacity;                         /* 配列の大きさ(2のべき) */
+  int head;                             /* 一番古いタスクの位置(盗む側) */
+  int count;                            /* タスクの数 */
+};
+
+/*
+ * TaskGroup -- 完了を待つ単位となるタスクの集まり
+ */
+struct TaskGroup {
+  pthread_mutex_t mutex;                /* pendingを守る */
+  pthread_cond_t done;                  /* pendingが0になったことを知らせる */
+  int pending;                          /* 終わっていないタスクの数 */
+};
+
+static int numWorker = 0;               /* ワーカスレッドの数 */
+static int numDeque = 0;                /* 両端キューの数(ワーカがなくても1つは置く) */
+static pthread_t worker[MAX_WORKER];
+static TaskDeque deque[MAX_WORKER];
+
+static pthread_mutex_t schedulerMutex = PTHREAD_MUTEX_INITIALIZER;  /* 以下を守る */
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;            /* タスクの投入を知らせる */
+static int numQueued = 0;               /* キューにあるタスクの数 */
+static int stopping = 0;                /* ワーカを止めるなら1 */
+static int nextDeque = 0;               /* ワーカ以外から投入するときに使うキュー */
+static pthread_cond_t groupChanged = PTHREAD_COND_INITIALIZER;     /* 以下が変わったことを知らせる */
+static int numGroup = 0;                /* 解放されていないタスクグループの数 */
+static int restarting = 0;              /* ワーカを起動し直しているなら1 */
+
+static pthread_key_t workerKey;         /* ワーカの番号+1(ワーカ以外のスレッドでは0) */
+static pthread_once_t workerKeyOnce = PTHREAD_ONCE_INIT;
+
+/*
+ * createWorkerKey -- ワーカの番号を覚えるキーの作成(一度だけ呼ばれる)
+ */
+static void createWorkerKey()
+{
+  pthread_key_create(&workerKey, NULL);
+}
+
+/*
+ * getWorkerNo -- 呼び出したスレッドのワーカ番号の取得
+ *
+ * 返り値:
+ *  ワーカの番号、ワーカでなければ-1
+ */
+static int getWorkerNo()
+{
+  return (int) (long) pthread_getspecific(workerKey) - 1;
+}
+
+/*
+ * pushTask -- 両端キューの後ろにタスクを加える
+ */
+static Result pushTask(TaskDeque *d, Task *task)
+{
+  Task *newTask;
+  int i;
+
+  pthread_mutex_lock(&d->mutex);
+  if (d->count == d->capacity) {
+    /* 倍の大きさの配列に、古い順に並べ直す */
+    if ((newTask = malloc(sizeof(Task) * d->capacity * 2)) == NULL) {
+      pthread_mutex_unlock(&d->mutex);
+      return NG;
+    }
+    for (i = 0; i < d->count; i++) {
+      newTask[i] = d->task[(d->head + i) & (d->capacity - 1)];
+    }
+    free(d->task);
+    d->task = newTask;
+    d->capacity *= 2;
+    d->head = 0;
+  }
+  d->task[(d->head + d->count) & (d->capacity - 1)] = *task;
+  d->count++;
+  pthread_mutex_unlock(&d->mutex);
+
+  return OK;
+}
+
+/*
+ * popTask -- 両端キューの後ろ(一番新しいタスク)を取り出す
+ */
+static int popTask(TaskDeque *d, Task *task)
+{
+  int found = 0;
+
+  pthread_mutex_lock(&d->mutex);
+  if (d->count > 0) {
+    d->count--;
+    *task = d->task[(d->head + d->count) & (d->capacity - 1)];
+    found = 1;
+  }
+  pthread_mutex_unlock(&d->mutex);
+
+  return found;
+}
+
+/*
+ * stealTask -- 両端キューの前(一番古いタスク)を盗む
+ */
+static int stealTask(TaskDeque *d, Task *task)
+{
+  int found = 0;
+
+  pthread_mutex_lock(&d->mutex);
+  if (d->count > 0) {
+    *task = d->task[d->head];
+    d->head = (d->head + 1) & (d->capacity - 1);
+    d->count--;
+    found = 1;
+  }
+  pthread_mutex_unlock(&d->mutex);
+
+  return found;
+}
+
+/*
+ * takeTask -- 実行するタスクを1つ取る
+ *
+ * 引数:
+ *  self: 呼び出したワーカの番号(ワーカでなければ-1)
+ *  task: 取ったタスクを返す領域
+ *
+ * 返り値:
+ *  取れたら1、どのキューも空なら0
+ *
+ * 自分のキューを先に見て、空ならほかのキューを順に見て盗む。
+ */
+static int takeTask(int self, Task *task)
+{
+  int i, found = 0;
+
+  if (self >= 0) {
+    found = popTask(&deque[self], task);
+  }
+  for (i = 1; i <= numDeque && !found; i++) {
+    found = stealTask(&deque[(self + i + numDeque) % numDeque], task);
+  }
+
+  if (found) {
+    pthread_mutex_lock(&schedulerMutex);
+    numQueued--;
+    pthread_mutex_unlock(&schedulerMutex);
+  }
+
+  return found;
+}
+
+/*
+ * runTask -- タスクを実行し、タスクグループに完了を知らせる
+ */
+static void runTask(Task *task)
+{
+  TaskGroup *group = task->group;
+
+  task->function(task->arg);
+
+  pthread_mutex_lock(&group->mutex);
+  if (--group->pending == 0) {
+    pthread_cond_broadcast(&group->done);
+  }
+  pthread_mutex_unlock(&group->mutex);
+}
+
+/*
+ * workerMain -- ワーカスレッドの処理
+ *
+ * タスクがある限り実行し、なくなったら投入されるまで眠る。
+ */
+static void *workerMain(void *arg)
+{
+  int self = (int) (long) arg;
+  Task task;
+
+  pthread_setspecific(workerKey, (void *) (long) (self + 1));
+
+  for (;;) {
+    if (takeTask(self, &task)) {
+      runTask(&task);
+      continue;
+    }
+
+    pthread_mutex_lock(&schedulerMutex);
+    while (numQueued == 0 && !stopping) {
+      pthread_cond_wait(&wakeup, &schedulerMutex);
+    }
+    if (numQueued == 0 && stopping) {
+      pthread_mutex_unlock(&schedulerMutex);
+      break;
+    }
+    pthread_mutex_unlock(&schedulerMutex);
+  }
+
+  return NULL;
+}
+
+static void finalizeSchedulerUnlocked();
+
+/*
+ * beginRestart -- ワーカの起動と停止を始める(タスクグループがなくなるまで待つ)
+ *
+ * タスクの中で作るタスクグループは外側のグループがある間に作られるので、
+ * numGroupが0になってから新しいグループを待たせても、行き詰まらない。
+ */
+static void beginRestart()
+{
+  pthread_mutex_lock(&schedulerMutex);
+  while (restarting || numGroup > 0) {
+    pthread_cond_wait(&groupChanged, &schedulerMutex);
+  }
+  restarting = 1;
+  pthread_mutex_unlock(&schedulerMutex);
+}
+
+/*
+ * endRestart -- ワーカの起動と停止を終え、待っているタスクグループの作成を再開させる
+ */
+static void endRestart()
+{
+  pthread_mutex_lock(&schedulerMutex);
+  restarting = 0;
+  pthread_cond_broadcast(&groupChanged);
+  pthread_mutex_unlock(&schedulerMutex);
+}
+
+/*
+ * initializeScheduler -- スケジューラの初期化(ワーカスレッドの起動)
+ *
+ * 引数:
+ *  numThread: タスクを実行するスレッドの数(waitTaskGroupを呼ぶスレッドを含む)
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ *
+ * numThread - 1個のワーカを起動する。numThreadが1以下なら、タスクはすべて
+ * waitTaskGroupを呼んだスレッドで実行される。
+ * 起動できなかったワーカの分は、起動できたワーカが受け持つ。
+ * すでに起動していれば、使用中のタスクグループがなくなるのを待って止めてから
+ * 起動し直す。タスクグループを持ったまま呼ばないこと。
+ */
+static Result initializeSchedulerUnlocked(int numThread)
+{
+  int i;
+
+  if (numDeque > 0) {
+    finalizeSchedulerUnlocked();
+  }
+
+  numWorker = numThread - 1;
+  if (numWorker < 0) {
+    numWorker = 0;
+  }
+  if (numWorker > MAX_WORKER) {
+    numWorker = MAX_WORKER;
+  }
+  numDeque = numWorker > 0 ? numWorker : 1;
+
+  for (i = 0; i < numDeque; i++) {
+    pthread_mutex_init(&deque[i].mutex, NULL);
+    deque[i].capacity = INITIAL_DEQUE_SIZE;
+    deque[i].head = 0;
+    deque[i].count = 0;
+    if ((deque[i].task = malloc(sizeof(Task) * INITIAL_DEQUE_SIZE)) == NULL) {
+      numDeque = i;
+      finalizeSchedulerUnlocked();
+      return NG;
+    }
+  }
+
+  numQueued = 0;
+  stopping = 0;
+  nextDeque = 0;
+  for (i = 0; i < numWorker; i++) {
+    if (pthread_create(&worker[i], NULL, workerMain, (void *) (long) i) != 0) {
+      break;
+    }
+  }
+  numWorker = i;
+
+  return OK;
+}
+
+Result initializeScheduler(int numThread)
+{
+  Result ret;
+
+  pthread_once(&workerKeyOnce, createWorkerKey);
+
+  beginRestart();
+  ret = initializeSchedulerUnlocked(numThread);
+  endRestart();
+
+  return ret;
+}
+
+/*
+ * finalizeScheduler -- スケジューラの終了処理(ワーカスレッドの停止)
+ *
+ * キューに残っているタスクを実行し終えてからワーカを止める。
+ */
+static void finalizeSchedulerUnlocked()
+{
+  int i;
+
+  pthread_mutex_lock(&schedulerMutex);
+  stopping = 1;
+  pthread_cond_broadcast(&wakeup);
+  pthread_mutex_unlock(&schedulerMutex);
+
+  for (i = 0; i < numWorker; i++) {
+    pthread_join(worker[i], NULL);
+  }
+  for (i = 0; i < numDeque; i++) {
+    pthread_mutex_destroy(&deque[i].mutex);
+    free(deque[i].task);
+  }
+
+  numWorker = 0;
+  numDeque = 0;
+  stopping = 0;
+}
+
+void finalizeScheduler()
+{
+  beginRestart();
+  finalizeSchedulerUnlocked();
+  endRestart();
+}
+
+/*
+ * getSchedulerThreads -- タスクを実行するスレッドの数(呼び出したスレッドを含む)
+ */
+int getSchedulerThreads()
+{
+  int n;
+
+  pthread_mutex_lock(&schedulerMutex);
+  while (restarting) {
+    pthread_cond_wait(&groupChanged, &schedulerMutex);
+  }
+  n = numWorker + 1;
+  pthread_mutex_unlock(&schedulerMutex);
+
+  return n;
+}
+
+/*
+ * createTaskGroup -- タスクグループの作成
+ *
+ * 返り値:
+ *  作成したタスクグループ、失敗の場合NULL
+ *
+ * 不要になったらfreeTaskGroupで解放すること。解放するまでワーカは入れ替わらない。
+ */
+TaskGroup *createTaskGroup()
+{
+  TaskGroup *group;
+
+  if ((group = malloc(sizeof(TaskGroup))) == NULL) {
+    return NULL;
+  }
+  pthread_mutex_lock(&schedulerMutex);
+  while (restarting) {
+    pthread_cond_wait(&groupChanged, &schedulerMutex);
+  }
+  numGroup++;
+  pthread_mutex_unlock(&schedulerMutex);
+  pthread_mutex_init(&group->mutex, NULL);
+  pthread_cond_init(&group->done, NULL);
+  group->pending = 0;
+
+  return group;
+}
+
+/*
+ * freeTaskGroup -- タスクグループの解放(タスクがすべて終わってから呼ぶこと)
+ */
+void freeTaskGroup(TaskGroup *group)
+{
+  pthread_cond_destroy(&group->done);
+  pthread_mutex_destroy(&group->mutex);
+  free(group);
+
+  pthread_mutex_lock(&schedulerMutex);
+  if (--numGroup == 0) {
+    pthread_cond_broadcast(&groupChanged);
+  }
+  pthread_mutex_unlock(&schedulerMutex);
+}
+
+/*
+ * submitTask -- タスクの投入
+ *
+ * 引数:
+ *  group: タスクを加えるタスクグループ
+ *  function: 実行する関数
+ *  arg: 関数に渡す引数
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ *
+ * ワーカが実行中のタスクから投入した場合は、そのワーカのキューに入れる。
+ * それ以外のスレッドから投入した場合は、キューに順番に振り分ける。
+ * タスクの中からタスクを投入して、その完了を待ってもよい。
+ */
+Result submitTask(TaskGroup *group, TaskFunction function, void *arg)
+{
+  Task task;
+  int self = getWorkerNo();
+
+  task.function = function;
+  task.arg = arg;
+  task.group = group;
+
+  pthread_mutex_lock(&group->mutex);
+  group->pending++;
+  pthread_mutex_unlock(&group->mutex);
+
+  if (self < 0) {
+    pthread_mutex_lock(&schedulerMutex);
+    self = nextDeque;
+    nextDeque = (nextDeque + 1) % numDeque;
+    pthread_mutex_unlock(&schedulerMutex);
+  }
+
+  if (pushTask(&deque[self], &task) != OK) {
+    pthread_mutex_lock(&group->mutex);
+    group->pending--;
+    pthread_mutex_unlock(&group->mutex);
+    return NG;
+  }
+
+  pthread_mutex_lock(&schedulerMutex);
+  numQueued++;
+  pthread_cond_signal(&wakeup);
+  pthread_mutex_unlock(&schedulerMutex);
+
+  return OK;
+}
+
+/*
+ * waitTaskGroup -- タスクグループのタスクがすべて終わるのを待つ
+ *
+ * 引数:
+ *  group: 待つタスクグループ
+ *
+ * 返り値:
+ *  なし
+ *
+ * 待っている間も、キューにタスクがあれば(ほかのグループのものでも)実行する。
+ */
+void waitTaskGroup(TaskGroup *group)
+{
+  Task task;
+  int self = getWorkerNo();
+
+  for (;;) {
+    pthread_mutex_lock(&group->mutex);
+    if (group->pending == 0) {
+      pthread_mutex_unlock(&group->mutex);
+      break;
+    }
+    pthread_mutex_unlock(&group->mutex);
+
+    if (takeTask(self, &task)) {
+      runTask(&task);
+      continue;
+    }
+
+    /* 残りはほかのスレッドが実行中なので、終わるのを待つ */
+    pthread_mutex_lock(&group->mutex);
+    if (group->pending > 0) {
+      pthread_cond_wait(&group->done, &group->mutex);
+    }
+    pthread_mutex_unlock(&group->mutex);
+  }
+}
@@ -0,0 +1,896 @@
+/*
+ * server.c -- サーバモジュール
+ *
+ * UNIXドメインソケットで複数のクライアントからの接続を受け付け、
+ * 送られてきた文を実行して結果を返す。
+ *
+ * プロトコル:
+ *   やりとりはすべてフレームで行う。フレームは5バイトの見出し(内容のバイト数を
+ *   ネットワークバイトオーダーの4バイトで、種類を1バイトで表す)と内容からなる。
+ *   クライアントからサーバへ:
+ *     'Q' -- 文(改行は不要)
+ *   サーバからクライアントへ:
+ *     'D' -- 文の結果(対話的に動かしたときに標準出力に出力される内容)の一部
+ *     'E' -- 1つの文の結果の終わり(内容なし)
+ *     'X' -- プロトコルの誤り(内容はメッセージ)。この後、接続を閉じる。
+ *            誤りより前に届いた文は実行し、その結果を返してから送る
+ *   クライアントは結果を待たずに続けて文を送ってよい(パイプライン)。
+ *   文は接続ごとに送られた順に実行し、結果もその順に返す。
+ *   "quit"を送ると、その結果を返した後で接続を閉じる。
+ *
+ * スレッドの構成:
+ *   I/Oスレッド(NUM_IO_THREAD個) -- epollで多数の接続を受け持ち、
+ *     ノンブロッキングのソケットでフレームの読み書きだけを行う。
+ *   実行スレッド(NUM_EXECUTOR_THREAD個) -- 文の届いた接続を順に取り出して、
+ *     文を1つずつ実行する。1つの接続を受け持つのは同時に1つの実行スレッドだけなので、
+ *     接続ごとの文の順序は保たれ、別々の接続の文は並行して実行される。
+ *     結果は接続ごとの出力ストリームに書かれ、OUTPUT_CHUNKバイトごとに
+ *     'D'フレームとしてI/Oスレッドから送られる(結果全体を溜めることはない)。
+ *   バッファとカタログは、すべての接続で共有する。
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "microdb.h"
+
+/*
+ * NUM_IO_THREAD -- 接続の読み書きを受け持つスレッドの数
+ */
+#define NUM_IO_THREAD 2
+
+/*
+ * NUM_EXECUTOR_THREAD -- 文を実行するスレッドの数
+ */
+#define NUM_EXECUTOR_THREAD 4
+
+/*
+ * MAX_EVENT -- 1回のepoll_waitで受け取るイベントの数
+ */
+#define MAX_EVENT 64
+
+/*
+ * MAX_REQUEST -- 1つの文の最大バイト数
+ */
+#define MAX_REQUEST 65536
+
+/*
+ * FRAME_HEADER_SIZE -- フレームの見出しのバイト数
+ */
+#define FRAME_HEADER_SIZE 5
+
+/*
+ * OUTPUT_CHUNK -- 結果を'D'フレームに区切る大きさ
+ */
+#define OUTPUT_CHUNK 16384
+
+/*
+ * MAX_PENDING_OUTPUT -- 送り切れていない結果がこれを超えたら、実行スレッドを待たせる
+ */
+#define MAX_PENDING_OUTPUT (1024 * 1024)
+
+/*
+ * OUTPUT_TIMEOUT -- 実行スレッドを待たせる時間の上限(秒)
+ *
+ * この間に結果を読まないクライアントは、接続を切って結果を捨てる。
+ */
+#define OUTPUT_TIMEOUT 10
+
+/*
+ * フレームの種類
+ */
+#define FRAME_QUERY 'Q'
+#define FRAME_DATA 'D'
+#define FRAME_END 'E'
+#define FRAME_ERROR 'X'
+
+typedef struct IoThread IoThread;
+typedef struct Statement Statement;
+typedef struct Connection Connection;
+
+/*
+ * IoThread -- I/Oスレッドの情報
+ */
+struct IoThread {
+  pthread_t thread;
+  int epoll;                            /* epollのディスクリプタ */
+};
+
+/*
+ * Statement -- 実行を待っている文
+ */
+struct Statement {
+  char *text;                           /* 文('\0'で終わる) */
+  Statement *next;
+};
+
+/*
+ * Connection -- 1つの接続の状態
+ *
+ * in, inLength, brokenは受け持つI/Oスレッドだけが使う。
+ * output, sessionは接続を受け持っている実行スレッドだけが使う。それ以外はmutexで守る。
+ */
+struct Connection {
+  int desc;                             /* ソケット */
+  IoThread *io;                         /* 受け持つI/Oスレッド */
+  char in[FRAME_HEADER_SIZE + MAX_REQUEST];  /* 読み込んだフレーム */
+  size_t inLength;                      /* inに入っているバイト数 */
+  int broken;                           /* プロトコルの誤りがあったら1 */
+  FILE *output;                         /* 実行中の文の結果を書くストリーム */
+  Session session;                      /* set文で変えた接続ごとの設定 */
+
+  pthread_mutex_t mutex;
+  pthread_cond_t drained;               /* 送り切れていない結果が減ったことを知らせる */
+  char *out;                            /* 送るフレーム */
+  size_t outStart;                      /* outの送っていない部分の先頭 */
+  size_t outLength;                     /* outの使っている部分の終わり */
+  size_t outCapacity;                   /* outの大きさ */
+  int wantWrite;                        /* epollで書き込みを待っているなら1 */
+  Statement *head;                      /* 実行を待っている文の列 */
+  Statement *tail;
+  int running;                          /* 実行スレッドが受け持っているなら1 */
+  int closing;                          /* 新しい文を受け付けないなら1 */
+  int failed;                           /* 先に届いた文を実行し終えたら誤りを知らせるなら1 */
+  int dropped;                          /* 結果を読まないので切ることにしたなら1 */
+  int dead;                             /* 相手がいなくなって送れないなら1 */
+  Connection *nextRunnable;             /* 実行を待っている接続の列 */
+  Connection *prevConnection;           /* すべての接続の列(connectionMutexで守る) */
+  Connection *nextConnection;
+};
+
+static int listenDesc = -1;             /* 接続を受け付けるソケット */
+static StatementExecutor execute;       /* 文を実行する関数 */
+static IoThread ioThread[NUM_IO_THREAD];
+static int signalPipe[2] = {-1, -1};    /* 終了のシグナルを知らせるパイプ */
+static int stopPipe[2] = {-1, -1};      /* I/Oスレッドに終了を知らせるパイプ */
+static pthread_t executorThread[NUM_EXECUTOR_THREAD];
+
+static pthread_mutex_t runMutex = PTHREAD_MUTEX_INITIALIZER;      /* 以下の列を守る */
+static pthread_cond_t runnable = PTHREAD_COND_INITIALIZER;       /* 文の届いた接続ができた */
+static Connection *runHead = NULL;      /* 文の届いた接続の列 */
+static Connection *runTail = NULL;
+static int stopping = 0;                /* 実行スレッドを終わらせるなら1 */
+
+static pthread_mutex_t connectionMutex = PTHREAD_MUTEX_INITIALIZER;  /* 以下の列を守る */
+static Connection *connections = NULL;  /* すべての接続の列(終了するときに解放する) */
+
+/*
+ * handleSignal -- 終了のシグナルのハンドラ(どのスレッドで呼ばれてもよい)
+ */
+static void handleSignal(int sig)
+{
+  int saved = errno;
+
+  (void) sig;
+  write(signalPipe[1], "", 1);
+  errno = saved;
+}
+
+/*
+ * updateInterest -- epollで待つイベントを、送るものがあるかどうかに合わせる
+ *
+ * 引数:
+ *  connection: 接続(mutexを取ってから呼ぶこと)
+ *
+ * 返り値:
+ *  なし
+ */
+static void updateInterest(Connection *connection)
+{
+  struct epoll_event event;
+  int wantWrite;
+
+  if (connection->dead) {
+    return;
+  }
+
+  /* 閉じるだけの接続も、I/Oスレッドに解放させるため書き込みを待つ */
+  wantWrite = connection->outStart < connection->outLength
+    || (connection->closing && !connection->running);
+  if (wantWrite == connection->wantWrite) {
+    return;
+  }
+
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | (wantWrite ? EPOLLOUT : 0);
+  event.data.ptr = connection;
+  epoll_ctl(connection->io->epoll, EPOLL_CTL_MOD, connection->desc, &event);
+  connection->wantWrite = wantWrite;
+}
+
+/*
+ * appendFrame -- 送るフレームを加える
+ *
+ * 引数:
+ *  connection: 接続(mutexを取ってから呼ぶこと)
+ *  type: フレームの種類
+ *  data: 内容
+ *  size: 内容のバイト数
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ */
+static Result appendFrame(Connection *connection, int type, const char *data, size_t size)
+{
+  uint32_t length = htonl((uint32_t) size);
+  size_t need, capacity;
+  char *out;
+
+  if (connection->dead || connection->dropped) {
+    return OK;
+  }
+
+  /* 送り終えた部分を詰める */
+  if (connection->outStart > 0) {
+    memmove(connection->out, connection->out + connection->outStart,
+            connection->outLength - connection->outStart);
+    connection->outLength -= connection->outStart;
+    connection->outStart = 0;
+  }
+
+  need = connection->outLength + FRAME_HEADER_SIZE + size;
+  if (need > connection->outCapacity) {
+    capacity = connection->outCapacity == 0 ? OUTPUT_CHUNK * 2 : connection->outCapacity;
+    while (capacity < need) {
+      capacity *= 2;
+    }
+    if ((out = realloc(connection->out, capacity)) == NULL) {
+      return NG;
+    }
+    connection->out = out;
+    connection->outCapacity = capacity;
+  }
+
+  memcpy(connection->out + connection->outLength, &length, 4);
+  connection->out[connection->outLength + 4] = (char) type;
+  if (size > 0) {
+    memcpy(connection->out + connection->outLength + FRAME_HEADER_SIZE, data, size);
+  }
+  connection->outLength = need;
+
+  updateInterest(connection);
+  return OK;
+}
+
+/*
+ * writeOutput -- 結果のストリームに書かれた内容を'D'フレームにする
+ *
+ * 送り切れていない結果が多すぎる間は、クライアントが読むのを待つ。
+ * OUTPUT_TIMEOUT秒待っても読まなければ接続を切り、以後の結果は捨てる。
+ * 待っている間も文のロックは取ったままなので、いつまでも待つことはしない。
+ */
+static ssize_t writeOutput(void *cookie, const char *data, size_t size)
+{
+  Connection *connection = cookie;
+  struct timespec deadline;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += OUTPUT_TIMEOUT;
+
+  pthread_mutex_lock(&connection->mutex);
+  while (!connection->dead && !connection->dropped
+         && connection->outLength - connection->outStart > MAX_PENDING_OUTPUT) {
+    if (pthread_cond_timedwait(&connection->drained, &connection->mutex, &deadline) == ETIMEDOUT) {
+      /* 後始末は、接続が切れたことに気づいたI/Oスレッドに任せる */
+      connection->dropped = 1;
+      connection->closing = 1;
+      shutdown(connection->desc, SHUT_RDWR);
+    }
+  }
+  appendFrame(connection, FRAME_DATA, data, size);
+  pthread_mutex_unlock(&connection->mutex);
+
+  return size;
+}
+
+/*
+ * createConnection -- 接続の状態の作成
+ *
+ * 引数:
+ *  desc: ソケット
+ *  io: 受け持つI/Oスレッド
+ *
+ * 返り値:
+ *  接続の状態。失敗の場合NULL
+ */
+static Connection *createConnection(int desc, IoThread *io)
+{
+  Connection *connection;
+  cookie_io_functions_t functions;
+
+  if ((connection = calloc(1, sizeof(Connection))) == NULL) {
+    return NULL;
+  }
+
+  memset(&functions, 0, sizeof(functions));
+  functions.write = writeOutput;
+  if ((connection->output = fopencookie(connection, "w", functions)) == NULL) {
+    free(connection);
+    return NULL;
+  }
+  setvbuf(connection->output, NULL, _IOFBF, OUTPUT_CHUNK);
+
+  connection->desc = desc;
+  connection->io = io;
+  pthread_mutex_init(&connection->mutex, NULL);
+  pthread_cond_init(&connection->drained, NULL);
+
+  pthread_mutex_lock(&connectionMutex);
+  if ((connection->nextConnection = connections) != NULL) {
+    connections->prevConnection = connection;
+  }
+  connections = connection;
+  pthread_mutex_unlock(&connectionMutex);
+
+  return connection;
+}
+
+/*
+ * freeConnection -- 接続を閉じて状態を解放する
+ *
+ * 引数:
+ *  connection: 接続(I/Oスレッドからも実行スレッドからも使われていないこと)
+ *
+ * 返り値:
+ *  なし
+ */
+static void freeConnection(Connection *connection)
+{
+  Statement *statement;
+
+  pthread_mutex_lock(&connectionMutex);
+  if (connection->prevConnection == NULL) {
+    connections = connection->nextConnection;
+  } else {
+    connection->prevConnection->nextConnection = connection->nextConnection;
+  }
+  if (connection->nextConnection != NULL) {
+    connection->nextConnection->prevConnection = connection->prevConnection;
+  }
+  pthread_mutex_unlock(&connectionMutex);
+
+  close(connection->desc);
+  fclose(connection->output);
+  while ((statement = connection->head) != NULL) {
+    connection->head = statement->next;
+    free(statement->text);
+    free(statement);
+  }
+  pthread_cond_destroy(&connection->drained);
+  pthread_mutex_destroy(&connection->mutex);
+  free(connection->out);
+  free(connection);
+}
+
+/*
+ * pushRunnable -- 接続を実行スレッドの列の最後に加える
+ *
+ * connection->mutexを取り、runningを1にしてから呼ぶこと。
+ */
+static void pushRunnable(Connection *connection)
+{
+  pthread_mutex_lock(&runMutex);
+  connection->nextRunnable = NULL;
+  if (runTail == NULL) {
+    runHead = connection;
+  } else {
+    runTail->nextRunnable = connection;
+  }
+  runTail = connection;
+  pthread_cond_signal(&runnable);
+  pthread_mutex_unlock(&runMutex);
+}
+
+/*
+ * enqueueStatement -- 受け取った文を実行を待つ列に加える
+ *
+ * 引数:
+ *  connection: 接続
+ *  text: 文('\0'で終わっていなくてよい)
+ *  size: 文のバイト数
+ *
+ * 返り値:
+ *  成功の場合OK、失敗の場合NG
+ */
+static Result enqueueStatement(Connection *connection, char *text, size_t size)
+{
+  Statement *statement;
+
+  if ((statement = malloc(sizeof(Statement))) == NULL) {
+    return NG;
+  }
+  if ((statement->text = malloc(size + 1)) == NULL) {
+    free(statement);
+    return NG;
+  }
+  memcpy(statement->text, text, size);
+  statement->text[size] = '\0';
+  statement->next = NULL;
+
+  pthread_mutex_lock(&connection->mutex);
+  if (connection->closing) {
+    /* quitの後の文は実行しない */
+    free(statement->text);
+    free(statement);
+  } else {
+    if (connection->tail == NULL) {
+      connection->head = statement;
+    } else {
+      connection->tail->next = statement;
+    }
+    connection->tail = statement;
+    if (!connection->running) {
+      connection->running = 1;
+      pushRunnable(connection);
+    }
+  }
+  pthread_mutex_unlock(&connection->mutex);
+
+  return OK;
+}
+
+/*
+ * rejectConnection -- プロトコルの誤りを'X'フレームで知らせ、送り終えたら閉じさせる
+ *
+ * 引数:
+ *  connection: 接続(mutexを取ってから呼ぶこと)
+ *
+ * 返り値:
+ *  なし
+ */
+static void rejectConnection(Connection *connection)
+{
+  static char message[] = "フレームの形式が正しくありません。\n";
+
+  appendFrame(connection, FRAME_ERROR, message, sizeof(message) - 1);
+  connection->closing = 1;
+  connection->failed = 0;
+  updateInterest(connection);
+}
+
+/*
+ * readFrames -- ソケットから読めるだけ読み、揃ったフレームを処理する
+ *
+ * 引数:
+ *  connection: 接続
+ *
+ * 返り値:
+ *  接続が切れたらNG、それ以外はOK
+ */
+static Result readFrames(Connection *connection)
+{
+  uint32_t length;
+  size_t size, used;
+  ssize_t n;
+
+  for (;;) {
+    n = read(connection->desc, connection->in + connection->inLength,
+             sizeof(connection->in) - connection->inLength);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return OK;
+    }
+    if (n <= 0) {
+      return NG;
+    }
+
+    /* 誤りを知らせた後に届いたものは読み捨てる */
+    if (connection->broken) {
+      continue;
+    }
+    connection->inLength += n;
+
+    /* 揃ったフレームを順に処理する */
+    used = 0;
+    while (connection->inLength - used >= FRAME_HEADER_SIZE) {
+      memcpy(&length, connection->in + used, 4);
+      size = ntohl(length);
+      if (size > MAX_REQUEST || connection->in[used + 4] != FRAME_QUERY) {
+        /* 誤りより前に届いた文の結果を追い越さないよう、実行中なら後で知らせる */
+        pthread_mutex_lock(&connection->mutex);
+        if (connection->running) {
+          connection->failed = 1;
+        } else {
+          rejectConnection(connection);
+        }
+        pthread_mutex_unlock(&connection->mutex);
+        connection->broken = 1;
+        connection->inLength = used = 0;
+        break;
+      }
+      if (connection->inLength - used < FRAME_HEADER_SIZE + size) {
+        break;
+      }
+      if (enqueueStatement(connection, connection->in + used + FRAME_HEADER_SIZE, size) != OK) {
+        return NG;
+      }
+      used += FRAME_HEADER_SIZE + size;
+    }
+    memmove(connection->in, connection->in + used, connection->inLength - used);
+    connection->inLength -= used;
+  }
+}
+
+/*
+ * writeFrames -- 送るフレームを、ソケットに書けるだけ書く
+ *
+ * 引数:
+ *  connection: 接続
+ *
+ * 返り値:
+ *  接続が切れたらNG、それ以外はOK
+ */
+static Result writeFrames(Connection *connection)
+{
+  Result ret = OK;
+  ssize_t n;
+
+  pthread_mutex_lock(&connection->mutex);
+  while (connection->outStart < connection->outLength) {
+    n = write(connection->desc, connection->out + connection->outStart,
+              connection->outLength - connection->outStart);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        ret = NG;
+      }
+      break;
+    }
+    connection->outStart += n;
+  }
+  if (connection->outStart == connection->outLength) {
+    connection->outStart = connection->outLength = 0;
+  }
+  pthread_cond_signal(&connection->drained);
+  updateInterest(connection);
+  pthread_mutex_unlock(&connection->mutex);
+
+  return ret;
+}
+
+/*
+ * handleConnection -- 接続のイベントの処理(I/Oスレッド)
+ *
+ * 引数:
+ *  connection: 接続
+ *  events: 起きたイベント
+ *
+ * 返り値:
+ *  なし
+ *
+ * 接続を解放するのは、文を実行していないときはI/Oスレッド、
+ * 実行中に相手がいなくなったときは実行スレッドである。
+ */
+static void handleConnection(Connection *connection, uint32_t events)
+{
+  int alive = 1;
+  int finished;
+
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+    alive = readFrames(connection) == OK;
+  }
+  if (alive && (events & EPOLLOUT)) {
+    alive = writeFrames(connection) == OK;
+  }
+
+  pthread_mutex_lock(&connection->mutex);
+  if (!alive) {
+    /* 相手がいなくなった。実行中の文は最後まで実行させ、結果は捨てる */
+    epoll_ctl(connection->io->epoll, EPOLL_CTL_DEL, connection->desc, NULL);
+    connection->closing = 1;
+    connection->dead = 1;
+    pthread_cond_signal(&connection->drained);
+  }
+  finished = connection->closing && !connection->running
+    && (connection->dead || connection->outStart == connection->outLength);
+  pthread_mutex_unlock(&connection->mutex);
+
+  if (finished) {
+    if (!connection->dead) {
+      epoll_ctl(connection->io->epoll, EPOLL_CTL_DEL, connection->desc, NULL);
+    }
+    freeConnection(connection);
+  }
+}
+
+/*
+ * acceptConnections -- 待っている接続をすべて受け付け、I/Oスレッドに振り分ける
+ */
+static void acceptConnections()
+{
+  static int next = 0;
+  struct epoll_event event;
+  Connection *connection;
+  IoThread *io;
+  int desc;
+
+  while ((desc = accept(listenDesc, NULL, NULL)) != -1) {
+    fcntl(desc, F_SETFL, fcntl(desc, F_GETFL) | O_NONBLOCK);
+    io = &ioThread[next];
+    next = (next + 1) % NUM_IO_THREAD;
+    if ((connection = createConnection(desc, io)) == NULL) {
+      close(desc);
+      continue;
+    }
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = connection;
+    if (epoll_ctl(io->epoll, EPOLL_CTL_ADD, desc, &event) == -1) {
+      freeConnection(connection);
+    }
+  }
+}
+
+/*
+ * ioThreadMain -- I/Oスレッドの処理
+ *
+ * 1番目のI/Oスレッドは、接続の受け付けも受け持つ。
+ * stopPipeに書き込まれたら終わる。
+ */
+static void *ioThreadMain(void *arg)
+{
+  IoThread *io = arg;
+  struct epoll_event events[MAX_EVENT];
+  int i, n;
+
+  for (;;) {
+    if ((n = epoll_wait(io->epoll, events, MAX_EVENT, -1)) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    for (i = 0; i < n; i++) {
+      if (events[i].data.ptr == stopPipe) {
+        return NULL;
+      } else if (events[i].data.ptr == NULL) {
+        acceptConnections();
+      } else {
+        handleConnection(events[i].data.ptr, events[i].events);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * executorThreadMain -- 実行スレッドの処理
+ *
+ * 文の届いた接続を1つ取り出し、その接続の文を1つ実行して結果を送る。
+ * まだ文が残っていれば接続を列の最後に戻し、接続どうしで交互に実行する。
+ * stoppingが1になったら、残っている文は実行せずに終わる。
+ */
+static void *executorThreadMain(void *arg)
+{
+  Connection *connection;
+  Statement *statement;
+  int quit, dead;
+
+  (void) arg;
+  for (;;) {
+    pthread_mutex_lock(&runMutex);
+    while (runHead == NULL && !stopping) {
+      pthread_cond_wait(&runnable, &runMutex);
+    }
+    if (stopping) {
+      pthread_mutex_unlock(&runMutex);
+      break;
+    }
+    connection = runHead;
+    if ((runHead = connection->nextRunnable) == NULL) {
+      runTail = NULL;
+    }
+    pthread_mutex_unlock(&runMutex);
+
+    pthread_mutex_lock(&connection->mutex);
+    statement = connection->head;
+    if ((connection->head = statement->next) == NULL) {
+      connection->tail = NULL;
+    }
+    pthread_mutex_unlock(&connection->mutex);
+
+    /* 文を実行して、結果を接続の出力ストリームに書く */
+    quit = execute(statement->text, connection->output, &connection->session);
+    fflush(connection->output);
+
+    free(statement->text);
+    free(statement);
+
+    pthread_mutex_lock(&connection->mutex);
+    appendFrame(connection, FRAME_END, NULL, 0);
+    if (quit) {
+      connection->closing = 1;
+    }
+    if (connection->failed && (connection->head == NULL || connection->closing)) {
+      rejectConnection(connection);
+    }
+    if (connection->head != NULL && !connection->closing) {
+      pushRunnable(connection);
+    } else {
+      connection->running = 0;
+      updateInterest(connection);
+    }
+    dead = connection->dead && !connection->running;
+    pthread_mutex_unlock(&connection->mutex);
+
+    /* I/Oスレッドはもう監視していないので、ここで解放する */
+    if (dead) {
+      freeConnection(connection);
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * stopThreads -- 起動したスレッドを止めて、終わるのを待つ
+ *
+ * 引数:
+ *  numIo: 起動したI/Oスレッドの数
+ *  numExecutor: 起動した実行スレッドの数
+ *
+ * 返り値:
+ *  なし
+ *
+ * 実行中の文の結果を送り切れるよう、先に実行スレッドを止めてからI/Oスレッドを止める。
+ */
+static void stopThreads(int numIo, int numExecutor)
+{
+  int i;
+
+  pthread_mutex_lock(&runMutex);
+  stopping = 1;
+  pthread_cond_broadcast(&runnable);
+  pthread_mutex_unlock(&runMutex);
+  for (i = 0; i < numExecutor; i++) {
+    pthread_join(executorThread[i], NULL);
+  }
+
+  /* パイプは読まないので、すべてのI/Oスレッドが書き込みに気づく */
+  write(stopPipe[1], "", 1);
+  for (i = 0; i < numIo; i++) {
+    pthread_join(ioThread[i].thread, NULL);
+  }
+}
+
+/*
+ * runServer -- サーバとしてクライアントからの文を実行する
+ *
+ * 引数:
+ *  path: 接続を受け付けるUNIXドメインソケットのパス
+ *  executor: 1つの文を実行して、"quit"なら1を返す関数
+ *
+ * 返り値:
+ *  SIGINTかSIGTERMを受け取ったらOK、サーバを始められなければNG
+ *
+ * 戻るときは実行中の文が終わるのを待ってすべてのスレッドを止め、
+ * 残っている接続を閉じる。まだ実行していない文は実行しない。
+ * 呼び出し側は各モジュールの終了処理をしてプログラムを終えること。
+ */
+Result runServer(char *path, StatementExecutor executor)
+{
+  struct sockaddr_un address;
+  struct sigaction action;
+  struct epoll_event event;
+  Result ret = NG;
+  int numEpoll = 0, numIo = 0, numExecutor = 0;
+  char c;
+  int i;
+
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path is too long: %s\n", path);
+    return NG;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+
+  if ((listenDesc = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+    perror("socket");
+    return NG;
+  }
+  unlink(path);
+  if (bind(listenDesc, (struct sockaddr *) &address, sizeof(address)) == -1
+      || listen(listenDesc, SOMAXCONN) == -1) {
+    perror(path);
+    close(listenDesc);
+    return NG;
+  }
+  fcntl(listenDesc, F_SETFL, fcntl(listenDesc, F_GETFL) | O_NONBLOCK);
+
+  execute = executor;
+  stopping = 0;
+
+  /* 終了のシグナルはパイプで知らせてもらう。切れた接続への書き込みは無視する */
+  if (pipe(signalPipe) == -1 || pipe(stopPipe) == -1) {
+    perror("pipe");
+    goto done;
+  }
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handleSignal;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  printf("%sで接続を待っています。\n", path);
+  fflush(stdout);
+
+  /* I/Oスレッドを起動する。接続の受け付けは1番目のスレッドで待つ */
+  for (numEpoll = 0; numEpoll < NUM_IO_THREAD; numEpoll++) {
+    if ((ioThread[numEpoll].epoll = epoll_create1(0)) == -1) {
+      perror("epoll_create1");
+      goto done;
+    }
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = stopPipe;
+    epoll_ctl(ioThread[numEpoll].epoll, EPOLL_CTL_ADD, stopPipe[0], &event);
+  }
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  epoll_ctl(ioThread[0].epoll, EPOLL_CTL_ADD, listenDesc, &event);
+  for (numIo = 0; numIo < NUM_IO_THREAD; numIo++) {
+    if (pthread_create(&ioThread[numIo].thread, NULL, ioThreadMain, &ioThread[numIo]) != 0) {
+      perror("pthread_create");
+      goto done;
+    }
+  }
+
+  /* 実行スレッドを起動する */
+  for (numExecutor = 0; numExecutor < NUM_EXECUTOR_THREAD; numExecutor++) {
+    if (pthread_create(&executorThread[numExecutor], NULL, executorThreadMain, NULL) != 0) {
+      perror("pthread_create");
+      goto done;
+    }
+  }
+
+  while (read(signalPipe[0], &c, 1) != 1) {
+    /* シグナルによる中断なら読み直す */
+  }
+  ret = OK;
+
+done:
+  /* スレッドを止めてから、残っている接続と資源を解放する */
+  stopThreads(numIo, numExecutor);
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  while (connections != NULL) {
+    freeConnection(connections);
+  }
+  for (i = 0; i < numEpoll; i++) {
+    close(ioThread[i].epoll);
+  }
+  for (i = 0; i < 2; i++) {
+    if (signalPipe[i] != -1) {
+      close(signalPipe[i]);
+    }
+    if (stopPipe[i] != -1) {
+      close(stopPipe[i]);
+    }
+    signalPipe[i] = stopPipe[i] = -1;
+  }
+  close(listenDesc);
+  unlink(path);
+
+  return ret;
+}
@@ -0,0 +1,813 @@
+/*
+ * sort.c -- 整列モジュール
+ *
+ * 固定長の要素を、先頭keySizeバイトのキーのバイト列の大小(memcmp)で整列する。
+ * キーは呼び出し側で、バイト列の比較で正しい順序になるように正規化しておく。
+ * 要素がメモリの上限を超えたら、整列済みの列(ラン)を作業用ファイルに書き出し、
+ * 最後にランを併合しながら1つずつ取り出す(外部マージソート)。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "microdb.h"
+
+/*
+ * MIN_SORT_ENTRY -- メモリ上に持つ要素数の下限
+ */
+#define MIN_SORT_ENTRY 16
+
+/*
+ * Run -- 作業用ファイルに書き出した整列済みの列
+ */
+typedef struct Run Run;
+struct Run {
+  int startPage;                /* 先頭のページ番号 */
+  long numEntry;                /* 要素数 */
+};
+
+/*
+ * RunCursor -- ランを先頭から読み出すための情報
+ */
+typedef struct RunCursor RunCursor;
+struct RunCursor {
+  int pageNum;                  /* 読み込んでいるページの番号 */
+  int position;                 /* ページの中で次に返す要素の番号 */
+  long remain;                  /* まだ返していない要素数 */
+  char page[PAGE_SIZE];         /* 読み込んでいるページ */
+};
+
+/*
+ * RunWriter -- ランを書き出すための情報
+ */
+typedef struct RunWriter RunWriter;
+struct RunWriter {
+  File *file;                   /* 書き出し先の作業用ファイル */
+  int numPage;                  /* fileに書き出したページ数 */
+  int position;                 /* pageに溜めている要素数 */
+  char page[PAGE_SIZE];         /* 書き出し中のページ */
+};
+
+/*
+ * sortState -- 整列の状態
+ */
+typedef enum {
+  SORT_ADDING = 0,              /* 要素を追加中 */
+  SORT_MEMORY = 1,              /* メモリ上の要素を取り出し中 */
+  SORT_MERGING = 2              /* ランを併合しながら取り出し中 */
+} sortState;
+
+/*
+ * Sorter -- 整列の途中の状態を保持する構造体
+ */
+struct Sorter {
+  int entrySize;                /* 要素のバイト数 */
+  int keySize;                  /* 比較するキーのバイト数 */
+  int entriesPerPage;           /* 1ページに収める要素数 */
+  int maxEntry;                 /* メモリ上に持てる要素数 */
+  int maxFanIn;                 /* 一度に併合するランの数の上限 */
+  sortState state;              /* 整列の状態 */
+
+  int numEntry;                 /* メモリ上の要素数 */
+  char *entry;                  /* メモリ上の要素の領域 */
+  char **pointer;               /* 整列に使うポインタの配列 */
+  char **work;                  /* 併合に使うポインタの配列 */
+  int next;                     /* メモリ上で次に返す要素の番号 */
+
+  RunWriter *writer;            /* ランの書き出し先(ランがなければNULL) */
+  Run *run;                     /* 書き出したランの配列 */
+  int numRun;                   /* 書き出したランの数 */
+  int maxRun;                   /* runの配列の大きさ */
+
+  RunCursor *cursor;            /* 併合中のランの読み出し位置 */
+  int *heap;                    /* 併合に使うヒープ(cursorの番号) */
+  int heapSize;                 /* ヒープの要素数 */
+  int lastCursor;               /* 直前に返した要素のランの番号(なければ-1) */
+
+  long limit;                   /* 取り出す要素数の上限(負なら上限なし) */
+  long numReturned;             /* 取り出した要素数 */
+  int bounded;                  /* 小さい方からlimit個だけをヒープで保持しているか */
+};
+
+/*
+ * mergeSortPointers -- ポインタの配列をキーの順に並べ替える(ボトムアップのマージソート)
+ *
+ * 引数:
+ *  pointer: 並べ替える配列
+ *  work: 作業用の同じ大きさの配列
+ *  n: 要素数
+ *  keySize: 比較するキーのバイト数
+ *
+ * 返り値:
+ *  並べ替えた結果が入った配列(pointerかworkのどちらか)
+ */
+static char **mergeSortPointers(char **pointer, char **work, int n, int keySize)
+{
+  char **from = pointer, **to = work, **tmp;
+  int width, lo, mid, hi, i, j, k;
+
+  for (width = 1; width < n; width *= 2) {
+    for (lo = 0; lo < n; lo += 2 * width) {
+      mid = (lo + width < n) ? lo + width : n;
+      hi = (lo + 2 * width < n) ? lo + 2 * width : n;
+      i = lo;
+      j = mid;
+      k = lo;
+      while (i < mid && j < hi) {
+        if (memcmp(from[j], from[i], keySize) < 0) {
+          to[k++] = from[j++];
+        } else {
+          to[k++] = from[i++];
+        }
+      }
+      while (i < mid) {
+        to[k++] = from[i++];
+      }
+      while (j < hi) {
+        to[k++] = from[j++];
+      }
+    }
+    tmp = from;
+    from = to;
+    to = tmp;
+  }
+
+  return from;
+}
+
+/*
+ * sortMemoryEntries -- メモリ上の要素を整列する
+ */
+static void sortMemoryEntries(Sorter *sorter)
+{
+  char **sorted;
+  int i;
+
+  for (i = 0; i < sorter->numEntry; i++) {
+    sorter->pointer[i] = sorter->entry + (size_t) sorter->entrySize * i;
+  }
+
+  sorted = mergeSortPointers(sorter->pointer, sorter->work, sorter->numEntry, sorter->keySize);
+  if (sorted != sorter->pointer) {
+    memcpy(sorter->pointer, sorted, sizeof(char *) * sorter->numEntry);
+  }
+}
+
+/*
+ * siftUpBounded -- 保持している要素のヒープで、末尾の要素を上に移す
+ *
+ * ヒープはpointerの配列で、根にキーの最も大きい要素を置く。
+ */
+static void siftUpBounded(Sorter *sorter, int i)
+{
+  char *tmp;
+  int parent;
+
+  while (i > 0) {
+    parent = (i - 1) / 2;
+    if (memcmp(sorter->pointer[parent], sorter->pointer[i], sorter->keySize) >= 0) {
+      break;
+    }
+    tmp = sorter->pointer[parent];
+    sorter->pointer[parent] = sorter->pointer[i];
+    sorter->pointer[i] = tmp;
+    i = parent;
+  }
+}
+
+/*
+ * siftDownBounded -- 保持している要素のヒープで、根の要素を下に移す
+ */
+static void siftDownBounded(Sorter *sorter)
+{
+  char *tmp;
+  int i = 0, child;
+
+  for (;;) {
+    child = 2 * i + 1;
+    if (child >= sorter->numEntry) {
+      break;
+    }
+    if (child + 1 < sorter->numEntry
+        && memcmp(sorter->pointer[child + 1], sorter->pointer[child], sorter->keySize) > 0) {
+      child++;
+    }
+    if (memcmp(sorter->pointer[i], sorter->pointer[child], sorter->keySize) >= 0) {
+      break;
+    }
+    tmp = sorter->pointer[i];
+    sorter->pointer[i] = sorter->pointer[child];
+    sorter->pointer[child] = tmp;
+    i = child;
+  }
+}
+
+/*
+ * addBoundedEntry -- 小さい方からlimit個だけを保持する場合の要素の追加
+ *
+ * limit個に満たなければそのまま加え、満ちていれば保持している中で
+ * 最も大きい要素より小さいときだけ、それと入れ替える。
+ */
+static void addBoundedEntry(Sorter *sorter, char *entry)
+{
+  char *slot;
+
+  if (sorter->numEntry < sorter->limit) {
+    slot = sorter->entry + (size_t) sorter->entrySize * sorter->numEntry;
+    memcpy(slot, entry, sorter->entrySize);
+    sorter->pointer[sorter->numEntry] = slot;
+    siftUpBounded(sorter, sorter->numEntry);
+    sorter->numEntry++;
+  } else if (sorter->numEntry > 0
+             && memcmp(entry, sorter->pointer[0], sorter->keySize) < 0) {
+    memcpy(sorter->pointer[0], entry, sorter->entrySize);
+    siftDownBounded(sorter);
+  }
+}
+
+/*
+ * createRunWriter -- ランを書き出す作業用ファイルの用意
+ */
+static RunWriter *createRunWriter()
+{
+  RunWriter *writer;
+
+  if ((writer = malloc(sizeof(RunWriter))) == NULL) {
+    return NULL;
+  }
+  if ((writer->file = createTempFile()) == NULL) {
+    free(writer);
+    return NULL;
+  }
+  writer->numPage = 0;
+  writer->position = 0;
+  memset(writer->page, 0, PAGE_SIZE);
+
+  return writer;
+}
+
+/*
+ * freeRunWriter -- ランの作業用ファイルの削除
+ */
+static void freeRunWriter(RunWriter *writer)
+{
+  if (writer != NULL) {
+    deleteTempFile(writer->file);
+    free(writer);
+  }
+}
+
+/*
+ * writeRunEntry -- ランに要素を1つ書き出す
+ */
+static Result writeRunEntry(Sorter *sorter, RunWriter *writer, char *entry)
+{
+  memcpy(writer->page + sorter->entrySize * writer->position, entry, sorter->entrySize);
+  writer->position++;
+
+  if (writer->position == sorter->entriesPerPage) {
+    if (writePage(writer->file, writer->numPage, writer->page) != OK) {
+      return NG;
+    }
+    writer->numPage++;
+    writer->position = 0;
+  }
+
+  return OK;
+}
+
+/*
+ * finishRun -- 書きかけのページを書き出して、ランを終える
+ *
+ * 次のランはページの先頭から始める。
+ */
+static Result finishRun(RunWriter *writer)
+{
+  if (writer->position > 0) {
+    if (writePage(writer->file, writer->numPage, writer->page) != OK) {
+      return NG;
+    }
+    writer->numPage++;
+    writer->position = 0;
+  }
+
+  return OK;
+}
+
+/*
+ * addRun -- ランの情報を配列に追加する
+ */
+static Result addRun(Run **run, int *numRun, int *maxRun, int startPage, long numEntry)
+{
+  Run *newRun;
+
+  if (*numRun == *maxRun) {
+    *maxRun = (*maxRun == 0) ? 16 : *maxRun * 2;
+    if ((newRun = realloc(*run, sizeof(Run) * *maxRun)) == NULL) {
+      return NG;
+    }
+    *run = newRun;
+  }
+
+  (*run)[*numRun].startPage = startPage;
+  (*run)[*numRun].numEntry = numEntry;
+  (*numRun)++;
+
+  return OK;
+}
+
+/*
+ * spillMemoryEntries -- メモリ上の要素を整列し、1つのランとして書き出す
+ */
+static Result spillMemoryEntries(Sorter *sorter)
+{
+  int i, startPage;
+
+  if (sorter->numEntry == 0) {
+    return OK;
+  }
+
+  if (sorter->writer == NULL && (sorter->writer = createRunWriter()) == NULL) {
+    return NG;
+  }
+
+  sortMemoryEntries(sorter);
+
+  startPage = sorter->writer->numPage;
+  for (i = 0; i < sorter->numEntry; i++) {
+    if (writeRunEntry(sorter, sorter->writer, sorter->pointer[i]) != OK) {
+      return NG;
+    }
+  }
+  if (finishRun(sorter->writer) != OK) {
+    return NG;
+  }
+  if (addRun(&sorter->run, &sorter->numRun, &sorter->maxRun, startPage, sorter->numEntry) != OK) {
+    return NG;
+  }
+
+  sorter->numEntry = 0;
+  return OK;
+}
+
+/*
+ * cursorEntry -- ランの読み出し位置にある要素
+ */
+static char *cursorEntry(Sorter *sorter, RunCursor *cursor)
+{
+  return cursor->page + sorter->entrySize * cursor->position;
+}
+
+/*
+ * openCursor -- ランの先頭のページを読み込む
+ */
+static Result openCursor(File *file, Run *run, RunCursor *cursor)
+{
+  cursor->pageNum = run->startPage;
+  cursor->position = 0;
+  cursor->remain = run->numEntry;
+
+  if (cursor->remain > 0) {
+    return readPage(file, cursor->pageNum, cursor->page);
+  }
+
+  return OK;
+}
+
+/*
+ * advanceCursor -- ランの読み出し位置を1つ進める
+ */
+static Result advanceCursor(Sorter *sorter, File *file, RunCursor *cursor)
+{
+  cursor->remain--;
+  cursor->position++;
+
+  if (cursor->remain > 0 && cursor->position == sorter->entriesPerPage) {
+    cursor->pageNum++;
+    cursor->position = 0;
+    return readPage(file, cursor->pageNum, cursor->page);
+  }
+
+  return OK;
+}
+
+/*
+ * heapLess -- ヒープの2つの要素の比較
+ */
+static int heapLess(Sorter *sorter, int a, int b)
+{
+  return memcmp(cursorEntry(sorter, &sorter->cursor[a]),
+                cursorEntry(sorter, &sorter->cursor[b]), sorter->keySize) < 0;
+}
+
+/*
+ * siftDown -- ヒープの先頭の要素を正しい位置まで下ろす
+ */
+static void siftDown(Sorter *sorter, int i)
+{
+  int child, tmp;
+
+  for (;;) {
+    child = 2 * i + 1;
+    if (child >= sorter->heapSize) {
+      break;
+    }
+    if (child + 1 < sorter->heapSize && heapLess(sorter, sorter->heap[child + 1], sorter->heap[child])) {
+      child++;
+    }
+    if (!heapLess(sorter, sorter->heap[child], sorter->heap[i])) {
+      break;
+    }
+    tmp = sorter->heap[i];
+    sorter->heap[i] = sorter->heap[child];
+    sorter->heap[child] = tmp;
+    i = child;
+  }
+}
+
+/*
+ * startMerge -- ランの併合を始める
+ *
+ * 引数:
+ *  sorter: 整列の状態
+ *  file: ランを収めたファイル
+ *  run: 併合するランの配列
+ *  numRun: 併合するランの数
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+static Result startMerge(Sorter *sorter, File *file, Run *run, int numRun)
+{
+  int i;
+
+  free(sorter->cursor);
+  free(sorter->heap);
+  sorter->cursor = malloc(sizeof(RunCursor) * numRun);
+  sorter->heap = malloc(sizeof(int) * numRun);
+  if (sorter->cursor == NULL || sorter->heap == NULL) {
+    return NG;
+  }
+
+  sorter->heapSize = 0;
+  for (i = 0; i < numRun; i++) {
+    if (openCursor(file, &run[i], &sorter->cursor[i]) != OK) {
+      return NG;
+    }
+    if (sorter->cursor[i].remain > 0) {
+      sorter->heap[sorter->heapSize++] = i;
+    }
+  }
+  for (i = sorter->heapSize / 2 - 1; i >= 0; i--) {
+    siftDown(sorter, i);
+  }
+  sorter->lastCursor = -1;
+
+  return OK;
+}
+
+/*
+ * nextMergedEntry -- 併合中のランから次に小さい要素を取り出す
+ *
+ * 引数:
+ *  sorter: 整列の状態
+ *  file: ランを収めたファイル
+ *  entry: 要素へのポインタを返す領域(もう要素がなければNULL)
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 返した要素は、次にこの関数を呼び出すまで有効である。
+ */
+static Result nextMergedEntry(Sorter *sorter, File *file, char **entry)
+{
+  RunCursor *cursor;
+
+  /* 直前に返した要素のランを進めて、ヒープを直す */
+  if (sorter->lastCursor >= 0) {
+    cursor = &sorter->cursor[sorter->lastCursor];
+    if (advanceCursor(sorter, file, cursor) != OK) {
+      return NG;
+    }
+    if (cursor->remain == 0) {
+      sorter->heap[0] = sorter->heap[--sorter->heapSize];
+    }
+    siftDown(sorter, 0);
+    sorter->lastCursor = -1;
+  }
+
+  if (sorter->heapSize == 0) {
+    *entry = NULL;
+    return OK;
+  }
+
+  sorter->lastCursor = sorter->heap[0];
+  *entry = cursorEntry(sorter, &sorter->cursor[sorter->lastCursor]);
+  return OK;
+}
+
+/*
+ * reduceRuns -- ランの数が併合の上限以下になるまで、ランを併合して書き出す
+ */
+static Result reduceRuns(Sorter *sorter)
+{
+  RunWriter *writer;
+  Run *newRun;
+  int numNewRun, maxNewRun, from, count, startPage;
+  long numEntry;
+  char *entry;
+
+  while (sorter->numRun > sorter->maxFanIn) {
+    if ((writer = createRunWriter()) == NULL) {
+      return NG;
+    }
+    newRun = NULL;
+    numNewRun = 0;
+    maxNewRun = 0;
+
+    /* maxFanIn個ずつ併合して、新しいファイルにランとして書き出す */
+    for (from = 0; from < sorter->numRun; from += count) {
+      count = sorter->numRun - from;
+      if (count > sorter->maxFanIn) {
+        count = sorter->maxFanIn;
+      }
+      if (startMerge(sorter, sorter->writer->file, &sorter->run[from], count) != OK) {
+        freeRunWriter(writer);
+        free(newRun);
+        return NG;
+      }
+
+      startPage = writer->numPage;
+      numEntry = 0;
+      for (;;) {
+        if (nextMergedEntry(sorter, sorter->writer->file, &entry) != OK) {
+          freeRunWriter(writer);
+          free(newRun);
+          return NG;
+        }
+        if (entry == NULL) {
+          break;
+        }
+        if (writeRunEntry(sorter, writer, entry) != OK) {
+          freeRunWriter(writer);
+          free(newRun);
+          return NG;
+        }
+        numEntry++;
+      }
+      if (finishRun(writer) != OK
+          || addRun(&newRun, &numNewRun, &maxNewRun, startPage, numEntry) != OK) {
+        freeRunWriter(writer);
+        free(newRun);
+        return NG;
+      }
+    }
+
+    /* 古いランのファイルを捨てて、新しいランに置き換える */
+    freeRunWriter(sorter->writer);
+    free(sorter->run);
+    sorter->writer = writer;
+    sorter->run = newRun;
+    sorter->numRun = numNewRun;
+    sorter->maxRun = maxNewRun;
+  }
+
+  return OK;
+}
+
+/*
+ * createSorter -- 整列の準備
+ *
+ * 引数:
+ *  entrySize: 要素のバイト数(PAGE_SIZE以下)
+ *  keySize: 要素の先頭の、比較に使うキーのバイト数
+ *  memoryLimit: 整列に使うメモリの上限(バイト数)
+ *
+ * 返り値:
+ *  整列の状態を返す。失敗したらNULLを返す。
+ *
+ * ***注意***
+ *  返した構造体は、不要になったら必ずfreeSorterで解放すること。
+ */
+Sorter *createSorter(int entrySize, int keySize, long memoryLimit)
+{
+  Sorter *sorter;
+
+  if (entrySize <= 0 || entrySize > PAGE_SIZE || keySize > entrySize) {
+    return NULL;
+  }
+
+  if ((sorter = calloc(1, sizeof(Sorter))) == NULL) {
+    return NULL;
+  }
+
+  sorter->entrySize = entrySize;
+  sorter->keySize = keySize;
+  sorter->entriesPerPage = PAGE_SIZE / entrySize;
+  sorter->state = SORT_ADDING;
+  sorter->lastCursor = -1;
+  sorter->limit = -1;
+
+  /* 1要素ごとに、要素の領域とポインタ2つ分のメモリを使う */
+  sorter->maxEntry = memoryLimit / (entrySize + sizeof(char *) * 2);
+  if (sorter->maxEntry < MIN_SORT_ENTRY) {
+    sorter->maxEntry = MIN_SORT_ENTRY;
+  }
+  sorter->maxFanIn = memoryLimit / (sizeof(RunCursor) + sizeof(int));
+  if (sorter->maxFanIn < 2) {
+    sorter->maxFanIn = 2;
+  }
+
+  sorter->entry = malloc((size_t) entrySize * sorter->maxEntry);
+  sorter->pointer = malloc(sizeof(char *) * sorter->maxEntry);
+  sorter->work = malloc(sizeof(char *) * sorter->maxEntry);
+  if (sorter->entry == NULL || sorter->pointer == NULL || sorter->work == NULL) {
+    freeSorter(sorter);
+    return NULL;
+  }
+
+  return sorter;
+}
+
+/*
+ * setSortLimit -- 取り出す要素数の上限の指定
+ *
+ * 引数:
+ *  sorter: 整列の状態
+ *  limit: 取り出す要素数の上限(負なら上限なし)
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 要素を追加する前に呼び出すこと。limit個がメモリに収まる場合は、
+ * 追加しながら小さい方からlimit個だけをヒープに保持するので、
+ * 使うメモリは要素limit個分になり、ランも書き出さない。
+ */
+Result setSortLimit(Sorter *sorter, long limit)
+{
+  int size;
+
+  if (sorter->state != SORT_ADDING || sorter->numEntry > 0 || sorter->numRun > 0) {
+    return NG;
+  }
+
+  sorter->limit = limit;
+  if (limit < 0 || limit > sorter->maxEntry) {
+    return OK;
+  }
+
+  /* limit個分だけを残してメモリを返す */
+  size = (limit > 0) ? (int) limit : 1;
+  free(sorter->entry);
+  free(sorter->pointer);
+  free(sorter->work);
+  sorter->entry = malloc((size_t) sorter->entrySize * size);
+  sorter->pointer = malloc(sizeof(char *) * size);
+  sorter->work = malloc(sizeof(char *) * size);
+  if (sorter->entry == NULL || sorter->pointer == NULL || sorter->work == NULL) {
+    return NG;
+  }
+  sorter->maxEntry = size;
+  sorter->bounded = 1;
+
+  return OK;
+}
+
+/*
+ * addSortEntry -- 整列する要素の追加
+ *
+ * 引数:
+ *  sorter: 整列の状態
+ *  entry: 追加する要素(entrySizeバイト)
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ */
+Result addSortEntry(Sorter *sorter, char *entry)
+{
+  if (sorter->state != SORT_ADDING) {
+    return NG;
+  }
+
+  if (sorter->bounded) {
+    addBoundedEntry(sorter, entry);
+    return OK;
+  }
+
+  /* メモリがいっぱいなら、整列してランとして書き出す */
+  if (sorter->numEntry == sorter->maxEntry) {
+    if (spillMemoryEntries(sorter) != OK) {
+      return NG;
+    }
+  }
+
+  memcpy(sorter->entry + (size_t) sorter->entrySize * sorter->numEntry, entry, sorter->entrySize);
+  sorter->numEntry++;
+
+  return OK;
+}
+
+/*
+ * sortEntries -- 追加した要素の整列
+ *
+ * 引数:
+ *  sorter: 整列の状態
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * これを呼び出した後は、getNextSortEntryで小さい順に要素を取り出せる。
+ */
+Result sortEntries(Sorter *sorter)
+{
+  if (sorter->state != SORT_ADDING) {
+    return NG;
+  }
+
+  /* ランを書き出していなければ、メモリ上だけで整列する */
+  if (sorter->numRun == 0) {
+    sortMemoryEntries(sorter);
+    sorter->next = 0;
+    sorter->state = SORT_MEMORY;
+    return OK;
+  }
+
+  /* 残りもランとして書き出し、メモリを空けてから併合する */
+  if (spillMemoryEntries(sorter) != OK) {
+    return NG;
+  }
+  free(sorter->entry);
+  free(sorter->pointer);
+  free(sorter->work);
+  sorter->entry = NULL;
+  sorter->pointer = NULL;
+  sorter->work = NULL;
+
+  if (reduceRuns(sorter) != OK) {
+    return NG;
+  }
+  if (startMerge(sorter, sorter->writer->file, sorter->run, sorter->numRun) != OK) {
+    return NG;
+  }
+  sorter->state = SORT_MERGING;
+
+  return OK;
+}
+
+/*
+ * getNextSortEntry -- 整列した要素を小さい順に1つ取り出す
+ *
+ * 引数:
+ *  sorter: 整列の状態
+ *  entry: 要素へのポインタを返す領域(もう要素がなければNULL)
+ *
+ * 返り値:
+ *  成功ならOK、失敗ならNGを返す
+ *
+ * 返した要素の領域は、次にこの関数を呼び出すまで有効である。
+ * setSortLimitで上限を指定していれば、上限の数だけ取り出した後はNULLを返す。
+ */
+Result getNextSortEntry(Sorter *sorter, char **entry)
+{
+  if (sorter->limit >= 0 && sorter->numReturned >= sorter->limit
+      && (sorter->state == SORT_MEMORY || sorter->state == SORT_MERGING)) {
+    *entry = NULL;
+    return OK;
+  }
+  sorter->numReturned++;
+
+  switch (sorter->state) {
+    case SORT_MEMORY:
+      if (sorter->next < sorter->numEntry) {
+        *entry = sorter->pointer[sorter->next++];
+      } else {
+        *entry = NULL;
+      }
+      return OK;
+    case SORT_MERGING:
+      return nextMergedEntry(sorter, sorter->writer->file, entry);
+    default:
+      return NG;
+  }
+}
+
+/*
+ * freeSorter -- 整列の状態の解放
+ *
+ * 書き出したランの作業用ファイルも削除する。
+ */
+void freeSorter(Sorter *sorter)
+{
+  if (sorter == NULL) {
+    return;
+  }
+
+  freeRunWriter(sorter->writer);
+  free(sorter->run);
+  free(sorter->cursor);
+  free(sorter->heap);
+  free(sorter->entry);
+  free(sorter->pointer);
+  free(sorter->work);
+  free(sorter);
+}
@@ -126,6 +126,35 @@ int main(int argc, char **argv)
     /* 作成したテーブルの情報を出力 */
     printTableInfo(tableName);
 
+    /*
+     * カタログのテスト
+     * 2回取得したら同じ定義が返り、テーブルを作り直したら新しい定義になる
+     */
+    {
+	TableInfo *first, *second;
+	int ok;
+
+	first = getTableInfo("teacher");
+	second = getTableInfo("teacher");
+	ok = (first != NULL && first == second && first->numField == 6
+	      && first->recordSize == RECORD_HEADER_SIZE + MAX_STRING * 4 + sizeof(int) * 2
+	      && first->fieldOffset[3] == RECORD_HEADER_SIZE + MAX_STRING * 3);
+	freeTableInfo(second);
+
+	dropTable("teacher");
+	tableInfo.numField = 2;
+	if (createTable("teacher", &tableInfo) != OK) {
+	    ok = 0;
+	}
+	second = getTableInfo("teacher");
+	if (second == NULL || second->numField != 2 || first->numField != 6) {
+	    ok = 0;
+	}
+	freeTableInfo(first);
+	freeTableInfo(second);
+	fprintf(stderr, "catalog: %s\n", ok ? "OK" : "NG");
+    }
+
     /* 後始末 */
     dropTable("student");
     dropTable("teacher");
@@ -59,7 +59,7 @@ for (j = 0; j < 10; j++){
 
     record.numField = i;
 
-    if (insertRecord(TABLE_NAME, &record) != OK) {
+    if (insertRecord(TABLE_NAME, &record, NULL) != OK) {
     fprintf(stderr, "Cannot insert record.\n");
     return NG;
     }
@@ -121,7 +121,7 @@ Result test2()
 
     /* 結果を表示 */
     printf("name != Mickey or age=4\n");
-    printRecordSet(recordSet);
+    printRecordSet(stdout, recordSet);
 
     /* 結果を解放 */
     freeRecordSet(recordSet);
@@ -144,7 +144,7 @@ Result test2()
 
     /* 結果を表示 */
     printf("name != 'Mickey'\n");
-    printRecordSet(recordSet);
+    printRecordSet(stdout, recordSet);
 
     /* 結果を解放 */
     freeRecordSet(recordSet);
@@ -174,7 +174,7 @@ Result test3()
 	return NG;
     }
     /* データを表示する */
-    printTableData(TABLE_NAME);
+    printTableData(stdout, TABLE_NAME);
 
     return OK;
 }
@@ -5,6 +5,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include "microdb.h"
 
 #define TABLE_NAME "student"
@@ -44,7 +46,7 @@ Result test1()
 
     record.numField = i;
 
-    if (insertRecord(TABLE_NAME, &record) != OK) {
+    if (insertRecord(TABLE_NAME, &record, NULL) != OK) {
 	fprintf(stderr, "Cannot insert record.\n");
 	return NG;
     }
@@ -76,7 +78,7 @@ Result test1()
 
     record.numField = i;
 
-    if (insertRecord(TABLE_NAME, &record) != OK) {
+    if (insertRecord(TABLE_NAME, &record, NULL) != OK) {
 	fprintf(stderr, "Cannot insert record.\n");
 	return NG;
     }
@@ -108,7 +110,7 @@ Result test1()
 
     record.numField = i;
 
-    if (insertRecord(TABLE_NAME, &record) != OK) {
+    if (insertRecord(TABLE_NAME, &record, NULL) != OK) {
 	fprintf(stderr, "Cannot insert record.\n");
 	return NG;
     }
@@ -140,7 +142,7 @@ Result test1()
 
     record.numField = i;
 
-    if (insertRecord(TABLE_NAME, &record) != OK) {
+    if (insertRecord(TABLE_NAME, &record, NULL) != OK) {
 	fprintf(stderr, "Cannot insert record.\n");
 	return NG;
     }
@@ -172,7 +174,7 @@ Result test1()
 
     record.numField = i;
 
-    if (insertRecord(TABLE_NAME, &record) != OK) {
+    if (insertRecord(TABLE_NAME, &record, NULL) != OK) {
 	fprintf(stderr, "Cannot insert record.\n");
 	return NG;
     }
@@ -204,13 +206,13 @@ Result test1()
 
     record.numField = i;
 
-    if (insertRecord(TABLE_NAME, &record) != OK) {
+    if (insertRecord(TABLE_NAME, &record, NULL) != OK) {
 	fprintf(stderr, "Cannot insert record.\n");
 	return NG;
     }
 
     /* データを表示する */
-    printTableData(TABLE_NAME);
+    printTableData(stdout, TABLE_NAME);
 
     return OK;
 }
@@ -242,7 +244,7 @@ Result test2()
 
     /* 結果を表示 */
     printf("age > 17, not distinct\n");
-    printRecordSet(recordSet);
+    printRecordSet(stdout, recordSet);
 
     /* 結果を解放 */
     freeRecordSet(recordSet);
@@ -266,7 +268,7 @@ Result test2()
 
     /* 結果を表示 */
     printf("age > 17, distinct\n");
-    printRecordSet(recordSet);
+    printRecordSet(stdout, recordSet);
 
     /* 結果を解放 */
     freeRecordSet(recordSet);
@@ -290,7 +292,7 @@ Result test2()
 
     /* 結果を表示 */
     printf("address != 'Florida', not distinct\n");
-    printRecordSet(recordSet);
+    printRecordSet(stdout, recordSet);
 
     /* 結果を解放 */
     freeRecordSet(recordSet);
@@ -315,7 +317,7 @@ Result test2()
 
     /* 結果を表示 */
     printf("address != 'Florida', distinct\n");
-    printRecordSet(recordSet);
+    printRecordSet(stdout, recordSet);
 
     /* 結果を解放 */
     freeRecordSet(recordSet);
@@ -348,11 +350,1145 @@ Result test3()
     }
 
     /* データを表示する */
-    printTableData(TABLE_NAME);
+    printTableData(stdout, TABLE_NAME);
 
     return OK;
 }
 
+/*
+ * test4 -- レコードの位置を指定した取り出し、書き換え、削除、片付け
+ */
+Result test4()
+{
+    RecordData record, fetched;
+    RecordSet *recordSet;
+    RecordId recordId, oldId, last;
+    long numVacuum;
+    int i, numAll, numPaged;
+
+    /*
+     * 以下のレコードを挿入し、挿入した位置を受け取る
+     * ('i04009', 'Goofy', 30, 'Tokyo')
+     */
+    i = 0;
+    strcpy(record.fieldData[i].name, "id");
+    record.fieldData[i].dataType = TYPE_STRING;
+    strcpy(record.fieldData[i].valueSet.stringValue, "i04009");
+    i++;
+
+    strcpy(record.fieldData[i].name, "name");
+    record.fieldData[i].dataType = TYPE_STRING;
+    strcpy(record.fieldData[i].valueSet.stringValue, "Goofy");
+    i++;
+
+    strcpy(record.fieldData[i].name, "age");
+    record.fieldData[i].dataType = TYPE_INTEGER;
+    record.fieldData[i].valueSet.intValue = 30;
+    i++;
+
+    strcpy(record.fieldData[i].name, "address");
+    record.fieldData[i].dataType = TYPE_STRING;
+    strcpy(record.fieldData[i].valueSet.stringValue, "Tokyo");
+    i++;
+
+    record.numField = i;
+
+    if (insertRecord(TABLE_NAME, &record, &recordId) != OK) {
+	fprintf(stderr, "Cannot insert record.\n");
+	return NG;
+    }
+
+    /* 挿入した位置からそのレコードが取り出せるか */
+    if (fetchRecordById(TABLE_NAME, &recordId, &fetched) != OK
+	|| strcmp(fetched.fieldData[1].valueSet.stringValue, "Goofy") != 0
+	|| fetched.fieldData[2].valueSet.intValue != 30) {
+	fprintf(stderr, "Cannot fetch inserted record.\n");
+	return NG;
+    }
+
+    /* 書き換えても位置は変わらず、同じ位置から新しい値が取り出せるか */
+    record.fieldData[2].valueSet.intValue = 31;
+    oldId = recordId;
+    if (updateRecordById(TABLE_NAME, &recordId, &record) != OK
+	|| recordId.pageNum != oldId.pageNum || recordId.slotNum != oldId.slotNum
+	|| fetchRecordById(TABLE_NAME, &recordId, &fetched) != OK
+	|| fetched.fieldData[2].valueSet.intValue != 31) {
+	fprintf(stderr, "Cannot update record.\n");
+	return NG;
+    }
+
+    /* 1件ずつ続きを取り出して、全件の検索と数が合うか */
+    if ((recordSet = selectRecord(TABLE_NAME, NULL)) == NULL) {
+	fprintf(stderr, "Cannot select records.\n");
+	return NG;
+    }
+    numAll = recordSet->numRecord;
+    freeRecordSet(recordSet);
+    free(recordSet);
+
+    numPaged = 0;
+    last.pageNum = 0;
+    last.slotNum = -1;
+    for (;;) {
+	if ((recordSet = selectRecordAfter(TABLE_NAME, NULL, &last, 1)) == NULL) {
+	    fprintf(stderr, "Cannot select records after (%d, %d).\n", last.pageNum, last.slotNum);
+	    return NG;
+	}
+	if (recordSet->numRecord == 0) {
+	    free(recordSet);
+	    break;
+	}
+	last = recordSet->recordData->recordId;
+	numPaged++;
+	freeRecordSet(recordSet);
+	free(recordSet);
+    }
+    if (numPaged != numAll) {
+	fprintf(stderr, "Number of records is wrong: %d (expected %d)\n", numPaged, numAll);
+	return NG;
+    }
+
+    /* 削除したら、その位置からは取り出せなくなる */
+    if (deleteRecordById(TABLE_NAME, &recordId) != OK) {
+	fprintf(stderr, "Cannot delete record.\n");
+	return NG;
+    }
+    if (fetchRecordById(TABLE_NAME, &recordId, &fetched) == OK
+	|| deleteRecordById(TABLE_NAME, &recordId) == OK) {
+	fprintf(stderr, "Deleted record is found.\n");
+	return NG;
+    }
+
+    /* 書き換える前のレコードと削除したレコードは、片付けられる(2回目は何もない) */
+    if (vacuumTable(TABLE_NAME, &numVacuum) != OK || numVacuum < 2
+	|| vacuumTable(TABLE_NAME, &numVacuum) != OK || numVacuum != 0) {
+	fprintf(stderr, "Cannot vacuum table.\n");
+	return NG;
+    }
+
+    return OK;
+}
+
+/*
+ * test5 -- 書き換え
+ */
+Result test5()
+{
+    Assignment assignment;
+    Condition condition;
+    RecordSet *recordSet;
+    RecordData *record;
+    int numRecord;
+
+    /*
+     * 以下の書き換えを実行
+     * update TABLE_NAME set age = 40 , address = 'Chiba' where name = 'Mickey'
+     */
+    assignment.numField = 2;
+    strcpy(assignment.name[0], "age");
+    assignment.dataType[0] = TYPE_INTEGER;
+    assignment.valueSet[0].intValue = 40;
+    strcpy(assignment.name[1], "address");
+    assignment.dataType[1] = TYPE_STRING;
+    memset(&assignment.valueSet[1], 0, sizeof(ValueSet));
+    strcpy(assignment.valueSet[1].stringValue, "Chiba");
+
+    strcpy(condition.name, "name");
+    condition.dataType = TYPE_STRING;
+    condition.operator = OPR_EQUAL;
+    strcpy(condition.valueSet.stringValue, "Mickey");
+    condition.distinct = NOT_DISTINCT;
+    condition.orCondition = NULL;
+    condition.andCondition = NULL;
+
+    if ((recordSet = selectRecord(TABLE_NAME, &condition)) == NULL) {
+	fprintf(stderr, "Cannot select records.\n");
+	return NG;
+    }
+    numRecord = recordSet->numRecord;
+    freeRecordSet(recordSet);
+    free(recordSet);
+
+    if (updateRecord(TABLE_NAME, &assignment, &condition) != OK) {
+	fprintf(stderr, "Cannot update records.\n");
+	return NG;
+    }
+
+    /* 書き換えたレコードの数が変わらず、すべて新しい値になっているか */
+    if ((recordSet = selectRecord(TABLE_NAME, &condition)) == NULL) {
+	fprintf(stderr, "Cannot select records.\n");
+	return NG;
+    }
+    if (recordSet->numRecord != numRecord) {
+	fprintf(stderr, "Number of records is wrong: %d (expected %d)\n",
+		recordSet->numRecord, numRecord);
+	freeRecordSet(recordSet);
+	free(recordSet);
+	return NG;
+    }
+    for (record = recordSet->recordData; record != NULL; record = record->next) {
+	if (record->fieldData[2].valueSet.intValue != 40
+	    || strcmp(record->fieldData[3].valueSet.stringValue, "Chiba") != 0) {
+	    fprintf(stderr, "Record is not updated.\n");
+	    freeRecordSet(recordSet);
+	    free(recordSet);
+	    return NG;
+	}
+    }
+    freeRecordSet(recordSet);
+    free(recordSet);
+
+    /* 存在しないフィールドは書き換えられない */
+    strcpy(assignment.name[0], "grade");
+    if (updateRecord(TABLE_NAME, &assignment, &condition) == OK) {
+	fprintf(stderr, "Unknown field is updated.\n");
+	return NG;
+    }
+
+    return OK;
+}
+
+/*
+ * test6 -- 複数のレコードの一括挿入
+ */
+Result test6()
+{
+    RecordData *records, fetched;
+    int i, n = 500;
+
+    if ((records = calloc(n, sizeof(RecordData))) == NULL) {
+	return NG;
+    }
+
+    /* ('b%05d', 'Donald', i, 'Osaka') をn件まとめて挿入する */
+    for (i = 0; i < n; i++) {
+	records[i].numField = 4;
+	sprintf(records[i].fieldData[0].valueSet.stringValue, "b%05d", i);
+	strcpy(records[i].fieldData[1].valueSet.stringValue, "Donald");
+	records[i].fieldData[2].valueSet.intValue = i;
+	strcpy(records[i].fieldData[3].valueSet.stringValue, "Osaka");
+    }
+    if (insertRecords(TABLE_NAME, records, n) != OK) {
+	fprintf(stderr, "Cannot insert records.\n");
+	free(records);
+	return NG;
+    }
+
+    /* 返ってきた位置から、それぞれのレコードが取り出せるか */
+    for (i = 0; i < n; i++) {
+	if (fetchRecordById(TABLE_NAME, &records[i].recordId, &fetched) != OK
+	    || fetched.fieldData[2].valueSet.intValue != i
+	    || strcmp(fetched.fieldData[0].valueSet.stringValue,
+		      records[i].fieldData[0].valueSet.stringValue) != 0) {
+	    fprintf(stderr, "Cannot fetch record %d.\n", i);
+	    free(records);
+	    return NG;
+	}
+    }
+    free(records);
+
+    return OK;
+}
+
+/*
+ * test7 -- CSVファイルからの一括読み込み
+ */
+Result test7()
+{
+    FILE *fp;
+    RecordSet *recordSet;
+    Condition condition;
+    long numRecord;
+    int i, n = 3000;
+
+    /* 引用符で囲んだフィールドや改行のない最後の行も含むファイルを作る */
+    if ((fp = fopen("test-copy.csv", "w")) == NULL) {
+	return NG;
+    }
+    for (i = 0; i < n - 1; i++) {
+	fprintf(fp, "c%05d,\"Pluto, Jr.\",%d,Nagoya\r\n", i, 1000 + i);
+    }
+    fprintf(fp, "c%05d,Pluto,%d,Nagoya", i, 1000 + i);
+    fclose(fp);
+
+    if (copyFrom(TABLE_NAME, "test-copy.csv", &numRecord) != OK || numRecord != n) {
+	fprintf(stderr, "Cannot copy records.\n");
+	remove("test-copy.csv");
+	return NG;
+    }
+    remove("test-copy.csv");
+
+    /* 読み込んだレコードが検索できるか */
+    strcpy(condition.name, "age");
+    condition.dataType = TYPE_INTEGER;
+    condition.operator = OPR_GREATER_THAN;
+    condition.valueSet.intValue = 999;
+    condition.distinct = NOT_DISTINCT;
+    condition.orCondition = NULL;
+    condition.andCondition = NULL;
+    if ((recordSet = selectRecord(TABLE_NAME, &condition)) == NULL) {
+	fprintf(stderr, "Cannot select records.\n");
+	return NG;
+    }
+    i = recordSet->numRecord;
+    if (i == n && strcmp(recordSet->recordData->fieldData[1].valueSet.stringValue, "Pluto") != 0) {
+	i = -1;
+    }
+    freeRecordSet(recordSet);
+    free(recordSet);
+    if (i != n) {
+	fprintf(stderr, "Copied records are wrong.\n");
+	return NG;
+    }
+
+    /* 値の間違った行があれば失敗する */
+    if ((fp = fopen("test-copy.csv", "w")) == NULL) {
+	return NG;
+    }
+    fprintf(fp, "d00001,Pluto,12x,Nagoya\n");
+    fclose(fp);
+    if (copyFrom(TABLE_NAME, "test-copy.csv", &numRecord) == OK || numRecord != 0) {
+	fprintf(stderr, "Wrong line is accepted.\n");
+	remove("test-copy.csv");
+	return NG;
+    }
+    remove("test-copy.csv");
+
+    return OK;
+}
+
+/*
+ * test8 -- ファイルへの一括書き出し
+ */
+Result test8()
+{
+    FILE *fp;
+    Condition condition;
+    char line[256], expected[256];
+    long numRecord;
+    int n = 0;
+
+    /* test7で読み込んだレコード(age > 999)を書き出す */
+    strcpy(condition.name, "age");
+    condition.dataType = TYPE_INTEGER;
+    condition.operator = OPR_GREATER_THAN;
+    condition.valueSet.intValue = 999;
+    condition.distinct = NOT_DISTINCT;
+    condition.orCondition = NULL;
+    condition.andCondition = NULL;
+    if (copyTo(TABLE_NAME, &condition, "test-copy.csv", &numRecord) != OK || numRecord != 3000) {
+	fprintf(stderr, "Cannot copy records to file.\n");
+	remove("test-copy.csv");
+	return NG;
+    }
+
+    /* test7で読み込んだときと同じ内容になっているか */
+    if ((fp = fopen("test-copy.csv", "r")) == NULL) {
+	return NG;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (n < 2999) {
+	    sprintf(expected, "c%05d,\"Pluto, Jr.\",%d,Nagoya\n", n, 1000 + n);
+	} else {
+	    sprintf(expected, "c%05d,Pluto,%d,Nagoya\n", n, 1000 + n);
+	}
+	if (strcmp(line, expected) != 0) {
+	    fprintf(stderr, "Wrong line: %s", line);
+	    fclose(fp);
+	    remove("test-copy.csv");
+	    return NG;
+	}
+	n++;
+    }
+    fclose(fp);
+    remove("test-copy.csv");
+
+    return (n == 3000) ? OK : NG;
+}
+
+/*
+ * test9 -- 複数のスレッドによる走査
+ */
+Result test9()
+{
+    FILE *fp;
+    RecordSet *recordSet[2];
+    RecordData *p, *q;
+    Condition condition;
+    long numRecord;
+    int i, n = 20000;
+    Result ret = OK;
+
+    /* 並列に走査される大きさ(256ページ以上)にする */
+    if ((fp = fopen("test-copy.csv", "w")) == NULL) {
+	return NG;
+    }
+    for (i = 0; i < n; i++) {
+	fprintf(fp, "p%05d,Mars,%d,Tokyo\n", i, 5000 + i % 100);
+    }
+    fclose(fp);
+    if (copyFrom(TABLE_NAME, "test-copy.csv", &numRecord) != OK || numRecord != n) {
+	fprintf(stderr, "Cannot copy records.\n");
+	remove("test-copy.csv");
+	return NG;
+    }
+    remove("test-copy.csv");
+
+    /* 1スレッドと4スレッドで同じレコードが同じ順に返るか */
+    strcpy(condition.name, "age");
+    condition.dataType = TYPE_INTEGER;
+    condition.operator = OPR_EQUAL;
+    condition.valueSet.intValue = 5007;
+    condition.distinct = NOT_DISTINCT;
+    condition.orCondition = NULL;
+    condition.andCondition = NULL;
+    for (i = 0; i < 2; i++) {
+	setScanThreads(i == 0 ? 1 : 4);
+	if ((recordSet[i] = selectRecord(TABLE_NAME, &condition)) == NULL) {
+	    fprintf(stderr, "Cannot select records.\n");
+	    return NG;
+	}
+    }
+    if (recordSet[0]->numRecord != n / 100 || recordSet[1]->numRecord != n / 100) {
+	ret = NG;
+    }
+    for (p = recordSet[0]->recordData, q = recordSet[1]->recordData; p != NULL && q != NULL;
+	 p = p->next, q = q->next) {
+	if (strcmp(p->fieldData[0].valueSet.stringValue, q->fieldData[0].valueSet.stringValue) != 0
+	    || p->recordId.pageNum != q->recordId.pageNum || p->recordId.slotNum != q->recordId.slotNum) {
+	    ret = NG;
+	}
+    }
+    for (i = 0; i < 2; i++) {
+	freeRecordSet(recordSet[i]);
+	free(recordSet[i]);
+    }
+    if (ret != OK) {
+	fprintf(stderr, "Parallel scan returned wrong records.\n");
+	return NG;
+    }
+
+    /* 4スレッドで探して削除し、1スレッドで残りを数える */
+    condition.operator = OPR_GREATER_THAN;
+    condition.valueSet.intValue = 5049;
+    if (deleteRecord(TABLE_NAME, &condition) != OK) {
+	fprintf(stderr, "Cannot delete records.\n");
+	return NG;
+    }
+    setScanThreads(1);
+    condition.valueSet.intValue = 4999;
+    if ((recordSet[0] = selectRecord(TABLE_NAME, &condition)) == NULL) {
+	return NG;
+    }
+    i = recordSet[0]->numRecord;
+    freeRecordSet(recordSet[0]);
+    free(recordSet[0]);
+    setScanThreads(0);
+
+    return (i == n / 2) ? OK : NG;
+}
+
+/*
+ * test10 -- 準備済みの文の実行
+ */
+Result test10()
+{
+    PreparedStatement *insert, *select, *update, *delete;
+    RecordData record;
+    RecordSet *recordSet;
+    Condition condition, condition2;
+    Assignment assignment;
+    int param[MAX_FIELD] = { 1, 0, 2, 0 };
+    char id[MAX_STRING];
+    int i, numRecord;
+    Result ret = OK;
+
+    /* ('q0000' + i, 'Pluto', 7000 + i, 'Mars')を挿入する文 */
+    memset(&record, 0, sizeof(record));
+    strcpy(record.fieldData[0].name, "id");
+    record.fieldData[0].dataType = TYPE_STRING;
+    strcpy(record.fieldData[1].name, "name");
+    record.fieldData[1].dataType = TYPE_STRING;
+    strcpy(record.fieldData[1].valueSet.stringValue, "Pluto");
+    strcpy(record.fieldData[2].name, "age");
+    record.fieldData[2].dataType = TYPE_INTEGER;
+    strcpy(record.fieldData[3].name, "address");
+    record.fieldData[3].dataType = TYPE_STRING;
+    strcpy(record.fieldData[3].valueSet.stringValue, "Mars");
+    record.numField = 4;
+
+    /* age = ? で検索する文 */
+    strcpy(condition.name, "age");
+    condition.dataType = TYPE_INTEGER;
+    condition.operator = OPR_EQUAL;
+    condition.distinct = NOT_DISTINCT;
+    condition.andCondition = NULL;
+    condition.orCondition = NULL;
+    condition.param = 1;
+
+    /* id = ? のレコードのnameを ? にする文 */
+    strcpy(condition2.name, "id");
+    condition2.dataType = TYPE_STRING;
+    condition2.operator = OPR_EQUAL;
+    condition2.distinct = NOT_DISTINCT;
+    condition2.andCondition = NULL;
+    condition2.orCondition = NULL;
+    condition2.param = 2;
+    assignment.numField = 1;
+    strcpy(assignment.name[0], "name");
+    assignment.dataType[0] = TYPE_STRING;
+    assignment.param[0] = 1;
+
+    insert = prepareInsert(TABLE_NAME, &record, param);
+    select = prepareSelect(TABLE_NAME, &condition, NULL);
+    update = prepareUpdate(TABLE_NAME, &assignment, &condition2);
+    condition.operator = OPR_GREATER_THAN;
+    delete = prepareDelete(TABLE_NAME, &condition);
+    if (insert == NULL || select == NULL || update == NULL || delete == NULL
+	|| getParameterCount(insert) != 2 || getParameterType(insert, 2) != TYPE_INTEGER) {
+	fprintf(stderr, "Cannot prepare statements.\n");
+	return NG;
+    }
+
+    /* 値を設定していないパラメータがあれば実行しない */
+    if (executeQuery(select) != NULL || bindString(select, 1, "x") == OK) {
+	ret = NG;
+    }
+
+    for (i = 0; i < 3; i++) {
+	snprintf(id, sizeof(id), "q%04d", i);
+	if (bindString(insert, 1, id) != OK || bindInteger(insert, 2, 7000 + i) != OK
+	    || executeUpdate(insert) != OK) {
+	    fprintf(stderr, "Cannot execute insert.\n");
+	    ret = NG;
+	}
+    }
+
+    bindString(update, 1, "Goofy");
+    bindString(update, 2, "q0002");
+    if (executeUpdate(update) != OK) {
+	ret = NG;
+    }
+
+    /* 同じ文を値を変えて実行する */
+    for (i = 0; i < 3; i++) {
+	bindInteger(select, 1, 7000 + i);
+	if ((recordSet = executeQuery(select)) == NULL) {
+	    ret = NG;
+	    continue;
+	}
+	snprintf(id, sizeof(id), "q%04d", i);
+	if (recordSet->numRecord != 1
+	    || strcmp(recordSet->recordData->fieldData[0].valueSet.stringValue, id) != 0
+	    || strcmp(recordSet->recordData->fieldData[1].valueSet.stringValue,
+		      i == 2 ? "Goofy" : "Pluto") != 0) {
+	    ret = NG;
+	}
+	freeRecordSet(recordSet);
+	free(recordSet);
+    }
+
+    /* age > 6999 を削除する */
+    bindInteger(delete, 1, 6999);
+    if (executeUpdate(delete) != OK) {
+	ret = NG;
+    }
+    bindInteger(select, 1, 7001);
+    if ((recordSet = executeQuery(select)) == NULL) {
+	ret = NG;
+    } else {
+	numRecord = recordSet->numRecord;
+	freeRecordSet(recordSet);
+	free(recordSet);
+	if (numRecord != 0) {
+	    ret = NG;
+	}
+    }
+
+    freePreparedStatement(insert);
+    freePreparedStatement(select);
+    freePreparedStatement(update);
+    freePreparedStatement(delete);
+
+    return ret;
+}
+
+/*
+ * AGGREGATE_TABLE -- 集約のテストに使うテーブルの名前
+ */
+#define AGGREGATE_TABLE "aggtest"
+
+/*
+ * setAggregate -- 集約関数の指定を作る(テスト用)
+ */
+static void setAggregate(Aggregate *aggregate, AggregateType type, char *name)
+{
+    memset(aggregate, 0, sizeof(Aggregate));
+    aggregate->type = type;
+    strcpy(aggregate->name, name);
+}
+
+/*
+ * test11 -- 集約関数
+ */
+Result test11()
+{
+    TableInfo tableInfo;
+    RecordData records[10];
+    RecordSet *recordSet;
+    RecordData *p;
+    Aggregate aggregate[MAX_AGGREGATE + 1];
+    GroupBy groupBy;
+    Condition condition;
+    FILE *fp;
+    char *text;
+    size_t size;
+    int i, g, seen, expectedCount[3] = { 4, 3, 3 }, expectedSum[3] = { 18, 12, 15 };
+    Result ret = OK;
+
+    /* (名前, i % 3, i) を10件入れたテーブルを作る */
+    dropTable(AGGREGATE_TABLE);
+    tableInfo.numField = 3;
+    strcpy(tableInfo.fieldInfo[0].name, "name");
+    tableInfo.fieldInfo[0].dataType = TYPE_STRING;
+    strcpy(tableInfo.fieldInfo[1].name, "grp");
+    tableInfo.fieldInfo[1].dataType = TYPE_INTEGER;
+    strcpy(tableInfo.fieldInfo[2].name, "val");
+    tableInfo.fieldInfo[2].dataType = TYPE_INTEGER;
+    if (createTable(AGGREGATE_TABLE, &tableInfo) != OK) {
+	fprintf(stderr, "Cannot create table.\n");
+	return NG;
+    }
+    memset(records, 0, sizeof(records));
+    for (i = 0; i < 10; i++) {
+	records[i].numField = 3;
+	sprintf(records[i].fieldData[0].valueSet.stringValue, "n%d", 9 - i);
+	records[i].fieldData[1].valueSet.intValue = i % 3;
+	records[i].fieldData[2].valueSet.intValue = i;
+    }
+    if (insertRecords(AGGREGATE_TABLE, records, 10) != OK) {
+	fprintf(stderr, "Cannot insert records.\n");
+	dropTable(AGGREGATE_TABLE);
+	return NG;
+    }
+
+    /* すべてのレコードについての count, sum, avg, min, max */
+    setAggregate(&aggregate[0], AGG_COUNT, "*");
+    setAggregate(&aggregate[1], AGG_SUM, "val");
+    setAggregate(&aggregate[2], AGG_AVG, "val");
+    setAggregate(&aggregate[3], AGG_MIN, "val");
+    setAggregate(&aggregate[4], AGG_MAX, "val");
+    setAggregate(&aggregate[5], AGG_MIN, "name");
+    setAggregate(&aggregate[6], AGG_MAX, "name");
+    if (aggregateRecord(AGGREGATE_TABLE, NULL, aggregate, 7) != OK
+	|| aggregate[0].count != 10 || aggregate[1].sum != 45
+	|| aggregate[2].sum != 45 || aggregate[2].count != 10
+	|| aggregate[3].min.intValue != 0 || aggregate[4].max.intValue != 9
+	|| strcmp(aggregate[5].min.stringValue, "n0") != 0
+	|| strcmp(aggregate[6].max.stringValue, "n9") != 0) {
+	fprintf(stderr, "Aggregates are wrong.\n");
+	ret = NG;
+    }
+
+    /* 文字列のフィールドの合計や、多すぎる集約関数は受け付けない */
+    setAggregate(&aggregate[1], AGG_SUM, "name");
+    if (aggregateRecord(AGGREGATE_TABLE, NULL, aggregate, 2) == OK) {
+	fprintf(stderr, "Sum of strings is accepted.\n");
+	ret = NG;
+    }
+    for (i = 0; i <= MAX_AGGREGATE; i++) {
+	setAggregate(&aggregate[i], AGG_COUNT, "*");
+    }
+    if (aggregateRecord(AGGREGATE_TABLE, NULL, aggregate, MAX_AGGREGATE + 1) == OK) {
+	fprintf(stderr, "Too many aggregates are accepted.\n");
+	ret = NG;
+    }
+
+    /* 条件を満たすレコードがなければ、countとsumは0、avg, min, maxは値なし(空欄) */
+    strcpy(condition.name, "val");
+    condition.dataType = TYPE_INTEGER;
+    condition.operator = OPR_GREATER_THAN;
+    condition.valueSet.intValue = 100;
+    condition.distinct = NOT_DISTINCT;
+    condition.andCondition = NULL;
+    condition.orCondition = NULL;
+    condition.param = 0;
+    setAggregate(&aggregate[0], AGG_COUNT, "*");
+    setAggregate(&aggregate[1], AGG_SUM, "val");
+    setAggregate(&aggregate[2], AGG_AVG, "val");
+    setAggregate(&aggregate[3], AGG_MIN, "val");
+    setAggregate(&aggregate[4], AGG_MAX, "name");
+    if (aggregateRecord(AGGREGATE_TABLE, &condition, aggregate, 5) != OK
+	|| aggregate[0].count != 0 || aggregate[1].sum != 0 || aggregate[3].count != 0) {
+	fprintf(stderr, "Aggregates of no records are wrong.\n");
+	ret = NG;
+    } else if ((fp = open_memstream(&text, &size)) != NULL) {
+	printAggregate(fp, aggregate, 5);
+	fclose(fp);
+	if (strstr(text, "|              0|              0|               |               |               |") == NULL) {
+	    fprintf(stderr, "Aggregates of no records are printed wrong:\n%s", text);
+	    ret = NG;
+	}
+	free(text);
+    }
+
+    /* group by grp でグループごとの count, sum, min, max, avg */
+    groupBy.numField = 1;
+    strcpy(groupBy.name[0], "grp");
+    setAggregate(&aggregate[0], AGG_COUNT, "*");
+    setAggregate(&aggregate[1], AGG_SUM, "val");
+    setAggregate(&aggregate[2], AGG_MIN, "val");
+    setAggregate(&aggregate[3], AGG_MAX, "val");
+    setAggregate(&aggregate[4], AGG_AVG, "val");
+    if ((recordSet = groupRecord(AGGREGATE_TABLE, NULL, &groupBy, aggregate, 5)) == NULL) {
+	fprintf(stderr, "Cannot group records.\n");
+	ret = NG;
+    } else {
+	seen = 0;
+	for (p = recordSet->recordData; p != NULL; p = p->next) {
+	    g = p->fieldData[0].valueSet.intValue;
+	    if (p->numField != 6 || g < 0 || g > 2 || (seen & (1 << g))
+		|| p->fieldData[1].valueSet.intValue != expectedCount[g]
+		|| p->fieldData[2].valueSet.intValue != expectedSum[g]
+		|| p->fieldData[3].valueSet.intValue != g
+		|| p->fieldData[4].valueSet.intValue != g + 3 * (expectedCount[g] - 1)) {
+		fprintf(stderr, "Group %d is wrong.\n", g);
+		ret = NG;
+		break;
+	    }
+	    seen |= 1 << g;
+	}
+	if (recordSet->numRecord != 3 || seen != 7) {
+	    fprintf(stderr, "Number of groups is wrong: %d\n", recordSet->numRecord);
+	    ret = NG;
+	}
+	freeRecordSet(recordSet);
+	free(recordSet);
+    }
+
+    /* 条件を満たすレコードがなければ、グループは1つもできない */
+    if ((recordSet = groupRecord(AGGREGATE_TABLE, &condition, &groupBy, aggregate, 5)) == NULL
+	|| recordSet->numRecord != 0) {
+	fprintf(stderr, "Groups of no records are wrong.\n");
+	ret = NG;
+    }
+    if (recordSet != NULL) {
+	freeRecordSet(recordSet);
+	free(recordSet);
+    }
+
+    dropTable(AGGREGATE_TABLE);
+    return ret;
+}
+
+/*
+ * checkGroups -- groupRecordの結果を確かめる(test12用)
+ *
+ * numGroup個のグループgが、それぞれcount = 10, sum = 10 * g + numGroup * 45 になっているか。
+ */
+static Result checkGroups(RecordSet *recordSet, int numGroup)
+{
+    RecordData *p;
+    char *seen;
+    int g, n = 0;
+    Result ret = OK;
+
+    if ((seen = calloc(numGroup, 1)) == NULL) {
+	return NG;
+    }
+    for (p = recordSet->recordData; p != NULL; p = p->next) {
+	g = p->fieldData[0].valueSet.intValue;
+	if (g < 0 || g >= numGroup || seen[g]
+	    || p->fieldData[1].valueSet.intValue != 10
+	    || p->fieldData[2].valueSet.intValue != 10 * g + numGroup * 45) {
+	    fprintf(stderr, "Group %d is wrong.\n", g);
+	    ret = NG;
+	    break;
+	}
+	seen[g] = 1;
+	n++;
+    }
+    if (ret == OK && (n != numGroup || recordSet->numRecord != numGroup)) {
+	fprintf(stderr, "Number of groups is wrong: %d (expected %d)\n", n, numGroup);
+	ret = NG;
+    }
+    free(seen);
+
+    return ret;
+}
+
+/*
+ * test12 -- メモリに収まらないグループ化(作業用ファイルへの分割)
+ */
+Result test12()
+{
+    TableInfo tableInfo;
+    RecordData *records;
+    RecordSet *recordSet;
+    Aggregate aggregate[2];
+    GroupBy groupBy;
+    long saved = getWorkMemory();
+    long memory[3] = { 4096, 1, 64 * 1024 * 1024 };
+    int i, m, numGroup = 500, n = 5000;
+    Result ret = OK;
+
+    /* (i % numGroup, i) をn件入れたテーブルを作る(各グループ10件) */
+    dropTable("grouptest");
+    tableInfo.numField = 2;
+    strcpy(tableInfo.fieldInfo[0].name, "grp");
+    tableInfo.fieldInfo[0].dataType = TYPE_INTEGER;
+    strcpy(tableInfo.fieldInfo[1].name, "val");
+    tableInfo.fieldInfo[1].dataType = TYPE_INTEGER;
+    if (createTable("grouptest", &tableInfo) != OK
+	|| (records = calloc(n, sizeof(RecordData))) == NULL) {
+	return NG;
+    }
+    for (i = 0; i < n; i++) {
+	records[i].numField = 2;
+	records[i].fieldData[0].valueSet.intValue = i % numGroup;
+	records[i].fieldData[1].valueSet.intValue = i;
+    }
+    if (insertRecords("grouptest", records, n) != OK) {
+	fprintf(stderr, "Cannot insert records.\n");
+	ret = NG;
+    }
+    free(records);
+
+    /*
+     * 4096バイトではハッシュ表に20グループほどしか入らないので、作業用ファイルに分割し、
+     * 分割したファイルもさらに分割する。1バイトでは1グループずつしか入らず、
+     * 分割の深さの上限まで分割してから表を広げる。最後はすべてメモリに収まる場合。
+     */
+    groupBy.numField = 1;
+    strcpy(groupBy.name[0], "grp");
+    for (m = 0; m < 3 && ret == OK; m++) {
+	setWorkMemory(memory[m]);
+	memset(aggregate, 0, sizeof(aggregate));
+	aggregate[0].type = AGG_COUNT;
+	strcpy(aggregate[0].name, "*");
+	aggregate[1].type = AGG_SUM;
+	strcpy(aggregate[1].name, "val");
+	if ((recordSet = groupRecord("grouptest", NULL, &groupBy, aggregate, 2)) == NULL) {
+	    fprintf(stderr, "Cannot group records with work memory %ld.\n", memory[m]);
+	    ret = NG;
+	    break;
+	}
+	ret = checkGroups(recordSet, numGroup);
+	freeRecordSet(recordSet);
+	free(recordSet);
+    }
+
+    setWorkMemory(saved);
+    dropTable("grouptest");
+    return ret;
+}
+
+/*
+ * MVCC_TABLE -- 版管理のテストに使うテーブルの名前
+ */
+#define MVCC_TABLE "mvcctest"
+
+/*
+ * MVCC_PIPE -- 書き出しの途中で止めておくための名前付きパイプ
+ */
+#define MVCC_PIPE "mvcctest.fifo"
+
+/*
+ * CopyReader -- 別のスレッドで書き出すcopyToの引数と結果
+ */
+typedef struct CopyReader CopyReader;
+struct CopyReader {
+    char *filename;             /* 書き出すファイルの名前 */
+    long numRecord;             /* 書き出したレコードの数 */
+    Result result;              /* copyToの結果 */
+};
+
+/*
+ * runCopyReader -- MVCC_TABLEのすべてのレコードを書き出すスレッド
+ */
+static void *runCopyReader(void *arg)
+{
+    CopyReader *reader = arg;
+
+    reader->result = copyTo(MVCC_TABLE, NULL, reader->filename, &reader->numRecord);
+    return NULL;
+}
+
+/*
+ * setMvccValue -- MVCC_TABLEのすべてのレコードのvalueを書き換える
+ */
+static Result setMvccValue(int value)
+{
+    Assignment assignment;
+
+    assignment.numField = 1;
+    strcpy(assignment.name[0], "value");
+    assignment.dataType[0] = TYPE_INTEGER;
+    assignment.valueSet[0].intValue = value;
+    assignment.param[0] = 0;
+    return updateRecord(MVCC_TABLE, &assignment, NULL);
+}
+
+/*
+ * countRecords -- 条件(field = value、fieldがNULLならすべて)を満たすレコードの数
+ */
+static int countRecords(char *tableName, char *field, int value)
+{
+    RecordSet *recordSet;
+    Condition condition;
+    int n;
+
+    if (field != NULL) {
+	strcpy(condition.name, field);
+	condition.dataType = TYPE_INTEGER;
+	condition.operator = OPR_EQUAL;
+	condition.valueSet.intValue = value;
+	condition.distinct = NOT_DISTINCT;
+	condition.orCondition = NULL;
+	condition.andCondition = NULL;
+    }
+    if ((recordSet = selectRecord(tableName, field != NULL ? &condition : NULL)) == NULL) {
+	return -1;
+    }
+    n = recordSet->numRecord;
+    freeRecordSet(recordSet);
+    free(recordSet);
+    return n;
+}
+
+/*
+ * checkVacuum -- 片付けたレコードの数が期待どおりか
+ */
+static Result checkVacuum(char *tableName, long expected)
+{
+    long numVacuum;
+
+    if (vacuumTable(tableName, &numVacuum) != OK || numVacuum != expected) {
+	fprintf(stderr, "Vacuum removed %ld records (expected %ld).\n", numVacuum, expected);
+	return NG;
+    }
+    return OK;
+}
+
+/*
+ * test13 -- スナップショットで読んでいる間の書き換えと片付け
+ */
+Result test13()
+{
+    TableInfo tableInfo;
+    RecordData *records;
+    CopyReader reader;
+    Snapshot snapshot;
+    pthread_t thread;
+    FILE *fp;
+    char line[256];
+    int i, id, value, n = 100000, numThread = getScanThreads();
+    int numLine = 0, numOld = 0;
+    Result ret = OK;
+
+    /* (i, 0, 'abcdefghijklmnopqrs') をn件入れる(書き出すと2MBを超える) */
+    dropTable(MVCC_TABLE);
+    tableInfo.numField = 3;
+    strcpy(tableInfo.fieldInfo[0].name, "id");
+    tableInfo.fieldInfo[0].dataType = TYPE_INTEGER;
+    strcpy(tableInfo.fieldInfo[1].name, "value");
+    tableInfo.fieldInfo[1].dataType = TYPE_INTEGER;
+    strcpy(tableInfo.fieldInfo[2].name, "pad");
+    tableInfo.fieldInfo[2].dataType = TYPE_STRING;
+    if (createTable(MVCC_TABLE, &tableInfo) != OK
+	|| (records = calloc(n, sizeof(RecordData))) == NULL) {
+	return NG;
+    }
+    for (i = 0; i < n; i++) {
+	records[i].numField = 3;
+	records[i].fieldData[0].valueSet.intValue = i;
+	records[i].fieldData[1].valueSet.intValue = 0;
+	strcpy(records[i].fieldData[2].valueSet.stringValue, "abcdefghijklmnopqrs");
+    }
+    ret = insertRecords(MVCC_TABLE, records, n);
+    free(records);
+    if (ret != OK) {
+	fprintf(stderr, "Cannot insert records.\n");
+	dropTable(MVCC_TABLE);
+	return NG;
+    }
+
+    /*
+     * パイプに書き出させ、最初の1行だけ読む。copyToはスナップショットを取って
+     * 走査を始め、1MBのバッファを書き出すところで止まる(まだ読んでいないページが残る)。
+     * 並列走査では先にすべて集めてしまうので、1スレッドで読ませる。
+     */
+    setScanThreads(1);
+    remove(MVCC_PIPE);
+    if (mkfifo(MVCC_PIPE, 0600) != 0) {
+	setScanThreads(numThread);
+	dropTable(MVCC_TABLE);
+	return NG;
+    }
+    reader.filename = MVCC_PIPE;
+    if (pthread_create(&thread, NULL, runCopyReader, &reader) != 0) {
+	remove(MVCC_PIPE);
+	setScanThreads(numThread);
+	dropTable(MVCC_TABLE);
+	return NG;
+    }
+    if ((fp = fopen(MVCC_PIPE, "r")) == NULL) {
+	/* copyToがオープンを待ったままになるので、続けられない */
+	fprintf(stderr, "Cannot open pipe.\n");
+	exit(1);
+    }
+    if (fgets(line, sizeof(line), fp) != NULL) {
+	numLine++;
+	if (sscanf(line, "%d,%d", &id, &value) == 2 && value == 0) {
+	    numOld++;
+	}
+    }
+
+    /*
+     * 読んでいる途中で2回書き換える。まだ読んでいないレコードは、元の場所では
+     * 2回目の版になり、1回目の版の写しを経て元の版の写しにたどり着く。
+     * 写しは読んでいるスナップショットから見えるので、片付けない。
+     */
+    if (setMvccValue(1) != OK || setMvccValue(2) != OK) {
+	fprintf(stderr, "Cannot update records while reading.\n");
+	ret = NG;
+    }
+    if (checkVacuum(MVCC_TABLE, 0) != OK) {
+	ret = NG;
+    }
+
+    /* 書き換える前に取ったスナップショットなので、すべて元の値が見える */
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	numLine++;
+	if (sscanf(line, "%d,%d", &id, &value) == 2 && value == 0) {
+	    numOld++;
+	}
+    }
+    fclose(fp);
+    pthread_join(thread, NULL);
+    remove(MVCC_PIPE);
+    if (reader.result != OK || reader.numRecord != n || numLine != n || numOld != n) {
+	fprintf(stderr, "Reader saw %d old values in %d lines (expected %d).\n", numOld, numLine, n);
+	ret = NG;
+    }
+
+    /* 新しいスナップショットでは最後の版が見え、2回分の写しは片付けられる */
+    if (countRecords(MVCC_TABLE, "value", 2) != n) {
+	fprintf(stderr, "Updated values are not visible.\n");
+	ret = NG;
+    }
+    if (checkVacuum(MVCC_TABLE, 2L * n) != OK || checkVacuum(MVCC_TABLE, 0) != OK) {
+	ret = NG;
+    }
+
+    /* スナップショットを返すまで、その後で消した版は片付けない */
+    if (takeSnapshot(&snapshot) != OK) {
+	setScanThreads(numThread);
+	dropTable(MVCC_TABLE);
+	return NG;
+    }
+    if (getVacuumHorizon() > snapshot.xmin) {
+	fprintf(stderr, "Vacuum horizon passed a snapshot in use.\n");
+	ret = NG;
+    }
+    if (setMvccValue(3) != OK || checkVacuum(MVCC_TABLE, 0) != OK) {
+	ret = NG;
+    }
+    releaseSnapshot(&snapshot);
+    if (checkVacuum(MVCC_TABLE, n) != OK) {
+	ret = NG;
+    }
+
+    setScanThreads(numThread);
+    dropTable(MVCC_TABLE);
+    return ret;
+}
+
+/*
+ * UNDO_TABLE -- 失敗した文を元に戻すテストに使うテーブルの名前
+ */
+#define UNDO_TABLE "undotest"
+
+/*
+ * test14 -- 途中で失敗した一括読み込みの取り消し
+ */
+Result test14()
+{
+    TableInfo tableInfo;
+    IndexInfo indexInfo;
+    RecordData records[100];
+    FILE *fp;
+    long numRecord;
+    int i, n = 20000;
+    Result ret = OK;
+
+    /* 索引のあるテーブルに (i, i) を100件入れる */
+    dropTable(UNDO_TABLE);
+    tableInfo.numField = 2;
+    strcpy(tableInfo.fieldInfo[0].name, "id");
+    tableInfo.fieldInfo[0].dataType = TYPE_INTEGER;
+    strcpy(tableInfo.fieldInfo[1].name, "value");
+    tableInfo.fieldInfo[1].dataType = TYPE_INTEGER;
+    memset(&indexInfo, 0, sizeof(indexInfo));
+    strcpy(indexInfo.name, "undotest_id");
+    strcpy(indexInfo.fieldName, "id");
+    indexInfo.dataType = TYPE_INTEGER;
+    indexInfo.indexType = INDEX_BTREE;
+    for (i = 0; i < 100; i++) {
+	records[i].numField = 2;
+	records[i].fieldData[0].valueSet.intValue = i;
+	records[i].fieldData[1].valueSet.intValue = i;
+    }
+    if (createTable(UNDO_TABLE, &tableInfo) != OK || createIndex(UNDO_TABLE, &indexInfo) != OK
+	|| insertRecords(UNDO_TABLE, records, 100) != OK) {
+	fprintf(stderr, "Cannot create table.\n");
+	dropTable(UNDO_TABLE);
+	return NG;
+    }
+
+    /* 何ページ分も書き込んでから、最後の行で失敗するファイル */
+    if ((fp = fopen("test-copy.csv", "w")) == NULL) {
+	dropTable(UNDO_TABLE);
+	return NG;
+    }
+    for (i = 0; i < n; i++) {
+	fprintf(fp, "%d,%d\n", 100 + i, i);
+    }
+    fprintf(fp, "x,0\n");
+    fclose(fp);
+    if (copyFrom(UNDO_TABLE, "test-copy.csv", &numRecord) == OK || numRecord != n) {
+	fprintf(stderr, "Wrong line is accepted.\n");
+	ret = NG;
+    }
+
+    /* 読み込んだ行はデータファイルからも索引からも消え、元のレコードは残る */
+    if (countRecords(UNDO_TABLE, NULL, 0) != 100 || countRecords(UNDO_TABLE, "id", 50) != 1
+	|| countRecords(UNDO_TABLE, "id", 100 + n / 2) != 0) {
+	fprintf(stderr, "Failed copy is not undone.\n");
+	ret = NG;
+    }
+
+    /* 同じ行を読み込み直すと、索引で1件ずつ見つかる */
+    remove("test-copy.csv");
+    if ((fp = fopen("test-copy.csv", "w")) == NULL) {
+	dropTable(UNDO_TABLE);
+	return NG;
+    }
+    for (i = 0; i < n; i++) {
+	fprintf(fp, "%d,%d\n", 100 + i, i);
+    }
+    fclose(fp);
+    if (copyFrom(UNDO_TABLE, "test-copy.csv", &numRecord) != OK || numRecord != n
+	|| countRecords(UNDO_TABLE, NULL, 0) != 100 + n || countRecords(UNDO_TABLE, "id", 100 + n / 2) != 1) {
+	fprintf(stderr, "Cannot copy records again.\n");
+	ret = NG;
+    }
+    remove("test-copy.csv");
+
+    dropTable(UNDO_TABLE);
+    return ret;
+}
+
 /*
  * main -- データ操作モジュールのテスト
  */
@@ -447,6 +1583,94 @@ int main(int argc, char **argv)
 	fprintf(stderr, "test3: NG\n\n");
     }
 
+    /* レコードの位置を指定した操作のテスト */
+    fprintf(stderr, "test4: Start\n\n");
+    if (test4() == OK) {
+	fprintf(stderr, "test4: OK\n\n");
+    } else {
+	fprintf(stderr, "test4: NG\n\n");
+    }
+
+    /* 書き換えテスト */
+    fprintf(stderr, "test5: Start\n\n");
+    if (test5() == OK) {
+	fprintf(stderr, "test5: OK\n\n");
+    } else {
+	fprintf(stderr, "test5: NG\n\n");
+    }
+
+    /* 一括挿入テスト */
+    fprintf(stderr, "test6: Start\n\n");
+    if (test6() == OK) {
+	fprintf(stderr, "test6: OK\n\n");
+    } else {
+	fprintf(stderr, "test6: NG\n\n");
+    }
+
+    /* 一括読み込みテスト */
+    fprintf(stderr, "test7: Start\n\n");
+    if (test7() == OK) {
+	fprintf(stderr, "test7: OK\n\n");
+    } else {
+	fprintf(stderr, "test7: NG\n\n");
+    }
+
+    /* 一括書き出しテスト */
+    fprintf(stderr, "test8: Start\n\n");
+    if (test8() == OK) {
+	fprintf(stderr, "test8: OK\n\n");
+    } else {
+	fprintf(stderr, "test8: NG\n\n");
+    }
+
+    /* 並列走査のテスト */
+    fprintf(stderr, "test9: Start\n\n");
+    if (test9() == OK) {
+	fprintf(stderr, "test9: OK\n\n");
+    } else {
+	fprintf(stderr, "test9: NG\n\n");
+    }
+
+    /* 準備済みの文のテスト */
+    fprintf(stderr, "test10: Start\n\n");
+    if (test10() == OK) {
+	fprintf(stderr, "test10: OK\n\n");
+    } else {
+	fprintf(stderr, "test10: NG\n\n");
+    }
+
+    /* 集約関数のテスト */
+    fprintf(stderr, "test11: Start\n\n");
+    if (test11() == OK) {
+	fprintf(stderr, "test11: OK\n\n");
+    } else {
+	fprintf(stderr, "test11: NG\n\n");
+    }
+
+    /* 分割を伴うグループ化のテスト */
+    fprintf(stderr, "test12: Start\n\n");
+    if (test12() == OK) {
+	fprintf(stderr, "test12: OK\n\n");
+    } else {
+	fprintf(stderr, "test12: NG\n\n");
+    }
+
+    /* 版管理のテスト */
+    fprintf(stderr, "test13: Start\n\n");
+    if (test13() == OK) {
+	fprintf(stderr, "test13: OK\n\n");
+    } else {
+	fprintf(stderr, "test13: NG\n\n");
+    }
+
+    /* 失敗した文の取り消しのテスト */
+    fprintf(stderr, "test14: Start\n\n");
+    if (test14() == OK) {
+	fprintf(stderr, "test14: OK\n\n");
+    } else {
+	fprintf(stderr, "test14: NG\n\n");
+    }
+
     /* 後始末 */
     dropTable(TABLE_NAME);
     finalizeDataManipModule();
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <time.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "microdb.h"
 
 /*
@@ -19,6 +20,11 @@
 #define TEST_FILE1 "testfile1"
 #define TEST_FILE2 "testfile2"
 
+/*
+ * 単一ファイル形式のテストに使うデータベースファイルのファイル名
+ */
+#define TEST_CONTAINER "testfile.mdb"
+
 /*
  * ファイルサイズ(ファイルに書き込むページ数)
  */
@@ -212,6 +218,62 @@ Result test4()
     return OK;
 }
 
+/*
+ * test5 -- 単一ファイル形式での作成、読み書き、削除
+ */
+Result test5()
+{
+    File *file;
+    char page[PAGE_SIZE];
+
+    deleteFile(TEST_CONTAINER);
+    if (openContainer(TEST_CONTAINER) != OK) {
+	fprintf(stderr, "Cannot open container.\n");
+	return NG;
+    }
+
+    if (test1() != OK) {
+	return NG;
+    }
+
+    /* 一度閉じて開き直しても中身が残っていること */
+    if (closeContainer() != OK || openContainer(TEST_CONTAINER) != OK) {
+	fprintf(stderr, "Cannot reopen container.\n");
+	return NG;
+    }
+    if (test2() != OK || test3() != OK) {
+	return NG;
+    }
+
+    /* writePagesで後ろに加えたページ */
+    if ((file = openFile(TEST_FILE1)) == NULL) {
+	fprintf(stderr, "Cannot open file.\n");
+	return NG;
+    }
+    if (writePages(file, FILE_SIZE, pagePattern[0], FILE_SIZE) != OK ||
+	readPage(file, FILE_SIZE + 3, page) != OK ||
+	memcmp(page, pagePattern[3], PAGE_SIZE) != 0) {
+	fprintf(stderr, "writePages failed.\n");
+	return NG;
+    }
+    if (closeFile(file) != OK || getNumPages(TEST_FILE1) != FILE_SIZE * 2) {
+	fprintf(stderr, "Number of pages is wrong.\n");
+	return NG;
+    }
+
+    if (test4() != OK || existFile(TEST_FILE1) || closeContainer() != OK) {
+	return NG;
+    }
+
+    /* データベースファイルの外にはファイルを作らないこと */
+    if (access(TEST_FILE1, F_OK) == 0 || access(TEST_FILE2, F_OK) == 0) {
+	fprintf(stderr, "File created outside of container.\n");
+	return NG;
+    }
+
+    return deleteFile(TEST_CONTAINER);
+}
+
 /*
  * main -- エントリポイント
  */
@@ -278,6 +340,13 @@ int main(int argc, char **argv)
 	fprintf(stderr, "%s: test 4: NG\n\n", TEST_NAME);
     }
 
+    fprintf(stderr, "%s: test 5: Start\n", TEST_NAME);
+    if (test5() == OK) {
+	fprintf(stderr, "%s: test 5: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 5: NG\n\n", TEST_NAME);
+    }
+
     /*
      * ファイルアクセスモジュールの終了処理
      */
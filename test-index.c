@@ -0,0 +1,575 @@
+/*
+ * 索引モジュールテストプログラム
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdlib.h>
+#include "microdb.h"
+
+/*
+ * テスト名
+ */
+#define TEST_NAME "test-index"
+
+/*
+ * テスト用の索引のテーブル名と索引名
+ */
+#define TEST_TABLE "testindex"
+#define TEST_INDEX "idx"
+
+/*
+ * 索引に加える要素数と、キーの値の範囲
+ */
+#define NUM_ENTRY 30000
+#define MAX_KEY 3000
+
+/*
+ * キーの値の上限(test1でこの範囲の値を加える)
+ */
+int maxKey = MAX_KEY;
+
+/*
+ * test1で要素を一括作成で加えるなら1
+ */
+int useBuilder = 0;
+
+/*
+ * 問い合わせの回数
+ */
+#define NUM_QUERY 50
+
+/*
+ * 索引に加えたキーの値(削除したものは-1)
+ */
+int keys[NUM_ENTRY];
+
+/*
+ * テスト用の索引の定義
+ */
+IndexInfo indexInfo;
+
+/*
+ * getRandomInteger -- 乱数の発生
+ */
+int getRandomInteger(int min, int max)
+{
+    int r;
+
+    /* min〜maxまでの(整数の)乱数を作る */
+    r = min + (int) (max - min + 1) * (rand() / (RAND_MAX + 1.0));
+
+    return r;
+}
+
+/*
+ * makeKey -- 整数の値から索引のキーを作る
+ *
+ * 文字列型の索引では、値を0で埋めた固定幅の数字にして共通の接頭辞を付ける。
+ * こうすると文字列の大小と整数の大小が一致し、前方圧縮も効く。
+ */
+void makeKey(int value, ValueSet *key)
+{
+    memset(key, 0, sizeof(ValueSet));
+    if (indexInfo.dataType == TYPE_INTEGER) {
+	key->intValue = value;
+    } else {
+	sprintf(key->stringValue, "code-%06d", value);
+    }
+}
+
+/*
+ * getKey -- 索引のキーから整数の値を取り出す
+ */
+int getKey(ValueSet *key)
+{
+    if (indexInfo.dataType == TYPE_INTEGER) {
+	return key->intValue;
+    }
+
+    return atoi(key->stringValue + strlen("code-"));
+}
+
+/*
+ * makeEntry -- i番目の要素を作る(レコードIDは番号から決める)
+ */
+void makeEntry(int i, IndexEntry *entry)
+{
+    memset(entry, 0, sizeof(IndexEntry));
+    makeKey(keys[i], &entry->key);
+    entry->recordId.pageNum = i / 100;
+    entry->recordId.slotNum = i % 100;
+
+    /* 索引に含めるフィールドがあれば、キーから決まる値を入れる(test9) */
+    if (indexInfo.numInclude > 0) {
+	memcpy(entry->payload, &i, sizeof(int));
+	sprintf(entry->payload + sizeof(int), "value-%d", keys[i]);
+    }
+}
+
+/*
+ * checkPayload -- 要素に含めたフィールドの値が、加えたとおりか調べる
+ */
+Result checkPayload(int i, IndexEntry *entry)
+{
+    IndexEntry expected;
+    int size;
+
+    if (indexInfo.numInclude == 0) {
+	return OK;
+    }
+
+    makeEntry(i, &expected);
+    size = sizeof(int) + MAX_STRING;
+    return (memcmp(entry->payload, expected.payload, size) == 0) ? OK : NG;
+}
+
+/*
+ * checkQuery -- 索引の走査の結果を、すべての要素を調べた結果と比べる
+ *
+ * 引数:
+ *	index: 索引
+ *	operator: 比較演算子
+ *	value: 比較する値
+ *
+ * 返り値:
+ *	一致すればOK、そうでなければNG
+ */
+Result checkQuery(Index *index, OperatorType operator, int value)
+{
+    IndexScan *scan;
+    IndexEntry *entry;
+    ValueSet key;
+    int i, expected = 0, count = 0, previous = -1, n, match;
+
+    for (i = 0; i < NUM_ENTRY; i++) {
+	if (keys[i] < 0) {
+	    continue;
+	}
+	switch (operator) {
+	case OPR_EQUAL:
+	    match = (keys[i] == value);
+	    break;
+	case OPR_LESS_THAN:
+	    match = (keys[i] < value);
+	    break;
+	default:
+	    match = (keys[i] > value);
+	    break;
+	}
+	expected += match;
+    }
+
+    makeKey(value, &key);
+    if ((scan = openIndexScan(index, operator, &key)) == NULL) {
+	fprintf(stderr, "Cannot open index scan.\n");
+	return NG;
+    }
+
+    /* 返ってきた要素が、加えたとおりのキーを持ち、キーの順に並んでいるか調べる */
+    while (getNextIndexEntry(scan, &entry) == OK && entry != NULL) {
+	n = entry->recordId.pageNum * 100 + entry->recordId.slotNum;
+	if (n < 0 || n >= NUM_ENTRY || keys[n] != getKey(&entry->key)
+	    || getKey(&entry->key) < previous || checkPayload(n, entry) != OK) {
+	    fprintf(stderr, "Wrong entry: key = %d\n", getKey(&entry->key));
+	    closeIndexScan(scan);
+	    return NG;
+	}
+	previous = getKey(&entry->key);
+	count++;
+    }
+    closeIndexScan(scan);
+
+    if (count != expected) {
+	fprintf(stderr, "Number of entries is wrong: %d (expected %d)\n", count, expected);
+	return NG;
+    }
+
+    return OK;
+}
+
+/*
+ * checkQueries -- いろいろな値で3種類の比較を試す
+ */
+Result checkQueries()
+{
+    Index *index;
+    ValueSet key;
+    int i, value;
+    Result ret = OK;
+
+    memset(&key, 0, sizeof(key));
+    if ((index = openIndex(TEST_TABLE, &indexInfo)) == NULL) {
+	fprintf(stderr, "Cannot open index.\n");
+	return NG;
+    }
+
+    for (i = 0; i < NUM_QUERY && ret == OK; i++) {
+	value = getRandomInteger(-1, maxKey + 1);
+	if (checkQuery(index, OPR_EQUAL, value) != OK) {
+	    ret = NG;
+	}
+
+	/* ハッシュ索引は=にしか使えない */
+	if (indexInfo.indexType == INDEX_HASH) {
+	    if (openIndexScan(index, OPR_LESS_THAN, &key) != NULL) {
+		ret = NG;
+	    }
+	} else if (checkQuery(index, OPR_LESS_THAN, value) != OK
+		   || checkQuery(index, OPR_GREATER_THAN, value) != OK) {
+	    ret = NG;
+	}
+    }
+
+    if (closeIndex(index) != OK) {
+	return NG;
+    }
+
+    return ret;
+}
+
+/*
+ * test1 -- 索引の作成と要素の挿入
+ */
+Result test1()
+{
+    Index *index;
+    IndexBuilder *builder = NULL;
+    IndexEntry entry;
+    int i;
+    Result ret;
+
+    if (createIndexFile(TEST_TABLE, &indexInfo) != OK) {
+	fprintf(stderr, "Cannot create index.\n");
+	return NG;
+    }
+    if ((index = openIndex(TEST_TABLE, &indexInfo)) == NULL) {
+	fprintf(stderr, "Cannot open index.\n");
+	return NG;
+    }
+    if (useBuilder && (builder = createIndexBuilder(index, 64 * 1024)) == NULL) {
+	fprintf(stderr, "Cannot create index builder.\n");
+	closeIndex(index);
+	return NG;
+    }
+
+    /* 同じ値が何度も現れるように、値の範囲を要素数より狭くする */
+    for (i = 0; i < NUM_ENTRY; i++) {
+	keys[i] = getRandomInteger(0, maxKey);
+	makeEntry(i, &entry);
+	ret = useBuilder ? addBuildEntry(builder, &entry) : insertIndexEntry(index, &entry);
+	if (ret != OK) {
+	    fprintf(stderr, "Cannot insert entry.\n");
+	    freeIndexBuilder(builder);
+	    closeIndex(index);
+	    return NG;
+	}
+    }
+    if (useBuilder) {
+	ret = buildIndex(builder);
+	freeIndexBuilder(builder);
+	if (ret != OK) {
+	    fprintf(stderr, "Cannot build index.\n");
+	    closeIndex(index);
+	    return NG;
+	}
+    }
+
+    if (closeIndex(index) != OK) {
+	fprintf(stderr, "Cannot close index.\n");
+	return NG;
+    }
+
+    return OK;
+}
+
+/*
+ * test2 -- 索引の検索
+ */
+Result test2()
+{
+    return checkQueries();
+}
+
+/*
+ * test3 -- 要素の削除と、削除後の検索
+ */
+Result test3()
+{
+    Index *index;
+    IndexEntry entry;
+    int i;
+
+    if ((index = openIndex(TEST_TABLE, &indexInfo)) == NULL) {
+	fprintf(stderr, "Cannot open index.\n");
+	return NG;
+    }
+
+    /* 半分の要素を削除する */
+    for (i = 0; i < NUM_ENTRY; i += 2) {
+	makeEntry(i, &entry);
+	if (deleteIndexEntry(index, &entry) != OK) {
+	    fprintf(stderr, "Cannot delete entry.\n");
+	    closeIndex(index);
+	    return NG;
+	}
+	keys[i] = -1;
+    }
+
+    /* 削除した要素をもう一度削除しようとしたら失敗するはず */
+    keys[0] = 0;
+    makeEntry(0, &entry);
+    keys[0] = -1;
+    if (deleteIndexEntry(index, &entry) == OK) {
+	fprintf(stderr, "Deleted entry is found.\n");
+	closeIndex(index);
+	return NG;
+    }
+
+    if (closeIndex(index) != OK) {
+	return NG;
+    }
+
+    return checkQueries();
+}
+
+/*
+ * test4 -- 索引の削除
+ */
+Result test4()
+{
+    if (deleteIndexFile(TEST_TABLE, TEST_INDEX) != OK) {
+	fprintf(stderr, "Cannot delete index.\n");
+	return NG;
+    }
+
+    return OK;
+}
+
+/*
+ * test5 -- 文字列型のキーの索引で、test1〜test4と同じことを行う
+ *
+ * キーの先頭部分が共通しているので、葉は前方圧縮され、
+ * 内部節には短く切り詰めたキーが入る。
+ */
+Result test5()
+{
+    Result ret;
+
+    indexInfo.dataType = TYPE_STRING;
+    ret = (test1() == OK && test2() == OK && test3() == OK && test4() == OK) ? OK : NG;
+    indexInfo.dataType = TYPE_INTEGER;
+
+    return ret;
+}
+
+/*
+ * test6 -- ハッシュ索引で、test1〜test4と同じことを行う(=の検索だけ)
+ */
+Result test6()
+{
+    Result ret = OK;
+
+    indexInfo.indexType = INDEX_HASH;
+    if (test1() != OK || test2() != OK || test3() != OK || test4() != OK) {
+	ret = NG;
+    }
+    indexInfo.dataType = TYPE_STRING;
+    if (test1() != OK || test2() != OK || test3() != OK || test4() != OK) {
+	ret = NG;
+    }
+    indexInfo.dataType = TYPE_INTEGER;
+    indexInfo.indexType = INDEX_BTREE;
+
+    return ret;
+}
+
+/*
+ * test7 -- 同じ値ばかりのハッシュ索引
+ *
+ * バケットを分割しても要素が分かれないので、あふれページがつながる。
+ */
+Result test7()
+{
+    Result ret;
+
+    indexInfo.indexType = INDEX_HASH;
+    maxKey = 3;
+    ret = (test1() == OK && test2() == OK && test3() == OK && test4() == OK) ? OK : NG;
+    maxKey = MAX_KEY;
+    indexInfo.indexType = INDEX_BTREE;
+
+    return ret;
+}
+
+/*
+ * test8 -- 整列した要素からの一括作成
+ *
+ * B+木(整数型と文字列型)とハッシュ索引を一括作成して検索し、削除した後、
+ * 満杯の葉に要素を挿入して分割させてから、もう一度検索する。
+ */
+Result test8()
+{
+    Index *index;
+    IndexEntry entry;
+    Result ret = OK;
+    int i, round;
+
+    useBuilder = 1;
+    for (round = 0; round < 3 && ret == OK; round++) {
+	indexInfo.dataType = (round == 1) ? TYPE_STRING : TYPE_INTEGER;
+	indexInfo.indexType = (round == 2) ? INDEX_HASH : INDEX_BTREE;
+	if (test1() != OK || test2() != OK || test3() != OK) {
+	    ret = NG;
+	    break;
+	}
+
+	/* 削除した要素を別の値で入れ直す */
+	if ((index = openIndex(TEST_TABLE, &indexInfo)) == NULL) {
+	    ret = NG;
+	    break;
+	}
+	for (i = 0; i < NUM_ENTRY && ret == OK; i += 2) {
+	    keys[i] = getRandomInteger(0, maxKey);
+	    makeEntry(i, &entry);
+	    ret = insertIndexEntry(index, &entry);
+	}
+	if (closeIndex(index) != OK || ret != OK || checkQueries() != OK || test4() != OK) {
+	    ret = NG;
+	}
+    }
+    useBuilder = 0;
+    indexInfo.dataType = TYPE_INTEGER;
+    indexInfo.indexType = INDEX_BTREE;
+
+    return ret;
+}
+
+/*
+ * test9 -- 葉にフィールドの値を含めた索引
+ *
+ * 整数型と文字列型のフィールドを含めて、挿入と一括作成の両方で作り、
+ * 検索で返ってきた要素の値を確かめる。
+ */
+Result test9()
+{
+    Result ret;
+
+    indexInfo.numInclude = 2;
+    strcpy(indexInfo.includeName[0], "number");
+    indexInfo.includeType[0] = TYPE_INTEGER;
+    strcpy(indexInfo.includeName[1], "name");
+    indexInfo.includeType[1] = TYPE_STRING;
+
+    ret = (test1() == OK && test2() == OK && test3() == OK && test4() == OK) ? OK : NG;
+    if (ret == OK) {
+	useBuilder = 1;
+	ret = (test1() == OK && test2() == OK && test3() == OK && test4() == OK) ? OK : NG;
+	useBuilder = 0;
+    }
+    indexInfo.numInclude = 0;
+
+    return ret;
+}
+
+/*
+ * main -- エントリポイント
+ */
+int main(int argc, char **argv)
+{
+    /* 乱数の初期化 */
+    srand((unsigned int) time(NULL));
+
+    /*
+     * ファイルアクセスモジュールの初期化
+     */
+    if (initializeFileModule() != OK) {
+	fprintf(stderr, "%s: initialization failed.\n", TEST_NAME);
+    }
+
+    /* テスト用の索引の定義 */
+    memset(&indexInfo, 0, sizeof(indexInfo));
+    strcpy(indexInfo.name, TEST_INDEX);
+    strcpy(indexInfo.fieldName, "key");
+    indexInfo.dataType = TYPE_INTEGER;
+
+    /*
+     * 前回このプログラムを実行したときの索引が
+     * 残っている可能性があるので、まず消去する
+     */
+    deleteIndexFile(TEST_TABLE, TEST_INDEX);
+
+    /* テストの実行 */
+    fprintf(stderr, "%s: test 1: Start\n", TEST_NAME);
+    if (test1() == OK) {
+	fprintf(stderr, "%s: test 1: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 1: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 2: Start\n", TEST_NAME);
+    if (test2() == OK) {
+	fprintf(stderr, "%s: test 2: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 2: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 3: Start\n", TEST_NAME);
+    if (test3() == OK) {
+	fprintf(stderr, "%s: test 3: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 3: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 4: Start\n", TEST_NAME);
+    if (test4() == OK) {
+	fprintf(stderr, "%s: test 4: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 4: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 5: Start\n", TEST_NAME);
+    if (test5() == OK) {
+	fprintf(stderr, "%s: test 5: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 5: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 6: Start\n", TEST_NAME);
+    if (test6() == OK) {
+	fprintf(stderr, "%s: test 6: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 6: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 7: Start\n", TEST_NAME);
+    if (test7() == OK) {
+	fprintf(stderr, "%s: test 7: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 7: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 8: Start\n", TEST_NAME);
+    if (test8() == OK) {
+	fprintf(stderr, "%s: test 8: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 8: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 9: Start\n", TEST_NAME);
+    if (test9() == OK) {
+	fprintf(stderr, "%s: test 9: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 9: NG\n\n", TEST_NAME);
+    }
+
+    /*
+     * ファイルアクセスモジュールの終了処理
+     */
+    if (finalizeFileModule() != OK) {
+	fprintf(stderr, "%s: finalization failed.\n", TEST_NAME);
+    }
+
+    exit(0);
+}
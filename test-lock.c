@@ -0,0 +1,294 @@
+/*
+ * ロック管理モジュールテストプログラム
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "microdb.h"
+
+/*
+ * テスト名
+ */
+#define TEST_NAME "test-lock"
+
+/*
+ * テストに使うテーブルの名前
+ */
+#define TABLE_NAME "locktest"
+
+/*
+ * ほかのスレッドが待ち始めるのを待つ時間(マイクロ秒)
+ */
+#define WAIT_TIME 100000
+
+/*
+ * ロックを取った順番
+ */
+pthread_mutex_t orderMutex = PTHREAD_MUTEX_INITIALIZER;
+int order[2];
+int numOrder;
+
+/*
+ * acquired -- ロックを取れたスレッドの数
+ */
+volatile int acquired;
+
+/*
+ * lockThread -- ロックを取って、取った順番を記録してから返すスレッド
+ */
+void *lockThread(void *arg)
+{
+    LockMode mode = (LockMode) (long) arg;
+
+    if (lockTable(TABLE_NAME, mode) != OK) {
+	return NULL;
+    }
+    pthread_mutex_lock(&orderMutex);
+    order[numOrder++] = mode;
+    acquired++;
+    pthread_mutex_unlock(&orderMutex);
+    unlockTable(TABLE_NAME);
+
+    return NULL;
+}
+
+/*
+ * test1 -- 共有ロックどうしは待たない
+ */
+Result test1()
+{
+    pthread_t thread;
+    int i;
+
+    acquired = 0;
+    numOrder = 0;
+    if (lockTable(TABLE_NAME, LOCK_SHARED) != OK) {
+	return NG;
+    }
+    pthread_create(&thread, NULL, lockThread, (void *) (long) LOCK_SHARED);
+    for (i = 0; i < 10 && acquired == 0; i++) {
+	usleep(WAIT_TIME);
+    }
+    unlockTable(TABLE_NAME);
+    pthread_join(thread, NULL);
+
+    return (i < 10) ? OK : NG;
+}
+
+/*
+ * test2 -- 排他ロックを待っているスレッドがあれば、後から来た共有ロックは待つ
+ */
+Result test2()
+{
+    pthread_t writer, reader;
+    int ret = OK;
+
+    acquired = 0;
+    numOrder = 0;
+    if (lockTable(TABLE_NAME, LOCK_SHARED) != OK) {
+	return NG;
+    }
+    pthread_create(&writer, NULL, lockThread, (void *) (long) LOCK_EXCLUSIVE);
+    usleep(WAIT_TIME);
+    pthread_create(&reader, NULL, lockThread, (void *) (long) LOCK_SHARED);
+    usleep(WAIT_TIME);
+
+    /* 共有ロックを持っている間は、どちらも取れない */
+    if (acquired != 0) {
+	ret = NG;
+    }
+    unlockTable(TABLE_NAME);
+    pthread_join(writer, NULL);
+    pthread_join(reader, NULL);
+
+    if (numOrder != 2 || order[0] != LOCK_EXCLUSIVE || order[1] != LOCK_SHARED) {
+	ret = NG;
+    }
+
+    return ret;
+}
+
+/*
+ * test3 -- 同じスレッドでのロックの重ね取り
+ */
+Result test3()
+{
+    pthread_t thread;
+    Result ret = OK;
+
+    /* 共有ロックは重ねて取れるが、排他ロックには変えられない */
+    if (lockTable(TABLE_NAME, LOCK_SHARED) != OK || lockTable(TABLE_NAME, LOCK_SHARED) != OK
+	|| lockTable(TABLE_NAME, LOCK_EXCLUSIVE) != NG) {
+	return NG;
+    }
+    unlockTable(TABLE_NAME);
+    unlockTable(TABLE_NAME);
+
+    /* 排他ロックを持っていれば、共有ロックも取れる */
+    acquired = 0;
+    numOrder = 0;
+    if (lockTable(TABLE_NAME, LOCK_EXCLUSIVE) != OK || lockTable(TABLE_NAME, LOCK_SHARED) != OK) {
+	return NG;
+    }
+    pthread_create(&thread, NULL, lockThread, (void *) (long) LOCK_SHARED);
+    usleep(WAIT_TIME);
+    unlockTable(TABLE_NAME);
+
+    /* 1回返しただけでは、まだ持っている */
+    usleep(WAIT_TIME);
+    if (acquired != 0) {
+	ret = NG;
+    }
+    unlockTable(TABLE_NAME);
+    pthread_join(thread, NULL);
+
+    return (ret == OK && acquired == 1) ? OK : NG;
+}
+
+/*
+ * test4 -- インテンション排他ロックどうしは待たないが、共有ロックとは待つ
+ */
+Result test4()
+{
+    pthread_t thread;
+    Result ret = OK;
+    int i;
+
+    acquired = 0;
+    numOrder = 0;
+    if (lockTable(TABLE_NAME, LOCK_INTENTION_EXCLUSIVE) != OK) {
+	return NG;
+    }
+    pthread_create(&thread, NULL, lockThread, (void *) (long) LOCK_INTENTION_EXCLUSIVE);
+    for (i = 0; i < 10 && acquired == 0; i++) {
+	usleep(WAIT_TIME);
+    }
+    pthread_join(thread, NULL);
+    if (acquired != 1) {
+	ret = NG;
+    }
+
+    pthread_create(&thread, NULL, lockThread, (void *) (long) LOCK_SHARED);
+    usleep(WAIT_TIME);
+    if (acquired != 1) {
+	ret = NG;
+    }
+    unlockTable(TABLE_NAME);
+    pthread_join(thread, NULL);
+
+    return (ret == OK && acquired == 2) ? OK : NG;
+}
+
+/*
+ * deadlockResult -- deadlockThreadが2つ目のロックを取れたかどうか
+ */
+Result deadlockResult;
+
+/*
+ * deadlockThread -- レコード(0, 1)、(0, 0)の順にロックを取るスレッド
+ */
+void *deadlockThread(void *arg)
+{
+    RecordId first, second;
+
+    (void) arg;
+    first.pageNum = 0;
+    first.slotNum = 1;
+    second.pageNum = 0;
+    second.slotNum = 0;
+
+    lockTable(TABLE_NAME, LOCK_INTENTION_EXCLUSIVE);
+    lockRecord(TABLE_NAME, &first, LOCK_EXCLUSIVE);
+    usleep(WAIT_TIME);
+    deadlockResult = lockRecord(TABLE_NAME, &second, LOCK_EXCLUSIVE);
+    if (deadlockResult == OK) {
+	unlockRecord(TABLE_NAME, &second);
+    }
+    unlockRecord(TABLE_NAME, &first);
+    unlockTable(TABLE_NAME);
+
+    return NULL;
+}
+
+/*
+ * test5 -- レコードのロックのデッドロックを見つける
+ *
+ * 2つのスレッドが、2つのレコードを逆の順にロックする。後から待とうとした
+ * スレッドがNGを返され、もう一方は待っていたロックを取れる。
+ */
+Result test5()
+{
+    pthread_t thread;
+    RecordId first, second;
+    Result ret;
+
+    first.pageNum = 0;
+    first.slotNum = 0;
+    second.pageNum = 0;
+    second.slotNum = 1;
+
+    if (lockTable(TABLE_NAME, LOCK_INTENTION_EXCLUSIVE) != OK
+	|| lockRecord(TABLE_NAME, &first, LOCK_EXCLUSIVE) != OK) {
+	return NG;
+    }
+    pthread_create(&thread, NULL, deadlockThread, NULL);
+
+    /* 相手がsecondをロックして、firstを待ち始めてから待つ */
+    usleep(WAIT_TIME * 3);
+    ret = lockRecord(TABLE_NAME, &second, LOCK_EXCLUSIVE);
+    if (ret == OK) {
+	unlockRecord(TABLE_NAME, &second);
+    }
+    unlockRecord(TABLE_NAME, &first);
+    unlockTable(TABLE_NAME);
+    pthread_join(thread, NULL);
+
+    /* こちらがデッドロックを見つけ、相手は取れたはず */
+    return (ret == NG && deadlockResult == OK) ? OK : NG;
+}
+
+/*
+ * main -- エントリポイント
+ */
+int main(int argc, char **argv)
+{
+    fprintf(stderr, "%s: test 1: Start\n", TEST_NAME);
+    if (test1() == OK) {
+	fprintf(stderr, "%s: test 1: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 1: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 2: Start\n", TEST_NAME);
+    if (test2() == OK) {
+	fprintf(stderr, "%s: test 2: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 2: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 3: Start\n", TEST_NAME);
+    if (test3() == OK) {
+	fprintf(stderr, "%s: test 3: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 3: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 4: Start\n", TEST_NAME);
+    if (test4() == OK) {
+	fprintf(stderr, "%s: test 4: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 4: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 5: Start\n", TEST_NAME);
+    if (test5() == OK) {
+	fprintf(stderr, "%s: test 5: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 5: NG\n\n", TEST_NAME);
+    }
+
+    exit(0);
+}
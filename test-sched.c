@@ -0,0 +1,219 @@
+/*
+ * タスクスケジューラテストプログラム
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "microdb.h"
+
+/*
+ * テスト名
+ */
+#define TEST_NAME "test-sched"
+
+/*
+ * 投入するタスクの数
+ */
+#define NUM_TASK 1000
+
+/*
+ * 入れ子で投入するタスクの数(1つのタスクあたり)
+ */
+#define NUM_CHILD 10
+
+/*
+ * 各タスクの結果
+ */
+long result[NUM_TASK];
+
+/*
+ * ChildTask -- 入れ子のタスクの引数
+ */
+typedef struct ChildTask ChildTask;
+struct ChildTask {
+    pthread_mutex_t *mutex;
+    long *sum;
+    int value;
+};
+
+/*
+ * squareTask -- 引数の番号の2乗を結果に書くタスク
+ *
+ * 番号が10の倍数のタスクだけ重くして、タスクの重さに偏りを作る。
+ */
+void squareTask(void *arg)
+{
+    int no = (int) (long) arg;
+    volatile long x = 0;
+    long i;
+
+    if (no % 10 == 0) {
+	for (i = 0; i < 200000; i++) {
+	    x += i;
+	}
+    }
+
+    result[no] = (long) no * no;
+}
+
+/*
+ * addTask -- 値を合計に加えるタスク
+ */
+void addTask(void *arg)
+{
+    ChildTask *child = arg;
+
+    pthread_mutex_lock(child->mutex);
+    *child->sum += child->value;
+    pthread_mutex_unlock(child->mutex);
+}
+
+/*
+ * parentTask -- タスクの中からタスクを投入し、その完了を待つタスク
+ */
+void parentTask(void *arg)
+{
+    int no = (int) (long) arg;
+    ChildTask child[NUM_CHILD];
+    pthread_mutex_t mutex;
+    TaskGroup *group;
+    long sum = 0;
+    int i;
+
+    pthread_mutex_init(&mutex, NULL);
+    if ((group = createTaskGroup()) == NULL) {
+	result[no] = -1;
+	return;
+    }
+    for (i = 0; i < NUM_CHILD; i++) {
+	child[i].mutex = &mutex;
+	child[i].sum = &sum;
+	child[i].value = no + i;
+	if (submitTask(group, addTask, &child[i]) != OK) {
+	    addTask(&child[i]);
+	}
+    }
+    waitTaskGroup(group);
+    freeTaskGroup(group);
+    pthread_mutex_destroy(&mutex);
+
+    result[no] = sum;
+}
+
+/*
+ * runTasks -- NUM_TASK個のタスクを投入して完了を待つ
+ */
+Result runTasks(TaskFunction function)
+{
+    TaskGroup *group;
+    int i;
+
+    memset(result, 0, sizeof(result));
+    if ((group = createTaskGroup()) == NULL) {
+	return NG;
+    }
+    for (i = 0; i < NUM_TASK; i++) {
+	if (submitTask(group, function, (void *) (long) i) != OK) {
+	    fprintf(stderr, "Cannot submit task.\n");
+	    return NG;
+	}
+    }
+    waitTaskGroup(group);
+    freeTaskGroup(group);
+
+    return OK;
+}
+
+/*
+ * test1 -- 1スレッド(呼び出したスレッドだけ)での実行
+ */
+Result test1()
+{
+    int i;
+
+    if (initializeScheduler(1) != OK || runTasks(squareTask) != OK) {
+	return NG;
+    }
+    for (i = 0; i < NUM_TASK; i++) {
+	if (result[i] != (long) i * i) {
+	    return NG;
+	}
+    }
+
+    return OK;
+}
+
+/*
+ * test2 -- 複数のスレッドでの実行(重さに偏りのあるタスク)
+ */
+Result test2()
+{
+    int i;
+
+    if (initializeScheduler(8) != OK || getSchedulerThreads() != 8) {
+	return NG;
+    }
+    if (runTasks(squareTask) != OK) {
+	return NG;
+    }
+    for (i = 0; i < NUM_TASK; i++) {
+	if (result[i] != (long) i * i) {
+	    return NG;
+	}
+    }
+
+    return OK;
+}
+
+/*
+ * test3 -- タスクの中からのタスクの投入
+ */
+Result test3()
+{
+    int i;
+
+    if (runTasks(parentTask) != OK) {
+	return NG;
+    }
+    for (i = 0; i < NUM_TASK; i++) {
+	/* no + (no+1) + ... + (no+NUM_CHILD-1) */
+	if (result[i] != (long) i * NUM_CHILD + NUM_CHILD * (NUM_CHILD - 1) / 2) {
+	    return NG;
+	}
+    }
+
+    return OK;
+}
+
+/*
+ * main -- エントリポイント
+ */
+int main(int argc, char **argv)
+{
+    fprintf(stderr, "%s: test 1: Start\n", TEST_NAME);
+    if (test1() == OK) {
+	fprintf(stderr, "%s: test 1: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 1: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 2: Start\n", TEST_NAME);
+    if (test2() == OK) {
+	fprintf(stderr, "%s: test 2: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 2: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 3: Start\n", TEST_NAME);
+    if (test3() == OK) {
+	fprintf(stderr, "%s: test 3: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 3: NG\n\n", TEST_NAME);
+    }
+
+    finalizeScheduler();
+
+    exit(0);
+}
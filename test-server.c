@@ -0,0 +1,773 @@
+/*
+ * サーバモジュールテストプログラム
+ *
+ * 同じプロセスの中でサーバを動かし、UNIXドメインソケットで接続して
+ * フレームのやりとりを確かめる。文はテスト用の実行関数で実行する。
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "microdb.h"
+
+/*
+ * テスト名
+ */
+#define TEST_NAME "test-server"
+
+/*
+ * ソケットのパス
+ */
+#define SOCKET_PATH "test-server.sock"
+
+/*
+ * 出力を読まないクライアントを切るまでの時間(server.cのOUTPUT_TIMEOUTと同じ)
+ */
+#define OUTPUT_TIMEOUT 10
+
+/*
+ * 受信を待つ時間の上限(秒)。これを超えたら応答がないものとみなす
+ */
+#define RECEIVE_TIMEOUT 30
+
+/*
+ * パイプラインで続けて送る文の数
+ */
+#define NUM_PIPELINE 200
+
+/*
+ * 読まないクライアントに返させる結果の大きさ
+ */
+#define LARGE_OUTPUT (16 * 1024 * 1024)
+
+/*
+ * フレームの種類(server.cと同じ)
+ */
+#define FRAME_QUERY 'Q'
+#define FRAME_DATA 'D'
+#define FRAME_END 'E'
+#define FRAME_ERROR 'X'
+
+/*
+ * テスト用の実行関数が記録する状態
+ */
+static pthread_mutex_t stateMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stateChanged = PTHREAD_COND_INITIALIZER;
+static int numTouch = 0;                /* "touch"を実行した回数 */
+static int numFinished = 0;             /* "sleep"と"large"を終えた回数 */
+static int signaled = 0;                /* "signal"を実行したら1 */
+
+/*
+ * サーバのスレッドと、runServerの結果
+ */
+static pthread_t serverThread;
+static int serverStarted = 0;
+static Result serverResult = NG;
+
+/*
+ * executeTestStatement -- テスト用の文を実行する
+ *
+ * 引数:
+ *  statement: 文
+ *  output: 結果を書くストリーム
+ *  session: 接続ごとの設定(使わない)
+ *
+ * 返り値:
+ *  "quit"なら1、それ以外は0
+ *
+ * 文:
+ *  echo 文字列 -- 文字列を返す
+ *  touch -- 実行した回数を数える(結果なし)
+ *  sleep ミリ秒 -- 待ってから"slept"を返す
+ *  wait -- 別の接続で"signal"が実行されるまで待つ
+ *  signal -- "wait"を起こす
+ *  large バイト数 -- 指定したバイト数の結果を返す
+ *  quit -- 接続を閉じさせる
+ */
+static int executeTestStatement(char *statement, FILE *output, Session *session)
+{
+    struct timespec deadline;
+    char buffer[4096];
+    long size, n;
+
+    (void) session;
+    if (strcmp(statement, "quit") == 0) {
+	return 1;
+    } else if (strncmp(statement, "echo ", 5) == 0) {
+	fprintf(output, "%s\n", statement + 5);
+    } else if (strcmp(statement, "touch") == 0) {
+	pthread_mutex_lock(&stateMutex);
+	numTouch++;
+	pthread_mutex_unlock(&stateMutex);
+    } else if (strncmp(statement, "sleep ", 6) == 0) {
+	usleep(atol(statement + 6) * 1000);
+	fprintf(output, "slept\n");
+	pthread_mutex_lock(&stateMutex);
+	numFinished++;
+	pthread_cond_broadcast(&stateChanged);
+	pthread_mutex_unlock(&stateMutex);
+    } else if (strcmp(statement, "wait") == 0) {
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += 5;
+	pthread_mutex_lock(&stateMutex);
+	while (!signaled) {
+	    if (pthread_cond_timedwait(&stateChanged, &stateMutex, &deadline) == ETIMEDOUT) {
+		break;
+	    }
+	}
+	fprintf(output, "%s\n", signaled ? "signaled" : "timeout");
+	pthread_mutex_unlock(&stateMutex);
+    } else if (strcmp(statement, "signal") == 0) {
+	pthread_mutex_lock(&stateMutex);
+	signaled = 1;
+	pthread_cond_broadcast(&stateChanged);
+	pthread_mutex_unlock(&stateMutex);
+    } else if (strncmp(statement, "large ", 6) == 0) {
+	memset(buffer, 'a', sizeof(buffer));
+	for (size = atol(statement + 6); size > 0; size -= n) {
+	    n = size < (long) sizeof(buffer) ? size : (long) sizeof(buffer);
+	    fwrite(buffer, 1, n, output);
+	}
+	pthread_mutex_lock(&stateMutex);
+	numFinished++;
+	pthread_cond_broadcast(&stateChanged);
+	pthread_mutex_unlock(&stateMutex);
+    } else {
+	fprintf(output, "unknown statement: %s\n", statement);
+    }
+
+    return 0;
+}
+
+/*
+ * runServerThread -- サーバを動かすスレッド
+ */
+static void *runServerThread(void *arg)
+{
+    (void) arg;
+    serverResult = runServer(SOCKET_PATH, executeTestStatement);
+    return NULL;
+}
+
+/*
+ * getCount -- 実行関数が記録した回数を読む
+ */
+static int getCount(int *count)
+{
+    int n;
+
+    pthread_mutex_lock(&stateMutex);
+    n = *count;
+    pthread_mutex_unlock(&stateMutex);
+    return n;
+}
+
+/*
+ * connectServer -- サーバに接続する
+ *
+ * 返り値:
+ *  ソケット。接続できなければ-1
+ *
+ * サーバが接続を待ち始めるまでは、少し待って接続し直す。
+ */
+static int connectServer()
+{
+    struct sockaddr_un address;
+    struct timeval timeout;
+    int desc, i;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, SOCKET_PATH);
+    timeout.tv_sec = RECEIVE_TIMEOUT;
+    timeout.tv_usec = 0;
+
+    for (i = 0; i < 100; i++) {
+	if ((desc = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+	    return -1;
+	}
+	if (connect(desc, (struct sockaddr *) &address, sizeof(address)) == 0) {
+	    setsockopt(desc, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	    return desc;
+	}
+	close(desc);
+	usleep(50 * 1000);
+    }
+
+    return -1;
+}
+
+/*
+ * writeAll -- 指定したバイト数をすべて書く
+ */
+static Result writeAll(int desc, const char *data, size_t size)
+{
+    ssize_t n;
+
+    while (size > 0) {
+	if ((n = write(desc, data, size)) == -1) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    return NG;
+	}
+	data += n;
+	size -= n;
+    }
+
+    return OK;
+}
+
+/*
+ * readAll -- 指定したバイト数をすべて読む
+ *
+ * 返り値:
+ *  すべて読めたらOK、接続が切れたか時間切れならNG
+ */
+static Result readAll(int desc, char *data, size_t size)
+{
+    ssize_t n;
+
+    while (size > 0) {
+	if ((n = read(desc, data, size)) == -1 && errno == EINTR) {
+	    continue;
+	}
+	if (n <= 0) {
+	    return NG;
+	}
+	data += n;
+	size -= n;
+    }
+
+    return OK;
+}
+
+/*
+ * makeFrame -- フレームを作ってバッファの後ろに書く
+ *
+ * 引数:
+ *  buffer: フレームを書く場所
+ *  type: フレームの種類
+ *  text: 内容
+ *
+ * 返り値:
+ *  書いたバイト数
+ */
+static size_t makeFrame(char *buffer, int type, char *text)
+{
+    uint32_t length = htonl((uint32_t) strlen(text));
+
+    memcpy(buffer, &length, 4);
+    buffer[4] = (char) type;
+    memcpy(buffer + 5, text, strlen(text));
+    return 5 + strlen(text);
+}
+
+/*
+ * sendStatement -- 文を'Q'フレームで送る
+ */
+static Result sendStatement(int desc, char *text)
+{
+    char buffer[256];
+    size_t size;
+
+    size = makeFrame(buffer, FRAME_QUERY, text);
+    return writeAll(desc, buffer, size);
+}
+
+/*
+ * receiveResult -- 1つの文の結果を'E'フレームまで受け取る
+ *
+ * 引数:
+ *  desc: ソケット
+ *  result: 'D'フレームの内容をつなげたものを書く場所
+ *  size: resultの大きさ
+ *
+ * 返り値:
+ *  受け取ったフレームの種類('E'か'X')。接続が切れたか時間切れなら-1
+ *
+ * 'X'フレームのときは、その内容をresultに書く。
+ */
+static int receiveResult(int desc, char *result, size_t size)
+{
+    uint32_t length;
+    char header[5];
+    char *data;
+    size_t used = 0;
+
+    result[0] = '\0';
+    for (;;) {
+	if (readAll(desc, header, sizeof(header)) != OK) {
+	    return -1;
+	}
+	memcpy(&length, header, 4);
+	length = ntohl(length);
+	if ((data = malloc(length + 1)) == NULL) {
+	    return -1;
+	}
+	if (readAll(desc, data, length) != OK) {
+	    free(data);
+	    return -1;
+	}
+	data[length] = '\0';
+
+	switch (header[4]) {
+	case FRAME_DATA:
+	    if (used + length < size) {
+		memcpy(result + used, data, length);
+		used += length;
+		result[used] = '\0';
+	    }
+	    free(data);
+	    break;
+	case FRAME_END:
+	    free(data);
+	    return FRAME_END;
+	case FRAME_ERROR:
+	    snprintf(result, size, "%s", data);
+	    free(data);
+	    return FRAME_ERROR;
+	default:
+	    free(data);
+	    return -1;
+	}
+    }
+}
+
+/*
+ * isClosed -- サーバが接続を閉じたか(届いているものは読み捨てる)
+ */
+static int isClosed(int desc)
+{
+    char buffer[4096];
+    ssize_t n;
+
+    while ((n = read(desc, buffer, sizeof(buffer))) > 0) {
+    }
+    return n == 0 || errno == ECONNRESET;
+}
+
+/*
+ * test1 -- 1つの文の実行と、結果のないもの・わからないものの扱い
+ */
+Result test1()
+{
+    char result[256];
+    int desc;
+    Result ret = OK;
+
+    /* サーバを起動して、接続できるようになるのを待つ */
+    unlink(SOCKET_PATH);
+    if (pthread_create(&serverThread, NULL, runServerThread, NULL) != 0) {
+	return NG;
+    }
+    serverStarted = 1;
+    if ((desc = connectServer()) == -1) {
+	fprintf(stderr, "Cannot connect to server.\n");
+	return NG;
+    }
+
+    if (sendStatement(desc, "echo hello") != OK
+	|| receiveResult(desc, result, sizeof(result)) != FRAME_END
+	|| strcmp(result, "hello\n") != 0) {
+	fprintf(stderr, "Wrong result: %s\n", result);
+	ret = NG;
+    }
+
+    /* 結果のない文にも'E'フレームだけは返る */
+    if (sendStatement(desc, "touch") != OK
+	|| receiveResult(desc, result, sizeof(result)) != FRAME_END
+	|| result[0] != '\0' || getCount(&numTouch) != 1) {
+	fprintf(stderr, "Wrong result of empty output.\n");
+	ret = NG;
+    }
+
+    /* 文の誤りは結果として返り、接続はそのまま使える */
+    if (sendStatement(desc, "nosuch") != OK
+	|| receiveResult(desc, result, sizeof(result)) != FRAME_END
+	|| strcmp(result, "unknown statement: nosuch\n") != 0) {
+	fprintf(stderr, "Wrong result of error: %s\n", result);
+	ret = NG;
+    }
+    if (sendStatement(desc, "echo again") != OK
+	|| receiveResult(desc, result, sizeof(result)) != FRAME_END
+	|| strcmp(result, "again\n") != 0) {
+	fprintf(stderr, "Connection is not usable after error.\n");
+	ret = NG;
+    }
+
+    close(desc);
+    return ret;
+}
+
+/*
+ * test2 -- 結果を待たずに続けて送った文(パイプライン)
+ */
+Result test2()
+{
+    char *buffer, text[64], result[256], expected[64];
+    size_t size = 0;
+    int desc, i;
+    Result ret = OK;
+
+    if ((desc = connectServer()) == -1) {
+	return NG;
+    }
+
+    /* NUM_PIPELINE個の文を1回で書き、フレームが途中で分かれるところも作る */
+    if ((buffer = malloc(NUM_PIPELINE * 64)) == NULL) {
+	close(desc);
+	return NG;
+    }
+    for (i = 0; i < NUM_PIPELINE; i++) {
+	sprintf(text, "echo %d", i);
+	size += makeFrame(buffer + size, FRAME_QUERY, text);
+    }
+    if (writeAll(desc, buffer, 7) != OK) {
+	ret = NG;
+    }
+    usleep(10 * 1000);
+    if (writeAll(desc, buffer + 7, size - 7) != OK) {
+	ret = NG;
+    }
+    free(buffer);
+
+    /* 結果は送った順に返る */
+    for (i = 0; i < NUM_PIPELINE && ret == OK; i++) {
+	sprintf(expected, "%d\n", i);
+	if (receiveResult(desc, result, sizeof(result)) != FRAME_END
+	    || strcmp(result, expected) != 0) {
+	    fprintf(stderr, "Wrong result of statement %d: %s\n", i, result);
+	    ret = NG;
+	}
+    }
+
+    close(desc);
+    return ret;
+}
+
+/*
+ * test3 -- "quit"と、プロトコルの誤り
+ */
+Result test3()
+{
+    char buffer[256], result[256];
+    size_t size;
+    uint32_t length;
+    int desc, touch;
+    Result ret = OK;
+
+    /* quitの後に送った文は実行せず、結果を返してから接続を閉じる */
+    if ((desc = connectServer()) == -1) {
+	return NG;
+    }
+    touch = getCount(&numTouch);
+    size = makeFrame(buffer, FRAME_QUERY, "echo bye");
+    size += makeFrame(buffer + size, FRAME_QUERY, "quit");
+    size += makeFrame(buffer + size, FRAME_QUERY, "touch");
+    if (writeAll(desc, buffer, size) != OK
+	|| receiveResult(desc, result, sizeof(result)) != FRAME_END
+	|| strcmp(result, "bye\n") != 0
+	|| receiveResult(desc, result, sizeof(result)) != FRAME_END
+	|| !isClosed(desc)) {
+	fprintf(stderr, "Connection is not closed by quit.\n");
+	ret = NG;
+    }
+    usleep(100 * 1000);
+    if (getCount(&numTouch) != touch) {
+	fprintf(stderr, "Statement after quit is executed.\n");
+	ret = NG;
+    }
+    close(desc);
+
+    /* 種類の正しくないフレームには'X'フレームを返して閉じる */
+    if ((desc = connectServer()) == -1) {
+	return NG;
+    }
+    size = makeFrame(buffer, 'Z', "echo bad");
+    if (writeAll(desc, buffer, size) != OK
+	|| receiveResult(desc, result, sizeof(result)) != FRAME_ERROR
+	|| result[0] == '\0' || !isClosed(desc)) {
+	fprintf(stderr, "Bad frame type is not rejected.\n");
+	ret = NG;
+    }
+    close(desc);
+
+    /* 大きすぎるフレームも同じ。誤りより前に届いた文はすべて実行し、結果の後で知らせる */
+    if ((desc = connectServer()) == -1) {
+	return NG;
+    }
+    touch = getCount(&numTouch);
+    size = makeFrame(buffer, FRAME_QUERY, "echo before");
+    size += makeFrame(buffer + size, FRAME_QUERY, "touch");
+    length = htonl(1024 * 1024);
+    memcpy(buffer + size, &length, 4);
+    buffer[size + 4] = FRAME_QUERY;
+    size += 5;
+    if (writeAll(desc, buffer, size) != OK
+	|| receiveResult(desc, result, sizeof(result)) != FRAME_END
+	|| strcmp(result, "before\n") != 0
+	|| receiveResult(desc, result, sizeof(result)) != FRAME_END
+	|| receiveResult(desc, result, sizeof(result)) != FRAME_ERROR
+	|| !isClosed(desc) || getCount(&numTouch) != touch + 1) {
+	fprintf(stderr, "Too large frame is not rejected.\n");
+	ret = NG;
+    }
+    close(desc);
+
+    return ret;
+}
+
+/*
+ * test4 -- 別々の接続の文の並行実行と、実行中の切断
+ */
+Result test4()
+{
+    char result[256];
+    int desc1, desc2, finished;
+    Result ret = OK;
+
+    /* 1つ目の接続の文は、2つ目の接続の文が実行されるまで終わらない */
+    if ((desc1 = connectServer()) == -1) {
+	return NG;
+    }
+    if ((desc2 = connectServer()) == -1) {
+	close(desc1);
+	return NG;
+    }
+    if (sendStatement(desc1, "wait") != OK) {
+	ret = NG;
+    }
+    usleep(50 * 1000);
+    if (sendStatement(desc2, "signal") != OK
+	|| receiveResult(desc2, result, sizeof(result)) != FRAME_END
+	|| receiveResult(desc1, result, sizeof(result)) != FRAME_END
+	|| strcmp(result, "signaled\n") != 0) {
+	fprintf(stderr, "Statements are not executed concurrently: %s\n", result);
+	ret = NG;
+    }
+    close(desc2);
+
+    /* 実行中に切断しても、文は最後まで実行され、サーバは動き続ける */
+    finished = getCount(&numFinished);
+    if (sendStatement(desc1, "sleep 200") != OK) {
+	ret = NG;
+    }
+    usleep(50 * 1000);
+    close(desc1);
+    pthread_mutex_lock(&stateMutex);
+    while (numFinished == finished) {
+	pthread_cond_wait(&stateChanged, &stateMutex);
+    }
+    pthread_mutex_unlock(&stateMutex);
+
+    if ((desc1 = connectServer()) == -1) {
+	return NG;
+    }
+    if (sendStatement(desc1, "echo alive") != OK
+	|| receiveResult(desc1, result, sizeof(result)) != FRAME_END
+	|| strcmp(result, "alive\n") != 0) {
+	fprintf(stderr, "Server does not respond after disconnection.\n");
+	ret = NG;
+    }
+    close(desc1);
+
+    return ret;
+}
+
+/*
+ * test5 -- 結果を読まないクライアントの切断
+ */
+Result test5()
+{
+    struct timespec start, now;
+    char buffer[65536], result[256];
+    long received = 0;
+    ssize_t n;
+    int slow, desc, finished;
+    Result ret = OK;
+
+    if ((slow = connectServer()) == -1) {
+	return NG;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    finished = getCount(&numFinished);
+    sprintf(buffer, "large %d", LARGE_OUTPUT);
+    if (sendStatement(slow, buffer) != OK) {
+	close(slow);
+	return NG;
+    }
+
+    /* 待たされている間も、ほかの接続には応答する */
+    usleep(500 * 1000);
+    if ((desc = connectServer()) == -1) {
+	close(slow);
+	return NG;
+    }
+    if (sendStatement(desc, "echo busy") != OK
+	|| receiveResult(desc, result, sizeof(result)) != FRAME_END
+	|| strcmp(result, "busy\n") != 0) {
+	fprintf(stderr, "Server does not respond while waiting for slow reader.\n");
+	ret = NG;
+    }
+    if (getCount(&numFinished) != finished) {
+	fprintf(stderr, "Large output is not throttled.\n");
+	ret = NG;
+    }
+
+    /* OUTPUT_TIMEOUT秒ほどで切られ、文は最後まで実行される */
+    pthread_mutex_lock(&stateMutex);
+    while (numFinished == finished) {
+	pthread_cond_wait(&stateChanged, &stateMutex);
+    }
+    pthread_mutex_unlock(&stateMutex);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - start.tv_sec < OUTPUT_TIMEOUT - 1
+	|| now.tv_sec - start.tv_sec > OUTPUT_TIMEOUT + 5) {
+	fprintf(stderr, "Slow reader is dropped after %ld seconds.\n", (long) (now.tv_sec - start.tv_sec));
+	ret = NG;
+    }
+
+    /* 切られた接続からは、結果の途中までしか読めない */
+    while ((n = read(slow, buffer, sizeof(buffer))) > 0) {
+	received += n;
+    }
+    if (n == -1 && errno != ECONNRESET) {
+	fprintf(stderr, "Slow reader is not disconnected.\n");
+	ret = NG;
+    }
+    if (received >= LARGE_OUTPUT) {
+	fprintf(stderr, "Slow reader received whole output.\n");
+	ret = NG;
+    }
+    close(slow);
+
+    /* 切った後も、ほかの接続は使える */
+    if (sendStatement(desc, "echo after") != OK
+	|| receiveResult(desc, result, sizeof(result)) != FRAME_END
+	|| strcmp(result, "after\n") != 0) {
+	fprintf(stderr, "Server does not respond after dropping slow reader.\n");
+	ret = NG;
+    }
+    close(desc);
+
+    return ret;
+}
+
+/*
+ * test6 -- 終了のシグナルを受けたときの停止
+ */
+Result test6()
+{
+    char buffer[256];
+    size_t size;
+    int desc, touch, finished;
+    Result ret = OK;
+
+    if (!serverStarted) {
+	return NG;
+    }
+
+    /* 実行中の文と、まだ実行していない文を残してシグナルを送る */
+    if ((desc = connectServer()) == -1) {
+	return NG;
+    }
+    touch = getCount(&numTouch);
+    finished = getCount(&numFinished);
+    size = makeFrame(buffer, FRAME_QUERY, "sleep 500");
+    size += makeFrame(buffer + size, FRAME_QUERY, "touch");
+    if (writeAll(desc, buffer, size) != OK) {
+	ret = NG;
+    }
+    usleep(100 * 1000);
+    kill(getpid(), SIGINT);
+
+    /* 実行中の文が終わってからrunServerが戻り、残りの文は実行しない */
+    pthread_join(serverThread, NULL);
+    if (serverResult != OK) {
+	fprintf(stderr, "Server is not stopped by signal.\n");
+	ret = NG;
+    }
+    if (getCount(&numFinished) != finished + 1) {
+	fprintf(stderr, "Server stopped before running statement finished.\n");
+	ret = NG;
+    }
+    if (getCount(&numTouch) != touch) {
+	fprintf(stderr, "Queued statement is executed after signal.\n");
+	ret = NG;
+    }
+
+    /* 残っていた接続は閉じられ、ソケットのファイルも消える */
+    if (!isClosed(desc)) {
+	fprintf(stderr, "Connection is not closed at shutdown.\n");
+	ret = NG;
+    }
+    close(desc);
+    if (access(SOCKET_PATH, F_OK) == 0) {
+	fprintf(stderr, "Socket file is left.\n");
+	ret = NG;
+    }
+
+    return ret;
+}
+
+/*
+ * main -- エントリポイント
+ */
+int main(int argc, char **argv)
+{
+    fprintf(stderr, "%s: test 1: Start\n", TEST_NAME);
+    if (test1() == OK) {
+	fprintf(stderr, "%s: test 1: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 1: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 2: Start\n", TEST_NAME);
+    if (test2() == OK) {
+	fprintf(stderr, "%s: test 2: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 2: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 3: Start\n", TEST_NAME);
+    if (test3() == OK) {
+	fprintf(stderr, "%s: test 3: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 3: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 4: Start\n", TEST_NAME);
+    if (test4() == OK) {
+	fprintf(stderr, "%s: test 4: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 4: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 5: Start\n", TEST_NAME);
+    if (test5() == OK) {
+	fprintf(stderr, "%s: test 5: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 5: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 6: Start\n", TEST_NAME);
+    if (test6() == OK) {
+	fprintf(stderr, "%s: test 6: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 6: NG\n\n", TEST_NAME);
+    }
+
+    exit(0);
+}
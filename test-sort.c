@@ -0,0 +1,260 @@
+/*
+ * 整列モジュールテストプログラム
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdlib.h>
+#include "microdb.h"
+
+/*
+ * テスト名
+ */
+#define TEST_NAME "test-sort"
+
+/*
+ * 要素の大きさ(先頭4バイトがキー、残りが要素の番号)
+ */
+#define ENTRY_SIZE 8
+#define KEY_SIZE 4
+
+/*
+ * 整列する要素数
+ */
+#define SMALL_SIZE 1000
+#define LARGE_SIZE 20000
+
+/*
+ * getRandomInteger -- 乱数の発生
+ */
+int getRandomInteger(int min, int max)
+{
+    int r;
+
+    /* min〜maxまでの(整数の)乱数を作る */
+    r = min + (int) (max - min + 1) * (rand() / (RAND_MAX + 1.0));
+
+    return r;
+}
+
+/*
+ * compareInteger -- qsort用の整数の比較
+ */
+int compareInteger(const void *a, const void *b)
+{
+    return *(const int *) a - *(const int *) b;
+}
+
+/*
+ * sortRandomEntries -- 乱数のキーを持つ要素を整列し、正しく整列されたか調べる
+ *
+ * 引数:
+ *	numEntry: 整列する要素数
+ *	memoryLimit: 整列に使うメモリの上限(バイト数)
+ *	limit: 取り出す要素数の上限(負なら上限なし)
+ *
+ * 返り値:
+ *	正しく整列できればOK、そうでなければNG
+ */
+Result sortRandomEntries(int numEntry, long memoryLimit, long limit)
+{
+    Sorter *sorter;
+    char entry[ENTRY_SIZE];
+    char *p;
+    char *seen;
+    int *keys;
+    int i, key, index, count, expected;
+    unsigned char previous[KEY_SIZE];
+
+    if ((sorter = createSorter(ENTRY_SIZE, KEY_SIZE, memoryLimit)) == NULL) {
+	fprintf(stderr, "Cannot create sorter.\n");
+	return NG;
+    }
+    if (setSortLimit(sorter, limit) != OK) {
+	fprintf(stderr, "Cannot set limit.\n");
+	freeSorter(sorter);
+	return NG;
+    }
+    if ((keys = malloc(sizeof(int) * (numEntry + 1))) == NULL) {
+	freeSorter(sorter);
+	return NG;
+    }
+
+    /* キーはバイト列の比較で大小が決まるように上位バイトから格納する */
+    for (i = 0; i < numEntry; i++) {
+	key = getRandomInteger(0, numEntry / 2);
+	keys[i] = key;
+	entry[0] = (key >> 24) & 0xff;
+	entry[1] = (key >> 16) & 0xff;
+	entry[2] = (key >> 8) & 0xff;
+	entry[3] = key & 0xff;
+	memcpy(entry + KEY_SIZE, &i, sizeof(int));
+	if (addSortEntry(sorter, entry) != OK) {
+	    fprintf(stderr, "Cannot add entry.\n");
+	    free(keys);
+	    freeSorter(sorter);
+	    return NG;
+	}
+    }
+    qsort(keys, numEntry, sizeof(int), compareInteger);
+
+    if (sortEntries(sorter) != OK) {
+	fprintf(stderr, "Cannot sort entries.\n");
+	free(keys);
+	freeSorter(sorter);
+	return NG;
+    }
+
+    /*
+     * どの要素も高々1回ずつ、キーの昇順に出てきて、
+     * そのキーの並びが全体を整列した先頭と一致することを確かめる
+     */
+    if ((seen = calloc(numEntry + 1, 1)) == NULL) {
+	free(keys);
+	freeSorter(sorter);
+	return NG;
+    }
+    memset(previous, 0, KEY_SIZE);
+    count = 0;
+    while (getNextSortEntry(sorter, &p) == OK && p != NULL) {
+	memcpy(&index, p + KEY_SIZE, sizeof(int));
+	key = ((p[0] & 0xff) << 24) | ((p[1] & 0xff) << 16) | ((p[2] & 0xff) << 8) | (p[3] & 0xff);
+	if (memcmp(previous, p, KEY_SIZE) > 0 || index < 0 || index >= numEntry
+	    || seen[index] || count >= numEntry || key != keys[count]) {
+	    fprintf(stderr, "Wrong entry at %d.\n", count);
+	    free(seen);
+	    free(keys);
+	    freeSorter(sorter);
+	    return NG;
+	}
+	seen[index] = 1;
+	memcpy(previous, p, KEY_SIZE);
+	count++;
+    }
+
+    free(seen);
+    free(keys);
+    freeSorter(sorter);
+
+    expected = (limit >= 0 && limit < numEntry) ? (int) limit : numEntry;
+    if (count != expected) {
+	fprintf(stderr, "Number of entries is wrong: %d\n", count);
+	return NG;
+    }
+
+    return OK;
+}
+
+/*
+ * test1 -- メモリ上だけでの整列
+ */
+Result test1()
+{
+    return sortRandomEntries(SMALL_SIZE, 1024 * 1024, -1);
+}
+
+/*
+ * test2 -- ランを作業用ファイルに書き出す整列
+ */
+Result test2()
+{
+    return sortRandomEntries(LARGE_SIZE, 64 * 1024, -1);
+}
+
+/*
+ * test3 -- ランを何段階にも併合する整列
+ *
+ * メモリの上限をごく小さくして、一度に併合できるランの数を2にする。
+ */
+Result test3()
+{
+    return sortRandomEntries(LARGE_SIZE, 256, -1);
+}
+
+/*
+ * test4 -- 要素のない整列
+ */
+Result test4()
+{
+    return sortRandomEntries(0, 1024, -1);
+}
+
+/*
+ * test5 -- 上位の要素だけを取り出す整列
+ *
+ * 上限がメモリに収まる場合(ヒープで保持)と収まらない場合(ランを書き出す)、
+ * 上限が要素数より多い場合と0の場合を試す。
+ */
+Result test5()
+{
+    if (sortRandomEntries(LARGE_SIZE, 64 * 1024, 20) != OK
+	|| sortRandomEntries(LARGE_SIZE, 1024, 5000) != OK
+	|| sortRandomEntries(SMALL_SIZE, 64 * 1024, SMALL_SIZE * 2) != OK
+	|| sortRandomEntries(SMALL_SIZE, 64 * 1024, 0) != OK) {
+	return NG;
+    }
+
+    return OK;
+}
+
+/*
+ * main -- エントリポイント
+ */
+int main(int argc, char **argv)
+{
+    /* 乱数の初期化 */
+    srand((unsigned int) time(NULL));
+
+    /*
+     * ファイルアクセスモジュールの初期化
+     */
+    if (initializeFileModule() != OK) {
+	fprintf(stderr, "%s: initialization failed.\n", TEST_NAME);
+    }
+
+    /* テストの実行 */
+    fprintf(stderr, "%s: test 1: Start\n", TEST_NAME);
+    if (test1() == OK) {
+	fprintf(stderr, "%s: test 1: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 1: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 2: Start\n", TEST_NAME);
+    if (test2() == OK) {
+	fprintf(stderr, "%s: test 2: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 2: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 3: Start\n", TEST_NAME);
+    if (test3() == OK) {
+	fprintf(stderr, "%s: test 3: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 3: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 4: Start\n", TEST_NAME);
+    if (test4() == OK) {
+	fprintf(stderr, "%s: test 4: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 4: NG\n\n", TEST_NAME);
+    }
+
+    fprintf(stderr, "%s: test 5: Start\n", TEST_NAME);
+    if (test5() == OK) {
+	fprintf(stderr, "%s: test 5: OK\n\n", TEST_NAME);
+    } else {
+	fprintf(stderr, "%s: test 5: NG\n\n", TEST_NAME);
+    }
+
+    /*
+     * ファイルアクセスモジュールの終了処理
+     */
+    if (finalizeFileModule() != OK) {
+	fprintf(stderr, "%s: finalization failed.\n", TEST_NAME);
+    }
+
+    exit(0);
+}